@@ -0,0 +1,703 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	checkip - vérifications ARP des adresses et des passerelles
+ *
+ *	checkip [-e fichier] <interface> <adresse> dupip|route
+ *				[<interface> <adresse> dupip|route...]
+ *
+ *	Remplace checkip.sh et arping2 : toutes les vérifications sont
+ *	menées en même temps, avec une socket AF_PACKET par interface et
+ *	une seule boucle poll(), dès que leur interface est active.
+ *
+ *	dupip (RFC 5227, 2.1) : PROBE_NUM sondes (adresse source 0.0.0.0)
+ *	après un délai aléatoire d'au plus PROBE_WAIT, espacées de PROBE_MIN
+ *	à PROBE_MAX, puis ANNOUNCE_WAIT d'écoute. Une trame ARP d'une autre
+ *	carte ayant l'adresse pour source, ou une sonde d'une autre carte
+ *	pour l'adresse, est un conflit. Sans conflit, l'adresse est annoncée
+ *	ANNOUNCE_NUM fois, à ANNOUNCE_INTERVAL d'intervalle.
+ *	route : au plus PROBE_NUM requêtes vers la passerelle, à PROBE_MIN
+ *	d'intervalle, depuis l'adresse de l'interface.
+ *
+ *	Une ligne de résultat par vérification est affichée, les échecs sont
+ *	journalisés et ajoutés au fichier d'erreurs (NET_ERROR par défaut).
+ *	Code de retour : 1 si une vérification a échoué, 0 sinon.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+#include <netinet/in.h>
+#include <linux/if_packet.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "oui.h"
+
+#define _LOG(prio, fmt, args...) syslog(prio, fmt"\n", ##args)
+
+#define _WARN(prio, fmt, args...) _LOG(prio, "%s(%d): "fmt, \
+				__FUNCTION__, __LINE__, ##args)
+
+#define LOG(fmt, args...) _LOG(LOG_INFO, fmt, ##args)
+
+#define WARN(fmt, args...) _WARN(LOG_WARNING, fmt, ##args)
+#define WARN_ERRNO(fmt, args...) \
+	_WARN(LOG_ERR, fmt": %s", ##args, strerror(errno))
+
+#define CK_NET_ERROR	"/usr/local/var/net_error"
+
+/* RFC 5227, 1.1 (ms) */
+#define PROBE_WAIT		1000U
+#define PROBE_NUM		3U
+#define PROBE_MIN		1000U
+#define PROBE_MAX		2000U
+#define ANNOUNCE_WAIT		2000U
+#define ANNOUNCE_NUM		2U
+#define ANNOUNCE_INTERVAL	2000U
+
+/* Attente de l'activation d'une interface (ms) */
+#define CK_IFWAIT	10000U
+#define CK_IFPOLL	100U
+
+#define CK_MAX_IFS	8
+#define CK_MAX_CHECKS	32
+/* Cartes relevées par vérification */
+#define CK_MAX_MACS	4
+#define CK_MANUF_LEN	64
+
+typedef enum {
+	CK_DUPIP = 0,
+	CK_ROUTE,
+} ck_action_t;
+
+typedef enum {
+	CK_WAIT = 0,	/* interface pas encore active */
+	CK_PROBE,	/* sondes, ou requêtes vers la passerelle */
+	CK_LISTEN,	/* écoute après la dernière sonde */
+	CK_ANNOUNCE,
+	CK_DONE,
+} ck_state_t;
+
+struct ck_if {
+	char name[IFNAMSIZ];
+	int index;
+	int fd;
+	uint8_t mac[ETH_ALEN];
+	struct in_addr addr;	/* source des requêtes route, 0 sinon */
+	int running;
+	int failed;		/* socket ou interface inutilisable */
+};
+
+struct ck_check {
+	struct ck_if *iface;
+	struct in_addr ip;
+	const char *ip_str;
+	ck_action_t action;
+	ck_state_t state;
+	unsigned int sent;
+	uint64_t next;		/* prochaine échéance (ms) */
+	unsigned int nmacs;
+	uint8_t macs[CK_MAX_MACS][ETH_ALEN];
+	char manuf[CK_MAX_MACS][CK_MANUF_LEN];
+};
+
+static const char *const g_actions[] = {
+	[CK_DUPIP] = "dupip",
+	[CK_ROUTE] = "route",
+};
+
+static const uint8_t g_bcast[ETH_ALEN] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+static struct ck_if g_ifs[CK_MAX_IFS];
+static unsigned int g_nifs;
+static struct ck_check g_checks[CK_MAX_CHECKS];
+static unsigned int g_nchecks;
+
+static uint64_t
+ck_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Délai aléatoire entre min et max ms */
+static uint64_t
+ck_random(unsigned int min, unsigned int max)
+{
+	return min + (uint64_t)random() % (max - min + 1);
+}
+
+/*********************************************************/
+/** Interfaces **/
+/*********************************************************/
+
+static struct ck_if *
+ck_get_if(const char *name)
+{
+	struct ck_if *iface;
+	unsigned int i;
+
+	for (i = 0; i < g_nifs; i++) {
+		if (!strcmp(g_ifs[i].name, name))
+			return &g_ifs[i];
+	}
+	if (g_nifs == CK_MAX_IFS || strlen(name) >= IFNAMSIZ)
+		return NULL;
+	iface = &g_ifs[g_nifs++];
+	strcpy(iface->name, name);
+	iface->fd = -1;
+	return iface;
+}
+
+/* Interface active (IFF_UP et IFF_RUNNING) */
+static int
+ck_if_running(const struct ck_if *iface)
+{
+	struct ifreq ifr;
+	int sock, ret = 0;
+
+	sock = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return 0;
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, iface->name);
+	if (!ioctl(sock, SIOCGIFFLAGS, &ifr))
+		ret = (ifr.ifr_flags & (IFF_UP|IFF_RUNNING))
+						== (IFF_UP|IFF_RUNNING);
+	(void)close(sock);
+	return ret;
+}
+
+/* Index, adresses MAC et IPv4, socket ARP liée à l'interface ; les
+ * alias (eth0:1) utilisent la socket de l'interface mère */
+static int
+ck_if_open(struct ck_if *iface)
+{
+	const struct sockaddr_in *sin;
+	struct sockaddr_ll sll;
+	struct ifreq ifr;
+	int sock;
+
+	sock = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		WARN_ERRNO("socket");
+		return -1;
+	}
+	memset(&ifr, 0, sizeof(ifr));
+	strcpy(ifr.ifr_name, iface->name);
+	if (ioctl(sock, SIOCGIFINDEX, &ifr)) {
+		WARN_ERRNO("no interface %s", iface->name);
+		goto err;
+	}
+	iface->index = ifr.ifr_ifindex;
+	if (ioctl(sock, SIOCGIFHWADDR, &ifr)
+			|| ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+		WARN("%s is not an ethernet interface", iface->name);
+		goto err;
+	}
+	memcpy(iface->mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	if (!ioctl(sock, SIOCGIFADDR, &ifr)) {
+		sin = (const struct sockaddr_in *)(const void *)&ifr.ifr_addr;
+		iface->addr = sin->sin_addr;
+	}
+	(void)close(sock);
+
+	iface->fd = socket(AF_PACKET, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK,
+							htons(ETH_P_ARP));
+	if (iface->fd < 0) {
+		WARN_ERRNO("packet socket on %s", iface->name);
+		return -1;
+	}
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_ifindex = iface->index;
+	if (bind(iface->fd, (struct sockaddr *)&sll, sizeof(sll))) {
+		WARN_ERRNO("bind packet socket on %s", iface->name);
+		(void)close(iface->fd);
+		iface->fd = -1;
+		return -1;
+	}
+	return 0;
+err:
+	(void)close(sock);
+	return -1;
+}
+
+/*********************************************************/
+/** Trames ARP **/
+/*********************************************************/
+
+static void
+ck_send(const struct ck_if *iface, struct in_addr spa, struct in_addr tpa)
+{
+	struct sockaddr_ll sll;
+	struct ether_arp arp;
+
+	memset(&arp, 0, sizeof(arp));
+	arp.arp_hrd = htons(ARPHRD_ETHER);
+	arp.arp_pro = htons(ETHERTYPE_IP);
+	arp.arp_hln = ETH_ALEN;
+	arp.arp_pln = sizeof(struct in_addr);
+	arp.arp_op = htons(ARPOP_REQUEST);
+	memcpy(arp.arp_sha, iface->mac, ETH_ALEN);
+	memcpy(arp.arp_spa, &spa, sizeof(spa));
+	memcpy(arp.arp_tpa, &tpa, sizeof(tpa));
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_ARP);
+	sll.sll_ifindex = iface->index;
+	sll.sll_halen = ETH_ALEN;
+	memcpy(sll.sll_addr, g_bcast, ETH_ALEN);
+	if (sendto(iface->fd, &arp, sizeof(arp), 0,
+				(struct sockaddr *)&sll, sizeof(sll)) < 0)
+		WARN_ERRNO("send arp on %s", iface->name);
+}
+
+static void
+ck_add_mac(struct ck_check *check, const uint8_t *mac)
+{
+	unsigned int i;
+
+	for (i = 0; i < check->nmacs; i++) {
+		if (!memcmp(check->macs[i], mac, ETH_ALEN))
+			return;
+	}
+	if (check->nmacs < CK_MAX_MACS)
+		memcpy(check->macs[check->nmacs++], mac, ETH_ALEN);
+}
+
+/* Trame reçue sur l'interface de check */
+static void
+ck_arp_input(struct ck_check *check, const struct ether_arp *arp)
+{
+	struct in_addr spa, tpa;
+
+	memcpy(&spa, arp->arp_spa, sizeof(spa));
+	memcpy(&tpa, arp->arp_tpa, sizeof(tpa));
+	if (check->state == CK_WAIT || check->state == CK_DONE
+			|| !memcmp(arp->arp_sha, check->iface->mac, ETH_ALEN))
+		return;
+
+	switch (check->action) {
+	case CK_DUPIP:
+		/* adresse utilisée, ou sondée en même temps par un autre */
+		if (spa.s_addr != check->ip.s_addr && (spa.s_addr
+				|| tpa.s_addr != check->ip.s_addr))
+			return;
+		if (!check->nmacs && check->state == CK_PROBE) {
+			/* les autres cartes en conflit répondent aussi */
+			check->state = CK_LISTEN;
+			check->next = ck_now() + PROBE_MIN;
+		}
+		break;
+	case CK_ROUTE:
+		if (spa.s_addr != check->ip.s_addr)
+			return;
+		/* les réponses en cours sont attendues jusqu'à l'échéance */
+		check->state = CK_LISTEN;
+		break;
+	}
+	ck_add_mac(check, arp->arp_sha);
+}
+
+static void
+ck_read(struct ck_if *iface)
+{
+	struct ether_arp arp;
+	struct sockaddr_ll sll;
+	socklen_t slen = sizeof(sll);
+	unsigned int i;
+	ssize_t len;
+
+	while ((len = recvfrom(iface->fd, &arp, sizeof(arp), MSG_TRUNC,
+				(struct sockaddr *)&sll, &slen)) >= 0) {
+		slen = sizeof(sll);
+		/* trames émises par l'hôte, y compris par le noyau */
+		if (sll.sll_pkttype == PACKET_OUTGOING
+				|| (size_t)len < sizeof(arp))
+			continue;
+		if (ntohs(arp.arp_hrd) != ARPHRD_ETHER
+				|| ntohs(arp.arp_pro) != ETHERTYPE_IP
+				|| arp.arp_hln != ETH_ALEN
+				|| arp.arp_pln != sizeof(struct in_addr))
+			continue;
+		for (i = 0; i < g_nchecks; i++) {
+			if (g_checks[i].iface == iface)
+				ck_arp_input(&g_checks[i], &arp);
+		}
+	}
+	if (errno != EAGAIN && errno != EINTR) {
+		WARN_ERRNO("read arp on %s", iface->name);
+		iface->failed = 1;
+	}
+}
+
+/*********************************************************/
+/** Échéances **/
+/*********************************************************/
+
+static void
+ck_start(struct ck_check *check, uint64_t now)
+{
+	check->state = CK_PROBE;
+	check->next = (check->action == CK_DUPIP)
+				? now + ck_random(0, PROBE_WAIT) : now;
+}
+
+static void
+ck_timeout(struct ck_check *check, uint64_t now)
+{
+	struct in_addr any = { .s_addr = INADDR_ANY };
+	const struct ck_if *iface = check->iface;
+
+	switch (check->state) {
+	case CK_PROBE:
+		if (check->action == CK_DUPIP) {
+			ck_send(iface, any, check->ip);
+			if (++check->sent < PROBE_NUM) {
+				check->next = now
+					+ ck_random(PROBE_MIN, PROBE_MAX);
+			} else {
+				check->state = CK_LISTEN;
+				check->next = now + ANNOUNCE_WAIT;
+			}
+			break;
+		}
+		if (check->sent == PROBE_NUM) {
+			check->state = CK_DONE;
+			break;
+		}
+		ck_send(iface, iface->addr, check->ip);
+		check->sent++;
+		check->next = now + PROBE_MIN;
+		break;
+	case CK_LISTEN:
+		if (check->nmacs || check->action == CK_ROUTE) {
+			check->state = CK_DONE;
+			break;
+		}
+		check->state = CK_ANNOUNCE;
+		check->sent = 0;
+		/* fall through */
+	case CK_ANNOUNCE:
+		if (check->nmacs) {
+			check->state = CK_DONE;
+			break;
+		}
+		ck_send(iface, check->ip, check->ip);
+		if (++check->sent == ANNOUNCE_NUM)
+			check->state = CK_DONE;
+		check->next = now + ANNOUNCE_INTERVAL;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Boucle : jusqu'à la fin de toutes les vérifications */
+static void
+ck_run(void)
+{
+	struct pollfd pfds[CK_MAX_IFS];
+	struct ck_if *ifs[CK_MAX_IFS];
+	struct ck_check *check;
+	uint64_t now, start, next;
+	unsigned int i, n;
+	int pending, timeout;
+
+	start = ck_now();
+	for (;;) {
+		now = ck_now();
+		pending = 0;
+		next = UINT64_MAX;
+		for (i = 0; i < g_nifs; i++) {
+			if (g_ifs[i].failed || g_ifs[i].running)
+				continue;
+			if (ck_if_running(&g_ifs[i])) {
+				g_ifs[i].running = 1;
+			} else if (now - start >= CK_IFWAIT) {
+				WARN("interface %s is not running",
+							g_ifs[i].name);
+				g_ifs[i].failed = 1;
+			}
+		}
+		for (i = 0; i < g_nchecks; i++) {
+			check = &g_checks[i];
+			if (check->iface->failed)
+				check->state = CK_DONE;
+			if (check->state == CK_WAIT && check->iface->running)
+				ck_start(check, now);
+			while (check->state != CK_WAIT
+					&& check->state != CK_DONE
+					&& check->next <= now)
+				ck_timeout(check, now);
+			if (check->state == CK_DONE)
+				continue;
+			pending = 1;
+			if (check->state == CK_WAIT)
+				next = (now + CK_IFPOLL < next)
+						? now + CK_IFPOLL : next;
+			else if (check->next < next)
+				next = check->next;
+		}
+		if (!pending)
+			return;
+
+		for (i = n = 0; i < g_nifs; i++) {
+			if (!g_ifs[i].running || g_ifs[i].failed)
+				continue;
+			ifs[n] = &g_ifs[i];
+			pfds[n].fd = g_ifs[i].fd;
+			pfds[n++].events = POLLIN;
+		}
+		timeout = (int)(next - now);
+		if (poll(pfds, n, timeout) < 0 && errno != EINTR) {
+			WARN_ERRNO("poll");
+			return;
+		}
+		for (i = 0; i < n; i++) {
+			if (pfds[i].revents)
+				ck_read(ifs[i]);
+		}
+	}
+}
+
+/*********************************************************/
+/** Résultats **/
+/*********************************************************/
+
+/* Fabricants des cartes relevées : index OUI_INDEX s'il est à jour,
+ * sinon une lecture de OUI_TXT */
+static void
+ck_manufacturers(void)
+{
+	struct oui_index idx;
+	struct ck_check *check;
+	const char *name;
+	char *line = NULL;
+	unsigned int i, j;
+	uint32_t prefix;
+	size_t len, sz = 0;
+	FILE *f;
+
+	if (!oui_open(&idx, OUI_INDEX, OUI_TXT)) {
+		for (i = 0; i < g_nchecks; i++) {
+			check = &g_checks[i];
+			for (j = 0; j < check->nmacs; j++) {
+				name = oui_lookup(&idx, check->macs[j]);
+				if (name)
+					snprintf(check->manuf[j], CK_MANUF_LEN,
+								"%s", name);
+			}
+		}
+		oui_close(&idx);
+		return;
+	}
+
+	f = fopen(OUI_TXT, "re");
+	if (!f)
+		return;
+	while (getline(&line, &sz, f) > 0) {
+		if (oui_parse_line(line, &prefix, &name, &len))
+			continue;
+		for (i = 0; i < g_nchecks; i++) {
+			check = &g_checks[i];
+			for (j = 0; j < check->nmacs; j++) {
+				if (check->manuf[j][0] || prefix !=
+						((uint32_t)check->macs[j][0] << 16
+						| (uint32_t)check->macs[j][1] << 8
+						| check->macs[j][2]))
+					continue;
+				snprintf(check->manuf[j], CK_MANUF_LEN,
+						"%.*s", (int)len, name);
+			}
+		}
+	}
+	free(line);
+	(void)fclose(f);
+}
+
+/* "<mac> (<fabricant>)[, <mac>...]" */
+static void
+ck_format_macs(const struct ck_check *check, char *buf, size_t len)
+{
+	const uint8_t *m;
+	size_t off = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < check->nmacs && off < len; i++) {
+		m = check->macs[i];
+		off += (size_t)snprintf(buf + off, len - off,
+			"%s%02x:%02x:%02x:%02x:%02x:%02x%s%s%s",
+			(i) ? ", " : "", m[0], m[1], m[2], m[3], m[4], m[5],
+			(check->manuf[i][0]) ? " (" : "", check->manuf[i],
+			(check->manuf[i][0]) ? ")" : "");
+	}
+}
+
+static void
+ck_error_add(FILE *err, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void
+ck_error_add(FILE *err, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!err)
+		return;
+	va_start(ap, fmt);
+	vfprintf(err, fmt, ap);
+	va_end(ap);
+	fputc('\n', err);
+}
+
+/* Résultat de chaque vérification : une ligne "<interface> <adresse>
+ * <action> ok|conflict|unreachable|failed [<cartes>]" */
+static int
+ck_report(const char *errfile)
+{
+	char macs[CK_MAX_MACS * (18 + CK_MANUF_LEN + 5)];
+	const struct ck_check *check;
+	const char *result;
+	unsigned int i;
+	FILE *err = NULL;
+	int ret = 0;
+
+	ck_manufacturers();
+	for (i = 0; i < g_nchecks; i++) {
+		check = &g_checks[i];
+		ck_format_macs(check, macs, sizeof(macs));
+		if (check->iface->failed) {
+			/* pas de conclusion, comme net_ifwaitup */
+			result = "failed";
+			ret = 1;
+		} else if (check->action == CK_ROUTE) {
+			result = (check->nmacs) ? "ok" : "unreachable";
+		} else {
+			result = (check->nmacs) ? "conflict" : "ok";
+		}
+		printf("%s %s %s %s%s%s\n", check->iface->name, check->ip_str,
+				g_actions[check->action], result,
+				(macs[0]) ? " " : "", macs);
+		if (check->iface->failed)
+			continue;
+
+		if (check->action == CK_ROUTE && check->nmacs) {
+			LOG("Default route %s can be joined through network "
+					"card %s", check->ip_str, macs);
+			continue;
+		}
+		if (check->action == CK_DUPIP && !check->nmacs)
+			continue;
+
+		ret = 1;
+		if (!err) {
+			err = fopen(errfile, "ae");
+			if (!err)
+				WARN_ERRNO("failed to open %s", errfile);
+		}
+		if (check->action == CK_ROUTE) {
+			_LOG(LOG_WARNING, "Unable to join the default route %s",
+							check->ip_str);
+			ck_error_add(err, "impossible d'atteindre la "
+				"passerelle par defaut %s", check->ip_str);
+		} else {
+			_LOG(LOG_WARNING, "Address %s already used by the "
+				"network card %s", check->ip_str, macs);
+			ck_error_add(err, "l'adresse IP %s est déjà en cours "
+				"d'utilisation par une autre machine avec "
+				"l'adresse MAC %s", check->ip_str, macs);
+		}
+	}
+	if (err && fclose(err))
+		WARN_ERRNO("failed to write %s", errfile);
+	return ret;
+}
+
+/*********************************************************/
+/** Principal **/
+/*********************************************************/
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-e error_file] <interface> <IP> "
+			"dupip|route [<interface> <IP> dupip|route...]\n",
+									prog);
+	exit(EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *errfile = CK_NET_ERROR;
+	struct ck_check *check;
+	unsigned int i, seed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "e:")) != -1) {
+		switch (opt) {
+		case 'e':
+			errfile = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc == optind || (argc - optind) % 3)
+		usage(argv[0]);
+
+	openlog("checkip", LOG_PID, LOG_DAEMON);
+	for (; optind < argc; optind += 3) {
+		if (g_nchecks == CK_MAX_CHECKS) {
+			fprintf(stderr, "too many checks\n");
+			return EINVAL;
+		}
+		check = &g_checks[g_nchecks++];
+		check->iface = ck_get_if(argv[optind]);
+		check->ip_str = argv[optind + 1];
+		if (!check->iface
+			|| inet_pton(AF_INET, check->ip_str, &check->ip) != 1)
+			usage(argv[0]);
+		for (i = 0; i < sizeof(g_actions) / sizeof(g_actions[0]); i++) {
+			if (!strcmp(argv[optind + 2], g_actions[i]))
+				break;
+		}
+		if (i == sizeof(g_actions) / sizeof(g_actions[0]))
+			usage(argv[0]);
+		check->action = (ck_action_t)i;
+	}
+
+	if (getrandom(&seed, sizeof(seed), GRND_NONBLOCK) != sizeof(seed))
+		seed = (unsigned int)getpid() ^ (unsigned int)ck_now();
+	srandom(seed);
+
+	for (i = 0; i < g_nifs; i++) {
+		if (ck_if_open(&g_ifs[i]))
+			g_ifs[i].failed = 1;
+	}
+	ck_run();
+	return ck_report(errfile);
+}
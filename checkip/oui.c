@@ -0,0 +1,441 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	oui - index des fabricants de cartes réseau
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "oui.h"
+
+#define OUI_MAGIC	"OUI1"
+#define OUI_HDR_LEN	16U
+#define OUI_ENTRY_LEN	8U
+
+/* Au-delà, oui.txt est refusé (l'IEEE en publie environ 40000) */
+#define OUI_MAX_ENTRIES	(1U << 20)
+
+struct oui_entry {
+	uint32_t prefix;
+	uint32_t seq;
+	uint32_t off;
+	char *name;
+};
+
+static uint32_t
+oui_get32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return ntohl(v);
+}
+
+static void
+oui_put32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, sizeof(v));
+}
+
+static int
+oui_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* 3 octets hexadécimaux séparés par sep */
+static int
+oui_parse_prefix(const char *str, char sep, uint8_t *out)
+{
+	int h, l;
+	unsigned int i;
+
+	for (i = 0; i < 3; i++) {
+		h = oui_hex(str[3 * i]);
+		l = (h < 0) ? -1 : oui_hex(str[3 * i + 1]);
+		if (l < 0)
+			return -1;
+		if (i < 2 && str[3 * i + 2] != sep)
+			return -1;
+		out[i] = (uint8_t)(h << 4 | l);
+	}
+	return 0;
+}
+
+int
+oui_parse_line(const char *line, uint32_t *prefix,
+		const char **name, size_t *len)
+{
+	const char *n;
+	uint8_t p[3];
+	size_t l;
+
+	if (oui_parse_prefix(line, '-', p))
+		return -1;
+	n = line + 8 + strspn(line + 8, " \t");
+	if (strncmp(n, "(hex)", 5))
+		return -1;
+	n += 5 + strspn(n + 5, " \t");
+	l = strcspn(n, "\r\n");
+	while (l && (n[l - 1] == ' ' || n[l - 1] == '\t'))
+		l--;
+	if (!l)
+		return -1;
+
+	*prefix = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+	*name = n;
+	*len = (l < OUI_NAME_MAX - 1) ? l : OUI_NAME_MAX - 1;
+	return 0;
+}
+
+int
+oui_parse_mac(const char *str, uint8_t *mac)
+{
+	if (strlen(str) < 8)
+		return -1;
+	if (oui_parse_prefix(str, str[2], mac)
+			|| (str[2] != ':' && str[2] != '-'))
+		return -1;
+	return 0;
+}
+
+/*********************************************************/
+/** Compilation **/
+/*********************************************************/
+
+static int
+oui_cmp_name(const void *a, const void *b)
+{
+	const struct oui_entry *const *x = a, *const *y = b;
+
+	return strcmp((*x)->name, (*y)->name);
+}
+
+/* Premier nom rencontré pour un préfixe en double */
+static int
+oui_cmp_prefix(const void *a, const void *b)
+{
+	const struct oui_entry *x = a, *y = b;
+
+	if (x->prefix != y->prefix)
+		return (x->prefix < y->prefix) ? -1 : 1;
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+static int
+oui_read(const char *src, struct oui_entry **out, uint32_t *count)
+{
+	struct oui_entry *ents = NULL, *tmp;
+	size_t alloc = 0, len, sz = 0;
+	char *line = NULL;
+	uint32_t n = 0, prefix;
+	const char *name;
+	FILE *f;
+	int err;
+
+	f = fopen(src, "re");
+	if (!f)
+		return -1;
+	while (getline(&line, &sz, f) > 0) {
+		if (oui_parse_line(line, &prefix, &name, &len))
+			continue;
+		if (n == alloc) {
+			if (alloc >= OUI_MAX_ENTRIES) {
+				errno = EFBIG;
+				goto err;
+			}
+			alloc = (alloc) ? 2 * alloc : 1024;
+			tmp = realloc(ents, alloc * sizeof(*ents));
+			if (!tmp)
+				goto err;
+			ents = tmp;
+		}
+		ents[n].name = strndup(name, len);
+		if (!ents[n].name)
+			goto err;
+		ents[n].prefix = prefix;
+		ents[n].seq = n;
+		n++;
+	}
+	if (ferror(f)) {
+		errno = EIO;
+		goto err;
+	}
+	free(line);
+	(void)fclose(f);
+	*out = ents;
+	*count = n;
+	return 0;
+
+err:
+	err = errno;
+	while (n)
+		free(ents[--n].name);
+	free(ents);
+	free(line);
+	(void)fclose(f);
+	errno = err;
+	return -1;
+}
+
+/* Table des noms, un seul exemplaire par fabricant : fixe ents[].off */
+static char *
+oui_names(struct oui_entry *ents, uint32_t n, uint32_t *names_len)
+{
+	struct oui_entry **byname;
+	size_t len = 0, l;
+	char *names;
+	uint32_t i;
+
+	byname = calloc(n, sizeof(*byname));
+	names = malloc((size_t)n * OUI_NAME_MAX);
+	if (!byname || !names) {
+		free(byname);
+		free(names);
+		return NULL;
+	}
+	for (i = 0; i < n; i++)
+		byname[i] = &ents[i];
+	qsort(byname, n, sizeof(*byname), oui_cmp_name);
+
+	for (i = 0; i < n; i++) {
+		if (i && !strcmp(byname[i]->name, byname[i - 1]->name)) {
+			byname[i]->off = byname[i - 1]->off;
+			continue;
+		}
+		l = strlen(byname[i]->name) + 1;
+		memcpy(names + len, byname[i]->name, l);
+		byname[i]->off = (uint32_t)len;
+		len += l;
+	}
+	free(byname);
+	*names_len = (uint32_t)len;
+	return names;
+}
+
+static int
+oui_write(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t ret;
+	size_t l;
+
+	for (l = 0; l < len; l += (size_t)ret) {
+		ret = write(fd, buf + l, len - l);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+oui_output(const char *dst, const struct oui_entry *ents, uint32_t n,
+		const char *names, uint32_t names_len)
+{
+	size_t tab_len = OUI_HDR_LEN + (size_t)n * OUI_ENTRY_LEN;
+	char tmp[PATH_MAX];
+	uint8_t *tab;
+	uint32_t i;
+	int fd, ret, err;
+
+	tab = malloc(tab_len);
+	if (!tab)
+		return -1;
+	memcpy(tab, OUI_MAGIC, 4);
+	oui_put32(tab + 4, n);
+	oui_put32(tab + 8, (uint32_t)tab_len);
+	oui_put32(tab + 12, names_len);
+	for (i = 0; i < n; i++) {
+		oui_put32(tab + OUI_HDR_LEN + i * OUI_ENTRY_LEN,
+				ents[i].prefix);
+		oui_put32(tab + OUI_HDR_LEN + i * OUI_ENTRY_LEN + 4,
+				ents[i].off);
+	}
+
+	ret = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", dst);
+	if (ret < 0 || (size_t)ret >= sizeof(tmp)) {
+		free(tab);
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		free(tab);
+		return -1;
+	}
+	if (fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)
+			|| oui_write(fd, tab, tab_len)
+			|| oui_write(fd, (const uint8_t *)names, names_len)) {
+		err = errno;
+		(void)close(fd);
+		goto err;
+	}
+	if (close(fd) || rename(tmp, dst)) {
+		err = errno;
+		goto err;
+	}
+	free(tab);
+	return 0;
+
+err:
+	free(tab);
+	(void)unlink(tmp);
+	errno = err;
+	return -1;
+}
+
+int
+oui_compile(const char *src, const char *dst)
+{
+	struct oui_entry *ents;
+	uint32_t n, i, j, names_len;
+	char *names;
+	int ret = -1, err = 0;
+
+	if (oui_read(src, &ents, &n))
+		return -1;
+	if (!n) {
+		free(ents);
+		errno = ENODATA;
+		return -1;
+	}
+
+	names = oui_names(ents, n, &names_len);
+	if (!names) {
+		err = errno;
+		goto out;
+	}
+	qsort(ents, n, sizeof(*ents), oui_cmp_prefix);
+	for (i = 1, j = 1; i < n; i++) {
+		if (ents[i].prefix != ents[j - 1].prefix)
+			ents[j++] = ents[i];
+		else
+			free(ents[i].name);
+	}
+	for (i = j; i < n; i++)
+		ents[i].name = NULL;
+
+	if (oui_output(dst, ents, j, names, names_len))
+		err = errno;
+	else
+		ret = (int)j;
+	free(names);
+
+out:
+	for (i = 0; i < n; i++)
+		free(ents[i].name);
+	free(ents);
+	errno = err;
+	return ret;
+}
+
+/*********************************************************/
+/** Consultation **/
+/*********************************************************/
+
+int
+oui_open(struct oui_index *idx, const char *path, const char *src)
+{
+	struct stat st, sst;
+	uint32_t count, names, names_len;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st))
+		goto err;
+
+	/* oui.txt mis à jour depuis la compilation */
+	if (src && !stat(src, &sst) && (sst.st_mtim.tv_sec > st.st_mtim.tv_sec
+			|| (sst.st_mtim.tv_sec == st.st_mtim.tv_sec
+			&& sst.st_mtim.tv_nsec > st.st_mtim.tv_nsec))) {
+		errno = ESTALE;
+		goto err;
+	}
+	if ((size_t)st.st_size < OUI_HDR_LEN + 1) {
+		errno = EINVAL;
+		goto err;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+	(void)close(fd);
+
+	idx->map = map;
+	idx->size = (size_t)st.st_size;
+	count = oui_get32(idx->map + 4);
+	names = oui_get32(idx->map + 8);
+	names_len = oui_get32(idx->map + 12);
+	if (memcmp(idx->map, OUI_MAGIC, 4)
+			|| count > OUI_MAX_ENTRIES
+			|| names != OUI_HDR_LEN + count * OUI_ENTRY_LEN
+			|| !names_len
+			|| (size_t)names + names_len != idx->size
+			|| idx->map[idx->size - 1] != '\0') {
+		oui_close(idx);
+		errno = EINVAL;
+		return -1;
+	}
+	idx->count = count;
+	idx->entries = idx->map + OUI_HDR_LEN;
+	idx->names = (const char *)idx->map + names;
+	idx->names_len = names_len;
+	return 0;
+
+err:
+	(void)close(fd);
+	return -1;
+}
+
+void
+oui_close(struct oui_index *idx)
+{
+	if (idx->map)
+		(void)munmap((void *)(uintptr_t)idx->map, idx->size);
+	memset(idx, 0, sizeof(*idx));
+}
+
+const char *
+oui_lookup(const struct oui_index *idx, const uint8_t *mac)
+{
+	uint32_t key = (uint32_t)mac[0] << 16 | (uint32_t)mac[1] << 8 | mac[2];
+	uint32_t lo = 0, hi = idx->count, mid, p, off;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p = oui_get32(idx->entries + mid * OUI_ENTRY_LEN);
+		if (p == key) {
+			off = oui_get32(idx->entries + mid * OUI_ENTRY_LEN + 4);
+			return (off < idx->names_len) ? idx->names + off : NULL;
+		}
+		if (p < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef OUI_H
+#define OUI_H
+
+/*
+ * Index des fabricants de cartes réseau (préfixes OUI de l'IEEE).
+ *
+ * oui_compile() transforme oui.txt (lignes "XX-XX-XX   (hex)	<nom>") en
+ * une table triée, projetée en mémoire par oui_open() et parcourue par
+ * dichotomie : une recherche ne lit que quelques pages, sans analyser
+ * le fichier texte.
+ *
+ * Format, entiers de 32 bits gros-boutistes : en-tête de 16 octets
+ * (magique "OUI1", nombre d'entrées, position et taille des noms), puis
+ * les entrées de 8 octets triées par préfixe (préfixe sur 24 bits, position
+ * du nom dans la table des noms), puis les noms, sans doublon, terminés
+ * par un octet nul.
+ *
+ * Les erreurs sont signalées par un retour -1 et errno ; seule
+ * oui_compile() alloue de la mémoire.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUI_TXT		"/usr/share/misc/oui.txt"
+#define OUI_INDEX	"/usr/share/misc/oui.idx"
+
+/* Noms plus longs tronqués */
+#define OUI_NAME_MAX	128
+
+struct oui_index {
+	const uint8_t *map;
+	size_t size;
+	uint32_t count;
+	const uint8_t *entries;
+	const char *names;
+	uint32_t names_len;
+};
+
+/* Index de src écrit dans dst (fichier temporaire puis rename) ;
+ * retourne le nombre d'entrées */
+int
+oui_compile(const char *src, const char *dst);
+
+/* Projection de l'index path. Si src n'est pas NULL, un index plus
+ * ancien que src est refusé (ESTALE). */
+int
+oui_open(struct oui_index *idx, const char *path, const char *src);
+
+void
+oui_close(struct oui_index *idx);
+
+/* Fabricant de la carte mac (au moins 3 octets), NULL s'il est inconnu */
+const char *
+oui_lookup(const struct oui_index *idx, const uint8_t *mac);
+
+/* Ligne "XX-XX-XX   (hex)	<nom>" de oui.txt : préfixe sur 24 bits dans
+ * prefix, nom (sans blancs finaux, non terminé) dans name et len.
+ * Retourne -1 pour les autres lignes. */
+int
+oui_parse_line(const char *line, uint32_t *prefix,
+		const char **name, size_t *len);
+
+/* "xx:xx:xx[...]" ou "xx-xx-xx[...]" : 3 premiers octets dans mac */
+int
+oui_parse_mac(const char *str, uint8_t *mac);
+
+#endif /* OUI_H */
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	oui_bench - coût d'une recherche de fabricant
+ *
+ *	oui_bench [-n recherches] [-g lancements] [-i index] [oui.txt]
+ *
+ *	Compile oui.txt dans l'index, puis compare le temps moyen d'une
+ *	recherche par l'index projeté (ouverture comprise ou non), par
+ *	lecture de oui.txt comme checkip sans index, et par le pipeline
+ *	grep | sed | head de findmac (checkip.sh), dont les résultats sont
+ *	comparés à ceux de l'index.
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "oui.h"
+
+#define BENCH_NMACS	1024
+
+static uint8_t g_macs[BENCH_NMACS][3];
+
+static void
+bench_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n lookups] [-g runs] [-i index] "
+			"[oui.txt]\n", prog);
+	exit(EINVAL);
+}
+
+static double
+bench_ns(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1e9
+			+ (end.tv_nsec - start->tv_nsec);
+}
+
+/* Une adresse sur deux connue de l'index, les autres tirées au hasard */
+static void
+bench_macs(const struct oui_index *idx)
+{
+	uint32_t p;
+	unsigned int i;
+
+	srandom(1);
+	for (i = 0; i < BENCH_NMACS; i++) {
+		if (i % 2) {
+			p = (uint32_t)random() & 0xffffff;
+		} else {
+			memcpy(&p, idx->entries + 8 * ((uint32_t)random()
+						% idx->count), sizeof(p));
+			p = ntohl(p);
+		}
+		g_macs[i][0] = (uint8_t)(p >> 16);
+		g_macs[i][1] = (uint8_t)(p >> 8);
+		g_macs[i][2] = (uint8_t)p;
+	}
+}
+
+/* Lecture complète de oui.txt jusqu'au préfixe, comme checkip
+ * en l'absence d'index */
+static int
+bench_scan(const char *src, const uint8_t *mac)
+{
+	char *line = NULL;
+	const char *name;
+	uint32_t key, prefix;
+	size_t len, sz = 0;
+	int found = 0;
+	FILE *f;
+
+	key = (uint32_t)mac[0] << 16 | (uint32_t)mac[1] << 8 | mac[2];
+	f = fopen(src, "re");
+	if (!f)
+		err(EXIT_FAILURE, "%s", src);
+	while (!found && getline(&line, &sz, f) > 0) {
+		if (!oui_parse_line(line, &prefix, &name, &len))
+			found = (prefix == key);
+	}
+	free(line);
+	(void)fclose(f);
+	return found;
+}
+
+/* findmac de checkip.sh ; retourne 1 si sa sortie diffère de expect */
+static int
+bench_pipeline(const char *src, const uint8_t *mac, const char *expect)
+{
+	char cmd[1024], out[OUI_NAME_MAX + 2];
+	size_t len;
+	FILE *p;
+
+	snprintf(cmd, sizeof(cmd), "mac=\"$(echo '%02x:%02x:%02x:00:00:00'"
+		" | head -c 8 | tr -- ':a-f' '-A-F')\"; grep \"^${mac}\" -- '%s'"
+		" | sed -nr 's/[-0-9A-F]{8}\\s*\\(hex\\)\\s*(.*)\\s*$/\\1/p'"
+		" | head -n 1", mac[0], mac[1], mac[2], src);
+	p = popen(cmd, "r");
+	if (!p)
+		err(EXIT_FAILURE, "popen");
+	if (!fgets(out, sizeof(out), p))
+		out[0] = '\0';
+	if (pclose(p) == -1)
+		err(EXIT_FAILURE, "pclose");
+
+	/* sed conserve les blancs finaux, l'index non */
+	len = strcspn(out, "\r\n");
+	while (len && (out[len - 1] == ' ' || out[len - 1] == '\t'))
+		len--;
+	out[len] = '\0';
+	return strncmp(out, (expect) ? expect : "", OUI_NAME_MAX - 1) != 0;
+}
+
+static void
+bench_print(const char *name, unsigned long n, double ns)
+{
+	printf("%-20s %10lu %14.1f\n", name, n, ns / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *index = "oui_bench.idx", *src = OUI_TXT, *name;
+	unsigned long n = 1000000, runs = 20, opens, i, hits = 0, diff = 0;
+	struct oui_index idx;
+	struct timespec start;
+	double ns;
+	int opt, count;
+
+	while ((opt = getopt(argc, argv, "n:g:i:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			if (!n)
+				bench_usage(argv[0]);
+			break;
+		case 'g':
+			runs = strtoul(optarg, NULL, 10);
+			if (!runs)
+				bench_usage(argv[0]);
+			break;
+		case 'i':
+			index = optarg;
+			break;
+		default:
+			bench_usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		src = argv[optind++];
+	if (optind < argc)
+		bench_usage(argv[0]);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	count = oui_compile(src, index);
+	if (count < 0)
+		err(EXIT_FAILURE, "compile %s", src);
+	ns = bench_ns(&start);
+	printf("%s: %d entries, compiled in %.1f ms\n\n", src, count,
+								ns / 1e6);
+
+	if (oui_open(&idx, index, NULL))
+		err(EXIT_FAILURE, "%s", index);
+	bench_macs(&idx);
+
+	printf("%-20s %10s %14s\n", "method", "n", "ns/lookup");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		if (oui_lookup(&idx, g_macs[i % BENCH_NMACS]))
+			hits++;
+	}
+	bench_print("index", n, bench_ns(&start));
+
+	/* checkip : une projection par lancement */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	opens = (n > 100) ? n / 100 : 1;
+	for (i = 0; i < opens; i++) {
+		struct oui_index tmp;
+
+		if (oui_open(&tmp, index, src))
+			err(EXIT_FAILURE, "%s", index);
+		(void)oui_lookup(&tmp, g_macs[i % BENCH_NMACS]);
+		oui_close(&tmp);
+	}
+	bench_print("index + open", opens, bench_ns(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < runs; i++)
+		(void)bench_scan(src, g_macs[i % BENCH_NMACS]);
+	bench_print("oui.txt scan", runs, bench_ns(&start));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < runs; i++) {
+		name = oui_lookup(&idx, g_macs[i % BENCH_NMACS]);
+		diff += (unsigned long)bench_pipeline(src,
+					g_macs[i % BENCH_NMACS], name);
+	}
+	bench_print("grep pipeline", runs, bench_ns(&start));
+
+	printf("\n%lu/%lu index hits, %lu/%lu pipeline mismatches\n",
+			hits, n, diff, runs);
+	oui_close(&idx);
+	return (diff) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
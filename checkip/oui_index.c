@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	oui_index - index des fabricants de cartes réseau
+ *
+ *	oui_index [-f index] compile [oui.txt]
+ *		(re)construit l'index, à relancer à chaque mise à jour de
+ *		oui.txt : un index plus ancien que oui.txt est ignoré.
+ *	oui_index [-f index] lookup mac [mac...]
+ *		affiche le fabricant de chaque carte, une ligne (vide si
+ *		inconnu) par adresse. Code de retour non nul si l'index est
+ *		absent ou périmé : l'appelant se rabat alors sur oui.txt.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "oui.h"
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f index] compile [oui.txt]\n"
+		"       %s [-f index] lookup mac [mac...]\n",
+		prog, prog);
+	exit(EINVAL);
+}
+
+static int
+cmd_compile(const char *path, int argc, char *argv[])
+{
+	const char *src = (argc) ? argv[0] : OUI_TXT;
+	int n;
+
+	if (argc > 1)
+		usage("oui_index");
+	n = oui_compile(src, path);
+	if (n < 0)
+		err(EXIT_FAILURE, "compile %s", src);
+	printf("%s: %d entries\n", path, n);
+	return 0;
+}
+
+static int
+cmd_lookup(const char *path, int argc, char *argv[])
+{
+	struct oui_index idx;
+	const char *name;
+	uint8_t mac[3];
+	int i;
+
+	if (!argc)
+		usage("oui_index");
+	if (oui_open(&idx, path, OUI_TXT))
+		err(EXIT_FAILURE, "%s", path);
+	for (i = 0; i < argc; i++) {
+		name = (oui_parse_mac(argv[i], mac)) ?
+					NULL : oui_lookup(&idx, mac);
+		printf("%s\n", (name) ? name : "");
+	}
+	oui_close(&idx);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = OUI_INDEX, *cmd;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "+f:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+	cmd = argv[optind++];
+	argc -= optind;
+	argv += optind;
+
+	if (!strcmp(cmd, "compile"))
+		return cmd_compile(path, argc, argv);
+	if (!strcmp(cmd, "lookup"))
+		return cmd_lookup(path, argc, argv);
+	usage("oui_index");
+	return EINVAL;
+}
@@ -0,0 +1,782 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netmonitor - surveillance de l'état du réseau
+ *
+ *	netmonitor [-f fichier] [-s délai] [-r délai] [-p délai] [-t type]
+ *					<interface> wired|wifi|umts
+ *
+ *	-s : intervalle (ms) des mesures wifi tant que le lien est dégradé,
+ *	0 pour s'en tenir aux vérifications périodiques.
+ *	-r : intervalle (ms) entre les lancements concurrents des passerelles
+ *	redondantes d'un tunnel IPsec, 0 (défaut) pour les essayer l'une
+ *	après l'autre.
+ *	-p : intervalle (ms) des mesures de RTT et de pertes vers les
+ *	passerelles IPsec, qui ordonnent les essais, 0 (défaut) sans mesure.
+ *	-t : type de modem passé à umts_config (umts_type de lib/umts). À
+ *	défaut, le pilote de l'interface, avec la même correspondance
+ *	qmi_wwan => qmi et cdc_ncm => mbim selon UMTS_QMI et UMTS_MBIM.
+ *
+ *	Remplace la boucle de netmonitor.sh par une boucle d'événements
+ *	(epoll) : changements de lien, d'adresse et de route (rtnetlink),
+ *	du marqueur nonetwork (inotify), fin des commandes filles (signalfd) et
+ *	vérification périodique (timerfd). L'état est publié dans NET_STATUS
+ *	dès qu'il change, et seulement dans ce cas. Les commandes externes
+ *	(ipsec, umts_config) sont exécutées sans bloquer la boucle.
+ *	SIGHUP force une vérification immédiate.
+ */
+
+#include "netmonitor.h"
+
+#include <net/if.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#define NM_MAX_WATCH	16
+
+const char *nm_iface;
+nm_mode_t nm_mode;
+
+static const char *const g_modes[] = {
+	[NM_WIRED] = "wired",
+	[NM_WIFI] = "wifi",
+	[NM_UMTS] = "umts",
+};
+
+static const char *g_status = NETSTATUS_FILE;
+
+static int g_epoll = -1;
+static volatile int g_stop;
+static int g_refresh;
+
+static int g_wifi_timer = -1;
+static unsigned int g_wifi_wait = NM_WIFI_FAST;
+static int g_wifi_fast;
+
+struct nm_slot {
+	int fd;
+	nm_handler_t handler;
+	void *data;
+};
+
+static struct nm_slot g_slots[NM_MAX_WATCH];
+static struct nm_job *g_jobs[NM_MAX_JOBS];
+
+/*********************************************************/
+/** Boucle d'événements **/
+/*********************************************************/
+
+void
+nm_watch(int fd, nm_handler_t handler, void *data)
+{
+	struct epoll_event ev;
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_WATCH && g_slots[i].handler; i++)
+		;
+	if (i == NM_MAX_WATCH)
+		ERROR(ENOSPC, "too many watched descriptors");
+
+	g_slots[i].fd = fd;
+	g_slots[i].handler = handler;
+	g_slots[i].data = data;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = &g_slots[i];
+	if (epoll_ctl(g_epoll, EPOLL_CTL_ADD, fd, &ev))
+		ERROR_ERRNO("epoll_ctl %d", fd);
+}
+
+void
+nm_unwatch(int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_WATCH; i++) {
+		if (g_slots[i].handler && g_slots[i].fd == fd)
+			break;
+	}
+	if (i == NM_MAX_WATCH)
+		return;
+	(void)epoll_ctl(g_epoll, EPOLL_CTL_DEL, fd, NULL);
+	memset(&g_slots[i], 0, sizeof(g_slots[i]));
+	g_slots[i].fd = -1;
+}
+
+void
+nm_refresh(void)
+{
+	g_refresh = 1;
+}
+
+/*********************************************************/
+/** Processus fils **/
+/*********************************************************/
+
+static void
+nm_job_finish(struct nm_job *job)
+{
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_JOBS; i++) {
+		if (g_jobs[i] == job)
+			g_jobs[i] = NULL;
+	}
+	job->pid = 0;
+	job->out[job->len] = '\0';
+	job->done(job);
+}
+
+static void
+nm_job_read(int fd, uint32_t events __attribute__((unused)), void *data)
+{
+	struct nm_job *job = data;
+	char buf[4096];
+	size_t room;
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				return;
+			WARN_ERRNO("read from child %d", job->pid);
+			len = 0;
+		}
+		if (!len)
+			break;
+		/* au-delà de NM_JOB_OUT, la sortie est lue puis ignorée */
+		room = sizeof(job->out) - 1 - job->len;
+		if ((size_t)len < room)
+			room = (size_t)len;
+		memcpy(job->out + job->len, buf, room);
+		job->len += room;
+	}
+
+	nm_unwatch(fd);
+	(void)close(fd);
+	job->fd = -1;
+	if (job->exited)
+		nm_job_finish(job);
+}
+
+static void
+nm_job_reap(void)
+{
+	unsigned int i;
+	pid_t pid;
+	int status;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < NM_MAX_JOBS; i++) {
+			if (g_jobs[i] && g_jobs[i]->pid == pid)
+				break;
+		}
+		if (i == NM_MAX_JOBS)
+			continue;
+		g_jobs[i]->status = status;
+		g_jobs[i]->exited = 1;
+		if (g_jobs[i]->fd < 0)
+			nm_job_finish(g_jobs[i]);
+	}
+}
+
+int
+nm_job_start(struct nm_job *job, const char *const argv[], int capture,
+							nm_job_done_t done)
+{
+	char *args[NM_JOB_ARGS + 1];
+	int pfd[2] = { -1, -1 };
+	unsigned int i;
+	sigset_t set;
+	int null;
+
+	for (i = 0; i < NM_MAX_JOBS && g_jobs[i]; i++)
+		;
+	if (i == NM_MAX_JOBS) {
+		WARN("too many running commands, %s not started", argv[0]);
+		return -1;
+	}
+	if (capture && pipe2(pfd, O_CLOEXEC|O_NONBLOCK)) {
+		WARN_ERRNO("pipe");
+		return -1;
+	}
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		WARN_ERRNO("fork");
+		job->pid = 0;
+		if (capture) {
+			(void)close(pfd[0]);
+			(void)close(pfd[1]);
+		}
+		return -1;
+	}
+
+	if (!job->pid) {
+		sigemptyset(&set);
+		(void)sigprocmask(SIG_SETMASK, &set, NULL);
+		null = open("/dev/null", O_RDWR);
+		if (null < 0)
+			_exit(EXIT_FAILURE);
+		(void)dup2(null, STDIN_FILENO);
+		(void)dup2(capture ? pfd[1] : null, STDOUT_FILENO);
+		for (i = 0; i < NM_JOB_ARGS && argv[i]; i++) {
+			args[i] = strdup(argv[i]);
+			if (!args[i])
+				_exit(EXIT_FAILURE);
+		}
+		args[i] = NULL;
+		execvp(args[0], args);
+		_exit(127);
+	}
+
+	job->fd = -1;
+	job->exited = 0;
+	job->status = 0;
+	job->len = 0;
+	job->done = done;
+	g_jobs[i] = job;
+	if (capture) {
+		(void)close(pfd[1]);
+		job->fd = pfd[0];
+		nm_watch(job->fd, nm_job_read, job);
+	}
+	return 0;
+}
+
+/*********************************************************/
+/** Publication **/
+/*********************************************************/
+
+static int
+nm_same_record(const struct netstatus *a, const struct netstatus *b)
+{
+	unsigned int i;
+
+	if (a->n != b->n)
+		return 0;
+	for (i = 0; i < a->n; i++) {
+		if (strcmp(a->lines[i], b->lines[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/* Les champs de l'itération courante sont publiés ensemble, et seulement
+ * s'ils modifient l'enregistrement. Avec update, les autres lignes de
+ * l'enregistrement sont conservées (update_lock de netmonitor.sh),
+ * sinon il est réécrit en entier (write_lock). */
+static void
+nm_publish(int update, const char *ipsec, const char *level, const char *addr,
+					const char *gw, const char *desc)
+{
+	static struct netstatus rec, old;
+	const char *probe = nm_probe_status();
+	int lock, loaded;
+
+	lock = netstatus_lock(g_status);
+	if (lock < 0) {
+		WARN_ERRNO("lock %s", g_status);
+		return;
+	}
+	loaded = !netstatus_load(&old, g_status);
+	if (!loaded && errno != ENOENT)
+		WARN_ERRNO("load %s, record reset", g_status);
+	if (loaded && update)
+		rec = old;
+	else
+		netstatus_init(&rec);
+
+	if (netstatus_set(&rec, "ipsec", ipsec)
+			|| netstatus_set(&rec, "type", g_modes[nm_mode])
+			|| netstatus_set(&rec, "level", level)
+			|| netstatus_set(&rec, "addr", addr)
+			|| netstatus_set(&rec, "gw", gw)
+			|| (probe && netstatus_set(&rec, "ipsec_gw", probe))
+			|| (desc && netstatus_add(&rec, desc))) {
+		WARN_ERRNO("status record");
+		goto out;
+	}
+	if (loaded && nm_same_record(&rec, &old))
+		goto out;
+	if (netstatus_publish(&rec, g_status))
+		WARN_ERRNO("publish %s", g_status);
+out:
+	netstatus_unlock(lock);
+}
+
+static void
+nm_reset_status(void)
+{
+	nm_publish(0, NM_NOIPSEC, "0", "", "", NULL);
+}
+
+/* Première ligne de fichier, sans le retour à la ligne */
+static void
+nm_read_line(const char *path, char *buf, size_t len)
+{
+	FILE *f = fopen(path, "re");
+
+	buf[0] = '\0';
+	if (!f)
+		return;
+	if (!fgets(buf, (int)len, f))
+		buf[0] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	(void)fclose(f);
+}
+
+static void
+nm_check_wired(void)
+{
+	char addr[NM_LEN] = "", gw[NM_LEN] = "";
+	const char *level = "0";
+
+	if (access(NM_NONETWORK, F_OK) && nm_rtnl_carrier())
+		level = "1";
+	if (nm_rtnl_ifaddr(addr, sizeof(addr)))
+		addr[0] = '\0';
+	if (nm_rtnl_default_gw(gw, sizeof(gw)))
+		gw[0] = '\0';
+	nm_publish(1, nm_ipsec_status(), level, addr, gw, NULL);
+}
+
+/* Mesures rapprochées tant que le lien reste associé mais dégradé */
+static void
+nm_wifi_sampling(int fast)
+{
+	struct itimerspec its;
+
+	if (g_wifi_timer < 0 || fast == g_wifi_fast)
+		return;
+	memset(&its, 0, sizeof(its));
+	if (fast) {
+		its.it_interval.tv_sec = g_wifi_wait / 1000;
+		its.it_interval.tv_nsec = (long)(g_wifi_wait % 1000) * 1000000;
+		its.it_value = its.it_interval;
+	}
+	if (timerfd_settime(g_wifi_timer, 0, &its, NULL)) {
+		WARN_ERRNO("timerfd_settime");
+		return;
+	}
+	g_wifi_fast = fast;
+}
+
+static void
+nm_check_wifi(void)
+{
+	char addr[NM_LEN] = "", gw[NM_LEN] = "";
+	char level[4], desc[NETSTATUS_LINE_LEN];
+	struct nm_wifi wifi;
+	unsigned int lvl;
+
+	if (nm_wifi_query(&wifi)) {
+		nm_wifi_sampling(0);
+		nm_reset_status();
+		return;
+	}
+	/* adresse et passerelle seulement une fois l'adresse obtenue */
+	if (!nm_rtnl_ifaddr(addr, sizeof(addr))
+			&& nm_rtnl_default_gw(gw, sizeof(gw)))
+		gw[0] = '\0';
+	/* niveaux 0 à 5, comme la qualité /70 divisée par 14 */
+	lvl = (wifi.quality < 100) ? wifi.quality * 5 / 100 : 5;
+	snprintf(level, sizeof(level), "%u", lvl);
+	snprintf(desc, sizeof(desc), "%s (%g Mb/s ; %u %%)", wifi.essid,
+				wifi.tx_rate / 1000.0, wifi.quality);
+	DBG("%s %s: signal %d dBm, tx %u kb/s, rx %u kb/s, "
+			"expected %u kb/s", wifi.essid, wifi.bssid, wifi.signal,
+			wifi.tx_rate, wifi.rx_rate, wifi.expected);
+	nm_wifi_sampling(lvl < NM_WIFI_DEGRADED);
+	nm_publish(0, nm_ipsec_status(), level, addr, gw, desc);
+}
+
+/*********************************************************/
+/** UMTS **/
+/*********************************************************/
+
+static struct nm_job g_umts_job;
+static const char *g_umts_type;
+
+static void
+nm_umts_ipsec(void);
+
+/* Sans -t : pilote de l'interface, traduit comme le fait umts_type */
+static const char *
+nm_umts_type(char *link, size_t size)
+{
+	char path[PATH_MAX];
+	const char *type, *env;
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/driver",
+								nm_iface);
+	len = readlink(path, link, size - 1);
+	if (len <= 0) {
+		WARN_ERRNO("readlink %s", path);
+		return NULL;
+	}
+	link[len] = '\0';
+	type = strrchr(link, '/');
+	type = (type) ? type + 1 : link;
+
+	env = getenv("UMTS_QMI");
+	if (!strcmp(type, "qmi_wwan") && env && !strcmp(env, "yes"))
+		return "qmi";
+	env = getenv("UMTS_MBIM");
+	if (!strcmp(type, "cdc_ncm") && env && !strcmp(env, "yes"))
+		return "mbim";
+	return type;
+}
+
+static void
+nm_umts_done(struct nm_job *job)
+{
+	if (!WIFEXITED(job->status) || WEXITSTATUS(job->status)) {
+		WARN("%s check failed (status %d)", NM_UMTS_CONFIG, job->status);
+		/* l'état IPsec reste publié, même sans lien */
+		nm_umts_ipsec();
+		return;
+	}
+	/* enregistrement réécrit sans les mesures des passerelles */
+	if (nm_probe_status())
+		nm_umts_ipsec();
+}
+
+/* umts_config publie l'enregistrement complet, état IPsec compris */
+static void
+nm_check_umts(void)
+{
+	char link[PATH_MAX], ipsec[NM_LEN];
+	const char *type;
+
+	if (nm_job_running(&g_umts_job))
+		return;
+
+	type = (g_umts_type) ? g_umts_type : nm_umts_type(link, sizeof(link));
+	if (!type)
+		return;
+	snprintf(ipsec, sizeof(ipsec), "%s", nm_ipsec_status());
+
+	{
+		const char *const argv[] = { NM_UMTS_CONFIG, g_status, type,
+					nm_iface, "check", ipsec, NULL };
+
+		(void)nm_job_start(&g_umts_job, argv, 0, nm_umts_done);
+	}
+}
+
+/* Nouvel état IPsec entre deux vérifications : seuls les champs ipsec
+ * et ipsec_gw de l'enregistrement publié par umts_config sont mis à
+ * jour */
+static void
+nm_umts_ipsec(void)
+{
+	static struct netstatus rec;
+	const char *probe = nm_probe_status();
+	int lock;
+
+	lock = netstatus_lock(g_status);
+	if (lock < 0) {
+		WARN_ERRNO("lock %s", g_status);
+		return;
+	}
+	if (netstatus_load(&rec, g_status)) {
+		if (errno != ENOENT)
+			WARN_ERRNO("load %s, record reset", g_status);
+		netstatus_init(&rec);
+	}
+	if (netstatus_set(&rec, "ipsec", nm_ipsec_status())
+		|| (probe && netstatus_set(&rec, "ipsec_gw", probe)))
+		WARN_ERRNO("status record");
+	else if (netstatus_publish(&rec, g_status))
+		WARN_ERRNO("publish %s", g_status);
+	netstatus_unlock(lock);
+}
+
+/*********************************************************/
+/** Vérifications **/
+/*********************************************************/
+
+static void
+nm_check(void)
+{
+	switch (nm_mode) {
+	case NM_WIRED:
+		nm_check_wired();
+		break;
+	case NM_WIFI:
+		nm_check_wifi();
+		break;
+	case NM_UMTS:
+		nm_check_umts();
+		break;
+	}
+	nm_ipsec_update();
+}
+
+void
+nm_ipsec_changed(void)
+{
+	switch (nm_mode) {
+	case NM_WIRED:
+		nm_check_wired();
+		break;
+	case NM_WIFI:
+		nm_check_wifi();
+		break;
+	case NM_UMTS:
+		nm_umts_ipsec();
+		break;
+	}
+}
+
+void
+nm_probe_changed(void)
+{
+	nm_ipsec_changed();
+}
+
+static void
+nm_timer(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) == sizeof(count))
+		nm_refresh();
+}
+
+static void
+nm_wifi_timer(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) == sizeof(count))
+		nm_check_wifi();
+}
+
+static void
+nm_signal(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	struct signalfd_siginfo si;
+
+	while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+		switch (si.ssi_signo) {
+		case SIGCHLD:
+			nm_job_reap();
+			break;
+		case SIGHUP:
+			nm_refresh();
+			break;
+		default:
+			g_stop = 1;
+			break;
+		}
+	}
+}
+
+/* Marqueur nonetwork */
+static void
+nm_rundir(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t len, off;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (off = 0; off < len;
+				off += (ssize_t)sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)(buf + off);
+			if (!ev->len)
+				continue;
+			if (!strcmp(ev->name, NM_NONETWORK_MARK))
+				nm_refresh();
+		}
+	}
+}
+
+static void
+nm_open_events(void)
+{
+	struct itimerspec its;
+	sigset_t set;
+	int fd;
+
+	g_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (g_epoll < 0)
+		ERROR_ERRNO("epoll_create1");
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGHUP);
+	if (sigprocmask(SIG_BLOCK, &set, NULL))
+		ERROR_ERRNO("sigprocmask");
+	fd = signalfd(-1, &set, SFD_CLOEXEC|SFD_NONBLOCK);
+	if (fd < 0)
+		ERROR_ERRNO("signalfd");
+	nm_watch(fd, nm_signal, NULL);
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+	if (fd < 0)
+		ERROR_ERRNO("timerfd_create");
+	its.it_interval.tv_sec = NM_WAIT / 1000;
+	its.it_interval.tv_nsec = (NM_WAIT % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(fd, 0, &its, NULL))
+		ERROR_ERRNO("timerfd_settime");
+	nm_watch(fd, nm_timer, NULL);
+
+	if (nm_mode == NM_WIFI && g_wifi_wait) {
+		g_wifi_timer = timerfd_create(CLOCK_MONOTONIC,
+						TFD_CLOEXEC|TFD_NONBLOCK);
+		if (g_wifi_timer < 0)
+			ERROR_ERRNO("timerfd_create");
+		nm_watch(g_wifi_timer, nm_wifi_timer, NULL);
+	}
+
+	fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+	if (fd < 0)
+		ERROR_ERRNO("inotify_init1");
+	if (inotify_add_watch(fd, NM_RUN_DIR, IN_CLOSE_WRITE|IN_MOVED_TO|
+					IN_CREATE|IN_DELETE|IN_MOVED_FROM) < 0)
+		ERROR_ERRNO("inotify_add_watch %s", NM_RUN_DIR);
+	nm_watch(fd, nm_rundir, NULL);
+
+	nm_rtnl_open();
+}
+
+/*********************************************************/
+/** Instance unique **/
+/*********************************************************/
+
+/* L'instance précédente publie l'état de repos avant de se terminer */
+static void
+nm_kill_previous(void)
+{
+	char buf[16];
+	pid_t pid;
+	int i;
+
+	nm_read_line(NM_PIDFILE, buf, sizeof(buf));
+	pid = (pid_t)strtol(buf, NULL, 10);
+	if (pid > 1 && pid != getpid() && !kill(pid, SIGTERM)) {
+		for (i = 0; i < 20 && !kill(pid, 0); i++)
+			(void)usleep(50000);
+		(void)kill(pid, SIGKILL);
+	}
+	(void)unlink(NM_PIDFILE);
+}
+
+static void
+nm_write_pidfile(void)
+{
+	FILE *f = fopen(NM_PIDFILE, "we");
+
+	if (!f)
+		ERROR_ERRNO("failed to create %s", NM_PIDFILE);
+	fprintf(f, "%d\n", (int)getpid());
+	if (fclose(f))
+		ERROR_ERRNO("failed to write %s", NM_PIDFILE);
+}
+
+static void
+nm_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f status_file] [-s degraded_wifi_ms] "
+			"[-r ipsec_race_ms] [-p ipsec_probe_ms] [-t umts_type] "
+			"<interface-name> wired|wifi|umts\n", prog);
+	exit(EINVAL);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct epoll_event evs[NM_MAX_WATCH];
+	struct nm_slot *slot;
+	unsigned int i, race = 0, probe = 0;
+	int opt, n;
+
+	while ((opt = getopt(argc, argv, "f:s:r:p:t:")) != -1) {
+		switch (opt) {
+		case 'f':
+			g_status = optarg;
+			break;
+		case 's':
+			g_wifi_wait = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			race = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			probe = (unsigned int)strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			g_umts_type = optarg;
+			break;
+		default:
+			nm_usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		nm_usage(argv[0]);
+	nm_iface = argv[optind];
+	for (i = 0; i < sizeof(g_modes) / sizeof(g_modes[0]); i++) {
+		if (!strcmp(argv[optind + 1], g_modes[i]))
+			break;
+	}
+	if (i == sizeof(g_modes) / sizeof(g_modes[0]))
+		nm_usage(argv[0]);
+	nm_mode = (nm_mode_t)i;
+	if (strlen(nm_iface) >= IFNAMSIZ)
+		ERROR(EINVAL, "invalid interface name: %s", nm_iface);
+
+	openlog("net-monitor", LOG_PID, LOG_DAEMON);
+	for (i = 0; i < NM_MAX_WATCH; i++)
+		g_slots[i].fd = -1;
+
+	nm_kill_previous();
+	nm_write_pidfile();
+	nm_open_events();
+	nm_probe_init(probe);
+	nm_ipsec_init(race);
+
+	nm_check();
+	while (!g_stop) {
+		n = epoll_wait(g_epoll, evs, NM_MAX_WATCH, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR_ERRNO("epoll_wait");
+		}
+		for (i = 0; i < (unsigned int)n; i++) {
+			slot = evs[i].data.ptr;
+			/* descripteur retiré par un événement précédent */
+			if (!slot->handler)
+				continue;
+			slot->handler(slot->fd, evs[i].events, slot->data);
+		}
+		/* plusieurs événements simultanés : une seule vérification */
+		if (g_refresh && !g_stop) {
+			g_refresh = 0;
+			nm_check();
+		}
+	}
+
+	nm_reset_status();
+	(void)unlink(NM_PIDFILE);
+	return 0;
+}
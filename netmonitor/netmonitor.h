@@ -0,0 +1,271 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef NETMONITOR_H
+#define NETMONITOR_H
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "netstatus.h"
+
+/*********************************************************/
+/** Journaux et erreurs **/
+/*********************************************************/
+
+#define _LOG(prio, fmt, args...) syslog(prio, fmt"\n", ##args)
+
+#define _WARN(prio, fmt, args...) _LOG(prio, "%s(%d): "fmt, \
+				__FUNCTION__, __LINE__, ##args)
+
+#define LOG(fmt, args...) _LOG(LOG_INFO, fmt, ##args)
+
+#define DBG(fmt, args...) _LOG(LOG_DEBUG, fmt, ##args)
+
+#define WARN(fmt, args...) _WARN(LOG_WARNING, fmt, ##args)
+#define WARN_ERRNO(fmt, args...) \
+	_WARN(LOG_ERR, fmt": %s", ##args, strerror(errno))
+
+#define ERROR(err, fmt, args...) do {\
+	_WARN(LOG_ERR, fmt, ##args); \
+	exit(err); \
+} while (0)
+
+#define ERROR_ERRNO(fmt, args...) do {\
+	WARN_ERRNO(fmt, ##args); \
+	exit(errno); \
+} while (0)
+
+/*********************************************************/
+/** Fichiers et commandes **/
+/*********************************************************/
+
+#define NM_PIDFILE	"/var/run/netmonitor.pid"
+#define NM_RUN_DIR	"/var/run"
+#define NM_NONETWORK_MARK "nonetwork"
+#define NM_NONETWORK	NM_RUN_DIR "/" NM_NONETWORK_MARK
+#define NM_IPSEC_CONF	"/var/run/ipsec.conf"
+#define NM_IPSEC_LIST	"/var/run/ipsec_gw.list"
+#define NM_IPSEC_MODES	"/var/run/ipsec_gw.redundancy"
+#define NM_IPSEC_RANK	"/var/run/ipsec_gw.rank"
+#define NM_IPSEC_LED	"/dev/leds/ipsec"
+#define NM_UMTS_CONFIG	"/sbin/umts_config"
+#define NM_IPSEC	"ipsec"
+#define NM_VICI		"/var/run/charon.vici"
+
+#define NM_NOIPSEC	"pas de tunnel actif"
+
+/* Intervalle des vérifications périodiques (ms) */
+#define NM_WAIT		30000U
+/* Intervalle des mesures wifi quand le lien est dégradé (ms), 0 pour
+ * s'en tenir aux vérifications périodiques ; voir l'option -s */
+#define NM_WIFI_FAST	5000U
+/* Lien wifi dégradé en deçà de ce niveau (0 à 5) */
+#define NM_WIFI_DEGRADED 2U
+
+#define NM_LEN		256
+
+typedef enum {
+	NM_WIRED = 0,
+	NM_WIFI,
+	NM_UMTS,
+} nm_mode_t;
+
+extern const char *nm_iface;
+extern nm_mode_t nm_mode;
+
+/*********************************************************/
+/** Boucle d'événements (netmonitor.c) **/
+/*********************************************************/
+
+typedef void (*nm_handler_t)(int fd, uint32_t events, void *data);
+
+void
+nm_watch(int fd, nm_handler_t handler, void *data);
+
+void
+nm_unwatch(int fd);
+
+/* Nouvelle vérification, à la suite d'un événement */
+void
+nm_refresh(void);
+
+/* L'état IPsec a changé */
+void
+nm_ipsec_changed(void);
+
+/* Les mesures des passerelles ont changé */
+void
+nm_probe_changed(void);
+
+/*********************************************************/
+/** Processus fils (netmonitor.c) **/
+/*********************************************************/
+
+#define NM_JOB_OUT	16384
+#define NM_JOB_ARGS	8
+/* commandes exécutées simultanément */
+#define NM_MAX_JOBS	8
+
+struct nm_job;
+typedef void (*nm_job_done_t)(struct nm_job *job);
+
+/* Commande exécutée sans bloquer la boucle ; done est appelée quand le
+ * fils est terminé et, si capture, que sa sortie est lue en entier */
+struct nm_job {
+	pid_t pid;		/* 0 : pas de commande en cours */
+	int fd;			/* sortie standard, -1 sans capture */
+	int status;
+	int exited;
+	size_t len;
+	char out[NM_JOB_OUT];
+	nm_job_done_t done;
+};
+
+int
+nm_job_start(struct nm_job *job, const char *const argv[], int capture,
+							nm_job_done_t done);
+
+static inline int
+nm_job_running(const struct nm_job *job)
+{
+	return job->pid != 0;
+}
+
+/*********************************************************/
+/** rtnetlink (nm_rtnl.c) **/
+/*********************************************************/
+
+/* Vue des interfaces, adresses IPv4 et routes par défaut, tenue à jour
+ * par les notifications du noyau */
+void
+nm_rtnl_open(void);
+
+/* Porteuse présente (LOWER_UP) sur nm_iface */
+int
+nm_rtnl_carrier(void);
+
+/* Première adresse de nm_iface, "<adresse>/<préfixe>" */
+int
+nm_rtnl_ifaddr(char *buf, size_t len);
+
+int
+nm_rtnl_default_gw(char *gw, size_t len);
+
+/* 1 si ip est une adresse locale, 0 sinon, -1 si ip n'est pas une
+ * adresse IPv4 */
+int
+nm_rtnl_is_local(const char *ip);
+
+/*********************************************************/
+/** Wifi (nm_wifi.c) **/
+/*********************************************************/
+
+struct nm_wifi {
+	char essid[33];
+	char bssid[18];		/* vide sans nl80211 */
+	int signal;		/* dBm, 0 si inconnu */
+	unsigned int tx_rate;	/* kb/s */
+	unsigned int rx_rate;	/* kb/s, 0 si inconnu */
+	unsigned int expected;	/* débit attendu en kb/s, 0 si inconnu */
+	unsigned int quality;	/* % */
+};
+
+int
+nm_wifi_query(struct nm_wifi *wifi);
+
+/*********************************************************/
+/** Table des SA IKE, via VICI (nm_vici.c) **/
+/*********************************************************/
+
+#define NM_SA_MAX	32
+#define NM_SA_CHILDREN	4
+#define NM_SA_NAME	64
+#define NM_SA_HOST	64
+
+struct nm_sa {
+	char name[NM_SA_NAME];		/* connexion */
+	unsigned int id;		/* uniqueid de l'IKE_SA */
+	int established;
+	unsigned int nchild;		/* CHILD_SA ESP en mode tunnel */
+	unsigned int child[NM_SA_CHILDREN];
+	char local[NM_SA_HOST];
+	char local_id[NM_LEN];
+	char remote[NM_SA_HOST];
+	char remote_id[NM_LEN];
+};
+
+typedef void (*nm_vici_done_t)(int err);
+
+/* Connexion à NM_VICI si besoin : 0 si connecté, -1 sinon. Les
+ * événements ike-updown et child-updown tiennent la table à jour et
+ * appellent nm_ipsec_update(). */
+int
+nm_vici_open(void);
+
+/* Table à jour depuis la connexion (list-sas déjà reçue) */
+int
+nm_vici_synced(void);
+
+/* Relecture de la table par list-sas ; done est appelée à la réponse,
+ * qui suit tous les événements émis avant la demande, ou avec une
+ * erreur si la connexion est perdue entre-temps */
+int
+nm_vici_sync(nm_vici_done_t done);
+
+unsigned int
+nm_vici_sas(const struct nm_sa **sas);
+
+/*********************************************************/
+/** Mesure des passerelles IPsec (nm_probe.c) **/
+/*********************************************************/
+
+/* interval : intervalle (ms) des séries de mesures, 0 sans mesure */
+void
+nm_probe_init(unsigned int interval);
+
+/* Connexions <config>0, <config>1... (au plus max) de la mieux classée
+ * à la moins bien classée, dans order. Retourne leur nombre, 0 sans
+ * mesure. */
+unsigned int
+nm_probe_order(const char *config, unsigned int *order, unsigned int max);
+
+/* Ligne "ipsec_gw" de NET_STATUS, NULL sans mesure */
+const char *
+nm_probe_status(void);
+
+/*********************************************************/
+/** IPsec (nm_ipsec.c) **/
+/*********************************************************/
+
+/* stagger : intervalle (ms) entre les lancements concurrents des
+ * connexions d'une configuration, 0 pour les essayer l'une après
+ * l'autre */
+void
+nm_ipsec_init(unsigned int stagger);
+
+/* Mise à jour de l'état des tunnels, avec tentative d'établissement
+ * des connexions absentes ; nm_ipsec_changed() est appelée si la
+ * ligne d'état change */
+void
+nm_ipsec_update(void);
+
+/* Changement de route ou d'adresse : mise à jour immédiate, en
+ * abandonnant la tentative d'établissement en cours */
+void
+nm_ipsec_restart(void);
+
+/* Ligne "ipsec" de NET_STATUS */
+const char *
+nm_ipsec_status(void);
+
+#endif /* NETMONITOR_H */
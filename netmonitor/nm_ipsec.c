@@ -0,0 +1,961 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netmonitor - état des tunnels IPsec
+ *
+ *	Pour chaque configuration de NM_IPSEC_LIST (gw_update, gw_admin...),
+ *	l'état est lu dans la table des SA tenue par VICI (nm_vici.c), ou à
+ *	défaut extrait de "ipsec status", lancé une seule fois par mise à
+ *	jour pour toutes les configurations. Une configuration sans
+ *	SA établie est relancée par "ipsec up" sur ses connexions <config>0,
+ *	<config>1... de NM_IPSEC_CONF, jusqu'au premier succès. Les commandes
+ *	sont exécutées l'une après l'autre, sans bloquer la boucle.
+ *
+ *	Une SA dont l'adresse locale n'est plus portée par une interface
+ *	(bascule sur une autre interface ou une autre adresse) est traitée
+ *	comme absente, et relancée sans attendre la détection par DPD.
+ *
+ *	En mode course (option -r), les connexions <config><n> sont lancées
+ *	en parallèle, à g_stagger ms d'intervalle : une passerelle morte ne
+ *	coûte plus un délai IKE complet. En redondance "rr" (NM_IPSEC_MODES),
+ *	la première établie est retenue ; en "linear", une connexion établie
+ *	n'est retenue que lorsque toutes celles de rang inférieur ont échoué,
+ *	et cède la place à une connexion de rang inférieur établie après
+ *	elle. Les perdantes sont arrêtées par "ipsec down".
+ *
+ *	Avec les mesures des passerelles (option -p, nm_probe.c), les
+ *	connexions sont essayées, et classées en "linear", dans l'ordre de
+ *	leur score plutôt que dans celui de NM_IPSEC_CONF.
+ */
+
+#include "netmonitor.h"
+
+#include <ctype.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+
+#define NM_IPSEC_MAX	8
+#define NM_CONN_LEN	64
+/* connexions <config><n> mises en concurrence */
+#define NM_RACE_MAX	8
+/* "ipsec up" et "ipsec down" simultanés de la course : restent un
+ * emplacement pour "ipsec status" et un pour umts_config */
+#define NM_RACE_JOBS	(NM_MAX_JOBS - 2)
+
+/* "ipsec: <état>" doit tenir sur une ligne de NET_STATUS */
+#define NM_STATUS_LEN	(NETSTATUS_LINE_LEN - sizeof("ipsec: "))
+
+struct nm_conn {
+	char name[NM_CONN_LEN];
+	char state[NM_LEN];	/* vide : pas de SA établie */
+	unsigned int num;	/* rang de la connexion en cours d'essai */
+	unsigned int order[NM_RACE_MAX];	/* <name><n> par rang */
+	unsigned int norder;
+	int tried;
+	int rr;			/* redondance "rr", "linear" sinon */
+	unsigned int up;	/* <name><n> établies, bit n */
+	unsigned int esp;	/* <name><n> avec une CHILD_SA installée */
+};
+
+typedef enum {
+	NM_IPSEC_IDLE = 0,
+	NM_IPSEC_STATUS,
+	NM_IPSEC_UP,
+	NM_IPSEC_RACE,
+} nm_ipsec_phase_t;
+
+typedef enum {
+	NM_CAND_WAIT = 0,	/* pas encore lancée */
+	NM_CAND_RUNNING,	/* "ipsec up" en cours */
+	NM_CAND_DONE,		/* "ipsec up" terminé */
+	NM_CAND_DROPPED,	/* perdante, ou course interrompue */
+} nm_cand_state_t;
+
+/* Connexion <config><n> de la course en cours, de rang i dans g_cands */
+struct nm_cand {
+	nm_cand_state_t state;
+	struct nm_job up;
+	struct nm_job down;
+	int down_retry;		/* "ipsec down" à relancer */
+};
+
+static struct nm_conn g_conns[NM_IPSEC_MAX];
+static unsigned int g_nconns;
+
+static struct nm_job g_job;
+static nm_ipsec_phase_t g_phase;
+static int g_again;
+/* "ipsec up" interrompu par nm_ipsec_restart() */
+static int g_abort;
+/* configuration en cours d'établissement, g_nconns sinon */
+static unsigned int g_cur;
+
+static char g_status[NM_STATUS_LEN] = NM_NOIPSEC;
+
+/* course : intervalle entre deux lancements (ms), 0 sans course */
+static unsigned int g_stagger;
+static int g_race_timer = -1;
+static struct nm_cand g_cands[NM_RACE_MAX];
+static unsigned int g_ncands;
+static unsigned int g_launched;
+static int g_winner;		/* indice retenu, -1 sinon */
+static int g_checking;		/* relecture de l'état en cours */
+static int g_recheck;
+
+static void
+nm_ipsec_status_start(int sync);
+
+static void
+nm_ipsec_race_timer(int fd, uint32_t events, void *data);
+
+/* Lignes "<config> rr|linear" de NM_IPSEC_MODES, "linear" par défaut */
+static void
+nm_ipsec_read_modes(void)
+{
+	char line[NM_LEN], name[NM_CONN_LEN], mode[16];
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(NM_IPSEC_MODES, "re");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%63s %15s", name, mode) != 2)
+			continue;
+		for (i = 0; i < g_nconns; i++) {
+			if (!strcmp(g_conns[i].name, name))
+				g_conns[i].rr = !strcmp(mode, "rr");
+		}
+	}
+	(void)fclose(f);
+}
+
+void
+nm_ipsec_init(unsigned int stagger)
+{
+	char buf[NM_CONN_LEN * NM_IPSEC_MAX];
+	char *tok, *save;
+	FILE *f;
+	size_t len;
+
+	if (stagger) {
+		g_race_timer = timerfd_create(CLOCK_MONOTONIC,
+						TFD_CLOEXEC|TFD_NONBLOCK);
+		if (g_race_timer < 0)
+			ERROR_ERRNO("timerfd_create");
+		nm_watch(g_race_timer, nm_ipsec_race_timer, NULL);
+		g_stagger = stagger;
+	}
+
+	f = fopen(NM_IPSEC_LIST, "re");
+	if (!f) {
+		WARN_ERRNO("failed to open %s", NM_IPSEC_LIST);
+		return;
+	}
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	buf[len] = '\0';
+	(void)fclose(f);
+
+	for (tok = strtok_r(buf, " \t\n", &save); tok;
+				tok = strtok_r(NULL, " \t\n", &save)) {
+		if (g_nconns == NM_IPSEC_MAX) {
+			WARN("too many ipsec configurations, %s ignored", tok);
+			continue;
+		}
+		if (strlen(tok) >= NM_CONN_LEN) {
+			WARN("ipsec configuration name too long: %s", tok);
+			continue;
+		}
+		strcpy(g_conns[g_nconns++].name, tok);
+	}
+	g_cur = g_nconns;
+	nm_ipsec_read_modes();
+}
+
+const char *
+nm_ipsec_status(void)
+{
+	return g_status;
+}
+
+/* État "IKE[/ESP] [id] [src] [dst]", tronqué à la taille d'une ligne
+ * de NET_STATUS */
+static void
+nm_ipsec_set_state(struct nm_conn *c, int esp, const char *sa)
+{
+	snprintf(c->state, sizeof(c->state), "%s %.*s",
+			(esp) ? "IKE/ESP" : "IKE", NM_LEN - 16, sa);
+}
+
+/*********************************************************/
+/** Table VICI **/
+/*********************************************************/
+
+/* Bit de la connexion <config><n> dans nm_conn.up et .esp */
+static unsigned int
+nm_ipsec_bit(unsigned int n)
+{
+	return (n < 32) ? 1U << n : 0;
+}
+
+/* n si conn est une connexion <config><n>, -1 sinon */
+static int
+nm_ipsec_conn_num(const char *conn, const char *config)
+{
+	size_t len = strlen(config);
+	char *end;
+	unsigned long n;
+
+	if (strncmp(conn, config, len) || !isdigit((unsigned char)conn[len]))
+		return -1;
+	n = strtoul(conn + len, &end, 10);
+	return (*end || n > INT_MAX) ? -1 : (int)n;
+}
+
+static void
+nm_ipsec_table(void)
+{
+	char sa[3 * NM_LEN + 8];
+	const struct nm_sa *sas, *best;
+	struct nm_conn *c;
+	unsigned int i, j, n;
+	int num;
+
+	n = nm_vici_sas(&sas);
+	for (i = 0; i < g_nconns; i++) {
+		c = &g_conns[i];
+		c->state[0] = '\0';
+		c->up = c->esp = 0;
+		best = NULL;
+		for (j = 0; j < n; j++) {
+			num = nm_ipsec_conn_num(sas[j].name, c->name);
+			if (!sas[j].established || num < 0)
+				continue;
+			if (!nm_rtnl_is_local(sas[j].local)) {
+				LOG("%s: stale SA from %s", c->name, sas[j].local);
+				continue;
+			}
+			c->up |= nm_ipsec_bit((unsigned int)num);
+			if (sas[j].nchild)
+				c->esp |= nm_ipsec_bit((unsigned int)num);
+			/* de préférence une SA avec ses CHILD_SA */
+			if (!best || (!best->nchild && sas[j].nchild))
+				best = &sas[j];
+		}
+		if (!best)
+			continue;
+		snprintf(sa, sizeof(sa), "[%.*s] [%s] [%s]", NM_LEN - 1,
+				best->local_id, best->local, best->remote);
+		nm_ipsec_set_state(c, best->nchild != 0, sa);
+	}
+}
+
+/*********************************************************/
+/** Analyse de "ipsec status" **/
+/*********************************************************/
+
+/* "<config><n>[<m>]: " (open '[') ou "<config><n>{<m>}: " (open '{'),
+ * après des blancs. Retourne la suite de la ligne, ou NULL, et n. */
+static const char *
+nm_ipsec_match(const char *line, const char *config, char open, char close,
+							unsigned int *num)
+{
+	size_t len = strlen(config);
+	const char *ptr = line;
+
+	while (isspace((unsigned char)*ptr))
+		ptr++;
+	if (strncmp(ptr, config, len))
+		return NULL;
+	ptr += len;
+	if (!isdigit((unsigned char)*ptr))
+		return NULL;
+	*num = 0;
+	while (isdigit((unsigned char)*ptr)) {
+		if (*num < 1000)
+			*num = *num * 10 + (unsigned int)(*ptr - '0');
+		ptr++;
+	}
+	if (*ptr++ != open || !isdigit((unsigned char)*ptr))
+		return NULL;
+	while (isdigit((unsigned char)*ptr))
+		ptr++;
+	if (*ptr++ != close || *ptr++ != ':' || *ptr != ' ')
+		return NULL;
+	while (*ptr == ' ')
+		ptr++;
+	return ptr;
+}
+
+/* "ESTABLISHED <durée>, <src>[<id>]...<dst>[<id distant>]" */
+static int
+nm_ipsec_ike(const char *ptr, char *id, char *src, char *dst, size_t len)
+{
+	const char *s, *e;
+
+	if (strncmp(ptr, "ESTABLISHED", sizeof("ESTABLISHED") - 1))
+		return -1;
+	s = strchr(ptr, ',');
+	if (!s || s[1] != ' ')
+		return -1;
+	s += 2;
+	e = strchr(s, '[');
+	if (!e)
+		return -1;
+	snprintf(src, len, "%.*s", (int)(e - s), s);
+	s = e + 1;
+	e = strchr(s, ']');
+	if (!e || strncmp(e + 1, "...", 3))
+		return -1;
+	snprintf(id, len, "%.*s", (int)(e - s), s);
+	s = e + 4;
+	e = strrchr(s, '[');
+	if (!e)
+		return -1;
+	snprintf(dst, len, "%.*s", (int)(e - s), s);
+	return 0;
+}
+
+static void
+nm_ipsec_parse(char *out)
+{
+	char id[NM_LEN], src[NM_LEN], dst[NM_LEN];
+	char sa[NM_IPSEC_MAX][3 * NM_LEN + 8];
+	const char *ptr;
+	struct nm_conn *c;
+	char *line, *save;
+	unsigned int i, num;
+	int ike[NM_IPSEC_MAX] = { 0 }, esp[NM_IPSEC_MAX] = { 0 };
+
+	for (i = 0; i < g_nconns; i++) {
+		g_conns[i].state[0] = '\0';
+		g_conns[i].up = g_conns[i].esp = 0;
+	}
+
+	for (line = strtok_r(out, "\n", &save); line;
+				line = strtok_r(NULL, "\n", &save)) {
+		for (i = 0; i < g_nconns; i++) {
+			c = &g_conns[i];
+			ptr = nm_ipsec_match(line, c->name, '[', ']', &num);
+			if (ptr && !nm_ipsec_ike(ptr, id, src, dst,
+								sizeof(id))) {
+				if (!nm_rtnl_is_local(src)) {
+					LOG("%s: stale SA from %s", c->name, src);
+					continue;
+				}
+				c->up |= nm_ipsec_bit(num);
+				if (ike[i])
+					continue;
+				ike[i] = 1;
+				snprintf(sa[i], sizeof(sa[i]),
+					"[%s] [%s] [%s]", id, src, dst);
+				continue;
+			}
+			ptr = nm_ipsec_match(line, c->name, '{', '}', &num);
+			if (ptr && !strncmp(ptr, "INSTALLED, TUNNEL, ESP ",
+					sizeof("INSTALLED, TUNNEL, ESP ") - 1)) {
+				c->esp |= nm_ipsec_bit(num);
+				esp[i] = 1;
+			}
+		}
+	}
+
+	for (i = 0; i < g_nconns; i++) {
+		if (ike[i])
+			nm_ipsec_set_state(&g_conns[i], esp[i], sa[i]);
+	}
+}
+
+/*********************************************************/
+/** Mise à jour **/
+/*********************************************************/
+
+/* n de la connexion <name><n> de rang k */
+static unsigned int
+nm_ipsec_rank(const struct nm_conn *c, unsigned int k)
+{
+	return (k < c->norder) ? c->order[k] : k;
+}
+
+/* La connexion <name><num> est-elle définie dans NM_IPSEC_CONF ? */
+static int
+nm_ipsec_conn_exists(const struct nm_conn *c, unsigned int num)
+{
+	char line[NM_LEN], conn[NM_CONN_LEN + 16];
+	size_t len;
+	FILE *f;
+	int found = 0;
+
+	len = (size_t)snprintf(conn, sizeof(conn), "conn %s%u", c->name, num);
+	f = fopen(NM_IPSEC_CONF, "re");
+	if (!f)
+		return 0;
+	while (!found && fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, conn, len) && (isspace((unsigned char)line[len])
+							|| !line[len]))
+			found = 1;
+	}
+	(void)fclose(f);
+	return found;
+}
+
+static void
+nm_ipsec_finish(void)
+{
+	char status[NM_STATUS_LEN] = "";
+	const char *name;
+	size_t len = 0;
+	unsigned int i;
+	int led;
+
+	g_phase = NM_IPSEC_IDLE;
+	for (i = 0; i < g_nconns; i++) {
+		name = g_conns[i].name;
+		if (!strncmp(name, "gw_", 3))
+			name += 3;
+		/* un état trop long est tronqué, sans séparateur final */
+		len += (size_t)snprintf(status + len, sizeof(status) - len,
+			"%s%s:%s", (i) ? ";" : "", name,
+			(g_conns[i].state[0]) ? g_conns[i].state : NM_NOIPSEC);
+		if (len >= sizeof(status))
+			break;
+	}
+
+	led = open(NM_IPSEC_LED, O_WRONLY|O_CLOEXEC|O_NOCTTY);
+	if (led >= 0) {
+		if (write(led, (status[0]) ? "1\n" : "0\n", 2) != 2)
+			WARN_ERRNO("failed to write %s", NM_IPSEC_LED);
+		(void)close(led);
+	}
+
+	if (!status[0])
+		snprintf(status, sizeof(status), "%s", NM_NOIPSEC);
+	if (strcmp(status, g_status)) {
+		memcpy(g_status, status, sizeof(g_status));
+		nm_ipsec_changed();
+	}
+
+	if (g_again) {
+		g_again = 0;
+		nm_ipsec_update();
+	}
+}
+
+static void
+nm_ipsec_up_done(struct nm_job *job __attribute__((unused)))
+{
+	if (g_abort) {
+		g_abort = 0;
+		g_cur = g_nconns;
+		nm_ipsec_finish();
+		return;
+	}
+	nm_ipsec_status_start(1);
+}
+
+/*********************************************************/
+/** Course entre passerelles **/
+/*********************************************************/
+
+/* Nombre de connexions <name>0, <name>1... consécutives définies dans
+ * NM_IPSEC_CONF, au plus NM_RACE_MAX */
+static unsigned int
+nm_ipsec_conn_count(const struct nm_conn *c)
+{
+	unsigned int n;
+
+	for (n = 0; n < NM_RACE_MAX && nm_ipsec_conn_exists(c, n); n++)
+		;
+	return n;
+}
+
+static void
+nm_ipsec_race_arm(unsigned int ms)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = ms / 1000;
+	its.it_interval.tv_nsec = (long)(ms % 1000) * 1000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(g_race_timer, 0, &its, NULL))
+		WARN_ERRNO("timerfd_settime");
+}
+
+/* Commandes de la course en cours d'exécution */
+static unsigned int
+nm_ipsec_race_jobs(void)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < g_ncands; i++) {
+		n += nm_job_running(&g_cands[i].up);
+		n += nm_job_running(&g_cands[i].down);
+	}
+	return n;
+}
+
+static int
+nm_ipsec_race_retrying(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_ncands; i++) {
+		if (g_cands[i].down_retry)
+			return 1;
+	}
+	return 0;
+}
+
+static int
+nm_ipsec_race_busy(void)
+{
+	return g_checking || nm_ipsec_race_jobs() || nm_ipsec_race_retrying();
+}
+
+static void
+nm_ipsec_race_end(void)
+{
+	struct nm_conn *c = &g_conns[g_cur];
+
+	nm_ipsec_race_arm(0);
+	c->tried = 1;
+	if (g_winner >= 0)
+		LOG("ipsec connection %s%u successfully brought up", c->name,
+				nm_ipsec_rank(c, (unsigned int)g_winner));
+	else if (!g_abort)
+		WARN("failed to bring any %s ipsec connection", c->name);
+	g_cur = g_nconns;
+	if (g_abort) {
+		g_abort = 0;
+		nm_ipsec_finish();
+		return;
+	}
+	/* état relu une fois les perdantes arrêtées */
+	nm_ipsec_status_start(1);
+}
+
+static void
+nm_ipsec_race_check(void);
+
+static void
+nm_ipsec_race_job_done(struct nm_job *job);
+
+/* "ipsec down" de la connexion de rang i ; s'il ne peut être lancé,
+ * il l'est à nouveau à l'échéance suivante du minuteur de la course */
+static void
+nm_ipsec_race_down(unsigned int i)
+{
+	struct nm_cand *cand = &g_cands[i];
+	struct nm_conn *c = &g_conns[g_cur];
+	char conn[NM_CONN_LEN + 16];
+	const char *const argv[] = { NM_IPSEC, "down", conn, NULL };
+
+	cand->down_retry = 0;
+	if (nm_job_running(&cand->down))
+		return;
+	snprintf(conn, sizeof(conn), "%s%u", c->name, nm_ipsec_rank(c, i));
+	if (!nm_job_start(&cand->down, argv, 0, nm_ipsec_race_job_done))
+		return;
+	WARN("failed to tear down ipsec connection %s, will retry", conn);
+	cand->down_retry = 1;
+	nm_ipsec_race_arm(g_stagger);
+}
+
+/* Arrêt de la connexion de rang i, perdante */
+static void
+nm_ipsec_race_drop(unsigned int i)
+{
+	struct nm_cand *cand = &g_cands[i];
+	struct nm_conn *c = &g_conns[g_cur];
+	nm_cand_state_t state = cand->state;
+	unsigned int n = nm_ipsec_rank(c, i);
+
+	cand->state = NM_CAND_DROPPED;
+	if (state == NM_CAND_WAIT)
+		return;
+	if (state == NM_CAND_RUNNING)
+		(void)kill(cand->up.pid, SIGTERM);
+	else if (!(c->up & nm_ipsec_bit(n)))
+		return;
+	/* "ipsec up" interrompu : la négociation continue dans charon */
+	LOG("tearing down ipsec connection %s%u", c->name, n);
+	nm_ipsec_race_down(i);
+}
+
+/* Relance des "ipsec down" qui n'ont pu démarrer */
+static void
+nm_ipsec_race_retry(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_ncands; i++) {
+		if (g_cands[i].down_retry)
+			nm_ipsec_race_down(i);
+	}
+}
+
+/* Connexion de rang i établie, avec sa CHILD_SA ou une fois "ipsec up"
+ * terminé */
+static int
+nm_ipsec_race_ok(const struct nm_conn *c, unsigned int i)
+{
+	unsigned int bit = nm_ipsec_bit(nm_ipsec_rank(c, i));
+
+	if (g_cands[i].state == NM_CAND_DROPPED || !(c->up & bit))
+		return 0;
+	return (c->esp & bit) || g_cands[i].state == NM_CAND_DONE;
+}
+
+static void
+nm_ipsec_race_eval(void)
+{
+	struct nm_conn *c = &g_conns[g_cur];
+	unsigned int i;
+	int best = -1, pending = 0;
+
+	if (!g_abort) {
+		for (i = 0; i < g_ncands && best < 0; i++) {
+			if (nm_ipsec_race_ok(c, i))
+				best = (int)i;
+		}
+		/* rr : la première établie reste retenue ; linear : la
+		 * mieux classée */
+		if (!c->rr || g_winner < 0
+				|| !nm_ipsec_race_ok(c, (unsigned int)g_winner))
+			g_winner = best;
+		for (i = 0; g_winner >= 0 && i < g_ncands; i++) {
+			if ((int)i == g_winner
+					|| g_cands[i].state == NM_CAND_DROPPED)
+				continue;
+			if (c->rr || (int)i > g_winner)
+				nm_ipsec_race_drop(i);
+		}
+		for (i = 0; i < g_ncands; i++) {
+			if (g_cands[i].state == NM_CAND_WAIT
+					|| g_cands[i].state == NM_CAND_RUNNING)
+				pending = 1;
+		}
+	}
+	if (!pending && !nm_ipsec_race_busy())
+		nm_ipsec_race_end();
+}
+
+static void
+nm_ipsec_race_checked(void)
+{
+	g_checking = 0;
+	if (g_recheck) {
+		g_recheck = 0;
+		nm_ipsec_race_check();
+		return;
+	}
+	nm_ipsec_race_eval();
+}
+
+static void
+nm_ipsec_race_synced(int err)
+{
+	if (err) {
+		g_checking = 0;
+		nm_ipsec_race_check();
+		return;
+	}
+	nm_ipsec_table();
+	nm_ipsec_race_checked();
+}
+
+static void
+nm_ipsec_race_status_done(struct nm_job *job)
+{
+	nm_ipsec_parse(job->out);
+	nm_ipsec_race_checked();
+}
+
+/* Relecture de l'état, puis nouvelle évaluation de la course */
+static void
+nm_ipsec_race_check(void)
+{
+	const char *const argv[] = { NM_IPSEC, "status", NULL };
+
+	if (g_checking) {
+		g_recheck = 1;
+		return;
+	}
+	g_checking = 1;
+	if (!nm_vici_open() && !nm_vici_sync(nm_ipsec_race_synced))
+		return;
+	if (!nm_job_start(&g_job, argv, 1, nm_ipsec_race_status_done))
+		return;
+	g_checking = 0;
+	nm_ipsec_race_eval();
+}
+
+static void
+nm_ipsec_race_job_done(struct nm_job *job)
+{
+	unsigned int i;
+
+	/* un emplacement vient de se libérer */
+	nm_ipsec_race_retry();
+	for (i = 0; i < g_ncands; i++) {
+		if (job == &g_cands[i].down) {
+			nm_ipsec_race_eval();
+			return;
+		}
+		if (job != &g_cands[i].up)
+			continue;
+		if (!WIFEXITED(job->status) || WEXITSTATUS(job->status))
+			DBG("ipsec up %s%u failed", g_conns[g_cur].name,
+					nm_ipsec_rank(&g_conns[g_cur], i));
+		if (g_cands[i].state == NM_CAND_RUNNING)
+			g_cands[i].state = NM_CAND_DONE;
+	}
+	if (g_abort)
+		nm_ipsec_race_eval();
+	else
+		nm_ipsec_race_check();
+}
+
+/* Lancement de la prochaine connexion en attente */
+static void
+nm_ipsec_race_launch(void)
+{
+	struct nm_conn *c = &g_conns[g_cur];
+	char conn[NM_CONN_LEN + 16];
+	const char *const argv[] = { NM_IPSEC, "up", conn, NULL };
+	unsigned int i;
+
+	while (g_launched < g_ncands
+			&& g_cands[g_launched].state != NM_CAND_WAIT)
+		g_launched++;
+	if (g_launched == g_ncands) {
+		if (!nm_ipsec_race_retrying())
+			nm_ipsec_race_arm(0);
+		return;
+	}
+	/* pas d'emplacement libre : lancement à l'échéance suivante */
+	if (nm_ipsec_race_jobs() >= NM_RACE_JOBS) {
+		DBG("%u ipsec commands running, %s%u delayed",
+			nm_ipsec_race_jobs(), c->name, nm_ipsec_rank(c, g_launched));
+		return;
+	}
+	i = g_launched++;
+	snprintf(conn, sizeof(conn), "%s%u", c->name, nm_ipsec_rank(c, i));
+	LOG("trying to bring up ipsec connection %s", conn);
+	if (!nm_job_start(&g_cands[i].up, argv, 0, nm_ipsec_race_job_done)) {
+		g_cands[i].state = NM_CAND_RUNNING;
+		return;
+	}
+	g_cands[i].state = NM_CAND_DONE;
+	nm_ipsec_race_eval();
+}
+
+static void
+nm_ipsec_race_timer(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count))
+		return;
+	if (g_phase != NM_IPSEC_RACE)
+		return;
+	nm_ipsec_race_retry();
+	if (!g_abort)
+		nm_ipsec_race_launch();
+	else if (!nm_ipsec_race_retrying())
+		nm_ipsec_race_arm(0);
+}
+
+/* -1 si la configuration est établie connexion par connexion */
+static int
+nm_ipsec_race_start(struct nm_conn *c)
+{
+	unsigned int i, n;
+
+	if (!g_stagger)
+		return -1;
+	n = nm_ipsec_conn_count(c);
+	if (n < 2)
+		return -1;
+	for (i = 0; i < n; i++) {
+		g_cands[i].state = NM_CAND_WAIT;
+		g_cands[i].down_retry = 0;
+	}
+	g_ncands = n;
+	g_launched = 0;
+	g_winner = -1;
+	g_checking = g_recheck = 0;
+	g_phase = NM_IPSEC_RACE;
+	DBG("racing %u %s connections (%s)", n, c->name,
+					(c->rr) ? "rr" : "linear");
+	nm_ipsec_race_arm(g_stagger);
+	nm_ipsec_race_launch();
+	return 0;
+}
+
+/* Établissement de la prochaine configuration sans SA */
+static void
+nm_ipsec_setup_next(void)
+{
+	struct nm_conn *c;
+	char conn[NM_CONN_LEN + 16];
+
+	for (;;) {
+		if (g_cur == g_nconns) {
+			for (g_cur = 0; g_cur < g_nconns; g_cur++) {
+				c = &g_conns[g_cur];
+				if (!c->state[0] && !c->tried)
+					break;
+			}
+			if (g_cur == g_nconns) {
+				nm_ipsec_finish();
+				return;
+			}
+			c = &g_conns[g_cur];
+			c->num = 0;
+			c->norder = nm_probe_order(c->name, c->order,
+								NM_RACE_MAX);
+			if (!nm_ipsec_race_start(c))
+				return;
+		}
+		c = &g_conns[g_cur];
+		if (!nm_ipsec_conn_exists(c, nm_ipsec_rank(c, c->num))) {
+			WARN("failed to bring any %s ipsec connection", c->name);
+			c->tried = 1;
+			g_cur = g_nconns;
+			continue;
+		}
+
+		snprintf(conn, sizeof(conn), "%s%u", c->name,
+						nm_ipsec_rank(c, c->num));
+		LOG("trying to bring up ipsec connection %s", conn);
+		{
+			const char *const argv[] = { NM_IPSEC, "up", conn, NULL };
+
+			g_phase = NM_IPSEC_UP;
+			if (!nm_job_start(&g_job, argv, 0, nm_ipsec_up_done))
+				return;
+		}
+		c->tried = 1;
+		g_cur = g_nconns;
+	}
+}
+
+/* Suite de l'établissement, une fois l'état relu */
+static void
+nm_ipsec_status_next(void)
+{
+	struct nm_conn *c;
+
+	if (g_cur < g_nconns) {
+		c = &g_conns[g_cur];
+		if (c->state[0]) {
+			LOG("ipsec connection %s%u successfully brought up",
+					c->name, nm_ipsec_rank(c, c->num));
+			c->tried = 1;
+			g_cur = g_nconns;
+		} else {
+			c->num++;
+		}
+	}
+	nm_ipsec_setup_next();
+}
+
+static void
+nm_ipsec_status_done(struct nm_job *job)
+{
+	nm_ipsec_parse(job->out);
+	nm_ipsec_status_next();
+}
+
+static void
+nm_ipsec_status_job(void)
+{
+	const char *const argv[] = { NM_IPSEC, "status", NULL };
+
+	if (nm_job_start(&g_job, argv, 1, nm_ipsec_status_done)) {
+		g_cur = g_nconns;
+		nm_ipsec_finish();
+	}
+}
+
+static void
+nm_ipsec_sync_done(int err)
+{
+	if (err) {
+		nm_ipsec_status_job();
+		return;
+	}
+	nm_ipsec_table();
+	nm_ipsec_status_next();
+}
+
+/* Lecture de l'état ; sync : la table VICI est relue même à jour, pour
+ * voir le résultat d'un "ipsec up" */
+static void
+nm_ipsec_status_start(int sync)
+{
+	g_phase = NM_IPSEC_STATUS;
+	if (!nm_vici_open()) {
+		if (!sync && nm_vici_synced()) {
+			nm_ipsec_table();
+			nm_ipsec_status_next();
+			return;
+		}
+		if (!nm_vici_sync(nm_ipsec_sync_done))
+			return;
+	}
+	nm_ipsec_status_job();
+}
+
+void
+nm_ipsec_restart(void)
+{
+	unsigned int i;
+
+	g_again = 1;
+	if (g_phase == NM_IPSEC_UP && nm_job_running(&g_job) && !g_abort) {
+		g_abort = 1;
+		(void)kill(g_job.pid, SIGTERM);
+	}
+	if (g_phase == NM_IPSEC_RACE && !g_abort) {
+		g_abort = 1;
+		nm_ipsec_race_arm(0);
+		for (i = 0; i < g_ncands; i++) {
+			if (g_cands[i].state == NM_CAND_RUNNING)
+				(void)kill(g_cands[i].up.pid, SIGTERM);
+			if (g_cands[i].state != NM_CAND_DONE)
+				g_cands[i].state = NM_CAND_DROPPED;
+		}
+		nm_ipsec_race_eval();
+	}
+}
+
+void
+nm_ipsec_update(void)
+{
+	unsigned int i;
+
+	if (g_phase != NM_IPSEC_IDLE) {
+		g_again = 1;
+		/* course : une connexion a pu s'établir (événement VICI) */
+		if (g_phase == NM_IPSEC_RACE && !g_abort && !g_checking
+							&& nm_vici_synced()) {
+			nm_ipsec_table();
+			nm_ipsec_race_eval();
+		}
+		return;
+	}
+	if (!g_nconns) {
+		nm_ipsec_finish();
+		return;
+	}
+	for (i = 0; i < g_nconns; i++)
+		g_conns[i].tried = 0;
+	g_again = 0;
+	g_cur = g_nconns;
+	nm_ipsec_status_start(0);
+}
@@ -0,0 +1,634 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netmonitor - mesure des passerelles IPsec
+ *
+ *	Les passerelles sont les adresses "right=" des connexions de
+ *	NM_IPSEC_CONF. Toutes les g_interval ms, une série de mesures
+ *	envoie à chacune un écho ICMP et une requête IKE_SA_INIT de version
+ *	majeure 3, sans charge utile : le répondeur la rejette par une
+ *	notification INVALID_MAJOR_VERSION (RFC 7296, 2.5), sans créer
+ *	d'état. Une passerelle qui a déjà répondu en IKE est mesurée en IKE
+ *	(le démon répond), les autres en ICMP. Les réponses arrivées après
+ *	la série suivante sont perdues. La requête IKE part d'un port
+ *	éphémère, le port 500 étant celui de charon : ces mesures ne
+ *	passent que par les règles pass_ipsec_probe de lib/netfilter.
+ *
+ *	Score (ms) : RTT lissé divisé par la proportion de réponses, soit
+ *	le délai moyen d'un échange avec retransmissions. Une passerelle ne
+ *	passe devant une autre que si son score est meilleur de
+ *	NM_PROBE_HYST %, pour ne pas alterner sur des écarts de mesure.
+ *	Le classement ordonne les essais de nm_ipsec.c, et est écrit dans
+ *	NM_IPSEC_RANK pour l'ordre des connexions générées par init/ipsec.
+ *	Au lancement, avant les premières mesures, le classement est celui
+ *	de NM_IPSEC_RANK.
+ */
+
+#include "netmonitor.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#define NM_PROBE_GWS	16
+#define NM_PROBE_CONNS	32
+/* Intervalle minimal des séries (ms) */
+#define NM_PROBE_MIN	1000U
+/* Poids des nouvelles mesures : 1/8 pour le RTT, 1/4 pour les pertes */
+#define NM_PROBE_RTT_W	8
+#define NM_PROBE_LOSS_W	4
+/* Séries consécutives sans réponse au-delà desquelles une passerelle
+ * est injoignable */
+#define NM_PROBE_MISSED	3
+#define NM_PROBE_HYST	20
+/* Scores : jamais mesurée, injoignable (ms) */
+#define NM_PROBE_UNKNOWN UINT_MAX
+#define NM_PROBE_DEAD	60000U
+
+/* En-tête IKE (RFC 7296, 3.1) */
+#define NM_IKE_PORT	500
+#define NM_IKE_HDR	28
+#define NM_IKE_VERSION	0x30	/* 3.0, refusée par les répondeurs IKEv2 */
+#define NM_IKE_SA_INIT	34
+#define NM_IKE_INITIATOR 0x08
+#define NM_IKE_RESPONSE	0x20
+
+struct nm_gw {
+	struct in_addr addr;
+	char name[INET_ADDRSTRLEN];
+	unsigned int rounds;	/* séries terminées */
+	unsigned int missed;	/* séries consécutives sans réponse */
+	int ike;		/* a déjà répondu en IKE */
+	uint64_t sent;		/* envoi de la série courante (µs) */
+	uint64_t rtt_ike;	/* réponses de la série courante (µs), 0 sinon */
+	uint64_t rtt_icmp;
+	uint64_t srtt;		/* µs, 0 sans réponse */
+	unsigned int loss;	/* pour mille */
+	unsigned int score;
+};
+
+/* Connexion de NM_IPSEC_CONF et sa passerelle (indice, -1 sinon) */
+struct nm_probe_conn {
+	char name[NM_SA_NAME];
+	int gw;
+};
+
+static unsigned int g_interval;
+static struct nm_gw g_gws[NM_PROBE_GWS];
+static unsigned int g_ngws;
+static unsigned int g_rank[NM_PROBE_GWS];
+static struct nm_probe_conn g_pconns[NM_PROBE_CONNS];
+static unsigned int g_npconns;
+
+static int g_icmp = -1;
+static int g_icmp_raw;		/* socket brute, sans socket "ping" */
+static int g_ike = -1;
+static uint16_t g_seq;
+/* identifiant des sondes : 4 premiers octets du SPI, identifiant ICMP */
+static uint32_t g_cookie;
+
+static char g_status[NETSTATUS_LINE_LEN - sizeof("ipsec_gw: ")];
+
+static uint64_t
+nm_probe_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static struct nm_gw *
+nm_probe_find(struct in_addr addr)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_ngws; i++) {
+		if (g_gws[i].addr.s_addr == addr.s_addr)
+			return &g_gws[i];
+	}
+	return NULL;
+}
+
+/*********************************************************/
+/** Connexions et passerelles **/
+/*********************************************************/
+
+static int
+nm_probe_add_gw(const char *value)
+{
+	struct in_addr addr;
+	struct nm_gw *gw;
+
+	/* %any, %defaultroute, noms : pas de mesure */
+	if (inet_pton(AF_INET, value, &addr) != 1)
+		return -1;
+	gw = nm_probe_find(addr);
+	if (gw)
+		return (int)(gw - g_gws);
+	if (g_ngws == NM_PROBE_GWS) {
+		WARN("too many ipsec gateways, %s not probed", value);
+		return -1;
+	}
+	gw = &g_gws[g_ngws];
+	gw->addr = addr;
+	gw->score = NM_PROBE_UNKNOWN;
+	snprintf(gw->name, sizeof(gw->name), "%s", value);
+	g_rank[g_ngws] = g_ngws;
+	return (int)g_ngws++;
+}
+
+/* Sections "conn <nom>" et leur paramètre "right=" */
+static void
+nm_probe_read_conf(void)
+{
+	char line[NM_LEN], *ptr, *val;
+	struct nm_probe_conn *conn = NULL;
+	size_t len;
+	FILE *f;
+
+	f = fopen(NM_IPSEC_CONF, "re");
+	if (!f) {
+		WARN_ERRNO("failed to open %s", NM_IPSEC_CONF);
+		return;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "#\n")] = '\0';
+		ptr = line + strspn(line, " \t");
+		if (ptr == line) {
+			conn = NULL;
+			if (strncmp(line, "conn ", 5))
+				continue;
+			ptr = line + 5 + strspn(line + 5, " \t");
+			len = strcspn(ptr, " \t");
+			if (!len || len >= NM_SA_NAME
+					|| g_npconns == NM_PROBE_CONNS)
+				continue;
+			conn = &g_pconns[g_npconns++];
+			memcpy(conn->name, ptr, len);
+			conn->name[len] = '\0';
+			conn->gw = -1;
+			continue;
+		}
+		if (!conn || strncmp(ptr, "right", 5))
+			continue;
+		ptr += 5 + strspn(ptr + 5, " \t");
+		if (*ptr++ != '=')
+			continue;
+		val = ptr + strspn(ptr, " \t");
+		val[strcspn(val, " \t")] = '\0';
+		conn->gw = nm_probe_add_gw(val);
+	}
+	(void)fclose(f);
+}
+
+/* Classement de l'instance précédente */
+static void
+nm_probe_read_rank(void)
+{
+	char line[NM_LEN], addr[INET_ADDRSTRLEN];
+	struct in_addr in;
+	const struct nm_gw *gw;
+	unsigned int i, r = 0, idx;
+	FILE *f;
+
+	f = fopen(NM_IPSEC_RANK, "re");
+	if (!f)
+		return;
+	while (r < g_ngws && fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%15s", addr) != 1
+				|| inet_pton(AF_INET, addr, &in) != 1)
+			continue;
+		gw = nm_probe_find(in);
+		if (!gw)
+			continue;
+		idx = (unsigned int)(gw - g_gws);
+		for (i = r; i < g_ngws && g_rank[i] != idx; i++)
+			;
+		if (i == g_ngws)
+			continue;
+		g_rank[i] = g_rank[r];
+		g_rank[r++] = idx;
+	}
+	(void)fclose(f);
+}
+
+static const struct nm_probe_conn *
+nm_probe_conn(const char *config, unsigned int n)
+{
+	char name[NM_SA_NAME];
+	unsigned int i;
+
+	snprintf(name, sizeof(name), "%s%u", config, n);
+	for (i = 0; i < g_npconns; i++) {
+		if (!strcmp(g_pconns[i].name, name))
+			return &g_pconns[i];
+	}
+	return NULL;
+}
+
+unsigned int
+nm_probe_order(const char *config, unsigned int *order, unsigned int max)
+{
+	const struct nm_probe_conn *conn;
+	unsigned int i, n, r, k = 0;
+
+	if (!g_interval)
+		return 0;
+	for (n = 0; n < max && nm_probe_conn(config, n); n++)
+		;
+	for (r = 0; r < g_ngws; r++) {
+		for (i = 0; i < n; i++) {
+			conn = nm_probe_conn(config, i);
+			if (conn->gw == (int)g_rank[r])
+				order[k++] = i;
+		}
+	}
+	/* sans adresse IPv4 : ordre de la configuration */
+	for (i = 0; i < n; i++) {
+		if (nm_probe_conn(config, i)->gw < 0)
+			order[k++] = i;
+	}
+	return n;
+}
+
+const char *
+nm_probe_status(void)
+{
+	return (g_interval) ? g_status : NULL;
+}
+
+/*********************************************************/
+/** Classement **/
+/*********************************************************/
+
+static unsigned int
+nm_probe_score(const struct nm_gw *gw)
+{
+	uint64_t score;
+
+	if (!gw->rounds)
+		return NM_PROBE_UNKNOWN;
+	if (!gw->srtt || gw->missed >= NM_PROBE_MISSED)
+		return NM_PROBE_DEAD;
+	score = (gw->srtt * 1000 / (1000 - gw->loss) + 999) / 1000;
+	return (score < NM_PROBE_DEAD) ? (unsigned int)score : NM_PROBE_DEAD - 1;
+}
+
+/* a passe-t-elle devant b ? */
+static int
+nm_probe_better(const struct nm_gw *a, const struct nm_gw *b)
+{
+	if (a->score == NM_PROBE_UNKNOWN || b->score == NM_PROBE_UNKNOWN)
+		return b->score == NM_PROBE_UNKNOWN
+			&& a->score != NM_PROBE_UNKNOWN;
+	return (uint64_t)a->score * (100 + NM_PROBE_HYST)
+						< (uint64_t)b->score * 100;
+}
+
+/* Tri par insertion du classement précédent : 1 s'il a changé */
+static int
+nm_probe_sort(void)
+{
+	unsigned int i, j, tmp;
+	int changed = 0;
+
+	for (i = 1; i < g_ngws; i++) {
+		for (j = i; j > 0 && nm_probe_better(&g_gws[g_rank[j]],
+						&g_gws[g_rank[j - 1]]); j--) {
+			tmp = g_rank[j];
+			g_rank[j] = g_rank[j - 1];
+			g_rank[j - 1] = tmp;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+/* "<adresse> <score>" par passerelle, de la mieux classée à la moins
+ * bien classée, "-" si elle n'a pas été mesurée */
+static void
+nm_probe_write_rank(void)
+{
+	const struct nm_gw *gw;
+	unsigned int i;
+	FILE *f;
+
+	f = fopen(NM_IPSEC_RANK ".tmp", "we");
+	if (!f) {
+		WARN_ERRNO("failed to create %s.tmp", NM_IPSEC_RANK);
+		return;
+	}
+	for (i = 0; i < g_ngws; i++) {
+		gw = &g_gws[g_rank[i]];
+		if (gw->score == NM_PROBE_UNKNOWN)
+			fprintf(f, "%s -\n", gw->name);
+		else
+			fprintf(f, "%s %u\n", gw->name, gw->score);
+	}
+	if (fclose(f)) {
+		WARN_ERRNO("failed to write %s.tmp", NM_IPSEC_RANK);
+		(void)unlink(NM_IPSEC_RANK ".tmp");
+		return;
+	}
+	if (rename(NM_IPSEC_RANK ".tmp", NM_IPSEC_RANK))
+		WARN_ERRNO("failed to rename %s.tmp", NM_IPSEC_RANK);
+}
+
+/* "<adresse> <score> (<RTT> ms ; <pertes> %)" par passerelle, dans
+ * l'ordre du classement, tronqué à une ligne de NET_STATUS */
+static void
+nm_probe_format(char *buf, size_t len)
+{
+	const struct nm_gw *gw;
+	size_t off = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < g_ngws && off < len; i++) {
+		gw = &g_gws[g_rank[i]];
+		if (gw->score == NM_PROBE_UNKNOWN)
+			off += (size_t)snprintf(buf + off, len - off, "%s%s -",
+						(i) ? ", " : "", gw->name);
+		else if (gw->score == NM_PROBE_DEAD)
+			off += (size_t)snprintf(buf + off, len - off,
+					"%s%s injoignable", (i) ? ", " : "",
+					gw->name);
+		else
+			off += (size_t)snprintf(buf + off, len - off,
+					"%s%s %u (%u ms ; %u %%)",
+					(i) ? ", " : "", gw->name, gw->score,
+					(unsigned int)((gw->srtt + 500) / 1000),
+					(gw->loss + 5) / 10);
+	}
+}
+
+/* Fin de la série courante */
+static void
+nm_probe_collect(void)
+{
+	char status[sizeof(g_status)];
+	struct nm_gw *gw;
+	unsigned int i;
+	uint64_t rtt;
+
+	for (i = 0; i < g_ngws; i++) {
+		gw = &g_gws[i];
+		rtt = (gw->ike) ? gw->rtt_ike : gw->rtt_icmp;
+		gw->rounds++;
+		if (rtt) {
+			gw->missed = 0;
+			if (gw->srtt)
+				gw->srtt = gw->srtt - gw->srtt / NM_PROBE_RTT_W
+						+ rtt / NM_PROBE_RTT_W;
+			else
+				gw->srtt = rtt;
+			gw->loss -= gw->loss / NM_PROBE_LOSS_W;
+		} else {
+			gw->missed++;
+			gw->loss += (1000 - gw->loss) / NM_PROBE_LOSS_W;
+		}
+		gw->score = nm_probe_score(gw);
+		DBG("ipsec gateway %s: ike %llu us, icmp %llu us, "
+			"srtt %llu us, loss %u, score %u", gw->name,
+			(unsigned long long)gw->rtt_ike,
+			(unsigned long long)gw->rtt_icmp,
+			(unsigned long long)gw->srtt, gw->loss, gw->score);
+	}
+
+	if (nm_probe_sort()) {
+		LOG("ipsec gateways ranking: %s", g_gws[g_rank[0]].name);
+		nm_probe_write_rank();
+	} else if (g_seq == 1) {
+		nm_probe_write_rank();
+	}
+	nm_probe_format(status, sizeof(status));
+	if (strcmp(status, g_status)) {
+		memcpy(g_status, status, sizeof(g_status));
+		nm_probe_changed();
+	}
+}
+
+/*********************************************************/
+/** Sondes **/
+/*********************************************************/
+
+static uint16_t
+nm_probe_cksum(const void *data, size_t len)
+{
+	const uint8_t *ptr = data;
+	uint32_t sum = 0;
+
+	for (; len > 1; ptr += 2, len -= 2)
+		sum += (uint32_t)ptr[0] << 8 | ptr[1];
+	if (len)
+		sum += (uint32_t)ptr[0] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons((uint16_t)~sum);
+}
+
+/* SPI initiateur : cookie, indice de la passerelle, numéro de série */
+static void
+nm_probe_spi(uint8_t *spi, unsigned int i)
+{
+	uint32_t cookie = htonl(g_cookie);
+	uint16_t idx = htons((uint16_t)i), seq = htons(g_seq);
+
+	memcpy(spi, &cookie, 4);
+	memcpy(spi + 4, &idx, 2);
+	memcpy(spi + 6, &seq, 2);
+}
+
+static void
+nm_probe_send(unsigned int i)
+{
+	struct nm_gw *gw = &g_gws[i];
+	struct sockaddr_in sin;
+	struct icmphdr icmp;
+	uint8_t ike[NM_IKE_HDR];
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr = gw->addr;
+	gw->rtt_ike = gw->rtt_icmp = 0;
+	gw->sent = nm_probe_now();
+
+	if (g_icmp >= 0) {
+		memset(&icmp, 0, sizeof(icmp));
+		icmp.type = ICMP_ECHO;
+		/* remplacé par le noyau pour une socket "ping" */
+		icmp.un.echo.id = htons((uint16_t)g_cookie);
+		icmp.un.echo.sequence = htons(g_seq);
+		icmp.checksum = nm_probe_cksum(&icmp, sizeof(icmp));
+		if (sendto(g_icmp, &icmp, sizeof(icmp), 0,
+				(struct sockaddr *)&sin, sizeof(sin)) < 0)
+			DBG("icmp probe to %s: %s", gw->name, strerror(errno));
+	}
+
+	if (g_ike >= 0) {
+		memset(ike, 0, sizeof(ike));
+		nm_probe_spi(ike, i);
+		ike[17] = NM_IKE_VERSION;
+		ike[18] = NM_IKE_SA_INIT;
+		ike[19] = NM_IKE_INITIATOR;
+		ike[27] = NM_IKE_HDR;
+		sin.sin_port = htons(NM_IKE_PORT);
+		if (sendto(g_ike, ike, sizeof(ike), 0,
+				(struct sockaddr *)&sin, sizeof(sin)) < 0)
+			DBG("ike probe to %s: %s", gw->name, strerror(errno));
+	}
+}
+
+static void
+nm_probe_icmp_read(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	uint8_t buf[512];
+	const uint8_t *ptr;
+	struct icmphdr icmp;
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	struct nm_gw *gw;
+	ssize_t len;
+	size_t hlen;
+
+	while ((len = recvfrom(fd, buf, sizeof(buf), 0,
+				(struct sockaddr *)&sin, &slen)) > 0) {
+		ptr = buf;
+		/* socket brute : en-tête IP compris, tous les ICMP reçus */
+		if (g_icmp_raw) {
+			hlen = (size_t)(buf[0] & 0x0f) * 4;
+			if ((size_t)len < hlen + sizeof(icmp))
+				continue;
+			ptr += hlen;
+			len -= (ssize_t)hlen;
+		}
+		if ((size_t)len < sizeof(icmp))
+			continue;
+		memcpy(&icmp, ptr, sizeof(icmp));
+		if (icmp.type != ICMP_ECHOREPLY
+				|| ntohs(icmp.un.echo.sequence) != g_seq)
+			continue;
+		if (g_icmp_raw
+			&& ntohs(icmp.un.echo.id) != (uint16_t)g_cookie)
+			continue;
+		gw = nm_probe_find(sin.sin_addr);
+		if (gw && !gw->rtt_icmp)
+			gw->rtt_icmp = nm_probe_now() - gw->sent + 1;
+		slen = sizeof(sin);
+	}
+}
+
+static void
+nm_probe_ike_read(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	uint8_t buf[512], spi[8];
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+	struct nm_gw *gw;
+	ssize_t len;
+
+	while ((len = recvfrom(fd, buf, sizeof(buf), 0,
+				(struct sockaddr *)&sin, &slen)) > 0) {
+		slen = sizeof(sin);
+		/* toute réponse à la sonde de la série courante */
+		if (len < NM_IKE_HDR || !(buf[19] & NM_IKE_RESPONSE))
+			continue;
+		gw = nm_probe_find(sin.sin_addr);
+		if (!gw)
+			continue;
+		nm_probe_spi(spi, (unsigned int)(gw - g_gws));
+		if (memcmp(buf, spi, sizeof(spi)) || gw->rtt_ike)
+			continue;
+		gw->rtt_ike = nm_probe_now() - gw->sent + 1;
+		if (gw->ike)
+			continue;
+		/* RTT lissé jusque-là sur les échos ICMP */
+		DBG("ipsec gateway %s answers ike probes", gw->name);
+		gw->ike = 1;
+		gw->srtt = 0;
+	}
+}
+
+static void
+nm_probe_timer(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	uint64_t count;
+	unsigned int i;
+
+	if (read(fd, &count, sizeof(count)) != sizeof(count))
+		return;
+	if (g_seq)
+		nm_probe_collect();
+	if (++g_seq == 0)
+		g_seq = 1;
+	for (i = 0; i < g_ngws; i++)
+		nm_probe_send(i);
+}
+
+static void
+nm_probe_open(void)
+{
+	g_icmp = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK,
+							IPPROTO_ICMP);
+	if (g_icmp < 0) {
+		/* net.ipv4.ping_group_range n'inclut pas notre groupe */
+		g_icmp = socket(AF_INET, SOCK_RAW|SOCK_CLOEXEC|SOCK_NONBLOCK,
+							IPPROTO_ICMP);
+		g_icmp_raw = 1;
+	}
+	if (g_icmp < 0)
+		WARN_ERRNO("icmp socket, no icmp probes");
+	else
+		nm_watch(g_icmp, nm_probe_icmp_read, NULL);
+
+	g_ike = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK, 0);
+	if (g_ike < 0)
+		WARN_ERRNO("udp socket, no ike probes");
+	else
+		nm_watch(g_ike, nm_probe_ike_read, NULL);
+}
+
+void
+nm_probe_init(unsigned int interval)
+{
+	struct itimerspec its;
+	int fd;
+
+	if (!interval)
+		return;
+	nm_probe_read_conf();
+	if (!g_ngws) {
+		LOG("no ipsec gateway address to probe");
+		return;
+	}
+	nm_probe_read_rank();
+	if (interval < NM_PROBE_MIN)
+		interval = NM_PROBE_MIN;
+	g_interval = interval;
+	if (getrandom(&g_cookie, sizeof(g_cookie), GRND_NONBLOCK)
+						!= sizeof(g_cookie))
+		g_cookie = (uint32_t)getpid() ^ (uint32_t)nm_probe_now();
+	nm_probe_format(g_status, sizeof(g_status));
+	nm_probe_open();
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC|TFD_NONBLOCK);
+	if (fd < 0)
+		ERROR_ERRNO("timerfd_create");
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = interval / 1000;
+	its.it_interval.tv_nsec = (long)(interval % 1000) * 1000000;
+	/* première série sans attendre */
+	its.it_value.tv_nsec = 1000000;
+	if (timerfd_settime(fd, 0, &its, NULL))
+		ERROR_ERRNO("timerfd_settime");
+	nm_watch(fd, nm_probe_timer, NULL);
+}
@@ -0,0 +1,531 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netmonitor - vue rtnetlink du réseau
+ *
+ *	Les interfaces, adresses IPv4 et routes IPv4 par défaut sont lues
+ *	une fois au démarrage, puis maintenues à jour par les groupes
+ *	RTNLGRP_LINK, RTNLGRP_IPV4_IFADDR et RTNLGRP_IPV4_ROUTE, sans appel
+ *	à ip(8). Un changement de porteuse ou d'adresse des interfaces
+ *	surveillées (nm_iface et les interfaces eth*), ou de la route par
+ *	défaut, déclenche aussitôt une vérification et le rétablissement
+ *	des tunnels IPsec.
+ */
+
+#include "netmonitor.h"
+
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#define NM_NL_BUF	16384
+
+#define NM_MAX_LINKS	16
+#define NM_MAX_ADDRS	32
+#define NM_MAX_ROUTES	8
+
+/* Drapeaux dont le changement est signalé */
+#define NM_LINK_FLAGS	(IFF_UP|IFF_RUNNING|IFF_LOWER_UP)
+
+struct nm_link {
+	int index;		/* 0 : entrée libre */
+	unsigned int flags;
+	char name[IFNAMSIZ];
+};
+
+struct nm_addr {
+	int index;		/* 0 : entrée libre */
+	unsigned char prefixlen;
+	struct in_addr addr;
+};
+
+struct nm_route {
+	int oif;		/* 0 : entrée libre */
+	uint32_t metric;
+	struct in_addr gw;
+};
+
+static struct nm_link g_links[NM_MAX_LINKS];
+static struct nm_addr g_addrs[NM_MAX_ADDRS];
+static struct nm_route g_routes[NM_MAX_ROUTES];
+
+static int
+nm_rtnl_socket(unsigned int groups)
+{
+	struct sockaddr_nl addr;
+	int sock;
+
+	sock = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC|SOCK_NONBLOCK,
+								NETLINK_ROUTE);
+	if (sock < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = groups;
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		(void)close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/*********************************************************/
+/** Vue **/
+/*********************************************************/
+
+static struct nm_link *
+nm_rtnl_link_get(int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_LINKS; i++) {
+		if (g_links[i].index == index)
+			return &g_links[i];
+	}
+	return NULL;
+}
+
+static struct nm_link *
+nm_rtnl_link_by_name(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_LINKS; i++) {
+		if (g_links[i].index && !strcmp(g_links[i].name, name))
+			return &g_links[i];
+	}
+	return NULL;
+}
+
+/* Interface dont l'état est publié ou peut servir en secours */
+static int
+nm_rtnl_watched(int index)
+{
+	const struct nm_link *l = nm_rtnl_link_get(index);
+
+	return l && (!strcmp(l->name, nm_iface) || !strncmp(l->name, "eth", 3));
+}
+
+/* Adresses et routes d'une interface supprimée */
+static void
+nm_rtnl_link_forget(int index)
+{
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_ADDRS; i++) {
+		if (g_addrs[i].index == index)
+			memset(&g_addrs[i], 0, sizeof(g_addrs[i]));
+	}
+	for (i = 0; i < NM_MAX_ROUTES; i++) {
+		if (g_routes[i].oif == index)
+			memset(&g_routes[i], 0, sizeof(g_routes[i]));
+	}
+}
+
+static int
+nm_rtnl_link(const struct nlmsghdr *nh)
+{
+	const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	const struct rtattr *rta = IFLA_RTA(ifi);
+	int len = (int)IFLA_PAYLOAD(nh);
+	const char *name = NULL;
+	struct nm_link *l;
+	unsigned int old;
+	int watched;
+
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifi)) || !ifi->ifi_index)
+		return 0;
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFLA_IFNAME)
+			name = RTA_DATA(rta);
+	}
+
+	l = nm_rtnl_link_get(ifi->ifi_index);
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		if (!l)
+			return 0;
+		watched = nm_rtnl_watched(l->index);
+		if (watched)
+			LOG("%s: removed", l->name);
+		nm_rtnl_link_forget(l->index);
+		memset(l, 0, sizeof(*l));
+		return watched;
+	}
+
+	if (!l) {
+		l = nm_rtnl_link_get(0);
+		if (!l) {
+			WARN("too many interfaces, %d ignored", ifi->ifi_index);
+			return 0;
+		}
+		l->index = ifi->ifi_index;
+		l->flags = 0;
+	}
+	if (name)
+		snprintf(l->name, sizeof(l->name), "%s", name);
+
+	old = l->flags;
+	l->flags = ifi->ifi_flags;
+	/* les messages sans changement de drapeaux (statistiques,
+	 * événements sans fil) sont ignorés */
+	if (!nm_rtnl_watched(l->index)
+			|| !((old ^ l->flags) & NM_LINK_FLAGS))
+		return 0;
+	if ((old ^ l->flags) & IFF_LOWER_UP)
+		LOG("%s: carrier %s", l->name,
+				(l->flags & IFF_LOWER_UP) ? "up" : "down");
+	return 1;
+}
+
+static int
+nm_rtnl_addr(const struct nlmsghdr *nh)
+{
+	const struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	const struct rtattr *rta = IFA_RTA(ifa);
+	int len = (int)IFA_PAYLOAD(nh);
+	const struct in_addr *local = NULL, *addr = NULL;
+	struct nm_addr *a = NULL, *slot = NULL;
+	unsigned int i;
+
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*ifa))
+					|| ifa->ifa_family != AF_INET)
+		return 0;
+	for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == IFA_LOCAL)
+			local = RTA_DATA(rta);
+		else if (rta->rta_type == IFA_ADDRESS)
+			addr = RTA_DATA(rta);
+	}
+	/* IFA_ADDRESS est l'adresse distante des liens point à point */
+	if (local)
+		addr = local;
+	if (!addr)
+		return 0;
+
+	for (i = 0; i < NM_MAX_ADDRS; i++) {
+		a = &g_addrs[i];
+		if (!a->index) {
+			if (!slot)
+				slot = a;
+			continue;
+		}
+		if (a->index == (int)ifa->ifa_index
+				&& a->addr.s_addr == addr->s_addr
+				&& a->prefixlen == ifa->ifa_prefixlen)
+			break;
+	}
+	if (nh->nlmsg_type == RTM_DELADDR) {
+		if (i == NM_MAX_ADDRS)
+			return 0;
+		memset(a, 0, sizeof(*a));
+		return nm_rtnl_watched((int)ifa->ifa_index);
+	}
+	if (i < NM_MAX_ADDRS)
+		return 0;
+	if (!slot) {
+		WARN("too many addresses, %s ignored", inet_ntoa(*addr));
+		return 0;
+	}
+	slot->index = (int)ifa->ifa_index;
+	slot->addr = *addr;
+	slot->prefixlen = ifa->ifa_prefixlen;
+	return nm_rtnl_watched(slot->index);
+}
+
+/* Routes IPv4 par défaut de la table main, avec passerelle */
+static int
+nm_rtnl_route(const struct nlmsghdr *nh)
+{
+	const struct rtmsg *rtm = NLMSG_DATA(nh);
+	const struct rtattr *rta = RTM_RTA(rtm);
+	int alen = (int)RTM_PAYLOAD(nh);
+	unsigned int table = rtm->rtm_table;
+	const struct in_addr *gw = NULL;
+	struct nm_route *r = NULL, *slot = NULL;
+	uint32_t metric = 0;
+	unsigned int i;
+	int oif = 0;
+
+	if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(*rtm))
+			|| rtm->rtm_family != AF_INET || rtm->rtm_dst_len
+			|| rtm->rtm_type != RTN_UNICAST)
+		return 0;
+	for (; RTA_OK(rta, alen); rta = RTA_NEXT(rta, alen)) {
+		switch (rta->rta_type) {
+		case RTA_TABLE:
+			table = *(const uint32_t *)RTA_DATA(rta);
+			break;
+		case RTA_GATEWAY:
+			gw = RTA_DATA(rta);
+			break;
+		case RTA_OIF:
+			oif = *(const int *)RTA_DATA(rta);
+			break;
+		case RTA_PRIORITY:
+			metric = *(const uint32_t *)RTA_DATA(rta);
+			break;
+		}
+	}
+	if (table != RT_TABLE_MAIN || !gw || !oif)
+		return 0;
+
+	for (i = 0; i < NM_MAX_ROUTES; i++) {
+		r = &g_routes[i];
+		if (!r->oif) {
+			if (!slot)
+				slot = r;
+			continue;
+		}
+		if (r->oif == oif && r->gw.s_addr == gw->s_addr
+						&& r->metric == metric)
+			break;
+	}
+	if (nh->nlmsg_type == RTM_DELROUTE) {
+		if (i == NM_MAX_ROUTES)
+			return 0;
+		memset(r, 0, sizeof(*r));
+		LOG("default route via %s removed", inet_ntoa(*gw));
+		return 1;
+	}
+	if (i < NM_MAX_ROUTES)
+		return 0;
+	if (!slot) {
+		WARN("too many default routes, %s ignored", inet_ntoa(*gw));
+		return 0;
+	}
+	slot->oif = oif;
+	slot->gw = *gw;
+	slot->metric = metric;
+	LOG("default route via %s", inet_ntoa(*gw));
+	return 1;
+}
+
+/* Retourne 1 si le message modifie l'état surveillé */
+static int
+nm_rtnl_msg(const struct nlmsghdr *nh)
+{
+	switch (nh->nlmsg_type) {
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		return nm_rtnl_link(nh);
+	case RTM_NEWADDR:
+	case RTM_DELADDR:
+		return nm_rtnl_addr(nh);
+	case RTM_NEWROUTE:
+	case RTM_DELROUTE:
+		return nm_rtnl_route(nh);
+	default:
+		return 0;
+	}
+}
+
+/*********************************************************/
+/** Lecture initiale **/
+/*********************************************************/
+
+/* Requête de vidage (NLM_F_DUMP), réponses intégrées à la vue */
+static int
+nm_rtnl_dump(uint16_t type, unsigned char family)
+{
+	char buf[NM_NL_BUF] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct {
+		struct nlmsghdr nh;
+		struct rtgenmsg gen;
+	} req;
+	const struct nlmsghdr *nh;
+	int sock, ret = -1, done = 0;
+	struct pollfd pfd;
+	ssize_t rlen;
+
+	sock = nm_rtnl_socket(0);
+	if (sock < 0) {
+		WARN_ERRNO("rtnetlink socket");
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = sizeof(req);
+	req.nh.nlmsg_type = type;
+	req.nh.nlmsg_flags = NLM_F_REQUEST|NLM_F_DUMP;
+	req.nh.nlmsg_seq = 1;
+	req.gen.rtgen_family = family;
+	if (send(sock, &req, sizeof(req), 0) < 0) {
+		WARN_ERRNO("rtnetlink send");
+		goto out;
+	}
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	while (!done) {
+		rlen = recv(sock, buf, sizeof(buf), 0);
+		if (rlen < 0) {
+			if (errno == EINTR)
+				continue;
+			/* la réponse du noyau est immédiate */
+			if (errno == EAGAIN && poll(&pfd, 1, 1000) > 0)
+				continue;
+			WARN_ERRNO("rtnetlink recv");
+			goto out;
+		}
+		for (nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, rlen);
+						nh = NLMSG_NEXT(nh, rlen)) {
+			if (nh->nlmsg_type == NLMSG_DONE
+					|| nh->nlmsg_type == NLMSG_ERROR) {
+				done = 1;
+				break;
+			}
+			(void)nm_rtnl_msg(nh);
+		}
+	}
+	ret = 0;
+out:
+	(void)close(sock);
+	return ret;
+}
+
+/* Vue reconstruite en entier : démarrage, ou messages perdus */
+static void
+nm_rtnl_sync(void)
+{
+	memset(g_links, 0, sizeof(g_links));
+	memset(g_addrs, 0, sizeof(g_addrs));
+	memset(g_routes, 0, sizeof(g_routes));
+	if (nm_rtnl_dump(RTM_GETLINK, AF_UNSPEC)
+			|| nm_rtnl_dump(RTM_GETADDR, AF_INET)
+			|| nm_rtnl_dump(RTM_GETROUTE, AF_INET))
+		WARN("incomplete rtnetlink view");
+}
+
+/*********************************************************/
+/** Événements **/
+/*********************************************************/
+
+static void
+nm_rtnl_read(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	char buf[NM_NL_BUF] __attribute__((aligned(NLMSG_ALIGNTO)));
+	const struct nlmsghdr *nh;
+	int changed = 0;
+	ssize_t len;
+
+	for (;;) {
+		len = recv(fd, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			/* ENOBUFS : messages perdus, la vue est relue */
+			if (errno == ENOBUFS) {
+				WARN("rtnetlink overrun, resynchronizing");
+				nm_rtnl_sync();
+				changed = 1;
+				continue;
+			}
+			WARN_ERRNO("rtnetlink recv");
+			break;
+		}
+		for (nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, len);
+						nh = NLMSG_NEXT(nh, len)) {
+			if (nm_rtnl_msg(nh))
+				changed = 1;
+		}
+	}
+	/* les tunnels suivent la route par défaut : nouvelle tentative
+	 * sans attendre la fin d'un "ipsec up" en cours */
+	if (changed) {
+		nm_refresh();
+		nm_ipsec_restart();
+	}
+}
+
+void
+nm_rtnl_open(void)
+{
+	int sock = nm_rtnl_socket(RTMGRP_LINK|RTMGRP_IPV4_IFADDR|
+							RTMGRP_IPV4_ROUTE);
+
+	if (sock < 0)
+		ERROR_ERRNO("rtnetlink socket");
+	nm_watch(sock, nm_rtnl_read, NULL);
+	/* après l'abonnement : aucun changement n'est perdu entre les deux */
+	nm_rtnl_sync();
+}
+
+/*********************************************************/
+/** Consultation **/
+/*********************************************************/
+
+int
+nm_rtnl_carrier(void)
+{
+	const struct nm_link *l = nm_rtnl_link_by_name(nm_iface);
+
+	return (l && (l->flags & IFF_LOWER_UP)) ? 1 : 0;
+}
+
+int
+nm_rtnl_ifaddr(char *buf, size_t len)
+{
+	const struct nm_link *l = nm_rtnl_link_by_name(nm_iface);
+	char ip[INET_ADDRSTRLEN];
+	unsigned int i;
+
+	if (!l)
+		return -1;
+	for (i = 0; i < NM_MAX_ADDRS; i++) {
+		if (g_addrs[i].index != l->index)
+			continue;
+		inet_ntop(AF_INET, &g_addrs[i].addr, ip, sizeof(ip));
+		snprintf(buf, len, "%s/%u", ip, g_addrs[i].prefixlen);
+		return 0;
+	}
+	return -1;
+}
+
+/* Route par défaut de plus petite métrique, sur une interface active,
+ * de préférence avec porteuse */
+int
+nm_rtnl_default_gw(char *gw, size_t len)
+{
+	const struct nm_route *best = NULL;
+	const struct nm_link *l;
+	int carrier, best_carrier = 0;
+	unsigned int i;
+
+	for (i = 0; i < NM_MAX_ROUTES; i++) {
+		if (!g_routes[i].oif)
+			continue;
+		l = nm_rtnl_link_get(g_routes[i].oif);
+		if (!l || !(l->flags & IFF_UP))
+			continue;
+		carrier = (l->flags & IFF_LOWER_UP) ? 1 : 0;
+		if (!best || carrier > best_carrier || (carrier == best_carrier
+				&& g_routes[i].metric < best->metric)) {
+			best = &g_routes[i];
+			best_carrier = carrier;
+		}
+	}
+	if (!best)
+		return -1;
+	return inet_ntop(AF_INET, &best->gw, gw, (socklen_t)len) ? 0 : -1;
+}
+
+int
+nm_rtnl_is_local(const char *ip)
+{
+	struct in_addr addr;
+	unsigned int i;
+
+	if (inet_pton(AF_INET, ip, &addr) != 1)
+		return -1;
+	for (i = 0; i < NM_MAX_ADDRS; i++) {
+		if (g_addrs[i].index && g_addrs[i].addr.s_addr == addr.s_addr)
+			return 1;
+	}
+	return 0;
+}
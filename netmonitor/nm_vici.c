@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netmonitor - table des SA IKE tenue par VICI
+ *
+ *	Abonnement aux événements ike-updown et child-updown de charon sur
+ *	sa socket de contrôle NM_VICI : la table des IKE_SA (état, identité
+ *	locale, extrémités, CHILD_SA ESP installées) est tenue à jour sans
+ *	lancer de commande. Elle est relue en entier par list-sas à la
+ *	première utilisation, après un renouvellement de clés, et à la
+ *	demande (nm_vici_sync()).
+ *
+ *	Les requêtes sont émises sans attendre ; les réponses arrivent
+ *	dans l'ordre des requêtes, mêlées aux événements.
+ */
+
+#include "netmonitor.h"
+#include "nm_vici_msg.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define NM_VICI_PENDING	16
+
+typedef enum {
+	NM_VICI_REGISTER = 0,
+	NM_VICI_LIST,
+} nm_vici_req_t;
+
+static const char *const g_events[] = {
+	"ike-updown", "child-updown", "ike-rekey", "child-rekey", "list-sa",
+};
+
+static int g_fd = -1;
+static int g_warned;
+/* incrémenté à chaque fermeture : un rappel peut fermer la connexion,
+ * puis la rouvrir */
+static unsigned int g_gen;
+
+/* requêtes en attente de réponse, dans l'ordre d'émission */
+static nm_vici_req_t g_pending[NM_VICI_PENDING];
+static unsigned int g_npending;
+
+static struct vici_buf g_out;
+static uint8_t g_in[VICI_MSG_MAX + 4];
+static size_t g_inlen;
+
+/* table courante, et table en cours de relecture par list-sas */
+static struct nm_sa g_tables[2][NM_SA_MAX];
+static struct nm_sa *g_sas = g_tables[0], *g_list = g_tables[1];
+static unsigned int g_nsas, g_nlist;
+
+static int g_synced;
+static int g_listing;		/* list-sas en attente de réponse */
+static int g_relist;		/* nouvelle relecture à sa réponse */
+static nm_vici_done_t g_list_done, g_next_done;
+static int g_changed;
+
+/* IKE_SA décrite par un message */
+struct nm_vici_ike {
+	struct nm_sa sa;
+	int in_sa;
+	int up;				/* "up = yes" (événements updown) */
+	unsigned int nseen;		/* CHILD_SA du message */
+	unsigned int seen[NM_SA_CHILDREN];
+	/* CHILD_SA en cours d'analyse */
+	unsigned int child_id;
+	int child_ok;			/* 3 : INSTALLED, TUNNEL, ESP */
+};
+
+static void
+nm_vici_read(int fd, uint32_t events, void *data);
+
+/*********************************************************/
+/** Table **/
+/*********************************************************/
+
+static struct nm_sa *
+nm_vici_find(struct nm_sa *sas, unsigned int n, unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		if (sas[i].id == id)
+			return &sas[i];
+	}
+	return NULL;
+}
+
+static void
+nm_vici_put(struct nm_sa *sas, unsigned int *n, const struct nm_sa *sa)
+{
+	struct nm_sa *old = nm_vici_find(sas, *n, sa->id);
+
+	if (old) {
+		*old = *sa;
+		return;
+	}
+	if (*n == NM_SA_MAX) {
+		WARN("too many IKE SAs, %s ignored", sa->name);
+		return;
+	}
+	sas[(*n)++] = *sa;
+}
+
+static void
+nm_vici_del(struct nm_sa *sas, unsigned int *n, unsigned int id)
+{
+	struct nm_sa *sa = nm_vici_find(sas, *n, id);
+
+	if (sa)
+		*sa = sas[--(*n)];
+}
+
+static void
+nm_vici_child_add(struct nm_sa *sa, unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < sa->nchild; i++) {
+		if (sa->child[i] == id)
+			return;
+	}
+	if (sa->nchild < NM_SA_CHILDREN)
+		sa->child[sa->nchild++] = id;
+}
+
+static void
+nm_vici_child_del(struct nm_sa *sa, unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < sa->nchild; i++) {
+		if (sa->child[i] == id) {
+			sa->child[i] = sa->child[--sa->nchild];
+			return;
+		}
+	}
+}
+
+/* child-updown : seules les CHILD_SA du message changent */
+static void
+nm_vici_child_updown(struct nm_sa *sas, unsigned int *n,
+					const struct nm_vici_ike *ike)
+{
+	struct nm_sa *sa = nm_vici_find(sas, *n, ike->sa.id);
+	struct nm_sa tmp;
+	unsigned int i;
+
+	if (!sa) {
+		if (!ike->up)
+			return;
+		nm_vici_put(sas, n, &ike->sa);
+		return;
+	}
+	tmp = *sa;
+	*sa = ike->sa;
+	sa->nchild = tmp.nchild;
+	memcpy(sa->child, tmp.child, sizeof(sa->child));
+	for (i = 0; i < ike->nseen; i++) {
+		if (!ike->up)
+			nm_vici_child_del(sa, ike->seen[i]);
+	}
+	for (i = 0; ike->up && i < ike->sa.nchild; i++)
+		nm_vici_child_add(sa, ike->sa.child[i]);
+}
+
+/*********************************************************/
+/** Analyse des messages **/
+/*********************************************************/
+
+static void
+nm_vici_copy(char *dst, size_t len, const char *src)
+{
+	snprintf(dst, len, "%.*s", (int)len - 1, src);
+}
+
+static int
+nm_vici_ike_cb(void *data, uint8_t type, unsigned int depth,
+				const char *name, const char *value)
+{
+	struct nm_vici_ike *ike = data;
+	struct nm_sa *sa = &ike->sa;
+
+	switch (type) {
+	case VICI_SECTION_START:
+		if (depth == 0) {
+			/* une seule IKE_SA par message */
+			if (ike->in_sa)
+				return 1;
+			ike->in_sa = 1;
+			nm_vici_copy(sa->name, sizeof(sa->name), name);
+		} else if (depth == 2) {
+			ike->child_id = 0;
+			ike->child_ok = 0;
+		}
+		break;
+	case VICI_SECTION_END:
+		/* fin d'une CHILD_SA de child-sas */
+		if (depth == 2 && ike->child_id) {
+			if (ike->nseen < NM_SA_CHILDREN)
+				ike->seen[ike->nseen++] = ike->child_id;
+			if (ike->child_ok == 3)
+				nm_vici_child_add(sa, ike->child_id);
+		}
+		break;
+	case VICI_KEY_VALUE:
+		if (depth == 0) {
+			if (!strcmp(name, "up"))
+				ike->up = !strcmp(value, "yes");
+		} else if (depth == 1) {
+			if (!strcmp(name, "uniqueid"))
+				sa->id = (unsigned int)strtoul(value, NULL, 10);
+			else if (!strcmp(name, "state"))
+				sa->established = !strcmp(value, "ESTABLISHED");
+			else if (!strcmp(name, "local-host"))
+				nm_vici_copy(sa->local, sizeof(sa->local), value);
+			else if (!strcmp(name, "local-id"))
+				nm_vici_copy(sa->local_id, sizeof(sa->local_id),
+									value);
+			else if (!strcmp(name, "remote-host"))
+				nm_vici_copy(sa->remote, sizeof(sa->remote),
+									value);
+			else if (!strcmp(name, "remote-id"))
+				nm_vici_copy(sa->remote_id,
+						sizeof(sa->remote_id), value);
+		} else if (depth == 3) {
+			if (!strcmp(name, "uniqueid"))
+				ike->child_id = (unsigned int)
+						strtoul(value, NULL, 10);
+			else if ((!strcmp(name, "state")
+					&& !strcmp(value, "INSTALLED"))
+				|| (!strcmp(name, "mode")
+					&& !strcmp(value, "TUNNEL"))
+				|| (!strcmp(name, "protocol")
+					&& !strcmp(value, "ESP")))
+				ike->child_ok++;
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static int
+nm_vici_ike(const struct vici_packet *pkt, struct nm_vici_ike *ike)
+{
+	memset(ike, 0, sizeof(*ike));
+	if (vici_parse(pkt->msg, pkt->msg_len, nm_vici_ike_cb, ike)
+				|| !ike->in_sa || !ike->sa.id) {
+		WARN("invalid VICI %s event", pkt->name);
+		return -1;
+	}
+	return 0;
+}
+
+/*********************************************************/
+/** Connexion **/
+/*********************************************************/
+
+static int
+nm_vici_send(nm_vici_req_t req)
+{
+	ssize_t len = vici_end(&g_out);
+
+	if (len < 0 || g_npending == NM_VICI_PENDING) {
+		WARN("VICI request dropped");
+		return -1;
+	}
+	if (send(g_fd, g_out.data, (size_t)len, MSG_NOSIGNAL) != len) {
+		WARN_ERRNO("VICI send");
+		return -1;
+	}
+	g_pending[g_npending++] = req;
+	return 0;
+}
+
+static void
+nm_vici_close(void)
+{
+	nm_vici_done_t done = g_list_done, next = g_next_done;
+
+	nm_unwatch(g_fd);
+	(void)close(g_fd);
+	g_fd = -1;
+	g_gen++;
+	g_npending = g_inlen = 0;
+	g_nsas = g_nlist = 0;
+	g_synced = g_listing = g_relist = g_changed = 0;
+	g_list_done = g_next_done = NULL;
+	if (done)
+		done(-1);
+	if (next)
+		next(-1);
+}
+
+static int
+nm_vici_list(nm_vici_done_t done)
+{
+	vici_begin(&g_out, VICI_CMD_REQUEST, "list-sas");
+	/* sans attendre les IKE_SA en cours de négociation */
+	vici_kv(&g_out, "noblock", "yes");
+	if (nm_vici_send(NM_VICI_LIST))
+		return -1;
+	g_listing = 1;
+	g_nlist = 0;
+	g_list_done = done;
+	return 0;
+}
+
+int
+nm_vici_open(void)
+{
+	struct sockaddr_un sun;
+	unsigned int i;
+
+	if (g_fd >= 0)
+		return 0;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", NM_VICI);
+	g_fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (g_fd < 0) {
+		WARN_ERRNO("socket");
+		return -1;
+	}
+	if (connect(g_fd, (struct sockaddr *)&sun, sizeof(sun))) {
+		if (!g_warned) {
+			LOG("no VICI socket (%s), using ipsec status",
+							strerror(errno));
+			g_warned = 1;
+		}
+		(void)close(g_fd);
+		g_fd = -1;
+		return -1;
+	}
+	nm_watch(g_fd, nm_vici_read, NULL);
+
+	for (i = 0; i < sizeof(g_events) / sizeof(g_events[0]); i++) {
+		vici_begin(&g_out, VICI_EVENT_REGISTER, g_events[i]);
+		if (nm_vici_send(NM_VICI_REGISTER)) {
+			nm_vici_close();
+			return -1;
+		}
+	}
+	LOG("connected to %s", NM_VICI);
+	g_warned = 0;
+	return 0;
+}
+
+int
+nm_vici_synced(void)
+{
+	return g_fd >= 0 && g_synced;
+}
+
+int
+nm_vici_sync(nm_vici_done_t done)
+{
+	if (g_fd < 0)
+		return -1;
+	if (g_listing) {
+		/* la réponse attendue peut précéder des événements récents */
+		if (g_relist && g_next_done && done)
+			WARN("VICI sync already pending");
+		g_relist = 1;
+		if (done)
+			g_next_done = done;
+		return 0;
+	}
+	if (nm_vici_list(done)) {
+		nm_vici_close();
+		return -1;
+	}
+	return 0;
+}
+
+unsigned int
+nm_vici_sas(const struct nm_sa **sas)
+{
+	*sas = g_sas;
+	return g_nsas;
+}
+
+/*********************************************************/
+/** Réception **/
+/*********************************************************/
+
+static void
+nm_vici_event(const struct vici_packet *pkt)
+{
+	struct nm_vici_ike ike;
+
+	if (!strcmp(pkt->name, "list-sa")) {
+		if (g_listing && !nm_vici_ike(pkt, &ike))
+			nm_vici_put(g_list, &g_nlist, &ike.sa);
+		return;
+	}
+	if (!strcmp(pkt->name, "ike-rekey")
+			|| !strcmp(pkt->name, "child-rekey")) {
+		/* nouveaux uniqueid : relecture complète */
+		(void)nm_vici_sync(NULL);
+		return;
+	}
+	if (nm_vici_ike(pkt, &ike))
+		return;
+
+	if (!strcmp(pkt->name, "ike-updown")) {
+		DBG("IKE SA %s[%u] %s", ike.sa.name, ike.sa.id,
+						(ike.up) ? "up" : "down");
+		if (ike.up) {
+			nm_vici_put(g_sas, &g_nsas, &ike.sa);
+			if (g_listing)
+				nm_vici_put(g_list, &g_nlist, &ike.sa);
+		} else {
+			nm_vici_del(g_sas, &g_nsas, ike.sa.id);
+			if (g_listing)
+				nm_vici_del(g_list, &g_nlist, ike.sa.id);
+		}
+	} else if (!strcmp(pkt->name, "child-updown")) {
+		DBG("CHILD SA of %s[%u] %s", ike.sa.name, ike.sa.id,
+						(ike.up) ? "up" : "down");
+		nm_vici_child_updown(g_sas, &g_nsas, &ike);
+		if (g_listing)
+			nm_vici_child_updown(g_list, &g_nlist, &ike);
+	} else {
+		return;
+	}
+	g_changed = 1;
+}
+
+/* Réponse à la plus ancienne requête */
+static int
+nm_vici_reply(const struct vici_packet *pkt, nm_vici_done_t *done)
+{
+	nm_vici_req_t req;
+	struct nm_sa *tmp;
+
+	if (!g_npending) {
+		WARN("unexpected VICI reply");
+		return -1;
+	}
+	req = g_pending[0];
+	memmove(g_pending, g_pending + 1, --g_npending * sizeof(*g_pending));
+
+	switch (pkt->type) {
+	case VICI_EVENT_CONFIRM:
+		return (req == NM_VICI_REGISTER) ? 0 : -1;
+	case VICI_EVENT_UNKNOWN:
+		/* charon trop ancien pour les événements *-rekey */
+		if (req != NM_VICI_REGISTER)
+			return -1;
+		WARN("VICI event registration refused");
+		return 0;
+	case VICI_CMD_UNKNOWN:
+		WARN("VICI list-sas command unknown");
+		return -1;
+	case VICI_CMD_RESPONSE:
+		if (req != NM_VICI_LIST)
+			return -1;
+		break;
+	default:
+		return -1;
+	}
+
+	tmp = g_sas;
+	g_sas = g_list;
+	g_list = tmp;
+	g_nsas = g_nlist;
+	g_synced = 1;
+	g_listing = 0;
+	/* relecture interne : la table a pu changer sans événement */
+	if (!g_list_done)
+		g_changed = 1;
+	*done = g_list_done;
+	g_list_done = NULL;
+	if (g_relist) {
+		g_relist = 0;
+		if (nm_vici_list(g_next_done))
+			return -1;
+		g_next_done = NULL;
+	}
+	return 0;
+}
+
+static void
+nm_vici_read(int fd, uint32_t events __attribute__((unused)),
+					void *data __attribute__((unused)))
+{
+	struct vici_packet pkt;
+	nm_vici_done_t done;
+	unsigned int gen = g_gen;
+	ssize_t len;
+	size_t off = 0;
+	int err = 0;
+
+	len = recv(fd, g_in + g_inlen, sizeof(g_in) - g_inlen, MSG_DONTWAIT);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return;
+		WARN_ERRNO("VICI recv");
+		err = 1;
+	} else if (!len) {
+		LOG("VICI connection closed");
+		err = 1;
+	} else {
+		g_inlen += (size_t)len;
+	}
+
+	while (!err) {
+		len = vici_packet_len(g_in + off, g_inlen - off);
+		if (!len)
+			break;
+		if (len < 0 || vici_decode(g_in + off, (size_t)len, &pkt)) {
+			WARN("invalid VICI packet");
+			err = 1;
+			break;
+		}
+		off += (size_t)len;
+		if (pkt.type == VICI_EVENT) {
+			nm_vici_event(&pkt);
+			/* relecture après un rekey impossible : connexion
+			 * fermée */
+			if (g_gen != gen) {
+				nm_ipsec_update();
+				return;
+			}
+			continue;
+		}
+		done = NULL;
+		if (nm_vici_reply(&pkt, &done)) {
+			err = 1;
+			break;
+		}
+		if (done) {
+			done(0);
+			/* connexion fermée par le rappel, et peut-être déjà
+			 * rouverte : g_in ne contient plus ce qui a été lu */
+			if (g_gen != gen)
+				return;
+		}
+	}
+	memmove(g_in, g_in + off, g_inlen - off);
+	g_inlen -= off;
+
+	if (err) {
+		nm_vici_close();
+		nm_ipsec_update();
+		return;
+	}
+	if (g_changed) {
+		g_changed = 0;
+		nm_ipsec_update();
+	}
+}
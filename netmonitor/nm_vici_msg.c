@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	nm_vici_msg - paquets VICI
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "nm_vici_msg.h"
+
+/* Profondeur maximale des sections */
+#define VICI_DEPTH_MAX	16
+
+static int
+vici_named(uint8_t type)
+{
+	return type == VICI_CMD_REQUEST || type == VICI_EVENT_REGISTER
+		|| type == VICI_EVENT_UNREGISTER || type == VICI_EVENT;
+}
+
+/*********************************************************/
+/** Émission **/
+/*********************************************************/
+
+static void
+vici_put(struct vici_buf *b, const void *data, size_t len)
+{
+	if (b->err || len > sizeof(b->data) - b->len) {
+		b->err = 1;
+		return;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void
+vici_put_u8(struct vici_buf *b, uint8_t val)
+{
+	vici_put(b, &val, 1);
+}
+
+static void
+vici_put_name(struct vici_buf *b, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (len > 255) {
+		b->err = 1;
+		return;
+	}
+	vici_put_u8(b, (uint8_t)len);
+	vici_put(b, name, len);
+}
+
+void
+vici_begin(struct vici_buf *b, uint8_t type, const char *name)
+{
+	b->len = 4;
+	b->err = 0;
+	vici_put_u8(b, type);
+	if (vici_named(type))
+		vici_put_name(b, name);
+}
+
+void
+vici_section_start(struct vici_buf *b, const char *name)
+{
+	vici_put_u8(b, VICI_SECTION_START);
+	vici_put_name(b, name);
+}
+
+void
+vici_section_end(struct vici_buf *b)
+{
+	vici_put_u8(b, VICI_SECTION_END);
+}
+
+void
+vici_kv(struct vici_buf *b, const char *key, const char *value)
+{
+	size_t len = strlen(value);
+
+	if (len > 0xffff) {
+		b->err = 1;
+		return;
+	}
+	vici_put_u8(b, VICI_KEY_VALUE);
+	vici_put_name(b, key);
+	vici_put_u8(b, (uint8_t)(len >> 8));
+	vici_put_u8(b, (uint8_t)(len & 0xff));
+	vici_put(b, value, len);
+}
+
+ssize_t
+vici_end(struct vici_buf *b)
+{
+	size_t len = b->len - 4;
+
+	if (b->err)
+		return -1;
+	b->data[0] = (uint8_t)(len >> 24);
+	b->data[1] = (uint8_t)(len >> 16);
+	b->data[2] = (uint8_t)(len >> 8);
+	b->data[3] = (uint8_t)len;
+	return (ssize_t)b->len;
+}
+
+/*********************************************************/
+/** Réception **/
+/*********************************************************/
+
+/* Longueur du paquet en tête de data, longueur comprise : 0 s'il est
+ * incomplet, -1 si sa longueur est invalide */
+ssize_t
+vici_packet_len(const uint8_t *data, size_t len)
+{
+	uint32_t plen;
+
+	if (len < 4)
+		return 0;
+	plen = (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16
+		| (uint32_t)data[2] << 8 | data[3];
+	if (!plen || plen > VICI_MSG_MAX)
+		return -1;
+	return (plen + 4 <= len) ? (ssize_t)plen + 4 : 0;
+}
+
+int
+vici_decode(const uint8_t *data, size_t len, struct vici_packet *pkt)
+{
+	const uint8_t *p = data + 4, *end = data + len;
+	size_t nlen;
+
+	if (vici_packet_len(data, len) != (ssize_t)len)
+		return -1;
+	pkt->type = *p++;
+	pkt->name[0] = '\0';
+	if (vici_named(pkt->type)) {
+		if (p == end || (size_t)(end - p) < 1U + *p)
+			return -1;
+		nlen = *p++;
+		memcpy(pkt->name, p, nlen);
+		pkt->name[nlen] = '\0';
+		p += nlen;
+	}
+	pkt->msg = p;
+	pkt->msg_len = (size_t)(end - p);
+	return 0;
+}
+
+/* Nom (longueur sur un octet) en tête de *p */
+static int
+vici_get_name(const uint8_t **p, const uint8_t *end, char *name)
+{
+	size_t len;
+
+	if (*p == end || (size_t)(end - *p) < 1U + **p)
+		return -1;
+	len = *(*p)++;
+	memcpy(name, *p, len);
+	name[len] = '\0';
+	*p += len;
+	return 0;
+}
+
+/* Valeur (longueur sur deux octets) en tête de *p, tronquée */
+static int
+vici_get_value(const uint8_t **p, const uint8_t *end, char *value)
+{
+	size_t len;
+
+	if (end - *p < 2)
+		return -1;
+	len = (size_t)(*p)[0] << 8 | (*p)[1];
+	*p += 2;
+	if ((size_t)(end - *p) < len)
+		return -1;
+	snprintf(value, VICI_VALUE_MAX, "%.*s", (int)len,
+					(const char *)*p);
+	*p += len;
+	return 0;
+}
+
+int
+vici_parse(const uint8_t *msg, size_t len, vici_cb_t cb, void *data)
+{
+	const uint8_t *p = msg, *end = msg + len;
+	char name[256], value[VICI_VALUE_MAX];
+	unsigned int depth = 0;
+	int list = 0;
+	uint8_t type;
+
+	while (p < end) {
+		type = *p++;
+		name[0] = value[0] = '\0';
+		switch (type) {
+		case VICI_SECTION_START:
+			if (list || depth == VICI_DEPTH_MAX
+					|| vici_get_name(&p, end, name))
+				return -1;
+			if (cb(data, type, depth++, name, value))
+				return 0;
+			continue;
+		case VICI_SECTION_END:
+			if (list || !depth)
+				return -1;
+			depth--;
+			break;
+		case VICI_KEY_VALUE:
+			if (list || vici_get_name(&p, end, name)
+					|| vici_get_value(&p, end, value))
+				return -1;
+			break;
+		case VICI_LIST_START:
+			if (list || vici_get_name(&p, end, name))
+				return -1;
+			list = 1;
+			break;
+		case VICI_LIST_ITEM:
+			if (!list || vici_get_value(&p, end, value))
+				return -1;
+			break;
+		case VICI_LIST_END:
+			if (!list)
+				return -1;
+			list = 0;
+			break;
+		default:
+			return -1;
+		}
+		if (cb(data, type, depth, name, value))
+			return 0;
+	}
+	return (depth || list) ? -1 : 0;
+}
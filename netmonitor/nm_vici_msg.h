@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef NM_VICI_MSG_H
+#define NM_VICI_MSG_H
+
+/*
+ *	Codage et décodage des paquets VICI (socket de contrôle de charon).
+ *	Aucune dépendance autre que la libc : partagé par netmonitor et le
+ *	serveur VICI de test.
+ *
+ *	Paquet : longueur sur 4 octets gros-boutiste (type compris), type
+ *	sur un octet, nom (longueur sur un octet) pour les types nommés,
+ *	puis le message. Le message est une suite d'éléments : début de
+ *	section (nom), fin de section, clé-valeur (nom, valeur de longueur
+ *	sur 2 octets gros-boutiste), début de liste (nom), élément de liste
+ *	(valeur), fin de liste.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Taille maximale d'un paquet, longueur exclue */
+#define VICI_MSG_MAX		65536
+
+/* Types de paquet */
+#define VICI_CMD_REQUEST	0	/* nommé */
+#define VICI_CMD_RESPONSE	1
+#define VICI_CMD_UNKNOWN	2
+#define VICI_EVENT_REGISTER	3	/* nommé */
+#define VICI_EVENT_UNREGISTER	4	/* nommé */
+#define VICI_EVENT_CONFIRM	5
+#define VICI_EVENT_UNKNOWN	6
+#define VICI_EVENT		7	/* nommé */
+
+/* Éléments de message */
+#define VICI_SECTION_START	1
+#define VICI_SECTION_END	2
+#define VICI_KEY_VALUE		3
+#define VICI_LIST_START		4
+#define VICI_LIST_ITEM		5
+#define VICI_LIST_END		6
+
+/* Valeurs plus longues tronquées par vici_parse() */
+#define VICI_VALUE_MAX		256
+
+/* Paquet à émettre */
+struct vici_buf {
+	uint8_t data[VICI_MSG_MAX + 4];
+	size_t len;
+	int err;		/* débordement */
+};
+
+/* Paquet reçu ; msg pointe dans le paquet */
+struct vici_packet {
+	uint8_t type;
+	char name[256];		/* vide pour les types non nommés */
+	const uint8_t *msg;
+	size_t msg_len;
+};
+
+void
+vici_begin(struct vici_buf *b, uint8_t type, const char *name);
+
+void
+vici_section_start(struct vici_buf *b, const char *name);
+
+void
+vici_section_end(struct vici_buf *b);
+
+void
+vici_kv(struct vici_buf *b, const char *key, const char *value);
+
+/* Longueur du paquet à émettre, -1 s'il a débordé */
+ssize_t
+vici_end(struct vici_buf *b);
+
+ssize_t
+vici_packet_len(const uint8_t *data, size_t len);
+
+int
+vici_decode(const uint8_t *data, size_t len, struct vici_packet *pkt);
+
+/* Parcours d'un message : cb est appelée pour chaque élément, avec
+ * depth le nombre de sections ouvertes qui le contiennent, name vide
+ * pour les fins et les éléments de liste, value vide hors clé-valeur
+ * et élément de liste. Une valeur non nulle retournée par cb arrête
+ * le parcours. */
+typedef int (*vici_cb_t)(void *data, uint8_t type, unsigned int depth,
+				const char *name, const char *value);
+
+int
+vici_parse(const uint8_t *msg, size_t len, vici_cb_t cb, void *data);
+
+#endif /* NM_VICI_MSG_H */
@@ -0,0 +1,433 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netmonitor - état du lien sans fil
+ *
+ *	L'état du lien est lu par nl80211 en un seul aller-retour : les
+ *	requêtes GET_INTERFACE (SSID) et GET_STATION (point d'accès associé :
+ *	BSSID, signal, débits, débit attendu) sont envoyées ensemble, et
+ *	leurs réponses lues à la suite. La qualité est déduite du signal en
+ *	dBm, et ne dépend plus de l'échelle propre à chaque pilote.
+ *	Les pilotes sans cfg80211 sont interrogés par les ioctl Wireless
+ *	Extensions, comme iwconfig(8).
+ */
+
+#include "netmonitor.h"
+
+#include <poll.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/genetlink.h>
+#include <linux/netlink.h>
+#include <linux/nl80211.h>
+#include <linux/wireless.h>
+
+#define NM_GENL_BUF	32768
+#define NM_GENL_TIMEOUT	1000	/* ms */
+
+/* Signal (dBm) correspondant à 0 et 100 % de qualité */
+#define NM_SIGNAL_MIN	-100
+#define NM_SIGNAL_MAX	-50
+
+static int g_genl = -1;
+static uint16_t g_nl80211;
+/* famille nl80211 absente : Wireless Extensions seules */
+static int g_no_nl80211;
+static uint32_t g_seq;
+
+/*********************************************************/
+/** Netlink générique **/
+/*********************************************************/
+
+/* Requêtes envoyées ensemble, en un seul send(2) */
+struct nm_genl_req {
+	size_t len;
+	char buf[256] __attribute__((aligned(NLMSG_ALIGNTO)));
+};
+
+static struct nlmsghdr *
+nm_genl_add(struct nm_genl_req *req, uint16_t type, uint16_t flags,
+							uint8_t cmd)
+{
+	struct nlmsghdr *nh = (struct nlmsghdr *)(req->buf + req->len);
+	struct genlmsghdr *genl = NLMSG_DATA(nh);
+
+	memset(nh, 0, NLMSG_LENGTH(GENL_HDRLEN));
+	nh->nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+	nh->nlmsg_type = type;
+	nh->nlmsg_flags = NLM_F_REQUEST|flags;
+	nh->nlmsg_seq = ++g_seq;
+	genl->cmd = cmd;
+	genl->version = 1;
+	req->len += NLMSG_ALIGN(nh->nlmsg_len);
+	return nh;
+}
+
+/* Attribut ajouté au dernier message de req */
+static void
+nm_genl_put(struct nm_genl_req *req, struct nlmsghdr *nh, uint16_t type,
+					const void *data, uint16_t len)
+{
+	struct nlattr *nla = (struct nlattr *)(req->buf + req->len);
+
+	nla->nla_type = type;
+	nla->nla_len = (uint16_t)(NLA_HDRLEN + len);
+	memcpy((char *)nla + NLA_HDRLEN, data, len);
+	memset((char *)nla + nla->nla_len, 0,
+				NLA_ALIGN(nla->nla_len) - nla->nla_len);
+	nh->nlmsg_len += NLA_ALIGN(nla->nla_len);
+	req->len += NLA_ALIGN(nla->nla_len);
+}
+
+/* Attributs de data, indexés par type (max exclu) */
+static void
+nm_nla_parse(const struct nlattr **tb, unsigned int max, const void *data,
+								size_t len)
+{
+	const struct nlattr *nla = data;
+	uint16_t type;
+
+	memset(tb, 0, max * sizeof(*tb));
+	while (len >= NLA_HDRLEN && nla->nla_len >= NLA_HDRLEN
+					&& nla->nla_len <= len) {
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (type < max)
+			tb[type] = nla;
+		if ((size_t)NLA_ALIGN(nla->nla_len) >= len)
+			break;
+		len -= NLA_ALIGN(nla->nla_len);
+		nla = (const struct nlattr *)
+				((const char *)nla + NLA_ALIGN(nla->nla_len));
+	}
+}
+
+static const void *
+nm_nla_data(const struct nlattr *nla)
+{
+	return (const char *)nla + NLA_HDRLEN;
+}
+
+static size_t
+nm_nla_len(const struct nlattr *nla)
+{
+	return nla->nla_len - NLA_HDRLEN;
+}
+
+static uint32_t
+nm_nla_u32(const struct nlattr *nla)
+{
+	uint32_t val = 0;
+
+	if (nm_nla_len(nla) >= sizeof(val))
+		memcpy(&val, nm_nla_data(nla), sizeof(val));
+	return val;
+}
+
+static void
+nm_genl_attrs(const struct nlmsghdr *nh, const struct nlattr **tb,
+							unsigned int max)
+{
+	nm_nla_parse(tb, max, (const char *)NLMSG_DATA(nh) + GENL_HDRLEN,
+				nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN));
+}
+
+typedef void (*nm_genl_cb_t)(const struct nlmsghdr *nh, void *data);
+
+/* Réponses aux requêtes de numéros first à last : cb est appelée pour
+ * chaque message ; retourne -1 si l'une d'elles échoue */
+static int
+nm_genl_recv(uint32_t first, uint32_t last, nm_genl_cb_t cb, void *data)
+{
+	char buf[NM_GENL_BUF] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct pollfd pfd = { .fd = g_genl, .events = POLLIN };
+	const struct nlmsgerr *err;
+	const struct nlmsghdr *nh;
+	unsigned int pending = last - first + 1;
+	int ret = 0;
+	ssize_t len;
+
+	while (pending) {
+		switch (poll(&pfd, 1, NM_GENL_TIMEOUT)) {
+		case -1:
+			if (errno == EINTR)
+				continue;
+			return -1;
+		case 0:
+			errno = ETIMEDOUT;
+			return -1;
+		default:
+			break;
+		}
+		len = recv(g_genl, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		}
+		for (nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, len);
+						nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq < first || nh->nlmsg_seq > last)
+				continue;
+			if (nh->nlmsg_type == NLMSG_ERROR) {
+				err = NLMSG_DATA(nh);
+				if (err->error) {
+					errno = -err->error;
+					ret = -1;
+				}
+				pending--;
+			} else if (nh->nlmsg_type == NLMSG_DONE) {
+				pending--;
+			} else {
+				cb(nh, data);
+				/* réponse simple : ni DONE ni acquittement */
+				if (!(nh->nlmsg_flags & NLM_F_MULTI))
+					pending--;
+			}
+		}
+	}
+	return ret;
+}
+
+static void
+nm_genl_family_cb(const struct nlmsghdr *nh, void *data)
+{
+	const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+	uint16_t *id = data;
+
+	nm_genl_attrs(nh, tb, CTRL_ATTR_MAX + 1);
+	if (tb[CTRL_ATTR_FAMILY_ID] && nm_nla_len(tb[CTRL_ATTR_FAMILY_ID]) >= 2)
+		memcpy(id, nm_nla_data(tb[CTRL_ATTR_FAMILY_ID]), sizeof(*id));
+}
+
+static int
+nm_genl_open(void)
+{
+	struct sockaddr_nl addr;
+	struct nm_genl_req req = { .len = 0 };
+	struct nlmsghdr *nh;
+
+	g_genl = socket(AF_NETLINK, SOCK_RAW|SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (g_genl < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind(g_genl, (struct sockaddr *)&addr, sizeof(addr)))
+		goto err;
+
+	nh = nm_genl_add(&req, GENL_ID_CTRL, 0, CTRL_CMD_GETFAMILY);
+	nm_genl_put(&req, nh, CTRL_ATTR_FAMILY_NAME, NL80211_GENL_NAME,
+					sizeof(NL80211_GENL_NAME));
+	if (send(g_genl, req.buf, req.len, 0) < 0
+			|| nm_genl_recv(nh->nlmsg_seq, nh->nlmsg_seq,
+					nm_genl_family_cb, &g_nl80211)
+			|| !g_nl80211)
+		goto err;
+	return 0;
+
+err:
+	(void)close(g_genl);
+	g_genl = -1;
+	return -1;
+}
+
+/*********************************************************/
+/** nl80211 **/
+/*********************************************************/
+
+/* Débit d'un attribut NL80211_STA_INFO_*_BITRATE, en kb/s */
+static unsigned int
+nm_nl80211_rate(const struct nlattr *nla)
+{
+	const struct nlattr *tb[NL80211_RATE_INFO_MAX + 1];
+	uint16_t rate16;
+
+	nm_nla_parse(tb, NL80211_RATE_INFO_MAX + 1, nm_nla_data(nla),
+							nm_nla_len(nla));
+	if (tb[NL80211_RATE_INFO_BITRATE32])
+		return nm_nla_u32(tb[NL80211_RATE_INFO_BITRATE32]) * 100;
+	if (tb[NL80211_RATE_INFO_BITRATE]
+			&& nm_nla_len(tb[NL80211_RATE_INFO_BITRATE]) >= 2) {
+		memcpy(&rate16, nm_nla_data(tb[NL80211_RATE_INFO_BITRATE]),
+							sizeof(rate16));
+		return rate16 * 100U;
+	}
+	return 0;
+}
+
+static void
+nm_nl80211_cb(const struct nlmsghdr *nh, void *data)
+{
+	const struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	const struct nlattr *sta[NL80211_STA_INFO_MAX + 1];
+	const struct genlmsghdr *genl = NLMSG_DATA(nh);
+	const unsigned char *mac;
+	struct nm_wifi *wifi = data;
+	size_t len;
+
+	if (nh->nlmsg_len < NLMSG_LENGTH(GENL_HDRLEN))
+		return;
+	nm_genl_attrs(nh, tb, NL80211_ATTR_MAX + 1);
+
+	if (genl->cmd == NL80211_CMD_NEW_INTERFACE) {
+		if (!tb[NL80211_ATTR_SSID])
+			return;
+		len = nm_nla_len(tb[NL80211_ATTR_SSID]);
+		if (len >= sizeof(wifi->essid))
+			len = sizeof(wifi->essid) - 1;
+		memcpy(wifi->essid, nm_nla_data(tb[NL80211_ATTR_SSID]), len);
+		wifi->essid[len] = '\0';
+		return;
+	}
+
+	/* en mode station, la seule station est le point d'accès */
+	if (genl->cmd != NL80211_CMD_NEW_STATION || !tb[NL80211_ATTR_STA_INFO]
+						|| wifi->bssid[0])
+		return;
+	if (tb[NL80211_ATTR_MAC] && nm_nla_len(tb[NL80211_ATTR_MAC]) >= 6) {
+		mac = nm_nla_data(tb[NL80211_ATTR_MAC]);
+		snprintf(wifi->bssid, sizeof(wifi->bssid),
+				"%02x:%02x:%02x:%02x:%02x:%02x",
+				mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+	}
+	nm_nla_parse(sta, NL80211_STA_INFO_MAX + 1,
+			nm_nla_data(tb[NL80211_ATTR_STA_INFO]),
+			nm_nla_len(tb[NL80211_ATTR_STA_INFO]));
+	/* moyenne du pilote de préférence, moins bruitée */
+	if (sta[NL80211_STA_INFO_SIGNAL_AVG])
+		wifi->signal = *(const int8_t *)
+				nm_nla_data(sta[NL80211_STA_INFO_SIGNAL_AVG]);
+	else if (sta[NL80211_STA_INFO_SIGNAL])
+		wifi->signal = *(const int8_t *)
+				nm_nla_data(sta[NL80211_STA_INFO_SIGNAL]);
+	if (sta[NL80211_STA_INFO_TX_BITRATE])
+		wifi->tx_rate = nm_nl80211_rate(sta[NL80211_STA_INFO_TX_BITRATE]);
+	if (sta[NL80211_STA_INFO_RX_BITRATE])
+		wifi->rx_rate = nm_nl80211_rate(sta[NL80211_STA_INFO_RX_BITRATE]);
+	if (sta[NL80211_STA_INFO_EXPECTED_THROUGHPUT])
+		wifi->expected =
+			nm_nla_u32(sta[NL80211_STA_INFO_EXPECTED_THROUGHPUT]);
+}
+
+static int
+nm_nl80211_query(struct nm_wifi *wifi, uint32_t ifindex)
+{
+	struct nm_genl_req req = { .len = 0 };
+	struct nlmsghdr *nh;
+	uint32_t first;
+	int signal;
+
+	if (g_genl < 0 && nm_genl_open()) {
+		g_no_nl80211 = 1;
+		LOG("nl80211 unavailable, using wireless extensions");
+		return -1;
+	}
+
+	/* dump en dernier : le noyau traite les deux requêtes du même
+	 * envoi, puis répond au dump */
+	nh = nm_genl_add(&req, g_nl80211, 0, NL80211_CMD_GET_INTERFACE);
+	nm_genl_put(&req, nh, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+	first = nh->nlmsg_seq;
+	nh = nm_genl_add(&req, g_nl80211, NLM_F_DUMP, NL80211_CMD_GET_STATION);
+	nm_genl_put(&req, nh, NL80211_ATTR_IFINDEX, &ifindex, sizeof(ifindex));
+	if (send(g_genl, req.buf, req.len, 0) < 0
+			|| nm_genl_recv(first, nh->nlmsg_seq, nm_nl80211_cb, wifi))
+		return -1;
+	if (!wifi->bssid[0]) {
+		errno = ENOTCONN;
+		return -1;
+	}
+
+	/* signal inconnu : qualité nulle */
+	if (!wifi->signal)
+		return 0;
+	signal = wifi->signal;
+	if (signal < NM_SIGNAL_MIN)
+		signal = NM_SIGNAL_MIN;
+	if (signal > NM_SIGNAL_MAX)
+		signal = NM_SIGNAL_MAX;
+	wifi->quality = (unsigned int)(signal - NM_SIGNAL_MIN) * 100
+					/ (NM_SIGNAL_MAX - NM_SIGNAL_MIN);
+	return 0;
+}
+
+/*********************************************************/
+/** Wireless Extensions **/
+/*********************************************************/
+
+static int
+nm_wext_ioctl(int sock, unsigned long req, struct iwreq *iwr)
+{
+	strncpy(iwr->ifr_name, nm_iface, IFNAMSIZ - 1);
+	iwr->ifr_name[IFNAMSIZ - 1] = '\0';
+	return ioctl(sock, req, iwr);
+}
+
+static int
+nm_wext_query(struct nm_wifi *wifi)
+{
+	struct iw_statistics stats;
+	struct iw_range range;
+	struct iwreq iwr;
+	int sock, ret = -1;
+
+	sock = socket(AF_INET, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		WARN_ERRNO("socket");
+		return -1;
+	}
+
+	memset(&iwr, 0, sizeof(iwr));
+	iwr.u.data.pointer = &stats;
+	iwr.u.data.length = sizeof(stats);
+	iwr.u.data.flags = 1;	/* remise à zéro de qual.updated */
+	if (nm_wext_ioctl(sock, SIOCGIWSTATS, &iwr)
+			|| (stats.qual.updated & IW_QUAL_QUAL_INVALID))
+		goto out;
+
+	memset(&range, 0, sizeof(range));
+	memset(&iwr, 0, sizeof(iwr));
+	iwr.u.data.pointer = &range;
+	iwr.u.data.length = sizeof(range);
+	if (nm_wext_ioctl(sock, SIOCGIWRANGE, &iwr) || !range.max_qual.qual)
+		goto out;
+	wifi->quality = stats.qual.qual * 100U / range.max_qual.qual;
+	if (wifi->quality > 100)
+		wifi->quality = 100;
+
+	memset(&iwr, 0, sizeof(iwr));
+	iwr.u.essid.pointer = wifi->essid;
+	iwr.u.essid.length = sizeof(wifi->essid) - 1;
+	if (nm_wext_ioctl(sock, SIOCGIWESSID, &iwr))
+		goto out;
+	wifi->essid[sizeof(wifi->essid) - 1] = '\0';
+
+	memset(&iwr, 0, sizeof(iwr));
+	if (!nm_wext_ioctl(sock, SIOCGIWRATE, &iwr) && iwr.u.bitrate.value > 0)
+		wifi->tx_rate = (unsigned int)(iwr.u.bitrate.value / 1000);
+	ret = 0;
+out:
+	(void)close(sock);
+	return ret;
+}
+
+/* Retourne -1 si l'interface n'est pas associée */
+int
+nm_wifi_query(struct nm_wifi *wifi)
+{
+	unsigned int ifindex;
+
+	memset(wifi, 0, sizeof(*wifi));
+	if (!g_no_nl80211) {
+		ifindex = if_nametoindex(nm_iface);
+		if (!ifindex)
+			return -1;
+		if (!nm_nl80211_query(wifi, ifindex))
+			return 0;
+		/* sauf interface sans cfg80211 : pas d'association */
+		if (!g_no_nl80211 && errno != ENODEV && errno != EOPNOTSUPP)
+			return -1;
+		memset(wifi, 0, sizeof(*wifi));
+	}
+	return nm_wext_query(wifi);
+}
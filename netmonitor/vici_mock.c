@@ -0,0 +1,430 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	vici_mock - serveur VICI de test
+ *
+ *	Écoute sur une socket VICI (NM_VICI par défaut), accepte les
+ *	abonnements aux événements, répond à list-sas par des événements
+ *	list-sa suivis de la réponse, et refuse les autres commandes. La
+ *	table des IKE_SA est pilotée par des lignes lues sur l'entrée
+ *	standard, qui émettent les événements correspondants :
+ *
+ *	up <nom> <id> <local> <id local> <distant> [esp]
+ *		IKE_SA établie (ike-updown), avec une CHILD_SA ESP
+ *		installée (child-updown) si esp
+ *	child <id> up|down
+ *		CHILD_SA de l'IKE_SA <id> installée ou supprimée
+ *	rekey <id> <nouvel id>
+ *		renouvellement de l'IKE_SA (ike-rekey)
+ *	down <id>
+ *		IKE_SA supprimée (ike-updown)
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#include "netmonitor.h"
+#include "nm_vici_msg.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MOCK_CLIENTS	8
+#define MOCK_SAS	32
+
+struct mock_sa {
+	char name[NM_SA_NAME];
+	unsigned int id;
+	int esp;
+	char local[NM_SA_HOST];
+	char local_id[NM_LEN];
+	char remote[NM_SA_HOST];
+};
+
+struct mock_client {
+	int fd;				/* -1 : libre */
+	unsigned int events;		/* abonnements, par indice */
+	uint8_t in[VICI_MSG_MAX + 4];
+	size_t len;
+};
+
+static const char *const mock_events[] = {
+	"ike-updown", "child-updown", "ike-rekey", "child-rekey", "list-sa",
+};
+#define MOCK_NEVENTS	(sizeof(mock_events) / sizeof(mock_events[0]))
+
+static struct mock_client g_clients[MOCK_CLIENTS];
+static struct mock_sa g_sas[MOCK_SAS];
+static unsigned int g_nsas;
+static struct vici_buf g_out;
+
+static char g_line[NM_LEN * 2];
+static size_t g_linelen;
+
+static void
+mock_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s socket]\n", prog);
+	exit(EINVAL);
+}
+
+static int
+mock_event_index(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < MOCK_NEVENTS; i++) {
+		if (!strcmp(name, mock_events[i]))
+			return (int)i;
+	}
+	return -1;
+}
+
+/*********************************************************/
+/** Émission **/
+/*********************************************************/
+
+static void
+mock_drop(struct mock_client *cl)
+{
+	(void)close(cl->fd);
+	cl->fd = -1;
+	LOG("client disconnected");
+}
+
+static void
+mock_send(struct mock_client *cl)
+{
+	ssize_t len = vici_end(&g_out);
+
+	if (len < 0) {
+		WARN("packet too large");
+		return;
+	}
+	if (send(cl->fd, g_out.data, (size_t)len, MSG_NOSIGNAL) != len) {
+		WARN_ERRNO("send");
+		mock_drop(cl);
+	}
+}
+
+/* Message list-sa / ike-updown / child-updown décrivant sa */
+static void
+mock_sa_msg(const struct mock_sa *sa, int child)
+{
+	char buf[NM_SA_NAME + 16];
+
+	vici_section_start(&g_out, sa->name);
+	snprintf(buf, sizeof(buf), "%u", sa->id);
+	vici_kv(&g_out, "uniqueid", buf);
+	vici_kv(&g_out, "version", "2");
+	vici_kv(&g_out, "state", "ESTABLISHED");
+	vici_kv(&g_out, "local-host", sa->local);
+	vici_kv(&g_out, "local-port", "4500");
+	vici_kv(&g_out, "local-id", sa->local_id);
+	vici_kv(&g_out, "remote-host", sa->remote);
+	vici_kv(&g_out, "remote-port", "4500");
+	vici_kv(&g_out, "remote-id", sa->remote);
+	vici_section_start(&g_out, "child-sas");
+	if (child) {
+		snprintf(buf, sizeof(buf), "%.*s-%u", NM_SA_NAME - 1,
+						sa->name, sa->id + 1000);
+		vici_section_start(&g_out, buf);
+		vici_kv(&g_out, "name", sa->name);
+		snprintf(buf, sizeof(buf), "%u", sa->id + 1000);
+		vici_kv(&g_out, "uniqueid", buf);
+		vici_kv(&g_out, "state", "INSTALLED");
+		vici_kv(&g_out, "mode", "TUNNEL");
+		vici_kv(&g_out, "protocol", "ESP");
+		vici_section_end(&g_out);
+	}
+	vici_section_end(&g_out);
+	vici_section_end(&g_out);
+}
+
+static void
+mock_broadcast(const char *event, const struct mock_sa *sa, int up,
+								int child)
+{
+	unsigned int i;
+	int idx = mock_event_index(event);
+
+	LOG("%s %s[%u] %s", event, sa->name, sa->id, (up) ? "up" : "down");
+	for (i = 0; i < MOCK_CLIENTS; i++) {
+		if (g_clients[i].fd < 0 || !(g_clients[i].events & 1U << idx))
+			continue;
+		vici_begin(&g_out, VICI_EVENT, event);
+		if (up)
+			vici_kv(&g_out, "up", "yes");
+		mock_sa_msg(sa, child);
+		mock_send(&g_clients[i]);
+	}
+}
+
+/*********************************************************/
+/** Requêtes des clients **/
+/*********************************************************/
+
+static void
+mock_request(struct mock_client *cl, const struct vici_packet *pkt)
+{
+	unsigned int i;
+	int idx;
+
+	switch (pkt->type) {
+	case VICI_EVENT_REGISTER:
+	case VICI_EVENT_UNREGISTER:
+		idx = mock_event_index(pkt->name);
+		if (idx < 0) {
+			vici_begin(&g_out, VICI_EVENT_UNKNOWN, NULL);
+			break;
+		}
+		if (pkt->type == VICI_EVENT_REGISTER)
+			cl->events |= 1U << idx;
+		else
+			cl->events &= ~(1U << idx);
+		vici_begin(&g_out, VICI_EVENT_CONFIRM, NULL);
+		break;
+	case VICI_CMD_REQUEST:
+		if (strcmp(pkt->name, "list-sas")) {
+			vici_begin(&g_out, VICI_CMD_UNKNOWN, NULL);
+			break;
+		}
+		idx = mock_event_index("list-sa");
+		for (i = 0; i < g_nsas && (cl->events & 1U << idx); i++) {
+			vici_begin(&g_out, VICI_EVENT, "list-sa");
+			mock_sa_msg(&g_sas[i], g_sas[i].esp);
+			mock_send(cl);
+			if (cl->fd < 0)
+				return;
+		}
+		vici_begin(&g_out, VICI_CMD_RESPONSE, NULL);
+		break;
+	default:
+		WARN("unexpected packet type %u", pkt->type);
+		mock_drop(cl);
+		return;
+	}
+	mock_send(cl);
+}
+
+static void
+mock_read(struct mock_client *cl)
+{
+	struct vici_packet pkt;
+	ssize_t len;
+	size_t off = 0;
+
+	len = recv(cl->fd, cl->in + cl->len, sizeof(cl->in) - cl->len, 0);
+	if (len <= 0) {
+		mock_drop(cl);
+		return;
+	}
+	cl->len += (size_t)len;
+	while (cl->fd >= 0) {
+		len = vici_packet_len(cl->in + off, cl->len - off);
+		if (!len)
+			break;
+		if (len < 0 || vici_decode(cl->in + off, (size_t)len, &pkt)) {
+			WARN("invalid packet");
+			mock_drop(cl);
+			return;
+		}
+		off += (size_t)len;
+		mock_request(cl, &pkt);
+	}
+	if (cl->fd < 0)
+		return;
+	memmove(cl->in, cl->in + off, cl->len - off);
+	cl->len -= off;
+}
+
+/*********************************************************/
+/** Commandes de l'entrée standard **/
+/*********************************************************/
+
+static struct mock_sa *
+mock_find(unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_nsas; i++) {
+		if (g_sas[i].id == id)
+			return &g_sas[i];
+	}
+	return NULL;
+}
+
+static void
+mock_command(char *line)
+{
+	char *argv[8], *save;
+	struct mock_sa *sa, old;
+	unsigned int argc = 0;
+
+	for (argv[0] = strtok_r(line, " \t\n", &save); argv[argc] && argc < 7;
+				argv[++argc] = strtok_r(NULL, " \t\n", &save))
+		;
+	if (!argc)
+		return;
+
+	if (!strcmp(argv[0], "up") && argc >= 6) {
+		if (g_nsas == MOCK_SAS || mock_find((unsigned int)atoi(argv[2]))) {
+			WARN("cannot add SA %s", argv[2]);
+			return;
+		}
+		sa = &g_sas[g_nsas++];
+		memset(sa, 0, sizeof(*sa));
+		snprintf(sa->name, sizeof(sa->name), "%s", argv[1]);
+		sa->id = (unsigned int)atoi(argv[2]);
+		snprintf(sa->local, sizeof(sa->local), "%s", argv[3]);
+		snprintf(sa->local_id, sizeof(sa->local_id), "%s", argv[4]);
+		snprintf(sa->remote, sizeof(sa->remote), "%s", argv[5]);
+		sa->esp = (argc > 6 && !strcmp(argv[6], "esp"));
+		mock_broadcast("ike-updown", sa, 1, 0);
+		if (sa->esp)
+			mock_broadcast("child-updown", sa, 1, 1);
+		return;
+	}
+
+	sa = (argc >= 2) ? mock_find((unsigned int)atoi(argv[1])) : NULL;
+	if (!sa) {
+		WARN("unknown command or SA: %s", argv[0]);
+		return;
+	}
+	if (!strcmp(argv[0], "child") && argc >= 3) {
+		sa->esp = !strcmp(argv[2], "up");
+		mock_broadcast("child-updown", sa, sa->esp, 1);
+	} else if (!strcmp(argv[0], "rekey") && argc >= 3) {
+		old = *sa;
+		sa->id = (unsigned int)atoi(argv[2]);
+		mock_broadcast("ike-rekey", &old, 1, old.esp);
+	} else if (!strcmp(argv[0], "down")) {
+		old = *sa;
+		*sa = g_sas[--g_nsas];
+		if (old.esp)
+			mock_broadcast("child-updown", &old, 0, 1);
+		mock_broadcast("ike-updown", &old, 0, 0);
+	} else {
+		WARN("unknown command: %s", argv[0]);
+	}
+}
+
+/* Lignes lues sur l'entrée standard ; -1 à sa fermeture */
+static int
+mock_stdin(void)
+{
+	ssize_t len;
+	char *nl;
+
+	len = read(STDIN_FILENO, g_line + g_linelen,
+					sizeof(g_line) - 1 - g_linelen);
+	if (len <= 0)
+		return (len < 0 && errno == EINTR) ? 0 : -1;
+	g_linelen += (size_t)len;
+	g_line[g_linelen] = '\0';
+	while ((nl = strchr(g_line, '\n'))) {
+		*nl++ = '\0';
+		mock_command(g_line);
+		g_linelen -= (size_t)(nl - g_line);
+		memmove(g_line, nl, g_linelen + 1);
+	}
+	if (g_linelen == sizeof(g_line) - 1) {
+		WARN("command line too long");
+		g_linelen = 0;
+	}
+	return 0;
+}
+
+/*********************************************************/
+/** Boucle **/
+/*********************************************************/
+
+static void
+mock_loop(int lfd)
+{
+	struct pollfd pfds[MOCK_CLIENTS + 2];
+	unsigned int i, n;
+	int fd, in = 1;
+
+	for (;;) {
+		pfds[0].fd = lfd;
+		pfds[0].events = POLLIN;
+		/* entrée standard ignorée après sa fermeture */
+		pfds[1].fd = (in) ? STDIN_FILENO : -1;
+		pfds[1].events = POLLIN;
+		for (i = 0; i < MOCK_CLIENTS; i++) {
+			pfds[i + 2].fd = g_clients[i].fd;
+			pfds[i + 2].events = POLLIN;
+		}
+		n = MOCK_CLIENTS + 2;
+		if (poll(pfds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR_ERRNO("poll");
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+			for (i = 0; fd >= 0 && i < MOCK_CLIENTS; i++) {
+				if (g_clients[i].fd < 0)
+					break;
+			}
+			if (fd < 0) {
+				WARN_ERRNO("accept");
+			} else if (i == MOCK_CLIENTS) {
+				WARN("too many clients");
+				(void)close(fd);
+			} else {
+				memset(&g_clients[i], 0, sizeof(g_clients[i]));
+				g_clients[i].fd = fd;
+				LOG("client connected");
+			}
+		}
+		if ((pfds[1].revents & (POLLIN|POLLHUP)) && mock_stdin())
+			in = 0;
+		for (i = 0; i < MOCK_CLIENTS; i++) {
+			if (pfds[i + 2].fd >= 0 && g_clients[i].fd >= 0
+					&& pfds[i + 2].revents)
+				mock_read(&g_clients[i]);
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un sun;
+	const char *path = NM_VICI;
+	unsigned int i;
+	int opt, lfd;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		default:
+			mock_usage(argv[0]);
+		}
+	}
+
+	openlog("vici_mock", LOG_PERROR|LOG_PID, LOG_DAEMON);
+
+	for (i = 0; i < MOCK_CLIENTS; i++)
+		g_clients[i].fd = -1;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path))
+		mock_usage(argv[0]);
+	strcpy(sun.sun_path, path);
+	(void)unlink(path);
+	lfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (lfd < 0)
+		ERROR_ERRNO("socket");
+	if (bind(lfd, (struct sockaddr *)&sun, sizeof(sun)) || listen(lfd, 4))
+		ERROR_ERRNO("bind %s", path);
+
+	mock_loop(lfd);
+	return EXIT_SUCCESS;
+}
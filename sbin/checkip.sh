@@ -14,6 +14,7 @@
 # 2 as published by the Free Software Foundation.
 
 NET_ERROR="/usr/local/var/net_error"
+OUI_INDEX="/sbin/oui_index"
 
 . /lib/clip/net.sub
 
@@ -30,6 +31,10 @@ OPT=""
 [[ "${INT}" == "${INT/%:*/}" ]] && OPT="-0"
 
 findmac() {
+	# prebuilt index first, oui.txt when it is missing or outdated
+	if [[ -x "${OUI_INDEX}" ]] && "${OUI_INDEX}" lookup "$1" 2>/dev/null; then
+		return
+	fi
 	local mac="$(echo "$1" | head -c 8 | tr -- ':a-f' '-A-F')"
 	grep "^${mac}" -- "/usr/share/misc/oui.txt" | sed -nr 's/[-0-9A-F]{8}\s*\(hex\)\s*(.*)\s*$/\1/p' | head -n 1
 }
@@ -21,8 +21,7 @@ IPSEC_CONFIGS="$(cat ${IPSEC_LIST})"
 IPSEC_MAIN_CONFIG="$(head -n 1 ${IPSEC_LIST})"
 
 reset_status() {
-	write_lock "type: ${MODE}\nlevel: 0\naddr: \ngw: "
-	update_lock ipsec "${NOIPSEC}"
+	write_lock "ipsec: ${NOIPSEC}\ntype: ${MODE}\nlevel: 0\naddr: \ngw: "
 }
 
 exit_trap() {
@@ -94,8 +93,9 @@ ipsec_conn_setup() {
 	done
 }
 
+# Prints the ipsec status line, to be published along with the other
+# fields of the current iteration
 ipsec_update() {
-	local first="y"
 	local status=""
 	for config in ${IPSEC_CONFIGS}; do
 		local conn_state="$(ipsec_conn_status "${config}")"
@@ -114,10 +114,10 @@ ipsec_update() {
 
 	if [[ -n ${status} ]]; then
 		[[ -c "/dev/leds/ipsec" ]] && echo 1 > "/dev/leds/ipsec"
-		update_lock ipsec "${status}"
+		echo -n "${status}"
 	else
 		[[ -c "/dev/leds/ipsec" ]] && echo 0 > "/dev/leds/ipsec"
-		update_lock ipsec "${NOIPSEC}"
+		echo -n "${NOIPSEC}"
 	fi
 }
 
@@ -132,10 +132,10 @@ wired)
 		else
 			ip link show "${IFACE}" | grep -q LOWER_UP && LVL=1 
 		fi
-		update_lock level "${LVL}"
-		update_lock addr $(cat "/var/run/${IFACE}_dhcp")
-		update_lock gw $(/sbin/ip -4 route|grep 'default'|awk '{print $3}')
-		ipsec_update
+		update_lock level "${LVL}" \
+			addr "$(cat "/var/run/${IFACE}_dhcp")" \
+			gw "$(/sbin/ip -4 route|grep 'default'|awk '{print $3}')" \
+			ipsec "$(ipsec_update)"
 		sleep "${WAIT}"
 	done
 	;;
@@ -156,20 +156,32 @@ wifi)
 				ADDR="$(cat "/var/run/${IFACE}_dhcp")"
 				GW=$(/sbin/ip -4 route|grep 'default'|awk '{print $3}')
 			fi
-			write_lock "type: wifi\nlevel: ${LVL}\naddr: ${ADDR}\ngw: ${GW}\n${ESSID} (${BANDWIDTH} Mb/s ; ${LEVEL} %)"
-			ipsec_update
+			write_lock "ipsec: $(ipsec_update)\ntype: wifi\nlevel: ${LVL}\naddr: ${ADDR}\ngw: ${GW}\n${ESSID} (${BANDWIDTH} Mb/s ; ${LEVEL} %)"
 		fi
 		sleep "${WAIT}"
 	done
 	;;
 
 umts)
+	# same modem type as umtsd and umts_config (qmi, mbim...)
+	source /lib/rc/net/umts || exit 1
+	IPSEC_STATUS="${NOIPSEC}"
 	while true; do
-		umts_type=$(basename $(readlink "/sys/class/net/${IFACE}/device/driver"))
-		ipsec_status="$(ipsec_conn_status "${IPSEC_MAIN_CONFIG}")"
-		[[ -n "${ipsec_status}" ]] || ipsec_status="${NOIPSEC}"
-		/sbin/umts_config "${NET_STATUS}" "${umts_type}" "${IFACE}" "check" "${ipsec_status}"
-		ipsec_update
+		umts_type="$(umts_type "${IFACE}")"
+		# umts_config publishes the whole record with the last known ipsec
+		# status: ipsec_update may block on "ipsec up", so it runs once the
+		# record is published, and only the ipsec field is then updated
+		# if it changed or if the check failed
+		CHECK_OK="yes"
+		if ! /sbin/umts_config "${NET_STATUS}" "${umts_type}" "${IFACE}" "check" "${IPSEC_STATUS}"; then
+			warn "umts check failed"
+			CHECK_OK="no"
+		fi
+		STATUS="$(ipsec_update)"
+		if [[ "${STATUS}" != "${IPSEC_STATUS}" || "${CHECK_OK}" == "no" ]]; then
+			IPSEC_STATUS="${STATUS}"
+			update_lock ipsec "${IPSEC_STATUS}"
+		fi
 		sleep "${WAIT}"
 	done
 	;;
@@ -0,0 +1,345 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netstatus - publication atomique de l'état du réseau
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "netstatus.h"
+
+static int
+netstatus_line(char *line, const char *fmt, const char *a, const char *b)
+{
+	int ret = snprintf(line, NETSTATUS_LINE_LEN, fmt, a, b);
+
+	if (ret < 0 || ret >= NETSTATUS_LINE_LEN) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return 0;
+}
+
+/* Longueur du nom de champ si line est de la forme "<champ>: ...",
+ * 0 sinon. Les champs sont en minuscules : "profile", "ipsec"... */
+static size_t
+netstatus_key_len(const char *line)
+{
+	size_t i;
+
+	for (i = 0; (line[i] >= 'a' && line[i] <= 'z') || line[i] == '_'; i++)
+		;
+	return (i && line[i] == ':' && line[i + 1] == ' ') ? i : 0;
+}
+
+static int
+netstatus_find(const struct netstatus *st, const char *key)
+{
+	size_t len = strlen(key);
+	unsigned int i;
+
+	for (i = 0; i < st->n; i++) {
+		if (netstatus_key_len(st->lines[i]) == len
+				&& !strncmp(st->lines[i], key, len))
+			return (int)i;
+	}
+	return -1;
+}
+
+void
+netstatus_init(struct netstatus *st)
+{
+	char link[PATH_MAX];
+	const char *profile = "";
+	ssize_t len;
+
+	memset(st, 0, sizeof(*st));
+	len = readlink(NETSTATUS_CONFLINK, link, sizeof(link) - 1);
+	if (len > 0) {
+		link[len] = '\0';
+		profile = strrchr(link, '/');
+		profile = (profile) ? profile + 1 : link;
+	}
+	/* un nom de profil trop long est tronqué */
+	snprintf(st->lines[st->n++], NETSTATUS_LINE_LEN, "profile: %.*s",
+					NETSTATUS_LINE_LEN - 10, profile);
+	snprintf(st->lines[st->n++], NETSTATUS_LINE_LEN, "ipsec: ");
+}
+
+int
+netstatus_load(struct netstatus *st, const char *path)
+{
+	/* un octet de plus que le plus grand enregistrement valide */
+	char buf[NETSTATUS_MAX_LINES * NETSTATUS_LINE_LEN + 2];
+	char *line, *next;
+	ssize_t len;
+	int fd;
+
+	memset(st, 0, sizeof(*st));
+	fd = open(path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	len = read(fd, buf, sizeof(buf) - 1);
+	(void)close(fd);
+	if (len < 0)
+		return -1;
+	if ((size_t)len == sizeof(buf) - 1) {
+		errno = EFBIG;
+		return -1;
+	}
+	buf[len] = '\0';
+
+	for (line = buf; *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		if (*line && netstatus_add(st, line))
+			return -1;
+	}
+	return 0;
+}
+
+const char *
+netstatus_get(const struct netstatus *st, const char *key)
+{
+	int i = netstatus_find(st, key);
+
+	return (i < 0) ? NULL : st->lines[i] + strlen(key) + 2;
+}
+
+int
+netstatus_set(struct netstatus *st, const char *key, const char *val)
+{
+	int i = netstatus_find(st, key);
+	unsigned int pos;
+
+	if (i >= 0)
+		return netstatus_line(st->lines[i], "%s: %s", key, val);
+
+	if (st->n >= NETSTATUS_MAX_LINES) {
+		errno = ENOSPC;
+		return -1;
+	}
+	/* Après le dernier champ de tête, avant le texte libre */
+	for (pos = 0; pos < st->n && netstatus_key_len(st->lines[pos]); pos++)
+		;
+	memmove(st->lines[pos + 1], st->lines[pos],
+				(st->n - pos) * NETSTATUS_LINE_LEN);
+	st->n++;
+	return netstatus_line(st->lines[pos], "%s: %s", key, val);
+}
+
+int
+netstatus_add(struct netstatus *st, const char *line)
+{
+	if (st->n >= NETSTATUS_MAX_LINES) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (netstatus_line(st->lines[st->n], "%s%s", line, ""))
+		return -1;
+	st->n++;
+	return 0;
+}
+
+/* Verrou des écrivains, à libérer par netstatus_unlock() */
+int
+netstatus_lock(const char *path)
+{
+	char lock[PATH_MAX];
+	int fd, ret;
+
+	ret = snprintf(lock, sizeof(lock), "%s.lock", path);
+	if (ret < 0 || (size_t)ret >= sizeof(lock)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = open(lock, O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC, S_IRUSR|S_IWUSR);
+	if (fd < 0)
+		return -1;
+	if (flock(fd, LOCK_EX)) {
+		(void)close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void
+netstatus_unlock(int fd)
+{
+	if (fd >= 0)
+		(void)close(fd);
+}
+
+/* Écriture du fichier temporaire, avec le propriétaire et les droits de
+ * la version publiée (0644 à la création) */
+static int
+netstatus_write(int fd, const struct netstatus *st, const char *path)
+{
+	char buf[NETSTATUS_MAX_LINES * (NETSTATUS_LINE_LEN + 1)];
+	size_t len = 0, l;
+	struct stat old;
+	unsigned int i;
+	ssize_t ret;
+
+	for (i = 0; i < st->n; i++) {
+		l = strnlen(st->lines[i], NETSTATUS_LINE_LEN - 1);
+		memcpy(buf + len, st->lines[i], l);
+		len += l;
+		buf[len++] = '\n';
+	}
+
+	if (!stat(path, &old)) {
+		if (fchmod(fd, old.st_mode & 07777))
+			return -1;
+		/* sans CAP_CHOWN, le fichier reste à l'appelant */
+		if (fchown(fd, old.st_uid, old.st_gid) && errno != EPERM)
+			return -1;
+	} else if (fchmod(fd, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH)) {
+		return -1;
+	}
+
+	for (l = 0; l < len; l += (size_t)ret) {
+		ret = write(fd, buf + l, len - l);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				ret = 0;
+				continue;
+			}
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int
+netstatus_publish(const struct netstatus *st, const char *path)
+{
+	char tmp[PATH_MAX];
+	int fd, ret, err;
+
+	ret = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if (ret < 0 || (size_t)ret >= sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (netstatus_write(fd, st, path)) {
+		err = errno;
+		(void)close(fd);
+		goto err;
+	}
+	if (close(fd) || rename(tmp, path)) {
+		err = errno;
+		goto err;
+	}
+	return 0;
+
+err:
+	(void)unlink(tmp);
+	errno = err;
+	return -1;
+}
+
+/* Surveillance du répertoire : rename(2) y produit IN_MOVED_TO ;
+ * IN_CLOSE_WRITE couvre les écrivains qui réécrivent le fichier sur place */
+int
+netstatus_watch_open(const char *path)
+{
+	char dir[PATH_MAX];
+	char *ptr;
+	int fd;
+
+	if (strlen(path) >= sizeof(dir)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(dir, path);
+	ptr = strrchr(dir, '/');
+	if (!ptr)
+		strcpy(dir, ".");
+	else if (ptr == dir)
+		dir[1] = '\0';
+	else
+		*ptr = '\0';
+
+	fd = inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+	if (fd < 0)
+		return -1;
+	if (inotify_add_watch(fd, dir, IN_MOVED_TO|IN_CLOSE_WRITE) < 0) {
+		(void)close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static long long
+netstatus_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int
+netstatus_watch(int fd, const char *path, int timeout)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	const char *name = strrchr(path, '/');
+	long long deadline = netstatus_now_ms() + timeout;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int found = 0, wait = timeout;
+	ssize_t len, off;
+
+	name = (name) ? name + 1 : path;
+	while (!found) {
+		if (timeout >= 0) {
+			wait = (int)(deadline - netstatus_now_ms());
+			if (wait < 0)
+				wait = 0;
+		}
+		switch (poll(&pfd, 1, wait)) {
+		case -1:
+			if (errno == EINTR)
+				continue;
+			return -1;
+		case 0:
+			return 0;
+		default:
+			break;
+		}
+
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return -1;
+		}
+		for (off = 0; off < len;
+				off += (ssize_t)sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)(buf + off);
+			if (ev->len && !strcmp(ev->name, name))
+				found = 1;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef NETSTATUS_H
+#define NETSTATUS_H
+
+/*
+ * Publication de l'état du réseau (NET_STATUS).
+ *
+ * L'enregistrement complet est construit en mémoire, puis publié d'un
+ * bloc : écriture d'un fichier temporaire dans le même répertoire et
+ * rename(2). Les lecteurs voient toujours une version complète, sans
+ * verrou ; ils sont prévenus de chaque publication par inotify
+ * (IN_MOVED_TO sur le répertoire), voir netstatus_watch(). Les
+ * écrivains sont sérialisés par un verrou sur <fichier>.lock, qui
+ * couvre les séquences lecture / modification / publication.
+ *
+ * Aucune fonction de ce module n'alloue de mémoire, ne termine le
+ * programme ni n'écrit dans les journaux : les erreurs sont signalées
+ * par un retour -1 et errno.
+ */
+
+#define NETSTATUS_FILE		"/usr/local/var/net_status"
+#define NETSTATUS_CONFLINK	"/etc/admin/conf.d/netconf"
+
+#define NETSTATUS_MAX_LINES	16
+#define NETSTATUS_LINE_LEN	256
+
+/* Lignes "<champ>: <valeur>", puis texte libre, dans l'ordre du fichier */
+struct netstatus {
+	unsigned int n;
+	char lines[NETSTATUS_MAX_LINES][NETSTATUS_LINE_LEN];
+};
+
+/* Enregistrement de base : "profile: <profil courant>", "ipsec: " */
+void
+netstatus_init(struct netstatus *st);
+
+/* Un enregistrement qui dépasse NETSTATUS_MAX_LINES lignes ou
+ * NETSTATUS_LINE_LEN caractères par ligne n'est pas tronqué : -1 et
+ * errno EFBIG, ENOSPC ou EMSGSIZE */
+int
+netstatus_load(struct netstatus *st, const char *path);
+
+/* Valeur du champ key, NULL s'il est absent */
+const char *
+netstatus_get(const struct netstatus *st, const char *key);
+
+/* Remplace le champ key, ou l'ajoute à la suite des champs existants */
+int
+netstatus_set(struct netstatus *st, const char *key, const char *val);
+
+/* Ajoute une ligne telle quelle à la fin de l'enregistrement */
+int
+netstatus_add(struct netstatus *st, const char *line);
+
+int
+netstatus_lock(const char *path);
+
+void
+netstatus_unlock(int fd);
+
+int
+netstatus_publish(const struct netstatus *st, const char *path);
+
+/* Attente de la prochaine publication de path, au plus timeout ms
+ * (-1 : sans limite). Retourne 1 si le fichier a été publié, 0 à
+ * l'échéance. fd est un descripteur inotify ouvert par
+ * netstatus_watch_open(). */
+int
+netstatus_watch_open(const char *path);
+
+int
+netstatus_watch(int fd, const char *path, int timeout);
+
+#endif /* NETSTATUS_H */
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	netstatus - mise à jour de NET_STATUS depuis les scripts
+ *
+ *	netstatus [-f fichier] write [ligne...]
+ *		publie un nouvel enregistrement : profil courant, ipsec vide,
+ *		puis les lignes données (lues sur l'entrée standard si
+ *		aucune n'est passée). Une ligne "<champ>: <valeur>" remplace
+ *		le champ de même nom.
+ *	netstatus [-f fichier] set champ valeur [champ valeur...]
+ *		met à jour plusieurs champs en une seule publication ; rien
+ *		n'est publié si aucune valeur ne change.
+ *	netstatus [-f fichier] add [ligne...]
+ *		ajoute des lignes de texte libre (lues sur l'entrée standard
+ *		si aucune n'est passée).
+ *	netstatus [-f fichier] get champ
+ *	netstatus [-f fichier] watch [-n nombre] [-t délai ms]
+ *		affiche l'enregistrement à chaque publication.
+ */
+
+#define _GNU_SOURCE
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "netstatus.h"
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f file] write [line...]\n"
+		"       %s [-f file] set key value [key value...]\n"
+		"       %s [-f file] add [line...]\n"
+		"       %s [-f file] get key\n"
+		"       %s [-f file] watch [-n count] [-t timeout_ms]\n",
+		prog, prog, prog, prog, prog);
+	exit(EINVAL);
+}
+
+static int
+same_record(const struct netstatus *a, const struct netstatus *b)
+{
+	unsigned int i;
+
+	if (a->n != b->n)
+		return 0;
+	for (i = 0; i < a->n; i++) {
+		if (strcmp(a->lines[i], b->lines[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/* Ligne de write : champ remplacé s'il existe, sinon ajoutée */
+static void
+write_line(struct netstatus *st, char *line)
+{
+	char *sep = strstr(line, ": ");
+	size_t len = strcspn(line, "\n");
+
+	line[len] = '\0';
+	if (!*line)
+		return;
+	if (sep) {
+		*sep = '\0';
+		if (netstatus_get(st, line)) {
+			if (netstatus_set(st, line, sep + 2))
+				err(EXIT_FAILURE, "set %s", line);
+			return;
+		}
+		*sep = ':';
+	}
+	if (netstatus_add(st, line))
+		err(EXIT_FAILURE, "add");
+}
+
+static void
+cmd_write(struct netstatus *st, int argc, char *argv[])
+{
+	char line[NETSTATUS_LINE_LEN];
+	int i;
+
+	netstatus_init(st);
+	if (!argc) {
+		while (fgets(line, sizeof(line), stdin))
+			write_line(st, line);
+		return;
+	}
+	for (i = 0; i < argc; i++) {
+		if (strlen(argv[i]) >= sizeof(line))
+			errx(EMSGSIZE, "line too long");
+		strcpy(line, argv[i]);
+		write_line(st, line);
+	}
+}
+
+/* Lignes de texte libre de add, les lignes vides sont ignorées */
+static void
+cmd_add(struct netstatus *st, int argc, char *argv[])
+{
+	char line[NETSTATUS_LINE_LEN];
+	int i;
+
+	if (argc) {
+		for (i = 0; i < argc; i++) {
+			if (netstatus_add(st, argv[i]))
+				err(EXIT_FAILURE, "add");
+		}
+		return;
+	}
+	while (fgets(line, sizeof(line), stdin)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (*line && netstatus_add(st, line))
+			err(EXIT_FAILURE, "add");
+	}
+}
+
+/* Enregistrement courant, ou de base s'il n'existe pas encore */
+static void
+load_record(struct netstatus *st, const char *path)
+{
+	if (netstatus_load(st, path)) {
+		if (errno != ENOENT)
+			err(EXIT_FAILURE, "%s", path);
+		netstatus_init(st);
+	}
+}
+
+static int
+cmd_watch(const char *path, int argc, char *argv[])
+{
+	struct netstatus st;
+	unsigned int i, count = 0, n = 0;
+	int fd, a, timeout = -1;
+
+	for (a = 0; a < argc; a += 2) {
+		if (a + 1 >= argc)
+			usage("netstatus");
+		if (!strcmp(argv[a], "-n"))
+			count = strtoul(argv[a + 1], NULL, 10);
+		else if (!strcmp(argv[a], "-t"))
+			timeout = atoi(argv[a + 1]);
+		else
+			usage("netstatus");
+	}
+
+	fd = netstatus_watch_open(path);
+	if (fd < 0)
+		err(EXIT_FAILURE, "inotify %s", path);
+	while (!count || n < count) {
+		switch (netstatus_watch(fd, path, timeout)) {
+		case -1:
+			err(EXIT_FAILURE, "watch %s", path);
+		case 0:
+			return ETIMEDOUT;
+		default:
+			break;
+		}
+		n++;
+		if (netstatus_load(&st, path))
+			continue;
+		for (i = 0; i < st.n; i++)
+			printf("%s\n", st.lines[i]);
+		printf("\n");
+		fflush(stdout);
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static struct netstatus st, old;
+	const char *path = NETSTATUS_FILE, *cmd, *val;
+	int opt, lock, i;
+
+	while ((opt = getopt(argc, argv, "+f:")) != -1) {
+		switch (opt) {
+		case 'f':
+			path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+	cmd = argv[optind++];
+	argc -= optind;
+	argv += optind;
+
+	if (!strcmp(cmd, "watch"))
+		return cmd_watch(path, argc, argv);
+	if (!strcmp(cmd, "get")) {
+		if (argc != 1)
+			usage("netstatus");
+		if (netstatus_load(&st, path))
+			err(EXIT_FAILURE, "%s", path);
+		val = netstatus_get(&st, argv[0]);
+		if (!val)
+			return ENOENT;
+		printf("%s\n", val);
+		return 0;
+	}
+
+	lock = netstatus_lock(path);
+	if (lock < 0)
+		err(EXIT_FAILURE, "lock %s", path);
+
+	if (!strcmp(cmd, "write")) {
+		cmd_write(&st, argc, argv);
+	} else if (!strcmp(cmd, "set")) {
+		if (!argc || argc % 2)
+			usage("netstatus");
+		load_record(&st, path);
+		old = st;
+		for (i = 0; i < argc; i += 2) {
+			if (netstatus_set(&st, argv[i], argv[i + 1]))
+				err(EXIT_FAILURE, "set %s", argv[i]);
+		}
+		if (same_record(&st, &old)) {
+			netstatus_unlock(lock);
+			return 0;
+		}
+	} else if (!strcmp(cmd, "add")) {
+		load_record(&st, path);
+		cmd_add(&st, argc, argv);
+	} else {
+		usage("netstatus");
+	}
+
+	if (netstatus_publish(&st, path))
+		err(EXIT_FAILURE, "publish %s", path);
+	netstatus_unlock(lock);
+	return 0;
+}
@@ -5,9 +5,11 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <setjmp.h>
 #include <termio.h>
 #include <fcntl.h>
 #include <limits.h>
@@ -20,9 +22,15 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <error.h>
 #include <errno.h>
 #include <syslog.h>
+#include <arpa/inet.h>
+
+#include "umts_parse.h"
 
 #define SIZE_PIN 8
 
@@ -65,14 +73,25 @@
 
 #define ERROR(err, fmt, args...) do {\
 	_WARN(LOG_ERR, fmt, ##args); \
-	exit(err); \
+	umts_exit(err); \
 } while (0)
 
 #define ERROR_ERRNO(fmt, args...) do {\
 	WARN_ERRNO(fmt, ##args); \
-	exit(errno); \
+	umts_exit(errno); \
 } while (0)
 
+/* Fin sur erreur : termine le processus, ou seulement la requête de
+ * umtsd en cours si umts_request_env est positionné. On revient alors
+ * au setjmp() de umtsd, avec le code d'erreur. */
+extern jmp_buf *umts_request_env;
+
+/* Arrêt de umtsd demandé : la requête en cours est abandonnée */
+extern volatile sig_atomic_t umts_stop;
+
+void
+umts_exit(int err) __attribute__((noreturn));
+
 /*********************************************************/
 /** Structures de données internes **/
 /*********************************************************/
@@ -89,31 +108,183 @@ struct cdata {
 	fixed_buf operator, ip_address, mask, gateway, dns1, dns2;
 };
 
+/* Politique de relance des boucles d'attente du modem : délai initial,
+ * multiplié par factor à chaque essai (1 : délai fixe) jusqu'à
+ * max_delay, augmenté d'un aléa d'au plus jitter %, le tout dans la
+ * limite de budget ms depuis le premier essai */
+struct retry_policy {
+	unsigned int initial;
+	unsigned int max_delay;
+	unsigned int factor;
+	unsigned int jitter;
+	unsigned int budget;
+};
+
 typedef struct
 {
 	const char* name;
 	const char* device;
 	const char* interface;
+	/* port de contrôle à messages binaires (QMI), sans termios ni AT */
+	int		raw;
+	/* Délai d'envoi entre chaque caractère (usec), 0 pour une émission
+	 * en bloc. À n'activer que pour les modems qui l'exigent. */
+	unsigned int	char_delay;
+	/* attente de disponibilité du modem */
+	struct retry_policy	init_retry;
+	/* attente des paramètres / de l'état de la connexion */
+	struct retry_policy	conn_retry;
 	int		(*init)(int comd);
+	/* vérification du code PIN, check_pin_status() (AT) si NULL */
+	int		(*check_pin)(int comd, struct cdata *p_conn_data);
 	void	(*check_conn_up)(int comd, struct cdata *p_conn_data, char *interface);
 	int		(*wait_reg_status)(int comd);
 	void	(*set_conn_down)(int comd, char *interface);
 	int		(*monitor_connection)(int comd, const char *filename,
 					const char *interface __attribute__((unused)),
 					const char *ipsec);
+	/* reprise de la connexion décrite par lease si l'appel est
+	 * toujours établi, retourne 0 si la connexion est reprise */
+	int		(*warm_start)(int comd, struct cdata *p_conn_data,
+				const struct cdata *lease, char *interface);
 } umts_device_t;
 
 extern umts_device_t hso_device;
 extern umts_device_t acm_device;
 extern umts_device_t huawei_device;
+extern umts_device_t qmi_device;
+extern umts_device_t mbim_device;
+
+/*********************************************************/
+/** Requêtes (umts_cmd.c) et démon umtsd **/
+/*********************************************************/
+/* Requête umts_config, transmise telle quelle à umtsd */
+struct umts_request {
+	fixed_buf filename, type, interface, cmd, ipsec;
+};
+
+/* Socket de umtsd ; la réponse est le code de sortie de la requête,
+ * ou UMTSD_NOT_MINE si le type demandé n'est pas celui du démon */
+#define UMTSD_SOCKET "/var/run/umtsd.sock"
+#define UMTSD_PIDFILE "/var/run/umtsd.pid"
+#define UMTSD_NOT_MINE -1
+
+/* Répertoire des fichiers d'état (capacités, baux) */
+#define UMTS_RUN_DIR "/var/run"
+
+umts_device_t *
+get_device(const char *type);
+
+void
+check_device(const umts_device_t *umts_device);
+
+const char *
+umts_run_dir(void);
 
-/* 0,1 s Délai d'envoi entre chaque caractère sur le port série */
+void
+run_key_sanitize(char *key);
+
+void
+check_request(const umts_device_t *umts_device,
+				const struct umts_request *req);
+
+void
+run_request(umts_device_t *umts_device, int comd, struct umts_request *req);
+
+void
+request_cleanup(void);
+
+int
+monitor_publish(const char *filename, const char *ipsec, int level,
+				const char *fmt, ...)
+				__attribute__((format(printf, 4, 5)));
+
+const char *
+umtsd_socket(void);
+
+/* Délais maximaux (ms) */
+#define AT_TIMEOUT 10000U	/* réponse à une commande AT */
+#define REG_TIMEOUT 30000U	/* enregistrement sur le réseau */
+#define CALL_TIMEOUT 30000U	/* établissement/coupure de l'appel */
+#define POLL_INTERVAL 1000U	/* intervalle entre deux interrogations */
+
+/* 0,01 s Délai d'envoi entre chaque caractère sur le port série,
+ * pour les modems utilisant l'émission caractère par caractère */
 #define MUDELAY 10000U
 /* 1 s Délai d'attente pour chaque interrogation de réponse */
 #define UDELAY 1000000U
 /* 30 s = TIMEOUT x UDELAY*/
 #define TIMEOUT 30U
 
+/*********************************************************/
+/** Horloge monotone et échéances                       **/
+/*********************************************************/
+typedef unsigned long long msec_t;
+
+msec_t
+clock_ms(void);
+
+static inline msec_t
+deadline_in(unsigned int ms)
+{
+	return clock_ms() + ms;
+}
+
+/* Temps restant avant l'échéance, en ms, 0 si elle est dépassée */
+static inline int
+ms_left(msec_t deadline)
+{
+	msec_t now = clock_ms();
+
+	if (now >= deadline)
+		return 0;
+	if (deadline - now > INT_MAX)
+		return INT_MAX;
+	return (int)(deadline - now);
+}
+
+/*********************************************************/
+/** Chronométrage des phases                            **/
+/*********************************************************/
+/* Compteurs d'activité sur le port série */
+struct umts_counters {
+	unsigned int at;		/* transactions AT */
+	unsigned long tx, rx;		/* octets émis / reçus */
+};
+
+extern struct umts_counters umts_counters;
+
+void
+timing_start(const char *cmd);
+
+void
+timing_end(int status);
+
+void
+phase_begin(const char *name);
+
+/*********************************************************/
+/** Relances                                            **/
+/*********************************************************/
+/* État d'une boucle d'attente, voir struct retry_policy */
+struct retry {
+	const char *what;
+	const struct retry_policy *policy;
+	msec_t start, deadline;
+	unsigned int attempts;
+	unsigned int delay;
+};
+
+void
+retry_start(struct retry *r, const char *what,
+			const struct retry_policy *policy);
+
+int
+retry_next(struct retry *r, int comd);
+
+void
+retry_end(struct retry *r, int success);
+
 /*********************************************************/
 /** Ouverture/fermeture de fichier                      **/
 /*********************************************************/
@@ -132,15 +303,37 @@ close_file(const char *path, FILE *fd);
 /** Gestion du port série **/
 /*********************************************************/
 
-/* variable de mémorisation de la configuration initiale */
-struct termios memorized_conf;
-
 int
-initiate_serial(const char *device);
+initiate_serial(const umts_device_t *umts_device);
 
 void
 close_serial(int comd);
 
+void
+serial_at_close(int comd, void (*fn)(int comd));
+
+/* Codes de résultat finaux d'une transaction AT */
+typedef enum {
+	AT_NONE = -1,		/* pas (encore) de code final */
+	AT_OK = 0,
+	AT_ERROR,
+	AT_CME_ERROR,		/* +CME ERROR / +CMS ERROR */
+} at_result_t;
+
+#define AT_MAX_LINES 8
+
+/* Réponse à une transaction AT */
+struct at_resp {
+	at_result_t result;
+	unsigned int nlines;
+	fixed_buf lines[AT_MAX_LINES];	/* réponses intermédiaires */
+	fixed_buf final;		/* code de résultat final */
+};
+
+int
+at_transaction(int comd, const char *cmd, struct at_resp *resp,
+		unsigned int timeout);
+
 int
 send_receive(int comd, const char *cmd, fixed_buf answer);
 
@@ -148,8 +341,39 @@ void
 get_check_answer(int comd, const char *cmd,
 	fixed_buf answer, const char *expected);
 
+/* Interrogation pour at_query_batch() */
+struct at_query {
+	const char *cmd;	/* commande complète : "AT+CSQ" */
+	const char *expected;	/* début de réponse attendu : "+CSQ: " */
+	fixed_buf answer;
+};
+
+void
+at_query_batch(int comd, struct at_query *queries, unsigned int n);
+
+int
+readline_until(int comd, fixed_buf answer, msec_t deadline);
+
+int
+serial_idle(int comd, msec_t until);
+
+int
+serial_drain(int comd);
+
+ssize_t
+serial_read(int comd, void *buf, size_t len, msec_t deadline);
+
+/* Codes de résultat non sollicités (URC) */
+typedef void (*urc_handler_t)(const char *line, void *data);
+
+int
+urc_register(const char *prefix, urc_handler_t handler, void *data);
+
+void
+urc_unregister(const char *prefix);
+
 int
-readcom(int comfd, fixed_buf answer, unsigned int udelay);
+urc_wait(int comd, const char *prefix, fixed_buf line, msec_t deadline);
 
 void
 setcom(int comd);
@@ -157,6 +381,9 @@ setcom(int comd);
 void
 writechar(int comd, char c);
 
+void
+writebuf(int comd, const char *buf, size_t len);
+
 void
 writecom(int comd, const char *text);
 
@@ -189,14 +416,105 @@ strip_right(char *buf)
 /* Scripts                                               */
 /*********************************************************/
 void
-check_ipaddr(const fixed_buf ip);
+set_ipconf(struct cdata *p_conn_data, const struct at_ipconf *ipconf);
+
+int
+fork_exec(char **argv);
+
+/*********************************************************/
+/* Cache des capacités du modem (umts_caps.c)            */
+/*********************************************************/
+/* Commandes optionnelles ou à variantes */
+typedef enum {
+	CAP_QCPDPP = 0,		/* AT$QCPDPP, sinon AT_OPDPP (hso) */
+	CAP_EIAAUR,		/* AT*EIAAUR (acm) */
+	CAP_CONCAT,		/* concaténation V.25ter */
+	CAP_CESQ,		/* AT+CESQ, RSRP/RSRQ (huawei) */
+	CAP_MAX
+} caps_t;
+
+typedef enum {
+	CAP_UNKNOWN = 0,
+	CAP_OK,
+	CAP_NO,
+} cap_state_t;
 
 void
-get_ipaddr(fixed_buf dst, const char *src,
-	const char *name __attribute__((unused)), size_t *curoff);
+caps_load(const umts_device_t *umts_device, int comd);
+
+cap_state_t
+caps_get(caps_t cap);
+
+void
+caps_set(caps_t cap, cap_state_t state);
 
 int
-fork_exec(char **argv);
+caps_command(int comd, caps_t cap, const char *cmd, fixed_buf answer);
+
+/*********************************************************/
+/* Dernière connexion par profil (umts_lease.c)          */
+/*********************************************************/
+void
+lease_save(const char *filename, const struct cdata *p_conn_data);
+
+void
+lease_clear(const char *filename);
+
+int
+lease_match(const struct cdata *lease, const struct cdata *p_conn_data);
+
+int
+lease_warm_start(umts_device_t *umts_device, int comd, const char *filename,
+			struct cdata *p_conn_data, char *interface);
+
+/*********************************************************/
+/* Configuration réseau par rtnetlink (umts_netlink.c)   */
+/*********************************************************/
+/* Options de net_up */
+#define NET_GATEWAY	0x01	/* route par défaut via la passerelle,
+				 * sinon directe sur l'interface */
+#define NET_FIX_HWADDR	0x02	/* adresse MAC imposée (Huawei) */
+
+int
+net_up(const char *interface, const struct cdata *p_conn_data,
+				unsigned int flags, char **hook);
+
+int
+net_down(const char *interface, char **hook);
+
+/*********************************************************/
+/* Historique de la qualité du lien (umts_quality.c)     */
+/*********************************************************/
+/* Grandeur non fournie par le modem */
+#define QUALITY_NONE	INT16_MIN
+
+/* Échantillon relevé à chaque check */
+struct quality_sample {
+	int64_t time;		/* secondes depuis l'epoch */
+	int16_t rssi;		/* dBm */
+	int16_t ber;		/* 0-7, codage de AT+CSQ */
+	int16_t rsrp;		/* dBm (LTE) */
+	int16_t rsrq;		/* dixièmes de dB (LTE) */
+	uint8_t level;		/* niveau publié, 0-5 */
+	char tech[15];		/* technologie d'accès */
+	char oper[24];
+};
+
+void
+quality_init(struct quality_sample *s, int level, const char *oper,
+							const char *tech);
+
+void
+quality_set_csq(struct quality_sample *s, const struct at_csq *csq);
+
+void
+quality_set_cesq(struct quality_sample *s, const struct at_cesq *cesq);
+
+void
+quality_record(const char *interface, const struct quality_sample *s);
+
+int
+quality_report(const char *interface, const char *filename, int raw);
 
 /*********************************************************/
 /* Configuration                                         */
@@ -270,4 +588,7 @@ buf_format_two_strings(fixed_buf buf, const char *format,
 int
 check_pin_status(int comd, struct cdata *p_conn_data);
 
+int
+wait_net_registration(int comd, unsigned int timeout);
+
 #endif /* UMTS_H */
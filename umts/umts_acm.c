@@ -11,19 +11,13 @@
 static int
 acm_wait_emrdy(int comd)
 {
-	unsigned int i;
 	fixed_buf tmp;
 	int ret;
 
-	for (i = 0; i < 5; i++) {
-		ret = readcom(comd, tmp, UDELAY);
-		if (ret < 0)
-			return ret;
-		if (strlen(tmp))
-			goto answer;
-		}
+	ret = readline_until(comd, tmp, deadline_in(ACM_EMRDY_TIMEOUT));
+	if (ret < 0)
+		return ret;
 
-answer:
 	if (!strmatch(tmp, "*EMRDY: 1")) {
 		DBG("expected EMRDY: 1, got %s", tmp);
 		return -1;
@@ -31,49 +25,73 @@ answer:
 	return 0;
 }
 
+/* Lecture de l'tat de la connexion, -1 si illisible */
 static int
-acm_wait_enap(int comd)
+acm_get_enap(int comd)
 {
 	fixed_buf tmp;
 	int status;
 	const char *str;
-	unsigned int i;
-	for (i = 0; i < 6; i++) {
-		/* AT*ENAP? <status>
-		 *  0. Not connected
-		 *  1. Connected
-		 *  2. Connection setup in progress
-		 */
-
-		if (send_receive(comd, "AT*ENAP?", tmp))
-			continue;
-
-		if (!strmatch(tmp, "*ENAP:")) {
-			LOG("Unexpected connection status: %s", tmp);
-			continue;
-		}
 
-		if (sscanf(tmp, "*ENAP:%d,\"\"", &status) != 1) {
-			LOG("Unreadable connection status: %s", tmp);
-			continue;
+	/* AT*ENAP? <status>
+	 *  0. Not connected
+	 *  1. Connected
+	 *  2. Connection setup in progress
+	 */
+	if (send_receive(comd, "AT*ENAP?", tmp))
+		return -1;
+
+	if (!strmatch(tmp, "*ENAP:")) {
+		LOG("Unexpected connection status: %s", tmp);
+		return -1;
+	}
+
+	if (at_parse_enap(tmp, &status)) {
+		LOG("Unreadable connection status: %s", tmp);
+		return -1;
+	}
+	switch (status) {
+		case 0:
+			str = "Disconnected";
+			break;
+		case 1:
+			str = "Connected";
+			break;
+		case 2:
+			str = "In setup";
+			break;
+		default:
+			str = "Unknown";
+			break;
+	}
+	LOG("New UMTS connection status: %s (%d)", str, status);
+	return status;
+}
+
+/* Attend que la connexion soit dans l'tat expected. Un retour  l'tat
+ * dconnect aprs la phase d'tablissement est un chec de l'appel. */
+static int
+acm_wait_enap(int comd, int expected)
+{
+	struct retry r;
+	int status, in_setup = 0;
+
+	retry_start(&r, (expected) ? "ENAP up" : "ENAP down",
+					&acm_device.conn_retry);
+	while (retry_next(&r, comd)) {
+		status = acm_get_enap(comd);
+		if (status == expected) {
+			retry_end(&r, 1);
+			return expected;
 		}
-		switch (status) {
-			case 0:
-				str = "Disconnected";
-				break;
-			case 1:
-				str = "Connected";
-				break;
-			case 2:
-				str = "In setup";
-				break;
-			default:
-				str = "Unknown";
-				break;
+		if (expected == 1 && status == 2)
+			in_setup = 1;
+		if (expected == 1 && status == 0 && in_setup) {
+			retry_end(&r, 0);
+			ERROR(ECALLFAILED, "Call failed");
 		}
-		LOG("New UMTS connection status: %s (%d)", str, status);
-		return status;
 	}
+	retry_end(&r, 0);
 
 	ERROR(EADDRNOTAVAIL, "Timed out waiting for connection status update");
 }
@@ -86,6 +104,7 @@ acm_configure_net_down(char *interface)
 		interface,
 		NULL };
 
+	phase_begin("net_down");
 	LOG("Bringing down network on %s", interface);
 
 	if (fork_exec(argv))
@@ -100,6 +119,7 @@ acm_configure_net_up(char *interface)
 		interface,
 		NULL };
 
+	phase_begin("net_up");
 	LOG("Bringing up network: %s", interface);
 
 	if (fork_exec(argv))
@@ -110,8 +130,8 @@ static void
 acm_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 {
 	fixed_buf cmd, answer;
-	unsigned int count = 0;
 
+	phase_begin("apn");
 	LOG("Registering with APN");
 	buf_format_string(cmd, "AT+CGDCONT=1,\"IP\",\"%s\"", p_conn_data->apn);
 	/*
@@ -158,7 +178,7 @@ acm_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 	} else {
 		ERROR(EPROTO, "Unexpected EIAAUW answer: %s", answer);
 	}
-	send_receive(comd, "AT*EIAAUR=1,1", answer);
+	caps_command(comd, CAP_EIAAUR, "AT*EIAAUR=1,1", answer);
 
 	/*
 	 * AT*ENAP: Undocumented Ericsson USB Ethernet Interface Control
@@ -168,21 +188,11 @@ acm_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 	 * <index> PDP context / Internet account index
 	 */
 
+	phase_begin("call");
 	get_check_answer(comd, "AT*ENAP=1,1", answer,"OK");
-	count = 0;
-	for (;;) {
-		int ret;
-		usleep(UDELAY);
-
-		/* Now wait for the connection */
-		ret = acm_wait_enap(comd);
-		if (ret == 1)
-			break;
 
-		if (count++ >= 5)
-			ERROR(EADDRNOTAVAIL, "Timed out waiting "
-					"for expected connection status");
-	}
+	/* Now wait for the connection */
+	acm_wait_enap(comd, 1);
 
 	acm_configure_net_up(interface);
 }
@@ -201,15 +211,13 @@ static void
 acm_check_conn_up(int comd, struct cdata *p_conn_data, char *interface)
 {
 	fixed_buf answer;
-	unsigned int status;
+	int status;
 
 	if (send_receive(comd, "AT*ENAP?", answer))
 		ERROR(EFAULT, "AT*ENAP error");
 
-	if(!strmatch(answer, "*ENAP:"))
+	if (at_parse_enap(answer, &status))
 		ERROR(EFAULT, "AT*ENAP error");
-
-	sscanf(answer, "*ENAP:%u,\"\"", &status);
 	switch(status)
 	{
 		case 0: /* not connected */
@@ -220,91 +228,50 @@ acm_check_conn_up(int comd, struct cdata *p_conn_data, char *interface)
 			acm_configure_net_up(interface);
 			break;
 		case 2: /* connection setup in progress */
-			usleep(UDELAY);
+			phase_begin("call");
+			acm_wait_enap(comd, 1);
 			acm_configure_net_up(interface);
 			break;
 	}
 }
 
+/* Reprise rapide : l'interface obtient ses paramtres par DHCP, seul
+ * l'tat de l'appel est vrifi */
+static int
+acm_warm_start(int comd, struct cdata *p_conn_data __attribute__((unused)),
+			const struct cdata *lease __attribute__((unused)),
+			char *interface)
+{
+	if (acm_get_enap(comd) != 1)
+		return -1;
+
+	acm_configure_net_up(interface);
+	return 0;
+}
+
 static int
 acm_wait_reg_status(int comd)
 {
 	fixed_buf answer;
-	unsigned int count;
 
 	/* Mise de la carte en mode de slection automatique */
 	if (send_receive(comd, "AT+CFUN=1", answer))
 		return -1;
 
-	/* Dsactivation de la gestion automatique */
-	get_check_answer(comd, "AT+CREG=0", answer, "OK");
-	/*
-	 * AT+CREG=<n>
-	 *  <n>
-	 *    0. Disable unsolicited status callback.
-	 *    1. Enable unsolicited status callback, +CREG: <stat>
-	 *    2. Enable unsolicited status callback,
-	 * +CREG: <stat>,[,<lac>,<ci>]
-	 *  <stat>
-	 *    0. Not registered, not searching
-	 *    1. Registered, home network
-	 *    2. Not registered, searching
-	 *    3. Registration denied
-	 *    4. Unknown
-	 *    5. Registered, roaming
-	 */
-	for (count = 0; count < 10; count++) {
-		if (send_receive(comd, "AT+CREG?", answer))
-			return -1;
-		/* enregistr sur le rseau natif */
-		if (strmatch(answer, "+CREG: 0,1")) {
-			LOG("Registered with network, native");
-			return 0;
-		}
-		/* enregistr en roaming */
-		if (strmatch(answer, "+CREG: 0,5")) {
-			LOG("Registered with network, roaming");
-			return 0;
-		}
-		/* enregistrement interdit */
-		if (strmatch(answer, "+CREG: 0,3")) {
-			WARN("CREG permission denied");
-			return -1;
-		}
-		/* non enregistr, inactif */
-		/* on vient de rentrer le PIN, on double le temps d'attente */
-		if (strmatch(answer, "+CREG: 0,0")) {
-			DBG("Not registered with network yet");
-			usleep(UDELAY);
-			/* unknown, semble se produire une fois lorsqu'on monte l'interface pour la
-			 * premire fois */
-			} else if (strmatch(answer, "+CREG: 0,4")) {
-			DBG("Unknown CREG answer, wait a little and retry");
-			usleep(UDELAY);
-		/* si on n'est pas en recherche */
-		} else if (!strmatch(answer, "+CREG: 0,2")) {
-			ERROR(EPROTO, "CREG unexpected answer %s", answer);
-		}
-		usleep(UDELAY);
-	}
-	WARN("CREG timeout");
-	return -1;
+	return wait_net_registration(comd, REG_TIMEOUT);
 }
 
 static void
 acm_set_conn_down(int comd, char *interface)
 {
 	fixed_buf answer;
-	unsigned int count = 0;
 
-	while (acm_wait_enap(comd)) {
+	if (acm_get_enap(comd)) {
 		send_receive(comd, "AT*ENAP=0", answer);
 		if (!(strmatch(answer,"OK")) && !strmatch(answer,"ERROR"))
 			ERROR(EFAULT, "AT*ENAP error");
 
-		if (count++ >= 5)
-			ERROR(EADDRNOTAVAIL, "Timed out waiting "
-					"for expected connection status");
+		acm_wait_enap(comd, 0);
 	}
 	get_check_answer(comd, "AT+CFUN=4", answer, "OK");
 	acm_configure_net_down(interface);
@@ -312,20 +279,28 @@ acm_set_conn_down(int comd, char *interface)
 
 static int
 acm_monitor_connection(int comd, const char *filename,
-			const char *interface __attribute__((unused)),
+			const char *interface,
 			const char *ipsec)
 {
-	FILE *fd;
-	fixed_buf operator, answer;
+	struct at_cops cops;
+	struct at_cell cell;
+	struct at_csq csq;
+	struct quality_sample sample;
 	int level = 5;
 	int type;
-	int ret;
-	char sep;
-	char *typestr, profile[256];
-	size_t off, len;
+	char *typestr;
+
+	/* Interrogations groupes en une seule transaction */
+	struct at_query queries[] = {
+		{ .cmd = "AT+COPS?", .expected = "+COPS: " },
+		{ .cmd = "AT+CIND?", .expected = "+CIND: " },
+		{ .cmd = "AT*ERINFO?", .expected = "*ERINFO: " },
+		{ .cmd = "AT+CSQ", .expected = "+CSQ: " },
+	};
+
+	at_query_batch(comd, queries, sizeof(queries)/sizeof(queries[0]));
 
 	/* Lecture du nom Activation de la gestion automatique */
-	get_check_answer(comd, "AT+COPS?", answer, "+COPS: ");
 	/* +COPS: 0,0,"Orange F",2
 	 * <mode>
 	 *
@@ -354,28 +329,10 @@ acm_monitor_connection(int comd, const char *filename,
 	 *  3. Forbidden
 	 */
 
-	off = sizeof("+COPS: 0,0") - 1;
-	if (answer[off] != ',')
-		ERROR(EFAULT,
-			"operator, expected ',' at %zd in %s", off, answer);
-	off++;
-	if (answer[off] == '"') {
-		sep = '"';
-		off++;
-	} else {
-		sep = ',';
-	}
-	buf_cpy(operator, answer + off);
-	DBGV(2, "operator: %s (raw)", operator);
-
-	len = strlen(operator);
-	for (off = 0; off < len; off++) {
-		if (operator[off] == sep) {
-			operator[off] = '\0';
-			break;
-		}
-	}
-	DBGV(2, "operator: %s", operator);
+	if (at_parse_cops(queries[0].answer, &cops) || !cops.oper)
+		ERROR(EFAULT, "operator, unexpected answer %s",
+						queries[0].answer);
+	DBGV(2, "operator: %s", cops.oper);
 
 	/* Lecture de la qualit du signal
 	 *
@@ -393,13 +350,9 @@ acm_monitor_connection(int comd, const char *filename,
 						("callsetup",(0-3)),
 						("callheld",(0-1))
 	 */
-	get_check_answer(comd, "AT+CIND?", answer, "+CIND: ");
-	off = sizeof("+CIND: 0,") - 1;
-	ret = sscanf(answer + off,"%u,", &level);
-	if (ret < 1) {
-		ERROR_ERRNO("sscanf failed for AT+CIND");
-		return(1);
-	}
+	if (at_parse_cind(queries[1].answer, &level))
+		ERROR(EPROTO, "unexpected AT+CIND answer %s",
+						queries[1].answer);
 
 	DBGV(2, "level: %d", level);
 
@@ -424,22 +377,13 @@ acm_monitor_connection(int comd, const char *filename,
 	 * 1. UMTS service available
 	 * 2. HSDPA service available
 	 */
-	get_check_answer(comd, "AT*ERINFO?", answer, "*ERINFO: ");
-	off = sizeof("*ERINFO: 0,") - 1;
-	ret = sscanf(answer + off,"%u",&type);
-	if (ret < 1) {
-		ERROR_ERRNO("2G sscanf failed for AT*ERINFO");
-		return(1);
-	}
+	if (at_parse_erinfo(queries[2].answer, &cell))
+		ERROR(EPROTO, "unexpected AT*ERINFO answer %s",
+						queries[2].answer);
+	type = cell.gsm;
 
 	if ((type <= 0) || ((unsigned)type >= sizeof(types2G)/sizeof(char *))) {
-		off = sizeof("*ERINFO: 0,0,") - 1;
-		ret = sscanf(answer + off, "%u", &type);
-		if (ret < 1) {
-			ERROR_ERRNO("3G sscanf failed for AT*ERINFO");
-			return(1);
-		}
-
+		type = cell.umts;
 		if ((type < 0) || ((unsigned)type >= sizeof(types3G)/sizeof(char *)))
 			typestr= types2G[0];
 		else
@@ -448,23 +392,18 @@ acm_monitor_connection(int comd, const char *filename,
 		typestr = types2G[type];
 
 	DBGV(2, "net: %s", typestr);
-	fd = open_file(filename, WriteMode);
-	if (!fd) {
-		ERROR_ERRNO("can't open report file %s", filename);
-		return(1);
-	}
-	len = readlink(CONFLINK, profile, sizeof(profile) - 1);
-	if(len > 0) {
-		profile[len] = '\0';
-		fprintf(fd, "profile: %s\n", basename(profile));
-	} else {
-		fprintf(fd, "profile: \n");
-	}
-	fprintf(fd, "ipsec: %s\n", ipsec);
-	fprintf(fd, "type: umts\n");
-	fprintf(fd, "level: %d\n", level);
-	fprintf(fd, "%s (%s)\n", operator, typestr);
-	return close_file(filename, fd);
+
+	/* RSSI et BER bruts pour l'historique, le niveau publi reste
+	 * celui de AT+CIND */
+	quality_init(&sample, level, cops.oper, typestr);
+	if (at_parse_csq(queries[3].answer, &csq))
+		WARN("unexpected AT+CSQ answer %s", queries[3].answer);
+	else
+		quality_set_csq(&sample, &csq);
+	quality_record(interface, &sample);
+
+	return monitor_publish(filename, ipsec, level, "%s (%s)",
+					cops.oper, typestr);
 }
 
 umts_device_t acm_device =
@@ -472,9 +411,14 @@ umts_device_t acm_device =
 	.name = "ACM",
 	.device = "/dev/ttyACM1",
 	.interface = "wwan0",
+	.conn_retry = {
+		.initial = 250, .max_delay = 2000, .factor = 2,
+		.jitter = 20, .budget = CALL_TIMEOUT,
+	},
 	.init = acm_init,
 	.check_conn_up = acm_check_conn_up,
 	.wait_reg_status = acm_wait_reg_status,
 	.set_conn_down = acm_set_conn_down,
 	.monitor_connection = acm_monitor_connection,
+	.warm_start = acm_warm_start,
 };
@@ -8,5 +8,8 @@
 #define ACM_SCRIPT_UP 	HOOKS_DIR"/umts_acm_net_up.sh"
 #define ACM_SCRIPT_DOWN	HOOKS_DIR"/umts_acm_net_down.sh"
 
+/* Délai maximal d'attente de *EMRDY (ms) */
+#define ACM_EMRDY_TIMEOUT	5000U
+
 extern umts_device_t acm_device;
 #endif /* UMTS_ACM_H */
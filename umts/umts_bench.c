@@ -0,0 +1,314 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_bench - mesure de latence de umts_config sur modem simulé
+ *
+ *	Lance umts_sim, puis exécute n fois la séquence up / check / down
+ *	de umts_config_sim sur le pseudo-terminal ainsi créé, et affiche
+ *	la médiane et le 99e centile de la durée de chaque phase.
+ *	Avec -d, les requêtes passent par umtsd_sim, lancé sur le même
+ *	pseudo-terminal. Les arguments suivant "--" sont transmis à umts_sim.
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#include <dirent.h>
+
+#include "umts.h"
+
+#define BENCH_MAX_ITER 1000
+#define BENCH_SIM "./umts_sim"
+#define BENCH_CONFIG "./umts_config_sim"
+#define BENCH_DAEMON "./umtsd_sim"
+
+struct bench_type {
+	const char *name;	/* type du simulateur */
+	const char *driver;	/* type passé à umts_config */
+	const char *interface;
+};
+
+static const struct bench_type bench_types[] = {
+	{ "hso", "hso", "hso0" },
+	{ "acm", "cdc_ncm", "wwan0" },
+	{ "huawei", "qmi_wwan", "wwan0" },
+	{ "qmi", "qmi", "wwan0" },
+	{ "mbim", "cdc_mbim", "wwan0" },
+};
+
+static const char *const bench_phases[] = { "up", "check", "down" };
+#define BENCH_NPHASES (sizeof(bench_phases) / sizeof(bench_phases[0]))
+
+static int verbose;
+
+static void
+bench_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-t hso|acm|huawei|qmi|mbim] [-d] [-v] "
+			"[-- umts_sim options]\n", prog);
+	exit(EINVAL);
+}
+
+/* Lance le simulateur, retourne son pid et le nom de l'esclave */
+static pid_t
+bench_start_sim(const char *type, char **sim_args, int nargs,
+						fixed_buf slave)
+{
+	char *argv[32];
+	fixed_buf type_arg;
+	int fds[2], i, n = 0;
+	pid_t pid;
+	FILE *fp;
+
+	if (nargs > 26)
+		ERROR(E2BIG, "too many simulator arguments");
+
+	argv[n++] = BENCH_SIM;
+	argv[n++] = "-t";
+	buf_cpy(type_arg, type);
+	argv[n++] = type_arg;
+	for (i = 0; i < nargs; i++)
+		argv[n++] = sim_args[i];
+	argv[n] = NULL;
+
+	if (pipe(fds))
+		ERROR_ERRNO("pipe");
+
+	pid = fork();
+	switch (pid) {
+		case -1:
+			ERROR_ERRNO("fork");
+		case 0:
+			close(fds[0]);
+			if (dup2(fds[1], STDOUT_FILENO) < 0)
+				ERROR_ERRNO("dup2");
+			execv(argv[0], argv);
+			ERROR_ERRNO("execv %s", argv[0]);
+		default:
+			break;
+	}
+
+	close(fds[1]);
+	fp = fdopen(fds[0], "r");
+	if (!fp || !fgets(slave, MAX_LEN, fp))
+		ERROR(EIO, "failed to read simulator pty name");
+	fclose(fp);
+	strip_right(slave);
+
+	return pid;
+}
+
+/* Lance umtsd_sim et attend la création de son socket */
+static pid_t
+bench_start_daemon(const struct bench_type *bt, const char *sock)
+{
+	struct stat buf;
+	msec_t deadline;
+	pid_t pid;
+	int nullfd;
+
+	pid = fork();
+	switch (pid) {
+		case -1:
+			ERROR_ERRNO("fork");
+		case 0:
+			if (!verbose) {
+				nullfd = open("/dev/null", O_WRONLY);
+				if (nullfd >= 0)
+					dup2(nullfd, STDERR_FILENO);
+			}
+			execl(BENCH_DAEMON, BENCH_DAEMON, "-f", bt->driver,
+								(char *)NULL);
+			ERROR_ERRNO("execl %s", BENCH_DAEMON);
+		default:
+			break;
+	}
+
+	deadline = deadline_in(AT_TIMEOUT);
+	while (stat(sock, &buf)) {
+		if (!ms_left(deadline) || waitpid(pid, NULL, WNOHANG) == pid)
+			ERROR(ETIMEDOUT, "umtsd_sim did not start");
+		usleep(10000);
+	}
+	return pid;
+}
+
+/* Exécute une commande umts_config, retourne sa durée en ms */
+static double
+bench_run(const struct bench_type *bt, const char *phase,
+		const char *conf, const char *status)
+{
+	const int check = !strcmp(phase, "check");
+	struct timespec start, end;
+	pid_t pid;
+	int status_code, nullfd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	switch (pid) {
+		case -1:
+			ERROR_ERRNO("fork");
+		case 0:
+			if (!verbose) {
+				nullfd = open("/dev/null", O_WRONLY);
+				if (nullfd >= 0)
+					dup2(nullfd, STDERR_FILENO);
+			}
+			/* check lit le fichier de statut, up / down la config */
+			execl(BENCH_CONFIG, BENCH_CONFIG, check ? status : conf,
+				bt->driver, bt->interface, phase,
+				check ? "bench" : NULL, (char *)NULL);
+			ERROR_ERRNO("execl %s", BENCH_CONFIG);
+		default:
+			break;
+	}
+	if (waitpid(pid, &status_code, 0) != pid)
+		ERROR_ERRNO("waitpid");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!WIFEXITED(status_code) || WEXITSTATUS(status_code))
+		ERROR(EFAULT, "%s %s failed (status %d)", bt->name, phase,
+						WEXITSTATUS(status_code));
+
+	return (end.tv_sec - start.tv_sec) * 1000.0
+		+ (end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+/* Suppression du répertoire temporaire et de son contenu
+ * (configuration, statut, cache des capacités) */
+static void
+bench_cleanup(const char *dir)
+{
+	struct dirent *ent;
+	char path[PATH_MAX];
+	DIR *dp = opendir(dir);
+
+	if (dp) {
+		while ((ent = readdir(dp))) {
+			if (ent->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+			unlink(path);
+		}
+		closedir(dp);
+	}
+	rmdir(dir);
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Centile p (0-100) d'un échantillon trié, au rang le plus proche */
+static double
+bench_percentile(const double *sorted, unsigned int n, unsigned int p)
+{
+	unsigned int rank = (p * n + 99) / 100;
+
+	if (!rank)
+		rank = 1;
+	return sorted[rank - 1];
+}
+
+static void
+bench_write_file(const char *path, const char *content)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (!fp || fputs(content, fp) < 0 || fclose(fp))
+		ERROR_ERRNO("failed to write %s", path);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static double times[BENCH_NPHASES][BENCH_MAX_ITER];
+	const struct bench_type *bt = &bench_types[0];
+	char dir[] = "/tmp/umts_bench.XXXXXX";
+	fixed_buf slave, conf, status, sock;
+	unsigned int n = 20, i, p, t;
+	pid_t sim_pid, daemon_pid = 0;
+	int opt, use_daemon = 0;
+
+	while ((opt = getopt(argc, argv, "n:t:dv")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			if (!n || n > BENCH_MAX_ITER)
+				bench_usage(argv[0]);
+			break;
+		case 't':
+			for (t = 0; t < sizeof(bench_types)
+					/ sizeof(bench_types[0]); t++) {
+				if (!strcmp(optarg, bench_types[t].name))
+					break;
+			}
+			if (t == sizeof(bench_types) / sizeof(bench_types[0]))
+				bench_usage(argv[0]);
+			bt = &bench_types[t];
+			break;
+		case 'd':
+			use_daemon = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			bench_usage(argv[0]);
+		}
+	}
+
+	openlog("umts_bench", LOG_PERROR|LOG_PID, LOG_DAEMON);
+
+	if (!mkdtemp(dir))
+		ERROR_ERRNO("mkdtemp");
+	buf_format_string(conf, "%s/umts.conf", dir);
+	buf_format_string(status, "%s/net_status", dir);
+	buf_format_string(sock, "%s/umtsd.sock", dir);
+	bench_write_file(conf, "pin: 1234\napn: \"bench\"\n"
+			"identity: \"user\"\npassword: \"pass\"\n");
+	bench_write_file(status, "");
+
+	sim_pid = bench_start_sim(bt->name, argv + optind,
+					argc - optind, slave);
+
+	/* Sans -d, le socket n'existe pas et umts_config_sim exécute
+	 * les requêtes lui-même */
+	if (setenv("UMTS_SIM_DEVICE", slave, 1)
+			|| setenv("UMTS_SIM_SOCKET", sock, 1)
+			|| setenv("UMTS_SIM_RUN_DIR", dir, 1))
+		ERROR_ERRNO("setenv");
+	if (use_daemon)
+		daemon_pid = bench_start_daemon(bt, sock);
+
+	for (i = 0; i < n; i++) {
+		for (p = 0; p < BENCH_NPHASES; p++)
+			times[p][i] = bench_run(bt, bench_phases[p],
+						conf, status);
+	}
+
+	if (daemon_pid) {
+		kill(daemon_pid, SIGTERM);
+		waitpid(daemon_pid, NULL, 0);
+	}
+	kill(sim_pid, SIGTERM);
+	waitpid(sim_pid, NULL, 0);
+	bench_cleanup(dir);
+
+	printf("%-8s %-6s %6s %10s %10s %10s %10s\n",
+		(use_daemon) ? "umtsd" : "type", "phase", "n", "min(ms)", "p50(ms)", "p99(ms)", "max(ms)");
+	for (p = 0; p < BENCH_NPHASES; p++) {
+		qsort(times[p], n, sizeof(double), bench_cmp);
+		printf("%-8s %-6s %6u %10.1f %10.1f %10.1f %10.1f\n",
+			bt->name, bench_phases[p], n, times[p][0],
+			bench_percentile(times[p], n, 50),
+			bench_percentile(times[p], n, 99),
+			times[p][n - 1]);
+	}
+
+	closelog();
+	return EXIT_SUCCESS;
+}
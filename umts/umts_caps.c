@@ -0,0 +1,377 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_caps - cache des capacités du modem
+ *
+ *	Les variantes de commandes acceptées ou refusées par le modem et le
+ *	support de la concaténation sont conservés dans
+ *	UMTS_RUN_DIR/umts_caps.<clé>, la clé identifiant le modem : VID:PID
+ *	USB lu dans sysfs, à défaut modèle et IMEI (AT+CGMM, AT+CGSN). Cette
+ *	dernière clé est mémorisée pour le nœud du périphérique, tant qu'il
+ *	n'est pas recréé, afin de ne pas coûter deux commandes par exécution.
+ *	Les exécutions suivantes passent directement par la variante connue.
+ *	Le cache n'est qu'une optimisation : toute erreur sur le fichier
+ *	est ignorée, et une commande acceptée est de nouveau tentée.
+ *	Seul un refus explicite (ERROR) marque une commande non supportée,
+ *	pas une erreur +CME ERROR, souvent passagère (SIM occupée, pas de
+ *	réseau). Le cache est abandonné au rebranchement du modem (nœud du
+ *	périphérique recréé) et au bout de CAPS_MAX_AGE.
+ */
+
+#include "umts.h"
+
+/* Durée de validité du cache (s) */
+#define CAPS_MAX_AGE (24 * 3600)
+
+/* Noms des capacités dans le fichier, dans l'ordre de caps_t */
+static const char *const caps_names[CAP_MAX] = {
+	"qcpdpp",
+	"eiaaur",
+	"concat",
+	"cesq",
+};
+
+static const char *const caps_states[] = {
+	"unknown",
+	"ok",
+	"no",
+};
+
+static struct {
+	fixed_buf key;		/* vide : cache non persistant */
+	fixed_buf node;		/* vide : nœud inconnu */
+	time_t date;		/* première identification */
+	cap_state_t state[CAP_MAX];
+} caps;
+
+static int
+caps_read_attr(const char *dir, const char *attr, fixed_buf val)
+{
+	char path[PATH_MAX + MAX_LEN];
+	FILE *fp;
+	int ret = -1;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	if (fgets(val, MAX_LEN, fp)) {
+		strip_right(val);
+		ret = (val[0]) ? 0 : -1;
+	}
+	fclose(fp);
+	return ret;
+}
+
+/* Clé usb-<vid>-<pid>, lue dans le périphérique USB parent du tty */
+static int
+caps_usb_key(const char *device, fixed_buf key)
+{
+	char path[PATH_MAX], dir[PATH_MAX], *ptr;
+	const char *name = strrchr(device, '/');
+	fixed_buf vid, pid;
+	unsigned int i;
+
+	snprintf(path, sizeof(path), "/sys/class/tty/%s/device",
+					(name) ? name + 1 : device);
+	if (!realpath(path, dir))
+		return -1;
+
+	/* ttyUSB : port usb-serial, puis interface, puis périphérique ;
+	 * ttyACM : interface, puis périphérique */
+	for (i = 0; i < 4; i++) {
+		if (!caps_read_attr(dir, "idVendor", vid)
+				&& !caps_read_attr(dir, "idProduct", pid)) {
+			buf_format_two_strings(key, "usb-%s-%s", vid, pid);
+			return 0;
+		}
+		ptr = strrchr(dir, '/');
+		if (!ptr || ptr == dir)
+			break;
+		*ptr = '\0';
+	}
+	return -1;
+}
+
+/* Réponse d'une ligne à une commande d'identification */
+static int
+caps_ident(int comd, const char *cmd, fixed_buf val)
+{
+	struct at_resp resp;
+
+	if (at_transaction(comd, cmd, &resp, AT_TIMEOUT)
+			|| resp.result != AT_OK || !resp.nlines)
+		return -1;
+	buf_cpy(val, resp.lines[0]);
+	return 0;
+}
+
+/* Clé at-<modèle>-<IMEI>, pour les modems hors sysfs */
+static int
+caps_at_key(int comd, fixed_buf key)
+{
+	fixed_buf model, serial;
+
+	if (caps_ident(comd, "AT+CGMM", model)
+			|| caps_ident(comd, "AT+CGSN", serial))
+		return -1;
+	if (strlen(model) + strlen(serial) + sizeof("at--") > MAX_LEN)
+		return -1;
+	buf_format_two_strings(key, "at-%s-%s", model, serial);
+	return 0;
+}
+
+/* Identité du nœud du périphérique : il est recréé, et sa date de
+ * modification d'inode change, à chaque branchement du modem */
+static int
+caps_node(const char *device, fixed_buf node)
+{
+	struct stat st;
+
+	if (stat(device, &st))
+		return -1;
+	snprintf(node, MAX_LEN, "%lx-%lld.%09ld", (unsigned long)st.st_rdev,
+			(long long)st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+	return 0;
+}
+
+static void
+caps_key_path(char *path, size_t len, const char *device, const char *suffix)
+{
+	fixed_buf name;
+
+	buf_cpy(name, device);
+	run_key_sanitize(name);
+	snprintf(path, len, "%s/umts_caps_key.%s%s", umts_run_dir(), name,
+								suffix);
+}
+
+/* Clé AT mémorisée pour ce nœud, retourne -1 si elle est absente ou
+ * si le nœud a été recréé depuis */
+static int
+caps_key_read(const char *device, const char *node, fixed_buf key)
+{
+	char path[PATH_MAX];
+	fixed_buf saved;
+	FILE *fp;
+	int ret;
+
+	caps_key_path(path, sizeof(path), device, "");
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	ret = fscanf(fp, "node=%199s key=%199s", saved, key);
+	fclose(fp);
+	if (ret != 2 || strcmp(saved, node))
+		return -1;
+	return 0;
+}
+
+static void
+caps_key_save(const char *device, const char *node, const char *key)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	FILE *fp;
+
+	caps_key_path(path, sizeof(path), device, "");
+	caps_key_path(tmp, sizeof(tmp), device, ".tmp");
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		WARN_ERRNO("failed to open %s", tmp);
+		return;
+	}
+	fprintf(fp, "node=%s\nkey=%s\n", node, key);
+	if (fclose(fp) || rename(tmp, path))
+		WARN_ERRNO("failed to write %s", path);
+}
+
+/* Clé du modem : sysfs, à défaut clé AT mémorisée ou interrogation */
+static int
+caps_key(const char *device, const char *node, int comd, fixed_buf key)
+{
+	if (!caps_usb_key(device, key)) {
+		run_key_sanitize(key);
+		return 0;
+	}
+	if (node[0] && !caps_key_read(device, node, key))
+		return 0;
+	if (caps_at_key(comd, key))
+		return -1;
+	run_key_sanitize(key);
+	if (node[0])
+		caps_key_save(device, node, key);
+	return 0;
+}
+
+static void
+caps_path(char *path, size_t len, const char *suffix)
+{
+	snprintf(path, len, "%s/umts_caps.%s%s", umts_run_dir(), caps.key,
+								suffix);
+}
+
+static void
+caps_save(void)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	unsigned int i;
+	FILE *fp;
+
+	if (!caps.key[0])
+		return;
+	caps_path(path, sizeof(path), "");
+	caps_path(tmp, sizeof(tmp), ".tmp");
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		WARN_ERRNO("failed to open %s", tmp);
+		return;
+	}
+	fprintf(fp, "key=%s\n", caps.key);
+	fprintf(fp, "node=%s\n", caps.node);
+	fprintf(fp, "date=%lld\n", (long long)caps.date);
+	for (i = 0; i < CAP_MAX; i++)
+		fprintf(fp, "%s=%s\n", caps_names[i], caps_states[caps.state[i]]);
+	if (fclose(fp) || rename(tmp, path))
+		WARN_ERRNO("failed to write %s", path);
+}
+
+/* Lecture du cache, retourne -1 s'il est absent, ne correspond pas à
+ * ce modem ou a expiré */
+static int
+caps_read(void)
+{
+	char path[PATH_MAX], line[MAX_LEN], *val;
+	unsigned int i, s;
+	int found = 0, same_node = 0;
+	time_t now = time(NULL);
+	FILE *fp;
+
+	caps_path(path, sizeof(path), "");
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		strip_right(line);
+		val = strchr(line, '=');
+		if (!val)
+			continue;
+		*val++ = '\0';
+		if (!strcmp(line, "key")) {
+			found = !strcmp(val, caps.key);
+		} else if (!strcmp(line, "node")) {
+			same_node = !strcmp(val, caps.node);
+		} else if (!strcmp(line, "date")) {
+			caps.date = (time_t)strtoll(val, NULL, 10);
+		} else {
+			for (i = 0; i < CAP_MAX; i++) {
+				if (strcmp(line, caps_names[i]))
+					continue;
+				for (s = 0; s < sizeof(caps_states)
+						/ sizeof(caps_states[0]); s++) {
+					if (!strcmp(val, caps_states[s]))
+						caps.state[i] = s;
+				}
+			}
+		}
+	}
+	fclose(fp);
+	if (!found)
+		return -1;
+	if (!same_node) {
+		DBG("modem %s plugged again, capabilities probed again",
+								caps.key);
+		return -1;
+	}
+	if (caps.date > now || now - caps.date > CAPS_MAX_AGE) {
+		DBG("capabilities of %s expired", caps.key);
+		return -1;
+	}
+	return 0;
+}
+
+/* Identification du modem et chargement de ses capacités connues.
+ * Dans umtsd, celles de la requête précédente restent valables tant
+ * que le nœud n'a pas été recréé et qu'elles n'ont pas expiré. */
+void
+caps_load(const umts_device_t *umts_device, int comd)
+{
+	fixed_buf node;
+	time_t now = time(NULL);
+	unsigned int i;
+
+	if (caps_node(umts_device->device, node))
+		node[0] = '\0';
+	if (caps.key[0] && node[0] && !strcmp(node, caps.node)
+			&& caps.date <= now && now - caps.date <= CAPS_MAX_AGE)
+		return;
+
+	memset(&caps, 0, sizeof(caps));
+	buf_cpy(caps.node, node);
+	if (caps_key(umts_device->device, caps.node, comd, caps.key)) {
+		DBG("modem not identified, capabilities not cached");
+		caps.key[0] = '\0';
+		return;
+	}
+
+	if (!caps_read()) {
+		for (i = 0; i < CAP_MAX; i++)
+			DBGV(2, "cap %s: %s", caps_names[i],
+						caps_states[caps.state[i]]);
+		return;
+	}
+
+	memset(caps.state, 0, sizeof(caps.state));
+	caps.date = time(NULL);
+	LOG("new modem %s", caps.key);
+	caps_save();
+}
+
+cap_state_t
+caps_get(caps_t cap)
+{
+	return caps.state[cap];
+}
+
+void
+caps_set(caps_t cap, cap_state_t state)
+{
+	if (caps.state[cap] == state)
+		return;
+	DBG("cap %s: %s -> %s", caps_names[cap], caps_states[caps.state[cap]],
+						caps_states[state]);
+	caps.state[cap] = state;
+	caps_save();
+}
+
+/* Envoi d'une commande optionnelle. Une commande connue pour être
+ * refusée n'est pas envoyée. Retourne 0 si elle est acceptée, -1 si elle
+ * est refusée ou en erreur (answer contient alors le code d'erreur) ou
+ * sans réponse. */
+int
+caps_command(int comd, caps_t cap, const char *cmd, fixed_buf answer)
+{
+	struct at_resp resp;
+
+	if (caps.state[cap] == CAP_NO) {
+		DBG("cap %s: not supported, skipped", caps_names[cap]);
+		buf_cpy(answer, "ERROR");
+		return -1;
+	}
+
+	if (at_transaction(comd, cmd, &resp, AT_TIMEOUT)) {
+		buf_cpy(answer, (resp.nlines) ? resp.lines[0] : "");
+		return -1;
+	}
+	buf_cpy(answer, (resp.nlines) ? resp.lines[0] : resp.final);
+
+	if (resp.result == AT_OK) {
+		caps_set(cap, CAP_OK);
+		return 0;
+	}
+	/* commande inconnue ; +CME ERROR ne dit rien de son support */
+	if (!strcmp(resp.final, "ERROR"))
+		caps_set(cap, CAP_NO);
+	return -1;
+}
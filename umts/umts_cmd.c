@@ -0,0 +1,199 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_cmd - exécution des commandes up / down / check,
+ *	commune à umts_config (exécution locale) et à umtsd
+ */
+
+#include "umts.h"
+#include "netstatus.h"
+
+/* Sélection du pilote d'après le type de périphérique */
+umts_device_t *
+get_device(const char *type)
+{
+	umts_device_t *umts_device;
+
+	if (strmatch(type, "hso"))
+		umts_device = &hso_device;
+	else if (strmatch(type, "cdc_ncm"))
+		umts_device = &acm_device;
+	else if (strmatch(type, "qmi_wwan"))
+		umts_device = &huawei_device;
+	else if (!strcmp(type, "qmi"))
+		/* qmi_wwan piloté en QMI natif sur cdc-wdm */
+		umts_device = &qmi_device;
+	else if (strmatch(type, "cdc_mbim") || !strcmp(type, "mbim"))
+		/* MBIM sur cdc-wdm, y compris pour cdc_ncm sur demande */
+		umts_device = &mbim_device;
+	else
+		ERROR(EUNSUPDEV, "unsupported device type: %s", type);
+
+#ifdef UMTS_SIM
+	/* Simulator build: control device is the umts_sim pty */
+	if (getenv("UMTS_SIM_DEVICE"))
+		umts_device->device = getenv("UMTS_SIM_DEVICE");
+#endif
+	return umts_device;
+}
+
+/* Chemin du socket de umtsd */
+const char *
+umtsd_socket(void)
+{
+#ifdef UMTS_SIM
+	if (getenv("UMTS_SIM_SOCKET"))
+		return getenv("UMTS_SIM_SOCKET");
+#endif
+	return UMTSD_SOCKET;
+}
+
+/* On vérifie que le device de contrôle est présent */
+void
+check_device(const umts_device_t *umts_device)
+{
+	struct stat buf;
+
+	if (stat(umts_device->device, &buf))
+		ERROR_ERRNO("can't stat device %s", umts_device->device);
+
+	if (!S_ISCHR(buf.st_mode))
+		ERROR(ENODEV,
+			"%s is not the device we're looking for", umts_device->device);
+}
+
+/* Validation des paramètres de la requête */
+void
+check_request(const umts_device_t *umts_device,
+				const struct umts_request *req)
+{
+	struct stat buf;
+
+	if (!(strmatch(req->cmd, "up")) && !(strmatch(req->cmd, "down"))
+					&& !(strmatch(req->cmd, "check")))
+		ERROR(EINVAL, "unsupported command : %s", req->cmd);
+
+	if (!(strmatch(req->interface, umts_device->interface))
+				&& !(strmatch(req->interface, "eth0")))
+		ERROR(EINVAL, "unsupported interface name : %s", req->interface);
+
+	if (stat(req->filename, &buf))
+		ERROR_ERRNO("can't stat config file %s", req->filename);
+
+	if (!S_ISREG(buf.st_mode))
+		ERROR(EINVAL, "config file %s is not a regular file",
+							req->filename);
+}
+
+/* Vérification du PIN, par le pilote s'il a sa propre méthode */
+static int
+device_check_pin(const umts_device_t *umts_device, int comd,
+					struct cdata *p_conn_data)
+{
+	if (umts_device->check_pin)
+		return umts_device->check_pin(comd, p_conn_data);
+	return check_pin_status(comd, p_conn_data);
+}
+
+/* Fichier de configuration en cours de lecture, refermé par
+ * request_cleanup() si une erreur interrompt la requête */
+static FILE *req_conf;
+
+/* Exécution d'une requête validée sur un port série déjà ouvert.
+ * Les erreurs (ERROR) terminent le processus, ou pour umtsd la seule
+ * requête, qui appelle alors request_cleanup(). */
+void
+run_request(umts_device_t *umts_device, int comd, struct umts_request *req)
+{
+	struct cdata conn_data;
+
+	memset(&conn_data, 0, sizeof(conn_data));
+	/* les capacités ne portent que sur des variantes de commandes AT */
+	if (!umts_device->raw)
+		caps_load(umts_device, comd);
+
+	if (strmatch(req->cmd, "check")) {
+		phase_begin("monitor");
+		DBG("checking interface %s", req->interface);
+		umts_device->monitor_connection(comd, req->filename,
+			req->interface, req->ipsec[0] ? req->ipsec : NULL);
+	} else if (strmatch(req->cmd, "up")) {
+		LOG("setting interface %s up", req->interface);
+		req_conf = open_file(req->filename, ReadMode);
+		if (!req_conf)
+			ERROR_ERRNO("can't open config file %s", req->filename);
+
+		parse_conf(req_conf, &conn_data);
+		close_file(req->filename, req_conf);
+		req_conf = NULL;
+
+		if (!lease_warm_start(umts_device, comd, req->filename,
+					&conn_data, req->interface))
+			return;
+
+		phase_begin("pin");
+		if (device_check_pin(umts_device, comd, &conn_data))
+			ERROR(EPROTO, "Error checking PIN");
+		phase_begin("register");
+		umts_device->wait_reg_status(comd);
+
+		/* les pilotes détaillent : apn, call, conn_params, net_up */
+		phase_begin("connect");
+		umts_device->check_conn_up(comd, &conn_data, req->interface);
+		lease_save(req->filename, &conn_data);
+	} else if (strmatch(req->cmd, "down")) {
+		LOG("setting interface %s down", req->interface);
+		lease_clear(req->filename);
+		phase_begin("pin");
+		if (!device_check_pin(umts_device, comd, &conn_data)) {
+			phase_begin("disconnect");
+			umts_device->set_conn_down(comd, req->interface);
+		}
+	}
+}
+
+/* Libération des ressources d'une requête interrompue par une erreur */
+void
+request_cleanup(void)
+{
+	if (req_conf) {
+		(void)fclose(req_conf);
+		req_conf = NULL;
+	}
+}
+
+/* Publication de l'état du lien par monitor_connection : enregistrement
+ * complet (profil, ipsec, type, niveau, description), publié d'un bloc */
+int
+monitor_publish(const char *filename, const char *ipsec, int level,
+				const char *fmt, ...)
+{
+	struct netstatus st;
+	char desc[NETSTATUS_LINE_LEN];
+	fixed_buf val;
+	va_list ap;
+	int lock, err;
+
+	va_start(ap, fmt);
+	vsnprintf(desc, sizeof(desc), fmt, ap);
+	va_end(ap);
+	buf_format(val, "%d", level);
+
+	lock = netstatus_lock(filename);
+	if (lock < 0)
+		ERROR_ERRNO("can't lock report file %s", filename);
+	netstatus_init(&st);
+	if (netstatus_set(&st, "ipsec", (ipsec) ? ipsec : "")
+			|| netstatus_set(&st, "type", "umts")
+			|| netstatus_set(&st, "level", val)
+			|| netstatus_add(&st, desc)
+			|| netstatus_publish(&st, filename)) {
+		/* le verrou ne doit pas survivre à la requête (umtsd) */
+		err = errno;
+		netstatus_unlock(lock);
+		ERROR(err, "can't publish report file %s: %s", filename,
+							strerror(err));
+	}
+	netstatus_unlock(lock);
+	return 0;
+}
@@ -2,6 +2,33 @@
 // Copyright © 2008-2018 ANSSI. All Rights Reserved.
 #include "umts.h"
 
+/*********************************************************/
+/** Fin sur erreur                                      **/
+/*********************************************************/
+jmp_buf *umts_request_env;
+volatile sig_atomic_t umts_stop;
+
+void
+umts_exit(int err)
+{
+	jmp_buf *env = umts_request_env;
+
+	if (!env)
+		exit(err);
+	umts_request_env = NULL;
+	/* longjmp() avec 0 reviendrait comme un succès */
+	longjmp(*env, (err) ? err : EFAULT);
+}
+
+/* Attente interrompue par un signal : abandon de la requête en cours
+ * si umtsd doit s'arrêter */
+static void
+check_stop(void)
+{
+	if (umts_stop && umts_request_env)
+		ERROR(EINTR, "request interrupted");
+}
+
 /*********************************************************/
 /** Ouverture/fermeture de fichier                      **/
 /*********************************************************/
@@ -176,59 +203,360 @@ parse_conf(FILE *fd, struct cdata *p_conn_data)
 }
 
 /*********************************************************/
-/** Parsing des données issues de OWANDATA **/
+/** Paramètres IP issus de OWANDATA / DHCP **/
 /*********************************************************/
 void
-check_ipaddr(const fixed_buf ip)
+set_ipconf(struct cdata *p_conn_data, const struct at_ipconf *ipconf)
 {
-	unsigned int i, A[4];
+	inet_ntop(AF_INET, &ipconf->addr, p_conn_data->ip_address, MAX_LEN);
+	inet_ntop(AF_INET, &ipconf->gw, p_conn_data->gateway, MAX_LEN);
+	inet_ntop(AF_INET, &ipconf->dns1, p_conn_data->dns1, MAX_LEN);
+	inet_ntop(AF_INET, &ipconf->dns2, p_conn_data->dns2, MAX_LEN);
+	if (ipconf->has_mask)
+		inet_ntop(AF_INET, &ipconf->mask, p_conn_data->mask, MAX_LEN);
+
+	DBGV(2, "Connection parameters: IP=%s/%s GW=%s DNS1=%s DNS2=%s",
+		p_conn_data->ip_address,
+		p_conn_data->mask,
+		p_conn_data->gateway,
+		p_conn_data->dns1,
+		p_conn_data->dns2);
+}
 
-	int ret = sscanf(ip, "%u.%u.%u.%u", A, A + 1, A + 2, A + 3);
-	if (ret != 4)
-		ERROR(EINVAL, "Failed to read members of "
-				"IP addr %s: %d found", ip, ret);
+/*********************************************************/
+/** Fichiers d'état **/
+/*********************************************************/
+/* Répertoire des fichiers d'état */
+const char *
+umts_run_dir(void)
+{
+#ifdef UMTS_SIM
+	if (getenv("UMTS_SIM_RUN_DIR"))
+		return getenv("UMTS_SIM_RUN_DIR");
+#endif
+	return UMTS_RUN_DIR;
+}
 
-	for (i = 0; i < 4; i++) {
-		if (A[i] > 255)
-			ERROR(EINVAL, "Invalid member %u of "
-					"IP addr %s", i, ip);
+/* Remplace dans une clé de fichier d'état les caractères impropres
+ * à un nom de fichier */
+void
+run_key_sanitize(char *key)
+{
+	for (; *key; key++) {
+		if (!((*key >= 'a' && *key <= 'z') || (*key >= 'A' && *key <= 'Z')
+				|| (*key >= '0' && *key <= '9')
+				|| *key == '-' || *key == '.'))
+			*key = '_';
 	}
 }
 
+/*********************************************************/
+/** Horloge monotone **/
+/*********************************************************/
+msec_t
+clock_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		ERROR_ERRNO("clock_gettime");
+
+	return (msec_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*********************************************************/
+/** Chronométrage des phases **/
+/*********************************************************/
+/* Chaque exécution d'une commande est découpée en phases successives
+ * (phase_begin() clôt la précédente) ; une phase reprise plus tard
+ * cumule ses durées et compteurs. À la sortie du processus, y compris
+ * sur ERROR(), un enregistrement clé=valeur est émis vers syslog, et
+ * écrit dans $UMTS_TIMING_DIR/umts_timing.<cmd> si cette variable est
+ * définie. */
+#define MAX_PHASES 12
+#define TIMING_LEN 1024
+
+struct umts_counters umts_counters;
+
+struct phase {
+	const char *name;
+	msec_t ms;
+	struct umts_counters cnt;
+};
+
+static struct {
+	const char *cmd;	/* NULL tant que timing_start() n'est pas appelé */
+	fixed_buf cmd_buf;
+	msec_t start;
+	unsigned int nphases;
+	struct phase phases[MAX_PHASES];
+	/* phase en cours */
+	struct phase *cur;
+	msec_t cur_start;
+	struct umts_counters cur_cnt;
+} timing;
+
+static void
+phase_close(void)
+{
+	struct phase *ph = timing.cur;
+
+	if (!ph)
+		return;
+	ph->ms += clock_ms() - timing.cur_start;
+	ph->cnt.at += umts_counters.at - timing.cur_cnt.at;
+	ph->cnt.tx += umts_counters.tx - timing.cur_cnt.tx;
+	ph->cnt.rx += umts_counters.rx - timing.cur_cnt.rx;
+	timing.cur = NULL;
+}
+
 void
-get_ipaddr(fixed_buf dst, const char *src,
-		const char *name __attribute__((unused)), size_t *curoff)
+phase_begin(const char *name)
 {
-	size_t off, len;
+	struct phase *ph = NULL;
+	unsigned int i;
 
-	buf_cpy(dst, src + *curoff);
-	len = strlen(dst);
+	if (!timing.cmd)
+		return;
+	phase_close();
 
-	for (off = 0; off < len; off++) {
-		if (dst[off] == ',') {
-			dst[off] = '\0';
-			break;
+	for (i = 0; i < timing.nphases; i++) {
+		if (!strcmp(timing.phases[i].name, name))
+			ph = &timing.phases[i];
+	}
+	if (!ph) {
+		if (timing.nphases == MAX_PHASES) {
+			WARN("too many phases, %s not timed", name);
+			return;
 		}
+		ph = &timing.phases[timing.nphases++];
+		memset(ph, 0, sizeof(*ph));
+		ph->name = name;
 	}
-	check_ipaddr(dst);
-	DBGV(2, "%s : %s", name, dst);
-	*curoff += off + 1;
-	if (src[*curoff] != ' ')
-		ERROR(EINVAL, "expected whitespace: %s", src + *curoff);
+	timing.cur = ph;
+	timing.cur_start = clock_ms();
+	timing.cur_cnt = umts_counters;
+}
+
+/* Ajout formaté à un tampon de TIMING_LEN octets */
+static void
+timing_append(char *buf, size_t *off, const char *fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+
+static void
+timing_append(char *buf, size_t *off, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
 
-	*curoff += 1;
+	if (*off >= TIMING_LEN)
+		return;
+	va_start(ap, fmt);
+	ret = vsnprintf(buf + *off, TIMING_LEN - *off, fmt, ap);
+	va_end(ap);
+	if (ret > 0)
+		*off += ret;
+}
+
+static void
+timing_write_file(const char *record)
+{
+	const char *dir = getenv("UMTS_TIMING_DIR");
+	char path[PATH_MAX], tmp[PATH_MAX];
+	FILE *fp;
+
+	if (!dir || !*dir)
+		return;
+	snprintf(path, sizeof(path), "%s/umts_timing.%s", dir, timing.cmd);
+	snprintf(tmp, sizeof(tmp), "%s/umts_timing.%s.tmp", dir, timing.cmd);
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		WARN_ERRNO("failed to open %s", tmp);
+		return;
+	}
+	fputs(record, fp);
+	if (fclose(fp) || rename(tmp, path))
+		WARN_ERRNO("failed to write %s", path);
+}
+
+/* Rapport de chronométrage de la commande en cours, une seule fois */
+void
+timing_end(int status)
+{
+	char line[TIMING_LEN], file[TIMING_LEN];
+	size_t loff = 0, foff = 0;
+	msec_t total;
+	unsigned int i;
+	struct phase *ph;
+
+	if (!timing.cmd)
+		return;
+	phase_close();
+	total = clock_ms() - timing.start;
+
+	timing_append(line, &loff, "timing: cmd=%s status=%d total_ms=%llu "
+		"at=%u tx=%lu rx=%lu", timing.cmd, status, total,
+		umts_counters.at, umts_counters.tx, umts_counters.rx);
+	timing_append(file, &foff, "cmd=%s\nstatus=%d\ntotal_ms=%llu\n"
+		"at=%u\ntx=%lu\nrx=%lu\n", timing.cmd, status, total,
+		umts_counters.at, umts_counters.tx, umts_counters.rx);
+
+	for (i = 0; i < timing.nphases; i++) {
+		ph = &timing.phases[i];
+		timing_append(line, &loff, " %s_ms=%llu %s_at=%u",
+			ph->name, ph->ms, ph->name, ph->cnt.at);
+		timing_append(file, &foff, "phase=%s ms=%llu at=%u "
+			"tx=%lu rx=%lu\n", ph->name, ph->ms, ph->cnt.at,
+			ph->cnt.tx, ph->cnt.rx);
+	}
+
+	LOG("%s", line);
+	timing_write_file(file);
+	timing.cmd = NULL;
+}
+
+static void
+timing_exit(int status, void *arg __attribute__((unused)))
+{
+	timing_end(status);
+}
+
+/* Début du chronométrage d'une commande, première phase "setup" */
+void
+timing_start(const char *cmd)
+{
+	static int registered;
+
+	buf_cpy(timing.cmd_buf, cmd);
+	timing.cmd = timing.cmd_buf;
+	timing.start = clock_ms();
+	timing.nphases = 0;
+	timing.cur = NULL;
+	memset(&umts_counters, 0, sizeof(umts_counters));
+	if (!registered && on_exit(timing_exit, NULL))
+		WARN("failed to register timing report");
+	registered = 1;
+	phase_begin("setup");
+}
+
+/*********************************************************/
+/** Relances **/
+/*********************************************************/
+/* Usage :
+ *	retry_start(&r, "AT_OBLS", &umts_device->init_retry);
+ *	while (retry_next(&r, comd)) {
+ *		if (succès) { retry_end(&r, 1); return 0; }
+ *		if (état terminal) break;
+ *	}
+ *	retry_end(&r, 0);
+ */
+void
+retry_start(struct retry *r, const char *what,
+			const struct retry_policy *policy)
+{
+	static int seeded;
+
+	if (!seeded) {
+		srandom(getpid() ^ (unsigned int)clock_ms());
+		seeded = 1;
+	}
+	r->what = what;
+	r->policy = policy;
+	r->start = clock_ms();
+	r->deadline = r->start + policy->budget;
+	r->attempts = 0;
+	r->delay = policy->initial;
+}
+
+/* Autorise un nouvel essai, après le délai courant pour les suivants.
+ * Les URC reçus pendant l'attente sont traités.
+ * Retourne 0 si le budget est épuisé ou le port inutilisable. */
+int
+retry_next(struct retry *r, int comd)
+{
+	const struct retry_policy *policy = r->policy;
+	unsigned int wait;
+	msec_t until;
+
+	if (r->attempts) {
+		if (!ms_left(r->deadline))
+			return 0;
+		wait = r->delay;
+		if (policy->jitter)
+			wait += random() % (wait * policy->jitter / 100 + 1);
+		until = deadline_in(wait);
+		if (until > r->deadline)
+			until = r->deadline;
+		if (serial_idle(comd, until))
+			return 0;
+		if (!ms_left(r->deadline))
+			return 0;
+
+		if (policy->factor > 1)
+			r->delay *= policy->factor;
+		if (r->delay > policy->max_delay)
+			r->delay = policy->max_delay;
+	}
+	r->attempts++;
+	return 1;
+}
+
+/* Trace du nombre d'essais effectifs, pour l'ajustement des politiques */
+void
+retry_end(struct retry *r, int success)
+{
+	LOG("retry: what=%s result=%s attempts=%u elapsed_ms=%llu budget_ms=%u",
+		r->what, (success) ? "ok" : "failed", r->attempts,
+		clock_ms() - r->start, r->policy->budget);
 }
 
 /*********************************************************/
 /** Gestion du port série **/
 /*********************************************************/
+/* Taille du tampon circulaire de réception */
+#define RX_BUF_LEN 1024
+
+/* État associé à chaque port série ouvert */
+struct serial_port {
+	int comd;
+	unsigned int char_delay;
+	/* périphérique à messages binaires (cdc-wdm), hors AT */
+	int raw;
+	/* appelé par close_serial(), port encore ouvert */
+	void (*at_close)(int comd);
+	/* mémorisation de la configuration initiale */
+	struct termios memorized_conf;
+	/* octets reçus non encore consommés */
+	char rx_buf[RX_BUF_LEN];
+	size_t rx_head, rx_len;
+};
+
+#define MAX_PORTS 2
+static struct serial_port ports[MAX_PORTS] = {
+	{ .comd = -1 }, { .comd = -1 }
+};
+
+static struct serial_port *
+port_get(int comd)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_PORTS; i++) {
+		if (ports[i].comd == comd)
+			return &ports[i];
+	}
+	return NULL;
+}
+
 /* Configuration de la communication série */
 void
 setcom(int comd)
 {
 	struct termios stbuf;
+	struct serial_port *port = port_get(comd);
 
-  if (tcgetattr(comd, &memorized_conf) == -1)
+	if (port && tcgetattr(comd, &port->memorized_conf) == -1)
 		ERROR_ERRNO("tcgetattr");
 	if (tcgetattr(comd, &stbuf) == -1 )
 		ERROR_ERRNO("tcgetattr");
@@ -258,13 +586,27 @@ setcom(int comd)
 
 /* Initialisation de la communication série */
 int
-initiate_serial(const char *device)
+initiate_serial(const umts_device_t *umts_device)
 {
 	int comd;
+	struct serial_port *port;
 
-	comd = open(device, O_RDWR|O_EXCL|O_NONBLOCK|O_NOCTTY);
+	comd = open(umts_device->device, O_RDWR|O_EXCL|O_NONBLOCK|O_NOCTTY);
 	if (comd < 0)
-		ERROR_ERRNO("open device %s", device);
+		ERROR_ERRNO("open device %s", umts_device->device);
+
+	port = port_get(-1);
+	if (!port)
+		ERROR(EMFILE, "too many serial ports open");
+	port->comd = comd;
+	port->char_delay = umts_device->char_delay;
+	port->raw = umts_device->raw;
+	port->at_close = NULL;
+	port->rx_head = port->rx_len = 0;
+
+	/* cdc-wdm n'est pas un terminal */
+	if (port->raw)
+		return comd;
 
 	setcom(comd);
 
@@ -279,16 +621,34 @@ initiate_serial(const char *device)
 void
 close_serial(int comd)
 {
+	struct serial_port *port;
+
 	if (comd >= 0) {
 		/*
 		 * if (tcflush(comd, TCIOFLUSH) == -1)
 		 * 	Error(errno, "tcflush");*/
 		/* if (tcsetattr(comd, TCSANOW, &memorized_conf) < 0)
 		 * 	Error(errno, "tcsetattr");*/
+		port = port_get(comd);
+		if (port && port->at_close)
+			port->at_close(comd);
+		if (port)
+			port->comd = -1;
 		close(comd);
 	}
 }
 
+/* Enregistre une fonction de nettoyage exécutée à la fermeture du port
+ * par close_serial(), avant celle du descripteur */
+void
+serial_at_close(int comd, void (*fn)(int comd))
+{
+	struct serial_port *port = port_get(comd);
+
+	if (port)
+		port->at_close = fn;
+}
+
 /*********************************************************/
 /** Fonctions d'écriture/lecture sur le port série **/
 /*********************************************************/
@@ -308,16 +668,60 @@ retry:
 	}
 	if (wret != 1)
  		ERROR(EFAULT, "write char %c returned %zu", c, wret);
+	umts_counters.tx++;
 
 	DBGV(3, "write -> %c", c);
 }
 
+/* Write a whole buffer in as few write() calls as possible, then wait
+ * for it to be transmitted. The device is opened O_NONBLOCK, so a full
+ * output queue is waited upon rather than treated as an error. */
+void
+writebuf(int comd, const char *buf, size_t len)
+{
+	struct serial_port *port = port_get(comd);
+	struct pollfd pfd;
+	ssize_t wret;
+	size_t off = 0;
+	int num;
+
+	while (off < len) {
+		wret = write(comd, buf + off, len - off);
+		if (wret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				ERROR_ERRNO("write failed on serial device");
+			pfd.fd = comd;
+			pfd.events = POLLOUT;
+			num = poll(&pfd, 1, UDELAY / 1000);
+			if (num < 0 && errno != EINTR)
+				ERROR_ERRNO("poll failed on serial device");
+			if (!num)
+				ERROR(ETIMEDOUT, "write timeout on serial device");
+			continue;
+		}
+		if (!wret)
+			ERROR(EFAULT, "write returned 0 on serial device");
+		off += wret;
+		umts_counters.tx += wret;
+	}
+
+	if (port && port->raw)
+		return;
+	while (tcdrain(comd) == -1) {
+		if (errno != EINTR)
+			ERROR_ERRNO("tcdrain");
+	}
+}
+
 /* Write a null-terminated string to communication device */
 void
 writecom(int comd, const char *text)
 {
+	struct serial_port *port = port_get(comd);
+	char buf[MAX_LEN + 1];
 	size_t off, len;
-	char c;
 
 	/*
 	 * if(tcflush(comd, TCIOFLUSH) == -1)
@@ -326,137 +730,577 @@ writecom(int comd, const char *text)
 	DBGV(2, "-> %s",text);
 
 	len = strlen(text);
-	for (off = 0; off < len; off++) {
-		c = text[off];
-		writechar(comd, c);
-		usleep(MUDELAY);
+	if (len >= MAX_LEN)
+		ERROR(EMSGSIZE, "command too long: %zu", len);
+
+	if (port && port->char_delay) {
+		/* Emission caractère par caractère, pour les modems
+		 * qui ne supportent pas une émission en bloc */
+		for (off = 0; off < len; off++) {
+			writechar(comd, text[off]);
+			usleep(port->char_delay);
+		}
+		writechar(comd, '\015');
+		return;
 	}
-	c = '\015';
-	writechar(comd, c);
+
+	memcpy(buf, text, len);
+	buf[len++] = '\015';
+	writebuf(comd, buf, len);
 }
 
-/* Gets a blob from comm. device.
- * Return EOF if none avail. */
+/* Extrait une ligne complète du tampon de réception, sans ses
+ * terminateurs. Retourne 1 si une ligne a été extraite, 0 si le tampon
+ * ne contient pas encore de ligne complète, -1 si la ligne dépasse
+ * la taille d'un fixed_buf (elle est alors ignorée). */
+static int
+rx_getline(struct serial_port *port, fixed_buf line)
+{
+	size_t i, pos, len = 0;
+	int overflow = 0;
+
+	for (i = 0; i < port->rx_len; i++) {
+		pos = (port->rx_head + i) % RX_BUF_LEN;
+		if (port->rx_buf[pos] == '\n')
+			break;
+	}
+	if (i == port->rx_len)
+		return 0;
+
+	for (;;) {
+		char c = port->rx_buf[port->rx_head];
+		port->rx_head = (port->rx_head + 1) % RX_BUF_LEN;
+		port->rx_len--;
+		if (c == '\n')
+			break;
+		if (len < MAX_LEN - 1)
+			line[len++] = c;
+		else
+			overflow = 1;
+	}
+	line[len] = '\0';
+
+	return (overflow) ? -1 : 1;
+}
+
+/* Lit tout ce qui est disponible sur le port, dans la limite de
+ * l'espace libre du tampon de réception.
+ * Retourne le nombre d'octets lus, 0 sur EOF, -1 sur erreur
+ * (errno vaut EAGAIN si rien n'était finalement disponible). */
+static ssize_t
+rx_fill(struct serial_port *port)
+{
+	size_t tail, room;
+	ssize_t rret;
+
+	tail = (port->rx_head + port->rx_len) % RX_BUF_LEN;
+	room = RX_BUF_LEN - port->rx_len;
+	if (tail + room > RX_BUF_LEN)
+		room = RX_BUF_LEN - tail; /* partie contiguë seulement */
+
+	for (;;) {
+		rret = read(port->comd, port->rx_buf + tail, room);
+		if (rret >= 0)
+			break;
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			WARN_ERRNO("read failed on serial device");
+		return -1;
+	}
+	DBGV(3, "read -> %.*s", (int)rret, port->rx_buf + tail);
+	port->rx_len += rret;
+	umts_counters.rx += rret;
+
+	return rret;
+}
+
+/* Gets a line from comm. device. Everything available is read at once
+ * into the port's receive buffer, and bytes following the first line
+ * are kept for the next call. Empty lines are skipped.
+ * Returns the length of the line, 0 with an empty answer if none is
+ * available before the deadline, -1 on error or hangup (errno EIO:
+ * modem unplugged). */
 int
-readcom(int comfd, fixed_buf answer, unsigned int udelay)
+readline_until(int comd, fixed_buf answer, msec_t deadline)
 {
-	fd_set rfds;
+	struct serial_port *port = port_get(comd);
+	struct pollfd pfd;
+	int num, ret;
 	ssize_t rret;
-	size_t off = 0;
-	const size_t len = sizeof(fixed_buf) - 1;
-	int num;
-	struct timeval timeout;
-	char c;
 	char *ptr;
 	fixed_buf buf;
 
-	buf[0] = '\0';
+	answer[0] = '\0';
+	if (!port) {
+		WARN("read on unknown serial device %d", comd);
+		return -1;
+	}
 
-	while (off < len) {
-		usleep(MUDELAY);
-		timeout.tv_sec = 0L;
-		timeout.tv_usec = udelay;
-		FD_ZERO(&rfds);
-		FD_SET(comfd, &rfds);
-		num = select(comfd + 1, &rfds, NULL, NULL, &timeout);
+	for (;;) {
+		while ((ret = rx_getline(port, buf))) {
+			if (ret < 0) {
+				WARN("read overflow on serial device");
+				return -1;
+			}
+			strip_right(buf);
+			ptr = strip_left(buf);
+			if (!*ptr)
+				continue;
+			buf_cpy(answer, ptr);
+			DBGV(2, "<- %s", answer);
+			return strlen(answer);
+		}
+
+		if (port->rx_len == RX_BUF_LEN) {
+			WARN("receive buffer full on serial device");
+			port->rx_len = 0;
+			return -1;
+		}
+
+		pfd.fd = comd;
+		pfd.events = POLLIN;
+		num = poll(&pfd, 1, ms_left(deadline));
 		if (num < 0) {
-			WARN_ERRNO("select failed on serial device");
+			if (errno == EINTR) {
+				check_stop();
+				continue;
+			}
+			WARN_ERRNO("poll failed on serial device");
 			return -1;
 		}
 		if (!num) {
-			DBG("select() timeout on serial link");
-			goto out;
+			DBG("poll() timeout on serial link");
+			return 0;
+		}
+		if (pfd.revents & (POLLERR|POLLNVAL)) {
+			WARN("error condition on serial device");
+			return -1;
 		}
 
-		if ((num != 1)) {
-			WARN("unexpected select retval : %d", num);
+		rret = rx_fill(port);
+		if (rret < 0 && errno == EAGAIN && !(pfd.revents & POLLHUP))
+			continue;
+		if (rret <= 0) {
+			/* EOF ou raccrochage : le port ne servira plus */
+			if (rret == 0 || errno == EAGAIN) {
+				WARN("hangup on serial device");
+				errno = EIO;
+			}
 			return -1;
 		}
+	}
+}
 
-		rret = read(comfd, &c, 1);
-		if (rret < 0) {
-			if (errno == EAGAIN) /* EOF */
-				break;
-			if (errno == EINTR)
-				continue;
+/* Lecture brute d'un périphérique raw : ce qui est disponible avant
+ * l'échéance, dans la limite de len. Retourne le nombre d'octets lus,
+ * 0 si rien n'est arrivé avant l'échéance, -1 sur erreur ou EOF. */
+ssize_t
+serial_read(int comd, void *buf, size_t len, msec_t deadline)
+{
+	struct pollfd pfd;
+	ssize_t rret;
+	int num;
+
+	for (;;) {
+		rret = read(comd, buf, len);
+		if (rret > 0) {
+			umts_counters.rx += rret;
+			return rret;
+		}
+		if (!rret) {
+			WARN("EOF on serial device");
+			return -1;
+		}
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN) {
 			WARN_ERRNO("read failed on serial device");
 			return -1;
 		}
-		if (!rret) /* EOF */
-			break;
 
-		DBGV(3, "read -> %c", c);
-		buf[off] = c;
-		if (c == '\n') /* EOL */
-			break;
-		off++;
+		pfd.fd = comd;
+		pfd.events = POLLIN;
+		num = poll(&pfd, 1, ms_left(deadline));
+		if (num < 0) {
+			if (errno == EINTR) {
+				check_stop();
+				continue;
+			}
+			WARN_ERRNO("poll failed on serial device");
+			return -1;
+		}
+		if (!num)
+			return 0;
+		if (pfd.revents & (POLLERR|POLLNVAL)) {
+			WARN("error condition on serial device");
+			return -1;
+		}
 	}
+}
 
-out:
-	if (off == len - 1) {
-		WARN("read overflow on serial device");
+/*********************************************************/
+/** Codes de résultat non sollicités (URC) **/
+/*********************************************************/
+/* URC connus, reconnus comme tels même lorsqu'aucun pilote ne les a
+ * demandés : ils sont alors simplement ignorés au lieu d'être pris pour
+ * la réponse à la commande en cours. */
+static const char *const known_urcs[] = {
+	"+CREG", "+CGREG", "+CEREG", "+CIEV", "+PACSP",
+	"_OWANCALL", "_OSIGQ", "_OCTI",
+	"*EMRDY", "*ERINFO", "*EPEV",
+	"^RSSI", "^MODE", "^BOOT", "^SRVST", "^SIMST", "^NDISSTAT",
+	"^HCSQ", "^DSFLOWRPT", "^RSSILVL",
+};
+
+#define MAX_URCS 4
+#define URC_QUEUE_LEN 8
+
+/* URC demandés par les pilotes */
+static struct urc_entry {
+	char prefix[16];
+	urc_handler_t handler;	/* NULL : mise en file pour urc_wait() */
+	void *data;
+} urcs[MAX_URCS];
+
+/* URC reçus en attente de lecture par urc_wait() */
+static struct {
+	unsigned int len;
+	fixed_buf lines[URC_QUEUE_LEN];
+} urc_queue;
+
+/* line commence-t-elle par "<prefix>:" ? */
+static inline int
+prefix_match(const char *line, const char *prefix)
+{
+	size_t len = strlen(prefix);
+
+	return (len && !strncmp(line, prefix, len) && line[len] == ':');
+}
+
+/* Préfixe des réponses attendues à une commande :
+ * "AT+CREG?" -> "+CREG", "AT_OWANDATA=1" -> "_OWANDATA" */
+static void
+at_cmd_prefix(fixed_buf prefix, const char *cmd)
+{
+	size_t len;
+
+	if (!strncasecmp(cmd, "AT", 2))
+		cmd += 2;
+	len = strcspn(cmd, "?=;");
+	if (len >= MAX_LEN)
+		len = MAX_LEN - 1;
+	memcpy(prefix, cmd, len);
+	prefix[len] = '\0';
+}
+
+/* Enregistre un URC à remettre au pilote : au gestionnaire handler
+ * s'il est non NULL, dans la file lue par urc_wait() sinon. */
+int
+urc_register(const char *prefix, urc_handler_t handler, void *data)
+{
+	struct urc_entry *free_entry = NULL;
+	unsigned int i;
+
+	if (strlen(prefix) >= sizeof(urcs[0].prefix))
+		ERROR(EMSGSIZE, "URC prefix too long: %s", prefix);
+
+	for (i = 0; i < MAX_URCS; i++) {
+		if (!strcmp(urcs[i].prefix, prefix)) {
+			free_entry = &urcs[i];
+			break;
+		}
+		if (!free_entry && !urcs[i].prefix[0])
+			free_entry = &urcs[i];
+	}
+	if (!free_entry) {
+		WARN("too many URCs registered, cannot add %s", prefix);
 		return -1;
 	}
-	off++;
-	buf[off] = 0;
-	strip_right(buf);
-	ptr = strip_left(buf);
-	buf_cpy(answer, ptr);
-	DBGV(2, "<- %s", answer);
-	return (off - 1);
+	snprintf(free_entry->prefix, sizeof(free_entry->prefix), "%s", prefix);
+	free_entry->handler = handler;
+	free_entry->data = data;
+	return 0;
 }
 
-/* Commande et réponse */
+void
+urc_unregister(const char *prefix)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < MAX_URCS; i++) {
+		if (!strcmp(urcs[i].prefix, prefix))
+			memset(&urcs[i], 0, sizeof(urcs[i]));
+	}
+	/* purge des URC correspondants restés en file */
+	for (i = 0, j = 0; i < urc_queue.len; i++) {
+		if (prefix_match(urc_queue.lines[i], prefix))
+			continue;
+		if (i != j)
+			memcpy(urc_queue.lines[j], urc_queue.lines[i],
+							sizeof(fixed_buf));
+		j++;
+	}
+	urc_queue.len = j;
+}
+
+/* Classification d'une ligne reçue : si c'est un URC, elle est remise
+ * au pilote qui l'a demandée (ou ignorée) et 1 est retourné.
+ * Les lignes portant le préfixe de la commande en cours (cmd, éventuellement
+ * NULL) ou de l'une des commandes qu'elle concatène sont des réponses.
+ * Les URC demandés par un pilote font exception : ils ne sont des
+ * réponses qu'aux commandes de lecture (AT+CREG? par exemple, mais pas
+ * AT_OWANCALL=1,1,1). */
+static int
+urc_dispatch(const char *line, const char *cmd)
+{
+	fixed_buf cmd_prefix;
+	int response = 0, query = 0;
+	const char *next;
+	unsigned int i;
+
+	/* commandes concaténées : AT+COPS?;+CSQ */
+	while (cmd && !response) {
+		at_cmd_prefix(cmd_prefix, cmd);
+		response = prefix_match(line, cmd_prefix);
+		next = strchr(cmd, ';');
+		query = (strcspn(cmd, "?;") < strcspn(cmd, ";"));
+		cmd = (next) ? next + 1 : NULL;
+	}
+
+	for (i = 0; i < MAX_URCS; i++) {
+		if (!prefix_match(line, urcs[i].prefix))
+			continue;
+		if (response && query)
+			return 0;
+		DBGV(2, "URC: %s", line);
+		if (urcs[i].handler) {
+			urcs[i].handler(line, urcs[i].data);
+			return 1;
+		}
+		if (urc_queue.len == URC_QUEUE_LEN) {
+			WARN("URC queue full, dropping %s", urc_queue.lines[0]);
+			memmove(urc_queue.lines[0], urc_queue.lines[1],
+				(URC_QUEUE_LEN - 1) * sizeof(fixed_buf));
+			urc_queue.len--;
+		}
+		buf_cpy(urc_queue.lines[urc_queue.len++], line);
+		return 1;
+	}
+
+	if (response)
+		return 0;
+
+	for (i = 0; i < sizeof(known_urcs) / sizeof(known_urcs[0]); i++) {
+		if (prefix_match(line, known_urcs[i])) {
+			DBG("ignoring unsolicited %s", line);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Attend un URC de préfixe prefix (préalablement enregistré sans
+ * gestionnaire), au plus jusqu'à l'échéance.
+ * Retourne 1 si un URC a été lu dans line, 0 sur échéance, -1 sur erreur */
 int
-send_receive(int comd, const char *cmd, fixed_buf answer)
+urc_wait(int comd, const char *prefix, fixed_buf line, msec_t deadline)
 {
 	unsigned int i;
 	int ret;
-	fixed_buf tmp, cmd_disp;
-	char *ptr;
 
-	buf_cpy(cmd_disp, cmd);
-	ptr = strchr(cmd_disp, '=');
-	if (ptr)
-		*ptr = '\0'; /* Let's not show what's after the '='
-				in debug logs.  */
-	writecom(comd, cmd);
+	for (;;) {
+		for (i = 0; i < urc_queue.len; i++) {
+			if (!prefix_match(urc_queue.lines[i], prefix))
+				continue;
+			buf_cpy(line, urc_queue.lines[i]);
+			urc_queue.len--;
+			memmove(urc_queue.lines[i], urc_queue.lines[i + 1],
+				(urc_queue.len - i) * sizeof(fixed_buf));
+			return 1;
+		}
 
-	for (i = 0; i < 5; i++) {
-		ret = readcom(comd, tmp, UDELAY);
+		if (!ms_left(deadline))
+			return 0;
+		ret = readline_until(comd, line, deadline);
 		if (ret < 0)
-			return ret;
-		if (strmatch(tmp, cmd))
-			goto matched;
-		WARN("read while trying to match %s: %s", cmd_disp, tmp);
+			return -1;
+		if (ret && !urc_dispatch(line, NULL))
+			DBG("unexpected line while waiting for %s: %s",
+							prefix, line);
+	}
+}
+
+/* Consomme les lignes reçues sans les attendre jusqu'à l'échéance,
+ * en lieu et place d'un usleep() entre deux interrogations du modem.
+ * Les URC reçus pendant ce temps sont remis aux pilotes. */
+int
+serial_idle(int comd, msec_t until)
+{
+	struct serial_port *port = port_get(comd);
+	fixed_buf line;
+	int ret;
+
+	/* Les messages d'un périphérique raw sont laissés à son pilote */
+	if (port && port->raw) {
+		while (ms_left(until)) {
+			if (poll(NULL, 0, ms_left(until)) < 0) {
+				if (errno != EINTR)
+					return -1;
+				check_stop();
+			}
+		}
+		return 0;
 	}
-	WARN("Failed to read echo of command %s", cmd_disp);
-	return -1;
 
-matched:
-	for (i = 0; i < 5; i++) {
-		ret = readcom(comd, tmp, UDELAY);
+	while (ms_left(until)) {
+		ret = readline_until(comd, line, until);
 		if (ret < 0)
-			return ret;
-		if (strlen(tmp))
-			goto answer;
+			return -1;
+		if (ret && !urc_dispatch(line, NULL))
+			DBG("unsolicited: %s", line);
 	}
-	WARN("Time out reading answer to %s", cmd_disp);
-	return -1;
+	return 0;
+}
 
-answer:
-	buf_cpy(answer, tmp);
-	DBG("%s: %s", cmd_disp, answer);
+/* Traitement des URC déjà reçues, sans attente.
+ * Retourne -1 si le port n'est plus utilisable. */
+int
+serial_drain(int comd)
+{
+	struct serial_port *port = port_get(comd);
+	fixed_buf line;
+	int ret;
+
+	/* Indications reçues hors requête : sans destinataire */
+	if (port && port->raw) {
+		while ((ret = serial_read(comd, line, sizeof(line),
+						clock_ms())) > 0)
+			DBG("unsolicited: %d bytes dropped", ret);
+		return ret;
+	}
+
+	while ((ret = readline_until(comd, line, clock_ms())) > 0) {
+		if (!urc_dispatch(line, NULL))
+			DBG("unsolicited: %s", line);
+	}
+	return ret;
+}
+
+/* Copie de la commande pour affichage, sans ce qui suit le '='
+ * (mots de passe, PIN...) */
+static void
+cmd_display(fixed_buf disp, const char *cmd)
+{
+	char *ptr;
+
+	buf_cpy(disp, cmd);
+	ptr = strchr(disp, '=');
+	if (ptr)
+		*ptr = '\0';
+}
+
+/* Reconnaissance des codes de résultat finaux */
+static at_result_t
+at_final_result(const char *line)
+{
+	if (!strcmp(line, "OK"))
+		return AT_OK;
+	if (!strcmp(line, "ERROR"))
+		return AT_ERROR;
+	if (strmatch(line, "+CME ERROR") || strmatch(line, "+CMS ERROR"))
+		return AT_CME_ERROR;
+	if (!strcmp(line, "NO CARRIER"))
+		return AT_ERROR;
+	return AT_NONE;
+}
+
+/* Transaction AT : émission de la commande, puis collecte des lignes de
+ * réponse jusqu'au code de résultat final ou jusqu'à l'échéance,
+ * timeout ms après l'émission. L'écho de la commande est ignoré, ainsi
+ * que les lignes reçues avant lui, qui ne peuvent lui répondre. Les URC
+ * reçus pendant la transaction sont remis aux pilotes.
+ * Retourne 0 si un code de résultat final a été reçu, -1 sinon. */
+int
+at_transaction(int comd, const char *cmd, struct at_resp *resp,
+		unsigned int timeout)
+{
+	msec_t deadline;
+	fixed_buf line, cmd_disp;
+	at_result_t final;
+	int ret;
+
+	resp->result = AT_NONE;
+	resp->nlines = 0;
+	resp->final[0] = '\0';
 
-	if (!strmatch(answer, "OK") && !strmatch(answer, "ERROR")) {
-		/* Try to glob trailing OK / ERROR */
-		for (i = 0; i < 5; i++) {
-			ret = readcom(comd, tmp, UDELAY);
-			if (ret >= 0 && (strmatch(tmp, "OK")
-					 || strmatch(tmp, "ERROR")))
-				break;
+	cmd_display(cmd_disp, cmd);
+	writecom(comd, cmd);
+	umts_counters.at++;
+	deadline = deadline_in(timeout);
+
+	for (;;) {
+		ret = readline_until(comd, line, deadline);
+		if (ret < 0)
+			return -1;
+		if (!ret) {
+			WARN("Time out reading answer to %s", cmd_disp);
+			return -1;
 		}
+
+		if (strmatch(line, cmd)) {
+			/* écho */
+			if (resp->nlines)
+				WARN("read while trying to match %s: %s",
+						cmd_disp, resp->lines[0]);
+			resp->nlines = 0;
+			continue;
+		}
+
+		final = at_final_result(line);
+		if (final != AT_NONE) {
+			buf_cpy(resp->final, line);
+			resp->result = final;
+			DBGV(2, "%s: %s (%u lines)", cmd_disp, line,
+							resp->nlines);
+			return 0;
+		}
+
+		if (urc_dispatch(line, cmd))
+			continue;
+
+		if (resp->nlines >= AT_MAX_LINES) {
+			WARN("too many lines in answer to %s: %s",
+							cmd_disp, line);
+			continue;
+		}
+		buf_cpy(resp->lines[resp->nlines++], line);
 	}
+}
+
+/* Commande et réponse : answer reçoit la première ligne de réponse
+ * portant le préfixe de la commande, à défaut la première ligne de
+ * réponse, ou à défaut le code de résultat final */
+int
+send_receive(int comd, const char *cmd, fixed_buf answer)
+{
+	struct at_resp resp;
+	fixed_buf cmd_disp, prefix;
+	unsigned int i;
+
+	if (at_transaction(comd, cmd, &resp, AT_TIMEOUT) && !resp.nlines)
+		return -1;
+
+	at_cmd_prefix(prefix, cmd);
+	for (i = 0; i < resp.nlines; i++) {
+		if (prefix_match(resp.lines[i], prefix))
+			break;
+	}
+	if (i == resp.nlines)
+		i = 0;
+	buf_cpy(answer, (resp.nlines) ? resp.lines[i] : resp.final);
+	cmd_display(cmd_disp, cmd);
+	DBG("%s: %s", cmd_disp, answer);
 
 	return 0;
 }
@@ -473,6 +1317,76 @@ get_check_answer(int comd, const char *cmd,
 						cmd, expected, answer);
 }
 
+/* Interrogations groupées en une seule transaction par concaténation
+ * V.25ter (AT+COPS?;+CSQ;_OWCTI?) : chaque ligne de réponse est
+ * attribuée à l'interrogation dont elle porte le préfixe. Si le modem
+ * refuse la ligne concaténée (ERROR, +CME ERROR), les interrogations sont
+ * reprises une à une, et la concaténation n'est plus tentée sur ce modem
+ * (voir umts_caps.c). Sur une échéance ou une réponse manquante, elles
+ * ne sont reprises une à une que pour cet appel.
+ * Comme pour get_check_answer(), une réponse ne commençant pas par
+ * expected est une erreur fatale. */
+void
+at_query_batch(int comd, struct at_query *queries, unsigned int n)
+{
+	struct at_resp resp;
+	fixed_buf cmd, prefix;
+	size_t len, qlen;
+	unsigned int i, j;
+
+	if (n > 1 && caps_get(CAP_CONCAT) != CAP_NO) {
+		/* "AT" de tête uniquement pour la première */
+		buf_cpy(cmd, "AT");
+		len = 2;
+		for (i = 0; i < n; i++) {
+			qlen = strlen(queries[i].cmd + 2);
+			if (len + qlen + 1 >= MAX_LEN)
+				ERROR(EMSGSIZE, "concatenated command too long");
+			if (i)
+				cmd[len++] = ';';
+			memcpy(cmd + len, queries[i].cmd + 2, qlen + 1);
+			len += qlen;
+		}
+
+		if (at_transaction(comd, cmd, &resp, AT_TIMEOUT)) {
+			WARN("%s: no answer, falling back to single commands",
+									cmd);
+		} else if (resp.result != AT_OK) {
+			LOG("%s: concatenation not supported, "
+				"falling back to single commands", cmd);
+			caps_set(CAP_CONCAT, CAP_NO);
+		} else {
+			for (i = 0; i < n; i++) {
+				at_cmd_prefix(prefix, queries[i].cmd);
+				for (j = 0; j < resp.nlines; j++) {
+					if (prefix_match(resp.lines[j], prefix))
+						break;
+				}
+				if (j == resp.nlines)
+					break;
+				buf_cpy(queries[i].answer, resp.lines[j]);
+				DBG("%s: %s", queries[i].cmd, queries[i].answer);
+				if (!strmatch(queries[i].answer,
+							queries[i].expected))
+					ERROR(EPROTO, "%s answer : expected %s, "
+						"got %s", queries[i].cmd,
+						queries[i].expected,
+						queries[i].answer);
+			}
+			if (i == n) {
+				caps_set(CAP_CONCAT, CAP_OK);
+				return;
+			}
+			WARN("%s: no answer to %s, falling back to single "
+					"commands", cmd, queries[i].cmd);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		get_check_answer(comd, queries[i].cmd, queries[i].answer,
+							queries[i].expected);
+}
+
 int
 fork_exec(char **argv)
 {
@@ -484,6 +1398,8 @@ fork_exec(char **argv)
 
 	switch (pid) {
 		case 0:
+			/* le fils ne revient pas dans la boucle de umtsd */
+			umts_request_env = NULL;
 			if (execve(argv[0], argv, envp))
 				ERROR_ERRNO("execve %s failed", argv[0]);
 			exit(EXIT_FAILURE);
@@ -491,7 +1407,9 @@ fork_exec(char **argv)
 			ERROR_ERRNO("fork %s failed", argv[0]);
 			return -1;
 		default:
-			wret = waitpid(pid, &status, 0);
+			do {
+				wret = waitpid(pid, &status, 0);
+			} while (wret < 0 && errno == EINTR);
 			if (wret < 0) {
 				ERROR_ERRNO("waitpid %s failed", argv[0]);
 				return -1;
@@ -527,7 +1445,8 @@ check_pin_status(int comd, struct cdata *p_conn_data)
 	}
 	if (strmatch(answer, "+CME ERROR: SIM busy")) {
 		LOG("SIM busy, retrying");
-		usleep(UDELAY);
+		if (serial_idle(comd, deadline_in(POLL_INTERVAL)))
+			return -1;
 		if (send_receive(comd, "AT+CPIN?", answer))
 			return -1;
 	}
@@ -555,3 +1474,91 @@ check_pin_status(int comd, struct cdata *p_conn_data)
 	return -1;
 }
 
+
+/* Interprétation de l'état d'enregistrement <stat> :
+ * retourne 0 si enregistré, -1 si refusé, 1 s'il faut attendre */
+static int
+creg_status(int stat)
+{
+	switch (stat) {
+		case 1: /* enregistré sur le réseau natif */
+			LOG("Registered with network, native");
+			return 0;
+		case 5: /* enregistré en roaming */
+			LOG("Registered with network, roaming");
+			return 0;
+		case 3: /* enregistrement interdit */
+			WARN("CREG permission denied");
+			return -1;
+		case 0: /* non enregistré, inactif */
+			DBG("Not registered with network yet");
+			return 1;
+		case 2: /* en recherche */
+			return 1;
+		case 4:
+			/* unknown, semble se produire une fois lorsqu'on
+			 * monte l'interface pour la première fois */
+			DBG("Unknown CREG answer, wait a little and retry");
+			return 1;
+		default:
+			ERROR(EPROTO, "CREG unexpected status %d", stat);
+	}
+}
+
+/* Attend l'enregistrement sur le réseau, au plus timeout ms.
+ * L'état courant est lu une fois, puis les changements sont attendus
+ * sous forme de notifications +CREG: <stat>. */
+int
+wait_net_registration(int comd, unsigned int timeout)
+{
+	fixed_buf answer;
+	struct at_creg creg;
+	msec_t deadline;
+	int ret;
+
+	deadline = deadline_in(timeout);
+	urc_register("+CREG", NULL, NULL);
+
+	/* Activation des notifications */
+	get_check_answer(comd, "AT+CREG=1", answer, "OK");
+	/*
+	 * AT+CREG=<n>
+	 *  <n>
+	 *    0. Disable unsolicited status callback.
+	 *    1. Enable unsolicited status callback, +CREG: <stat>
+	 *    2. Enable unsolicited status callback,
+	 * +CREG: <stat>,[,<lac>,<ci>[,<AcT>]]
+	 *  <stat>
+	 *    0. Not registered, not searching
+	 *    1. Registered, home network
+	 *    2. Not registered, searching
+	 *    3. Registration denied
+	 *    4. Unknown
+	 *    5. Registered, roaming
+	 */
+	if (send_receive(comd, "AT+CREG?", answer)) {
+		ret = -1;
+		goto out;
+	}
+	if (at_parse_creg(answer, 1, &creg))
+		ERROR(EPROTO, "CREG unexpected answer %s", answer);
+
+	while ((ret = creg_status(creg.stat)) > 0) {
+		ret = urc_wait(comd, "+CREG", answer, deadline);
+		if (ret <= 0) {
+			if (!ret)
+				WARN("CREG timeout");
+			ret = -1;
+			goto out;
+		}
+		if (at_parse_creg(answer, 0, &creg))
+			ERROR(EPROTO, "CREG unexpected notification %s", answer);
+	}
+
+out:
+	/* Désactivation des notifications */
+	urc_unregister("+CREG");
+	if (send_receive(comd, "AT+CREG=0", answer))
+		ret = -1;
+	return ret;
+}
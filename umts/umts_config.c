@@ -28,99 +28,107 @@
 
 #include "umts.h"
 
+/*********************************************************/
+/** Client umtsd **/
+/*********************************************************/
+/* Transmet la requte  umtsd s'il est actif.
+ * Retourne 0 et le code de sortie de la requte si elle a t traite
+ * par le dmon, -1 s'il faut l'excuter localement. */
+static int
+umtsd_request(struct umts_request *req, int *status)
+{
+	struct sockaddr_un addr;
+	fixed_buf path;
+	ssize_t ret;
+	int sock;
+
+	/* Le dmon ne partage pas le rpertoire courant */
+	if (realpath(req->filename, path))
+		buf_cpy(req->filename, path);
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		ERROR_ERRNO("socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, umtsd_socket(), sizeof(addr.sun_path) - 1);
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		if (errno != ENOENT && errno != ECONNREFUSED)
+			WARN_ERRNO("connect to umtsd failed");
+		close(sock);
+		return -1;
+	}
+
+	if (send(sock, req, sizeof(*req), 0) != sizeof(*req))
+		ERROR_ERRNO("send to umtsd failed");
+
+	do {
+		ret = recv(sock, status, sizeof(*status), 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret != sizeof(*status))
+		ERROR(EIO, "no answer from umtsd");
+	close(sock);
+
+	if (*status == UMTSD_NOT_MINE)
+		return -1;
+	return 0;
+}
+
 /*********************************************************/
 /** Programme principal **/
 /*********************************************************/
 int
 main(int argc, char *argv[])
 {
-	const char *filename;
-	char *interface;
-	const char *cmd;
-	struct stat buf;
-	struct cdata conn_data;
-	int comd;
-	FILE *fd;
+	struct umts_request req;
 	umts_device_t *umts_device;
-	const char *type;
-	
+	int comd, status;
+
 	/* Quatre arguments - cinq pour check */
 	if (argc > 6)
 		ERROR(E2BIG, "too many arguments (%d)", argc);
 	if (argc < 5)
 		ERROR(EIO, "too few arguments (%d)", argc);
 
-	filename = argv[1];
-	type = argv[2];
-	interface = argv[3];
-	cmd = argv[4];
+	memset(&req, 0, sizeof(req));
+	buf_cpy(req.filename, argv[1]);
+	buf_cpy(req.type, argv[2]);
+	buf_cpy(req.interface, argv[3]);
+	buf_cpy(req.cmd, argv[4]);
+	if (argc > 5)
+		buf_cpy(req.ipsec, argv[5]);
 
-	if (strmatch(type, "hso"))
-		umts_device = &hso_device;
-	else if (strmatch(type, "cdc_ncm"))
-		umts_device = &acm_device;
-	else if (strmatch(type, "qmi_wwan"))
-		umts_device = &huawei_device;
-	else
-		ERROR(EUNSUPDEV, "unsupported device type: %s", type);
+	openlog("umts_config", LOG_PERROR|LOG_PID, LOG_DAEMON);
 
-	/* On vrifie que le device de contrle est prsent */
-	if (stat(umts_device->device, &buf))
-		ERROR_ERRNO("can't stat device %s", umts_device->device);
+	/* Historique de la qualit du lien : sans le modem, le fichier
+	 * pass reoit le rsum (stats) ou les chantillons (export) */
+	if (strmatch(req.cmd, "stats") || strmatch(req.cmd, "export")) {
+		status = quality_report(req.interface, req.filename,
+						strmatch(req.cmd, "export"));
+		closelog();
+		return status;
+	}
 
-	if (!S_ISCHR(buf.st_mode))
-		ERROR(ENODEV,
-			"%s is not the device we're looking for", umts_device->device);
+	/* Si umtsd dtient le port de contrle, c'est lui qui excute */
+	if (!umtsd_request(&req, &status)) {
+		closelog();
+		return status;
+	}
 
-	openlog("umts_config", LOG_PERROR|LOG_PID, LOG_DAEMON);
+	timing_start(req.cmd);
+	umts_device = get_device(req.type);
+	check_device(umts_device);
 
 	DBG("detected interface type: %s", umts_device->name);
 
-	/* Validation des paramtres 2 et 3 */
-	if (!(strmatch(cmd, "up")) && !(strmatch(cmd, "down"))
-					&& !(strmatch(cmd, "check")))
-		ERROR(EINVAL, "unsupported command : %s", cmd);
-
-	if(!(strmatch(interface, umts_device->interface)) && !(strmatch(interface, "eth0")))
-		ERROR(EINVAL, "unsupported interface name : %s", interface);
-
-			/* Validation du paramtre 1 */
-	if (stat(filename, &buf))
-		ERROR_ERRNO("can't stat config file %s", filename);
-
-	if (!S_ISREG(buf.st_mode))
-		ERROR(EINVAL, "config file %s is not a regular file", filename);
-
-	if (strmatch(cmd, "check")) {
-		DBG("checking interface %s", interface);
-		if (argc < 5)
-			ERROR(EIO, "too few arguments (%d)", argc);
-		comd = initiate_serial(umts_device->device);
-		umts_device->monitor_connection(comd, filename, interface, argv[5]);
-		close_serial(comd);
-	} else if (strmatch(cmd, "up")) {
-		LOG("setting interface %s up", interface);
-		fd = open_file(filename, ReadMode);
-		if (!fd)
-			ERROR_ERRNO("can't open config file %s", filename);
-	
-		parse_conf(fd, &conn_data);
-		close_file(filename, fd);
-
-		comd = initiate_serial(umts_device->device);
-		if (check_pin_status(comd, &conn_data))
-			ERROR(EPROTO, "Error checking PIN");
-		umts_device->wait_reg_status(comd);
-
-		umts_device->check_conn_up(comd, &conn_data, interface);
-		close_serial(comd);
-	} else if (strmatch(cmd, "down")) {
-		LOG("setting interface %s down", interface);
-		comd = initiate_serial(umts_device->device);
-		if (!check_pin_status(comd, &conn_data))
-			umts_device->set_conn_down(comd, interface);
-		close_serial(comd);
-	}
+	check_request(umts_device, &req);
+
+	comd = initiate_serial(umts_device);
+	run_request(umts_device, comd, &req);
+	close_serial(comd);
+
 	closelog();
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,232 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umtsd - détenteur persistant du port de contrôle 3G
+ *
+ *	umtsd <type> ouvre et configure une seule fois le port de contrôle
+ *	du périphérique <type>, puis exécute les requêtes up / down / check
+ *	que lui transmet umts_config sur UMTSD_SOCKET, une à la fois et dans
+ *	leur ordre d'arrivée. Les requêtes sont exécutées dans le démon
+ *	lui-même, seul détenteur du port : l'état du port, des pilotes
+ *	(clients QMI, session MBIM) et les capacités du modem sont conservés
+ *	d'une requête à l'autre. Une erreur (ERROR) ne termine que la
+ *	requête, dont le code d'erreur est renvoyé au client.
+ *	Entre deux requêtes, les URC reçues sont lues et traitées.
+ */
+
+#include "umts.h"
+
+/* Requêtes en attente d'acceptation */
+#define UMTSD_BACKLOG 8
+
+static void
+umtsd_sighandler(int sig __attribute__((unused)))
+{
+	umts_stop = 1;
+}
+
+static void
+umtsd_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-f] <type> | -s\n", prog);
+	exit(EINVAL);
+}
+
+static int
+umtsd_listen(const char *path)
+{
+	struct sockaddr_un addr;
+	int sock;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		ERROR(ENAMETOOLONG, "socket path too long: %s", path);
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		ERROR_ERRNO("socket");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (unlink(path) && errno != ENOENT)
+		ERROR_ERRNO("failed to remove %s", path);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)))
+		ERROR_ERRNO("failed to bind %s", path);
+	if (chmod(path, S_IRUSR|S_IWUSR))
+		ERROR_ERRNO("failed to chmod %s", path);
+	if (listen(sock, UMTSD_BACKLOG))
+		ERROR_ERRNO("listen");
+
+	return sock;
+}
+
+/* Exécution d'une requête, retourne son code d'erreur (0 si succès) */
+static int
+umtsd_run(umts_device_t *umts_device, int comd, struct umts_request *req)
+{
+	jmp_buf env;
+	int status;
+
+	/* ERROR revient ici avec le code d'erreur */
+	status = setjmp(env);
+	if (!status) {
+		umts_request_env = &env;
+		timing_start(req->cmd);
+		check_request(umts_device, req);
+		run_request(umts_device, comd, req);
+	}
+	umts_request_env = NULL;
+	if (status)
+		request_cleanup();
+	timing_end(status);
+	return status;
+}
+
+/* Lecture et exécution de la requête d'un client */
+static void
+umtsd_client(umts_device_t *umts_device, const char *type,
+					int comd, int sock)
+{
+	struct umts_request req;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	ssize_t ret;
+	int client, status;
+
+	client = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+	if (client < 0) {
+		if (errno != EINTR && errno != EAGAIN)
+			WARN_ERRNO("accept");
+		return;
+	}
+
+	if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+		WARN_ERRNO("SO_PEERCRED");
+		goto out;
+	}
+	if (cred.uid != 0) {
+		WARN("rejected request from uid %u", cred.uid);
+		goto out;
+	}
+
+	ret = recv(client, &req, sizeof(req), 0);
+	if (ret != sizeof(req)) {
+		WARN("truncated request (%zd bytes)", ret);
+		goto out;
+	}
+	req.filename[MAX_LEN - 1] = req.type[MAX_LEN - 1] = '\0';
+	req.interface[MAX_LEN - 1] = req.cmd[MAX_LEN - 1] = '\0';
+	req.ipsec[MAX_LEN - 1] = '\0';
+
+	if (strcmp(req.type, type)) {
+		DBG("request for device type %s, not ours", req.type);
+		status = UMTSD_NOT_MINE;
+	} else {
+		DBG("request %s %s from pid %d", req.cmd, req.interface,
+								cred.pid);
+		status = umtsd_run(umts_device, comd, &req);
+	}
+
+	if (send(client, &status, sizeof(status), 0) != sizeof(status))
+		WARN_ERRNO("failed to answer pid %d", cred.pid);
+out:
+	close(client);
+}
+
+static void
+umtsd_write_pidfile(void)
+{
+	FILE *fp = fopen(UMTSD_PIDFILE, "w");
+
+	if (!fp)
+		ERROR_ERRNO("failed to open %s", UMTSD_PIDFILE);
+	fprintf(fp, "%d\n", getpid());
+	if (fclose(fp))
+		ERROR_ERRNO("failed to write %s", UMTSD_PIDFILE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	umts_device_t *umts_device;
+	struct sigaction sa;
+	struct pollfd pfd[2];
+	const char *type, *path;
+	int comd, sock, opt, foreground = 0;
+
+	while ((opt = getopt(argc, argv, "fs")) != -1) {
+		switch (opt) {
+		case 'f':
+			foreground = 1;
+			break;
+		case 's':
+			/* chemin du socket, pour les scripts (lib/umts) */
+			printf("%s\n", umtsd_socket());
+			return EXIT_SUCCESS;
+		default:
+			umtsd_usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		umtsd_usage(argv[0]);
+	type = argv[optind];
+
+	openlog("umtsd", (foreground) ? LOG_PERROR|LOG_PID : LOG_PID,
+								LOG_DAEMON);
+
+	umts_device = get_device(type);
+	check_device(umts_device);
+	path = umtsd_socket();
+
+	comd = initiate_serial(umts_device);
+	sock = umtsd_listen(path);
+
+	if (!foreground) {
+		if (daemon(0, 0))
+			ERROR_ERRNO("daemon");
+		umtsd_write_pidfile();
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = umtsd_sighandler;
+	sigemptyset(&sa.sa_mask);
+	/* pas de SA_RESTART : poll() doit être interrompu, y compris
+	 * pendant une requête, alors abandonnée */
+	if (sigaction(SIGTERM, &sa, NULL) || sigaction(SIGINT, &sa, NULL))
+		ERROR_ERRNO("sigaction");
+	signal(SIGPIPE, SIG_IGN);
+
+	LOG("serving %s requests on %s", umts_device->name, path);
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = comd;
+	pfd[1].events = POLLIN;
+
+	while (!umts_stop) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			WARN_ERRNO("poll");
+			break;
+		}
+		if (pfd[1].revents & (POLLHUP|POLLERR|POLLNVAL)) {
+			WARN("control device %s hung up", umts_device->device);
+			break;
+		}
+		if (pfd[1].revents & POLLIN && serial_drain(comd) < 0)
+			break;
+		if (pfd[0].revents & POLLIN)
+			umtsd_client(umts_device, type, comd, sock);
+	}
+
+	LOG("exiting");
+	close(sock);
+	unlink(path);
+	if (!foreground)
+		unlink(UMTSD_PIDFILE);
+	close_serial(comd);
+	closelog();
+	return EXIT_SUCCESS;
+}
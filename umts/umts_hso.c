@@ -4,7 +4,7 @@
 static void
 hso_parse_owandata(fixed_buf answer, struct cdata *p_conn_data)
 {
-	size_t off = sizeof("_OWANDATA: 1, ") - 1;
+	struct at_ipconf ipconf;
 	/*
 	 *	_OWANDATA: <pdp context>, <ip address>, <route?>,
 	 *	<nameserver 1>, <nameserver 2>, <unknown>, <unknown>, <speed>
@@ -12,24 +12,20 @@ hso_parse_owandata(fixed_buf answer, struct cdata *p_conn_data)
 	if (!strmatch(answer, "_OWANDATA: 1, "))
 		ERROR(EPROTO, "expected _OWANDATA: 1, got %s", answer);
 
-	get_ipaddr(p_conn_data->ip_address, answer, "ip_address", &off);
-	get_ipaddr(p_conn_data->gateway, answer, "gateway", &off);
-	get_ipaddr(p_conn_data->dns1, answer, "dns1", &off);
-	get_ipaddr(p_conn_data->dns2, answer, "dns2", &off);
+	if (at_parse_owandata(answer, &ipconf))
+		ERROR(EINVAL, "Unreadable connection parameters: %s", answer);
+	set_ipconf(p_conn_data, &ipconf);
 }
 
 static void
 hso_configure_net_down(char *interface)
 {
-	char *argv[] = {
-		HSO_SCRIPT_DOWN,
-		interface,
-		NULL };
-
+	/* pas de script de down : la déconfiguration est complète */
+	phase_begin("net_down");
 	LOG("Bringing down network on %s", interface);
 
-	if (fork_exec(argv))
-		ERROR(EFAULT, "Failed to run net_down script");
+	if (net_down(interface, NULL))
+		ERROR(EFAULT, "Failed to bring down network");
 }
 
 static void
@@ -44,6 +40,7 @@ hso_configure_net_up(char *interface, struct cdata *p_conn_data)
 		p_conn_data->dns2,
 		NULL };
 
+	phase_begin("net_up");
 	LOG("Bringing up network: %s:%s, GW: %s, DNS: %s / %s",
 		interface,
 		p_conn_data->ip_address,
@@ -51,22 +48,24 @@ hso_configure_net_up(char *interface, struct cdata *p_conn_data)
 		p_conn_data->dns1,
 		p_conn_data->dns2);
 
-	if (fork_exec(argv))
-		ERROR(EFAULT, "Failed to run net_up script");
+	if (net_up(interface, p_conn_data, 0, argv))
+		ERROR(EFAULT, "Failed to configure network");
 }
 
 static int
 hso_wait_obls(int comd)
 {
 	fixed_buf answer;
-	unsigned int i = 0;
+	struct retry r;
 	char *ptr;
 
-	while (i++ < 20) {
+	retry_start(&r, "AT_OBLS", &hso_device.init_retry);
+	while (retry_next(&r, comd)) {
 		if (send_receive(comd, "AT_OBLS", answer))
-			return -1;
+			break;
 		if (strmatch(answer, "_OBLS: 1,1,1")) {
 			LOG("Device initialized");
+			retry_end(&r, 1);
 			return 0;
 		}
 
@@ -74,8 +73,8 @@ hso_wait_obls(int comd)
 		if (!ptr)
 			ptr = answer;
 		LOG("Waiting for device (status %s)", ptr);
-		usleep(2 * UDELAY);
 	}
+	retry_end(&r, 0);
 
 	WARN("timeout waiting for subsystem");
 	return -1;
@@ -86,11 +85,13 @@ static int
 hso_wait_reg_status(int comd)
 {
 	fixed_buf answer;
-	unsigned int count;
 
+	phase_begin("obls");
 	if (hso_wait_obls(comd))
 		return -1;
 
+	phase_begin("register");
+
 	/* Mise de la carte en mode de sélection automatique */
 	if (send_receive(comd, "AT+COPS=0", answer))
 		return -1;
@@ -98,59 +99,25 @@ hso_wait_reg_status(int comd)
 	/* Sélection du mode préférentiel 3G/2G */
 	get_check_answer(comd, "AT_OPSYS=3", answer, "OK");
 
-	/* Désactivation de la gestion automatique */
-	get_check_answer(comd, "AT+CREG=0", answer, "OK");
-	/*
-	 * <n>
-	 *
-	 * 0. Disable unsolicited status callback.
-	 * 1. Enable unsolicited status callback, +CREG: <stat>
-	 * 2. Enable unsolicited status callback,
-	 * 	+CREG: <stat>,[,<lac>,<ci>[,<AcT>]]
-	 */
-	for (count = 0; count < 10; count++) {
-		if (send_receive(comd, "AT+CREG?", answer))
-			return -1;
-		/* enregistré sur le réseau natif */
-		if (strmatch(answer, "+CREG: 0,1")) {
-			LOG("Registered with network, native");
-			return 0;
-		}
-		/* enregistré en roaming */
-		if (strmatch(answer, "+CREG: 0,5")) {
-			LOG("Registered with network, roaming");
-			return 0;
-		}
-		/* enregistrement interdit */
-		if (strmatch(answer, "+CREG: 0,3")) {
-			WARN("CREG permission denied");
-			return -1;
-		}
-		/* non enregistré, inactif */
-		/* on vient de rentrer le PIN, on double le temps d'attente */
-		if (strmatch(answer, "+CREG: 0,0")) {
-			DBG("Not registered with network yet");
-			usleep(UDELAY);
-		/* si on n'est pas en recherche */
-		} else if (!strmatch(answer, "+CREG: 0,2")) {
-			ERROR(EPROTO, "CREG unexpected answer %s", answer);
-		}
-		usleep(UDELAY);
-	}
-	WARN("CREG timeout");
-	return -1;
+	return wait_net_registration(comd, REG_TIMEOUT);
 }
 
+/* Attend une notification _OWANCALL, au plus jusqu'à l'échéance.
+ * La notification doit avoir été demandée par urc_register() avant
+ * l'émission de la commande _OWANCALL correspondante. */
 static int
-hso_wait_owancall(int comd)
+hso_wait_owancall(int comd, msec_t deadline)
 {
 	fixed_buf tmp;
-	int status;
+	int status, ret;
 	const char *str;
-	unsigned int i;
-	for (i = 0; i < 6; i++) {
-		if (readcom(comd, tmp, 5 * UDELAY) <= 0)
-			continue;
+
+	for (;;) {
+		ret = urc_wait(comd, "_OWANCALL", tmp, deadline);
+		if (ret < 0)
+			ERROR(EFAULT, "read error waiting for connection status");
+		if (!ret)
+			break;
 
 		if (!strmatch(tmp, "_OWANCALL: 1,")) {
 			LOG("Unexpected connection status: %s", tmp);
@@ -189,8 +156,10 @@ static void
 hso_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 {
 	fixed_buf cmd, answer;
-	unsigned int count = 0;
+	msec_t deadline;
+	struct retry r;
 
+	phase_begin("apn");
 	LOG("Registering with APN");
 	buf_format_string(cmd, "AT+CGDCONT=1,\"IP\",\"%s\"", p_conn_data->apn);
 	/*
@@ -218,36 +187,32 @@ hso_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 	 * <auth_name> and <auth_pwd> are strings with the
 	 * 	authentication information.
 	 */
-	if (send_receive(comd, cmd, answer))
-		ERROR(EFAULT, "Failed to get AT$QCPDPP answer");
-	if (strmatch(answer, "OK")) {
+	if (!caps_command(comd, CAP_QCPDPP, cmd, answer)) {
 		DBGV(2, "got QCPDPP answer");
-	} else if (strmatch(answer, "ERROR")) {
+	} else if (caps_get(CAP_QCPDPP) == CAP_NO) {
+		/* refusée, ou connue pour l'être */
 		buf_format_two_strings(cmd, "AT_OPDPP=1,1,\"%s\",\"%s\"",
 			p_conn_data->password, p_conn_data->identity);
 		get_check_answer(comd, cmd, answer, "OK");
 	} else {
-		ERROR(EPROTO, "Unexpected AT$QCDPP answer: %s", answer);
+		ERROR(EFAULT, "Failed to get AT$QCPDPP answer");
 	}
 
 
+	phase_begin("call");
+	urc_register("_OWANCALL", NULL, NULL);
 	get_check_answer(comd, "AT_OWANCALL=1,1,1", answer,"OK");
-	count = 0;
+	deadline = deadline_in(CALL_TIMEOUT);
 	for (;;) {
 		int ret;
-		usleep(UDELAY);
 
 		/* Now wait for an OWANCALL update */
-		ret = hso_wait_owancall(comd);
+		ret = hso_wait_owancall(comd, deadline);
 		if (ret == 1)
 			break;
 
 		if (ret == 3)
 			ERROR(ECALLFAILED, "Call failed");
-
-		if (count++ >= 2)
-			ERROR(EADDRNOTAVAIL, "Timed out waiting "
-					"for expected connection status");
 	}
 
 	/*
@@ -259,16 +224,17 @@ hso_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 	 * 	when connection is established, 0 = silent
 	 */
 
-	count = 0;
-	for (;;) {
-		usleep(UDELAY);
+	phase_begin("conn_params");
+	retry_start(&r, "AT_OWANDATA", &hso_device.conn_retry);
+	while (retry_next(&r, comd)) {
 		if (send_receive(comd, "AT_OWANDATA=1", answer))
 			ERROR(EFAULT, "AT_OWANDATA error");
 		if (strmatch(answer, "_OWANDATA: 1, "))
 			break;
-		if (count++ >= 15)
-			ERROR(EADDRNOTAVAIL, "OWANDATA time-out");
-	} while (!strmatch(answer, "_OWANDATA: 1, "));
+	}
+	retry_end(&r, strmatch(answer, "_OWANDATA: 1, "));
+	if (!strmatch(answer, "_OWANDATA: 1, "))
+		ERROR(EADDRNOTAVAIL, "OWANDATA time-out");
 
 	hso_parse_owandata(answer, p_conn_data);
 	hso_configure_net_up(interface, p_conn_data);
@@ -298,42 +264,67 @@ hso_check_conn_up(int comd, struct cdata *p_conn_data, char *interface)
 	}
 }
 
+/* Reprise rapide : l'appel du bail précédent est-il toujours établi ? */
+static int
+hso_warm_start(int comd, struct cdata *p_conn_data,
+			const struct cdata *lease, char *interface)
+{
+	fixed_buf answer;
+	struct at_ipconf ipconf;
+
+	if (send_receive(comd, "AT_OWANDATA=1", answer)
+			|| !strmatch(answer, "_OWANDATA: 1, ")
+			|| at_parse_owandata(answer, &ipconf))
+		return -1;
+	set_ipconf(p_conn_data, &ipconf);
+	if (!lease_match(lease, p_conn_data))
+		return -1;
+
+	hso_configure_net_up(interface, p_conn_data);
+	return 0;
+}
+
 static void
 hso_set_conn_down(int comd, char *interface)
 {
 	fixed_buf answer;
-	unsigned int count = 0;
+	msec_t deadline;
 
-	for (;;) {
-		get_check_answer(comd, "AT_OWANCALL=1,0", answer,"OK");
+	urc_register("_OWANCALL", NULL, NULL);
+	get_check_answer(comd, "AT_OWANCALL=1,0", answer,"OK");
+	deadline = deadline_in(CALL_TIMEOUT);
 
-		/* Now wait for an OWANCALL update */
-		if (!hso_wait_owancall(comd))
-			break;
-		if (count++ >= 2)
-			ERROR(EADDRNOTAVAIL, "Timed out waiting "
-					"for expected connection status");
-	}
+	/* Now wait for an OWANCALL update */
+	while (hso_wait_owancall(comd, deadline))
+		;
 	hso_configure_net_down(interface);
 }
 
 /* Monitoring */
 static int
 hso_monitor_connection(int comd, const char *filename,
-			const char *interface __attribute__((unused)),
+			const char *interface,
 			const char *ipsec)
 {
-	FILE *fd;
-	fixed_buf operator, answer;
+	fixed_buf answer;
+	struct at_cops cops;
+	struct at_csq csq;
+	struct at_cell cell;
+	struct quality_sample sample;
 	int level = 5;
 	int strength, quality, type;
-	int ret;
-	char sep;
-	char *typestr, profile[256];
-	size_t off, len;
+	char *typestr;
+
+	/* Interrogations groupées en une seule transaction */
+	struct at_query queries[] = {
+		{ .cmd = "AT+COPS?", .expected = "+COPS: 0," },
+		{ .cmd = "AT+CSQ", .expected = "+CSQ: " },
+		{ .cmd = "AT_OWCTI?", .expected = "_OWCTI: " },
+	};
+
+	at_query_batch(comd, queries, sizeof(queries)/sizeof(queries[0]));
 
 	/* Lecture du nom Activation de la gestion automatique */
-	get_check_answer(comd, "AT+COPS?", answer, "+COPS: 0,");
 	/* +COPS: 0,0,"Orange F",2
 	 * <mode>
 	 *
@@ -362,28 +353,10 @@ hso_monitor_connection(int comd, const char *filename,
 	 *  3. Forbidden
 	 */
 
-	off = sizeof("+COPS: 0,0") - 1;
-	if (answer[off] != ',')
-		ERROR(EFAULT,
-			"operator, expected ',' at %zd in %s", off, answer);
-	off++;
-	if (answer[off] == '"') {
-		sep = '"';
-		off++;
-	} else {
-		sep = ',';
-	}
-	buf_cpy(operator, answer + off);
-	DBGV(2, "operator: %s (raw)", operator);
-
-	len = strlen(operator);
-	for (off = 0; off < len; off++) {
-		if (operator[off] == sep) {
-			operator[off] = '\0';
-			break;
-		}
-	}
-	DBGV(2, "operator: %s", operator);
+	if (at_parse_cops(queries[0].answer, &cops) || !cops.oper)
+		ERROR(EFAULT, "operator, unexpected answer %s",
+						queries[0].answer);
+	DBGV(2, "operator: %s", cops.oper);
 
 	/* Lecture de la qualité du signal
 	 *
@@ -425,13 +398,11 @@ hso_monitor_connection(int comd, const char *filename,
 	 *
 	 * si ber > 0, -1 sur le signal.
 	 */
-	get_check_answer(comd, "AT+CSQ", answer, "+CSQ: ");
-	off = sizeof("+CSQ: ") - 1;
-	ret = sscanf(answer + off,"%u,%u", &strength, &quality);
-	if (ret < 2) {
-		ERROR_ERRNO("sscanf failed for AT+CSQ");
-		return(1);
-	}
+	if (at_parse_csq(queries[1].answer, &csq))
+		ERROR(EPROTO, "unexpected AT+CSQ answer %s",
+						queries[1].answer);
+	strength = csq.rssi;
+	quality = csq.ber;
 
 	if ((strength > 99) || (strength < 0))
 		WARN("out of bounds strength %d", strength);
@@ -547,22 +518,16 @@ hso_monitor_connection(int comd, const char *filename,
 	 * 1   HSDPA call in progress
 	 */
 
-	get_check_answer(comd, "AT_OWCTI?", answer, "_OWCTI: ");
-	off = sizeof("_OWCTI: ") - 1;
-	ret = sscanf(answer + off,"%u",&type);
-	if (ret < 1) {
-		ERROR_ERRNO("sscanf failed for AT+OWCTI");
-		return(1);
-	}
+	if (at_parse_owcti(queries[2].answer, &cell))
+		ERROR(EPROTO, "unexpected AT_OWCTI answer %s",
+						queries[2].answer);
+	type = cell.umts;
 
 	if ((type <= 0) || ((unsigned)type >= sizeof(types3G)/sizeof(char *))) {
 		get_check_answer(comd, "AT_OCTI?", answer, "_OCTI: ");
-		off = sizeof("_OCTI: ") - 1;
-		ret = sscanf(answer + off, "%zd,%u", &off /*foo*/ , &type);
-		if (ret < 2) {
-			ERROR_ERRNO("sscanf failed for AT+OCTI");
-			return(1);
-		}
+		if (at_parse_octi(answer, &cell))
+			ERROR(EPROTO, "unexpected AT_OCTI answer %s", answer);
+		type = cell.gsm;
 
 		if ((type < 0) || ((unsigned)type
 				>= sizeof(types2G)/sizeof(char *)))
@@ -571,23 +536,13 @@ hso_monitor_connection(int comd, const char *filename,
 	} else
 		typestr = types3G[type];
 	DBGV(2, "net: %s", typestr);
-	fd = open_file(filename, WriteMode);
-	if (!fd) {
-		ERROR_ERRNO("can't open report file %s", filename);
-		return(1);
-	}
-	len = readlink(CONFLINK, profile, sizeof(profile) - 1);
-	if(len > 0) {
-		profile[len] = '\0';
-		fprintf(fd, "profile: %s\n", basename(profile));
-	} else {
-		fprintf(fd, "profile: \n");
-	}
-	fprintf(fd, "ipsec: %s\n", ipsec);
-	fprintf(fd, "type: umts\n");
-	fprintf(fd, "level: %d\n", level);
-	fprintf(fd, "%s (%s)\n", operator, typestr);
-	return close_file(filename, fd);
+
+	quality_init(&sample, level, cops.oper, typestr);
+	quality_set_csq(&sample, &csq);
+	quality_record(interface, &sample);
+
+	return monitor_publish(filename, ipsec, level, "%s (%s)",
+					cops.oper, typestr);
 }
 
 umts_device_t hso_device =
@@ -595,11 +550,20 @@ umts_device_t hso_device =
 	.name = "HSO",
 	.device = "/dev/ttyHS1",
 	.interface = "hso0",
+	.init_retry = {
+		.initial = 500, .max_delay = 4000, .factor = 2,
+		.jitter = 20, .budget = HSO_OBLS_TIMEOUT,
+	},
+	.conn_retry = {
+		.initial = 250, .max_delay = 2000, .factor = 2,
+		.jitter = 20, .budget = HSO_OWANDATA_TIMEOUT,
+	},
 	.init = hso_init,
 	.check_conn_up = hso_check_conn_up,
 	.wait_reg_status = hso_wait_reg_status,
 	.set_conn_down = hso_set_conn_down,
 	.monitor_connection = hso_monitor_connection,
+	.warm_start = hso_warm_start,
 };
 
 
@@ -5,8 +5,13 @@
 
 #include "umts.h"
 
+/* Étape facultative, exécutée après la configuration réseau
+ * (umts_netlink.c) si présente. Aucun script de down n'est exécuté. */
 #define HSO_SCRIPT_UP 	HOOKS_DIR"/umts_hso_net_up.sh"
-#define HSO_SCRIPT_DOWN	HOOKS_DIR"/umts_hso_net_down.sh"
+
+/* Délais maximaux (ms) */
+#define HSO_OBLS_TIMEOUT	40000U	/* initialisation du modem */
+#define HSO_OWANDATA_TIMEOUT	15000U	/* paramètres de connexion */
 
 static const char HSO_DEVICE[]="/dev/ttyHS1";
 
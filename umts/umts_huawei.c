@@ -11,73 +11,49 @@
 static void
 huawei_parse_dhcp(fixed_buf answer, struct cdata *p_conn_data)
 {
-	uint32_t ip_address, mask, gateway, dhcp, dns1, dns2, unk1, unk2;
-	if (sscanf(answer, "^DHCP:%x,%x,%x,%x,%x,%x,%d,%d",
-		&ip_address, &mask, &gateway, &dhcp, &dns1, &dns2, &unk1, &unk2) != 8)
-		ERROR_ERRNO("Unreadable connection parameters: %s", answer);
+	struct at_ipconf ipconf;
 
-	if (!inet_ntop(AF_INET, &ip_address, p_conn_data->ip_address, MAX_LEN))
-		ERROR_ERRNO("Error parsing IP address: %x.", ip_address);
-
-	if (!inet_ntop(AF_INET, &mask, p_conn_data->mask, MAX_LEN))
-		ERROR_ERRNO("Error parsing subnet mask: %x.", mask);
-
-	if (!inet_ntop(AF_INET, &gateway, p_conn_data->gateway, MAX_LEN))
-		ERROR_ERRNO("Error parsing gateway address: %x.", gateway);
-
-	if (!inet_ntop(AF_INET, &dns1, p_conn_data->dns1, MAX_LEN))
-		ERROR_ERRNO("Error parsing DNS1: %x.", dns1);
-
-	if (!inet_ntop(AF_INET, &dns2, p_conn_data->dns2, MAX_LEN))
-	{
-		WARN("Error parsing DNS2: %x.", dns2);
-	}
-
-	DBGV(2, "Connection parameters: IP=%s/%s GW=%s DNS1=%s DNS2=%s\n",
-		p_conn_data->ip_address,
-		p_conn_data->mask,
-		p_conn_data->gateway,
-		p_conn_data->dns1,
-		p_conn_data->dns2);
+	if (at_parse_dhcp(answer, &ipconf))
+		ERROR(EINVAL, "Unreadable connection parameters: %s", answer);
+	set_ipconf(p_conn_data, &ipconf);
 }
 
 static int
 huawei_wait_dhcp(int comd, struct cdata *p_conn_data)
 {
 	fixed_buf tmp;
-	int ip, mask, gw, dhcp, dns1, dns2, unk1, unk2;
-	unsigned int i;
-	for (i = 0; i < 6; i++) {
-		send_receive(comd, "AT^DHCP?", tmp);
-		if (strmatch(tmp, "+CME ERROR:")) {
-			LOG("No connection yet\n");
-			usleep(UDELAY);
-			continue;
-		}
-
-		if (sscanf(tmp, "^DHCP:%x,%x,%x,%x,%x,%x,%d,%d",
-			&ip, &mask, &gw, &dhcp, &dns1, &dns2, &unk1, &unk2) != 8) {
+	struct at_ipconf ipconf;
+	struct retry r;
+
+	retry_start(&r, "AT^DHCP", &huawei_device.conn_retry);
+	while (retry_next(&r, comd)) {
+		if (send_receive(comd, "AT^DHCP?", tmp))
+			tmp[0] = '\0';
+		if (strmatch(tmp, "^DHCP:")) {
+			if (!at_parse_dhcp(tmp, &ipconf)) {
+				set_ipconf(p_conn_data, &ipconf);
+				retry_end(&r, 1);
+				return 0;
+			}
 			LOG("Unreadable connection parameters: %s", tmp);
-			continue;
+		} else if (strmatch(tmp, "+CME ERROR:")) {
+			LOG("No connection yet");
 		}
-    huawei_parse_dhcp(tmp, p_conn_data);
-		return 0;
 	}
+	retry_end(&r, 0);
+
 	ERROR(EADDRNOTAVAIL, "Timed out waiting for connection status update");
 }
 
 static void
 huawei_configure_net_down(char *interface)
 {
-	char *argv[] = {
-		HUAWEI_SCRIPT_DOWN,
-		interface,
-		NULL };
-
+	/* pas de script de down : la dconfiguration est complte */
+	phase_begin("net_down");
 	LOG("Bringing down network on %s", interface);
 
-	if (fork_exec(argv))
-		ERROR(EFAULT, "Failed to run net_down script");
+	if (net_down(interface, NULL))
+		ERROR(EFAULT, "Failed to bring down network");
 }
 
 static void
@@ -93,6 +69,7 @@ huawei_configure_net_up(char *interface, struct cdata *p_conn_data)
 		p_conn_data->dns2,
 		NULL };
 
+	phase_begin("net_up");
 	LOG("Bringing up network: %s:%s/%s, GW: %s, DNS: %s / %s",
 		interface,
 		p_conn_data->ip_address,
@@ -101,8 +78,8 @@ huawei_configure_net_up(char *interface, struct cdata *p_conn_data)
 		p_conn_data->dns1,
 		p_conn_data->dns2);
 
-	if (fork_exec(argv))
-		ERROR(EFAULT, "Failed to run net_up script");
+	if (net_up(interface, p_conn_data, NET_GATEWAY | NET_FIX_HWADDR, argv))
+		ERROR(EFAULT, "Failed to configure network");
 }
 
 static void
@@ -110,11 +87,13 @@ huawei_set_up_conn(int comd, struct cdata *p_conn_data, char *interface)
 {
 	fixed_buf cmd, answer;
 
+	phase_begin("call");
 	LOG("Registering with APN");
 	buf_format_string(cmd, "AT^NDISDUP=1,1,\"%s\"", p_conn_data->apn);
 	get_check_answer(comd, cmd, answer, "OK");
 	DBGV(2, "got NDISDUP answer");
 
+	phase_begin("conn_params");
 	huawei_wait_dhcp(comd, p_conn_data);
 	huawei_configure_net_up(interface, p_conn_data);
 }
@@ -128,6 +107,25 @@ static int huawei_init(int comd)
 	writecom(comd, "ATE");
 	return 0;
 }
+/* Reprise rapide : l'appel du bail prcdent est-il toujours tabli ? */
+static int
+huawei_warm_start(int comd, struct cdata *p_conn_data,
+			const struct cdata *lease, char *interface)
+{
+	fixed_buf answer;
+	struct at_ipconf ipconf;
+
+	if (send_receive(comd, "AT^DHCP?", answer)
+			|| at_parse_dhcp(answer, &ipconf))
+		return -1;
+	set_ipconf(p_conn_data, &ipconf);
+	if (!lease_match(lease, p_conn_data))
+		return -1;
+
+	huawei_configure_net_up(interface, p_conn_data);
+	return 0;
+}
+
 /* Vrifie si la liaison est tablie, l'tablit au besoin */
 static void
 huawei_check_conn_up(int comd, struct cdata *p_conn_data, char *interface)
@@ -156,7 +154,6 @@ static int
 huawei_wait_reg_status(int comd)
 {
 	fixed_buf answer;
-	unsigned int count;
 
 	/* Mise de la carte en mode de slection automatique */
 	if (send_receive(comd, "AT+CFUN=1", answer))
@@ -165,59 +162,7 @@ huawei_wait_reg_status(int comd)
   if (strmatch(answer, "ERROR"))
       ERROR(EADDRNOTAVAIL, "Cant activate radio");
 
-	/* Dsactivation de la gestion automatique */
-	get_check_answer(comd, "AT+CREG=0", answer, "OK");
-	/*
-	 * AT+CREG=<n>
-	 *  <n>
-	 *    0. Disable unsolicited status callback.
-	 *    1. Enable unsolicited status callback, +CREG: <stat>
-	 *    2. Enable unsolicited status callback,
-	 * +CREG: <stat>,[,<lac>,<ci>]
-	 *  <stat>
-	 *    0. Not registered, not searching
-	 *    1. Registered, home network
-	 *    2. Not registered, searching
-	 *    3. Registration denied
-	 *    4. Unknown
-	 *    5. Registered, roaming
-	 */
-	for (count = 0; count < 10; count++) {
-		if (send_receive(comd, "AT+CREG?", answer))
-			return -1;
-		/* enregistr sur le rseau natif */
-		if (strmatch(answer, "+CREG: 0,1")) {
-			LOG("Registered with network, native");
-			return 0;
-		}
-		/* enregistr en roaming */
-		if (strmatch(answer, "+CREG: 0,5")) {
-			LOG("Registered with network, roaming");
-			return 0;
-		}
-		/* enregistrement interdit */
-		if (strmatch(answer, "+CREG: 0,3")) {
-			WARN("CREG permission denied");
-			return -1;
-		}
-		/* non enregistr, inactif */
-		/* on vient de rentrer le PIN, on double le temps d'attente */
-		if (strmatch(answer, "+CREG: 0,0")) {
-			DBG("Not registered with network yet");
-			usleep(UDELAY);
-			/* unknown, semble se produire une fois lorsqu'on monte l'interface pour la
-			 * premire fois */
-			} else if (strmatch(answer, "+CREG: 0,4")) {
-			DBG("Unknown CREG answer, wait a little and retry");
-			usleep(UDELAY);
-		/* si on n'est pas en recherche */
-		} else if (!strmatch(answer, "+CREG: 0,2")) {
-			ERROR(EPROTO, "CREG unexpected answer %s", answer);
-		}
-		usleep(UDELAY);
-	}
-	WARN("CREG timeout");
-	return -1;
+	return wait_net_registration(comd, REG_TIMEOUT);
 }
 
 static void
@@ -238,20 +183,34 @@ huawei_set_conn_down(int comd, char *interface)
 
 static int
 huawei_monitor_connection(int comd, const char *filename,
-			const char *interface __attribute__((unused)),
+			const char *interface,
 			const char *ipsec)
 {
-	FILE *fd;
-	fixed_buf operator, answer;
+	struct at_cops cops;
+	struct at_cell cell;
+	struct at_csq csq;
+	struct at_cesq cesq;
+	struct quality_sample sample;
+	fixed_buf answer;
 	int level = 5;
-	int ret;
-	char sep;
-	char profile[256];
-	size_t off, len;
-	fixed_buf mode, submode;
+	unsigned int n = 4;
+
+	/* Interrogations groupes en une seule transaction */
+	struct at_query queries[] = {
+		{ .cmd = "AT+COPS?", .expected = "+COPS: " },
+		{ .cmd = "AT+CIND?", .expected = "+CIND: " },
+		{ .cmd = "AT^SYSINFOEX", .expected = "^SYSINFOEX:" },
+		{ .cmd = "AT+CSQ", .expected = "+CSQ: " },
+		{ .cmd = "AT+CESQ", .expected = "+CESQ: " },
+	};
+
+	/* AT+CESQ rejoint la transaction une fois connu du modem ; il
+	 * n'est envoy seul que pour le sonder */
+	if (caps_get(CAP_CESQ) == CAP_OK && caps_get(CAP_CONCAT) == CAP_OK)
+		n++;
+	at_query_batch(comd, queries, n);
 
 	/* Lecture du nom Activation de la gestion automatique */
-	get_check_answer(comd, "AT+COPS?", answer, "+COPS: ");
 	/* +COPS: 0,0,"Orange F",2
 	 * <mode>
 	 *
@@ -280,28 +239,10 @@ huawei_monitor_connection(int comd, const char *filename,
 	 *  3. Forbidden
 	 */
 
-	off = sizeof("+COPS: 0,0") - 1;
-	if (answer[off] != ',')
-		ERROR(EFAULT,
-			"operator, expected ',' at %zd in %s", off, answer);
-	off++;
-	if (answer[off] == '"') {
-		sep = '"';
-		off++;
-	} else {
-		sep = ',';
-	}
-	buf_cpy(operator, answer + off);
-	DBGV(2, "operator: %s (raw)", operator);
-
-	len = strlen(operator);
-	for (off = 0; off < len; off++) {
-		if (operator[off] == sep) {
-			operator[off] = '\0';
-			break;
-		}
-	}
-	DBGV(2, "operator: %s", operator);
+	if (at_parse_cops(queries[0].answer, &cops) || !cops.oper)
+		ERROR(EFAULT, "operator, unexpected answer %s",
+						queries[0].answer);
+	DBGV(2, "operator: %s", cops.oper);
 
 	/* Lecture de la qualit du signal
 	 *
@@ -319,13 +260,9 @@ huawei_monitor_connection(int comd, const char *filename,
 						("callsetup",(0-3)),
 						("callheld",(0-1))
 	 */
-	get_check_answer(comd, "AT+CIND?", answer, "+CIND: ");
-	off = sizeof("+CIND: 0,") - 1;
-	ret = sscanf(answer + off,"%u,", &level);
-	if (ret < 1) {
-		ERROR_ERRNO("sscanf failed for AT+CIND");
-		return(1);
-	}
+	if (at_parse_cind(queries[1].answer, &level))
+		ERROR(EPROTO, "unexpected AT+CIND answer %s",
+						queries[1].answer);
 
 	DBGV(2, "level: %d", level);
 
@@ -422,29 +359,30 @@ huawei_monitor_connection(int comd, const char *filename,
 	 * 	<submode_name> System sub mode as a string
 	 */
 
-	get_check_answer(comd, "AT^SYSINFOEX", answer, "^SYSINFOEX:");
-	ret = sscanf(answer, "^SYSINFOEX:%*d,%*d,%*d,%*d,,%*d,\"%[^\"]\",%*d,\"%[^\"]\"", mode, submode);
-	if (ret < 2)
-		ERROR_ERRNO("sscanf failed for AT^SYSINFOEX");
+	if (at_parse_sysinfoex(queries[2].answer, &cell))
+		ERROR(EPROTO, "unexpected AT^SYSINFOEX answer %s",
+						queries[2].answer);
 
-	DBGV(2, "net: %s/%s", mode, submode);
-	fd = open_file(filename, WriteMode);
-	if (!fd) {
-		ERROR_ERRNO("can't open report file %s", filename);
-		return(1);
-	}
-	len = readlink(CONFLINK, profile, sizeof(profile) - 1);
-	if(len > 0) {
-		profile[len] = '\0';
-		fprintf(fd, "profile: %s\n", basename(profile));
-	} else {
-		fprintf(fd, "profile: \n");
+	DBGV(2, "net: %s/%s", cell.sysmode, cell.submode);
+
+	/* Historique : RSSI et BER bruts, RSRP et RSRQ (LTE) si le modem
+	 * connat AT+CESQ */
+	quality_init(&sample, level, cops.oper, cell.submode);
+	if (at_parse_csq(queries[3].answer, &csq))
+		WARN("unexpected AT+CSQ answer %s", queries[3].answer);
+	else
+		quality_set_csq(&sample, &csq);
+	if (n > 4) {
+		if (!at_parse_cesq(queries[4].answer, &cesq))
+			quality_set_cesq(&sample, &cesq);
+	} else if (!caps_command(comd, CAP_CESQ, "AT+CESQ", answer)
+			&& !at_parse_cesq(answer, &cesq)) {
+		quality_set_cesq(&sample, &cesq);
 	}
-	fprintf(fd, "ipsec: %s\n", ipsec);
-	fprintf(fd, "type: umts\n");
-	fprintf(fd, "level: %d\n", level);
-	fprintf(fd, "%s (%s/%s)\n", operator, mode, submode);
-	return close_file(filename, fd);
+	quality_record(interface, &sample);
+
+	return monitor_publish(filename, ipsec, level, "%s (%s/%s)",
+					cops.oper, cell.sysmode, cell.submode);
 }
 
 umts_device_t huawei_device =
@@ -452,9 +390,14 @@ umts_device_t huawei_device =
 	.name = "Huawei/Option",
 	.device = "/dev/ttyUSB0",
 	.interface = "wwan0",
+	.conn_retry = {
+		.initial = 250, .max_delay = 2000, .factor = 2,
+		.jitter = 20, .budget = HUAWEI_DHCP_TIMEOUT,
+	},
 	.init = huawei_init,
 	.check_conn_up = huawei_check_conn_up,
 	.wait_reg_status = huawei_wait_reg_status,
 	.set_conn_down = huawei_set_conn_down,
 	.monitor_connection = huawei_monitor_connection,
+	.warm_start = huawei_warm_start,
 };
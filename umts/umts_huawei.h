@@ -7,7 +7,9 @@
 #include <arpa/inet.h>
 
 #define HUAWEI_SCRIPT_UP 	HOOKS_DIR"/umts_huawei_net_up.sh"
-#define HUAWEI_SCRIPT_DOWN	HOOKS_DIR"/umts_hso_net_down.sh" /* same as HSO */
+
+/* Délai maximal d'obtention des paramètres de connexion (ms) */
+#define HUAWEI_DHCP_TIMEOUT	6000U
 
 extern umts_device_t huawei_device;
 #endif /* UMTS_HUAWEI_H */
@@ -0,0 +1,149 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_lease - mémorisation de la dernière connexion par profil
+ *
+ *	Après un up complet, l'APN et les paramètres IP obtenus sont
+ *	conservés dans UMTS_RUN_DIR/umts_lease.<clé>, la clé étant le
+ *	chemin du fichier de configuration du profil. Au up suivant, si
+ *	l'appel est toujours établi avec les mêmes paramètres (une seule
+ *	interrogation du modem), la configuration réseau est réappliquée
+ *	sans code PIN, enregistrement ni numérotation. Le bail est effacé
+ *	par down.
+ *
+ *	La cellule de service et l'opérateur ne sont pas conservés : un
+ *	appel établi avec les mêmes paramètres IP reste utilisable après
+ *	un changement de cellule (handover) ou d'opérateur (itinérance), et
+ *	les vérifier coûterait une interrogation de plus au démarrage
+ *	rapide.
+ */
+
+#include "umts.h"
+
+static void
+lease_path(char *path, size_t len, const char *filename, const char *suffix)
+{
+	char real[PATH_MAX];
+	fixed_buf key;
+
+	if (!realpath(filename, real))
+		buf_cpy(key, filename);
+	else if (strlen(real) >= MAX_LEN)
+		buf_cpy(key, real + strlen(real) - MAX_LEN + 1);
+	else
+		buf_cpy(key, real);
+	run_key_sanitize(key);
+	snprintf(path, len, "%s/umts_lease.%s%s", umts_run_dir(), key, suffix);
+}
+
+/* Champs du bail, dans l'ordre du fichier */
+static const struct {
+	const char *name;
+	size_t off;
+} lease_fields[] = {
+	{ "apn", offsetof(struct cdata, apn) },
+	{ "ip_address", offsetof(struct cdata, ip_address) },
+	{ "mask", offsetof(struct cdata, mask) },
+	{ "gateway", offsetof(struct cdata, gateway) },
+	{ "dns1", offsetof(struct cdata, dns1) },
+	{ "dns2", offsetof(struct cdata, dns2) },
+};
+#define LEASE_NFIELDS (sizeof(lease_fields) / sizeof(lease_fields[0]))
+
+void
+lease_save(const char *filename, const struct cdata *p_conn_data)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	unsigned int i;
+	FILE *fp;
+
+	lease_path(path, sizeof(path), filename, "");
+	lease_path(tmp, sizeof(tmp), filename, ".tmp");
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		WARN_ERRNO("failed to open %s", tmp);
+		return;
+	}
+	for (i = 0; i < LEASE_NFIELDS; i++)
+		fprintf(fp, "%s=%s\n", lease_fields[i].name,
+			(const char *)p_conn_data + lease_fields[i].off);
+	if (fclose(fp) || rename(tmp, path))
+		WARN_ERRNO("failed to write %s", path);
+}
+
+static int
+lease_load(const char *filename, struct cdata *lease)
+{
+	char path[PATH_MAX], line[2 * MAX_LEN], *val;
+	unsigned int i;
+	FILE *fp;
+
+	memset(lease, 0, sizeof(*lease));
+	lease_path(path, sizeof(path), filename, "");
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	while (fgets(line, sizeof(line), fp)) {
+		strip_right(line);
+		val = strchr(line, '=');
+		if (!val)
+			continue;
+		*val++ = '\0';
+		for (i = 0; i < LEASE_NFIELDS; i++) {
+			if (!strcmp(line, lease_fields[i].name)
+					&& strlen(val) < MAX_LEN)
+				strcpy((char *)lease + lease_fields[i].off, val);
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+void
+lease_clear(const char *filename)
+{
+	char path[PATH_MAX];
+
+	lease_path(path, sizeof(path), filename, "");
+	if (unlink(path) && errno != ENOENT)
+		WARN_ERRNO("failed to remove %s", path);
+}
+
+/* Les paramètres annoncés par le modem sont-ils ceux du bail ? */
+int
+lease_match(const struct cdata *lease, const struct cdata *p_conn_data)
+{
+	if (strcmp(lease->ip_address, p_conn_data->ip_address)
+			|| strcmp(lease->gateway, p_conn_data->gateway)) {
+		LOG("connection parameters changed: %s -> %s",
+			lease->ip_address, p_conn_data->ip_address);
+		return 0;
+	}
+	return 1;
+}
+
+/* Reprise de la connexion du bail précédent, si le pilote le permet
+ * et que le modem la confirme. Retourne 0 si la connexion est reprise,
+ * -1 s'il faut passer par l'établissement complet. */
+int
+lease_warm_start(umts_device_t *umts_device, int comd, const char *filename,
+			struct cdata *p_conn_data, char *interface)
+{
+	struct cdata lease;
+
+	if (!umts_device->warm_start || lease_load(filename, &lease))
+		return -1;
+	if (strcmp(lease.apn, p_conn_data->apn)) {
+		DBG("APN changed since last connection, full bring-up");
+		return -1;
+	}
+
+	phase_begin("warm");
+	if (umts_device->warm_start(comd, p_conn_data, &lease, interface)) {
+		LOG("previous connection is gone, full bring-up");
+		return -1;
+	}
+	LOG("warm start on %s, previous connection reused", interface);
+	return 0;
+}
@@ -0,0 +1,698 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#include "umts_mbim.h"
+
+/* umts_config module for cdc_mbim modems, MBIM control channel on
+ * /dev/cdc-wdmN
+ *
+ * La fonction MBIM est ouverte à la demande (MBIM_OPEN_MSG sur
+ * MBIM_ERROR_NOT_OPENED) et n'est jamais fermée : la fermeture
+ * désactiverait le contexte. L'état de la connexion est porté par le
+ * modem, check, le up suivant et down l'interrogent directement. */
+
+/**********************/
+/* Internal functions */
+/**********************/
+
+/* Session du contexte activé (une seule) */
+#define MBIM_SESSION_ID		0
+
+/* MBIM_SUBSCRIBER_READY_STATE */
+#define MBIM_READY_INITIALIZED	1
+#define MBIM_READY_DEVICE_LOCKED 6
+/* MBIM_PIN_TYPE, MBIM_PIN_STATE, MBIM_PIN_OPERATION */
+#define MBIM_PIN_TYPE_PIN1	2
+#define MBIM_PIN_STATE_LOCKED	1
+#define MBIM_PIN_OP_ENTER	0
+/* MBIM_REGISTER_STATE */
+#define MBIM_REG_SEARCHING	2
+#define MBIM_REG_HOME		3
+#define MBIM_REG_ROAMING	4
+#define MBIM_REG_PARTNER	5
+#define MBIM_REG_DENIED		6
+/* MBIM_ACTIVATION_STATE, MBIM_ACTIVATION_COMMAND */
+#define MBIM_ACT_ACTIVATED	1
+#define MBIM_ACT_ACTIVATING	2
+#define MBIM_ACT_DEACTIVATE	0
+#define MBIM_ACT_ACTIVATE	1
+/* MBIM_AUTH_PROTOCOL, MBIM_CONTEXT_IP_TYPE */
+#define MBIM_AUTH_NONE		0
+#define MBIM_AUTH_PAP		1
+#define MBIM_IP_TYPE_IPV4	1
+
+/* Parties fixes des tampons d'information */
+#define MBIM_PIN_SET_LEN	24
+#define MBIM_CONNECT_LEN	36
+#define MBIM_CONNECT_SET_LEN	60
+#define MBIM_IP_CONFIG_LEN	60
+#define MBIM_PACKET_SET_LEN	4
+
+#define MBIM_RX_LEN (2 * MBIM_MSG_MAX)
+
+static struct {
+	uint32_t tid;
+	uint8_t rx[MBIM_RX_LEN];	/* octets reçus non traités */
+	size_t rx_len;
+	uint8_t msg[MBIM_MSG_MAX];	/* dernier message extrait */
+} mbim;
+
+/* Extrait le prochain message reçu avant l'échéance. msg pointe dans
+ * mbim.msg, jusqu'à l'appel suivant. Retourne 1 si un message est
+ * extrait, 0 à l'échéance, -1 sur erreur. */
+static int
+mbim_recv(int comd, struct mbim_msg *msg, msec_t deadline)
+{
+	ssize_t mlen, rret;
+
+	for (;;) {
+		mlen = mbim_msg_len(mbim.rx, mbim.rx_len);
+		if (mlen < 0) {
+			/* pas de marqueur de début : tout est écarté */
+			WARN("dropping %zu bytes of garbage", mbim.rx_len);
+			mbim.rx_len = 0;
+			continue;
+		}
+		if (mlen > 0) {
+			memcpy(mbim.msg, mbim.rx, mlen);
+			mbim.rx_len -= mlen;
+			memmove(mbim.rx, mbim.rx + mlen, mbim.rx_len);
+			if (mbim_decode(mbim.msg, mlen, msg)) {
+				WARN("malformed MBIM message dropped");
+				continue;
+			}
+			return 1;
+		}
+
+		rret = serial_read(comd, mbim.rx + mbim.rx_len,
+					sizeof(mbim.rx) - mbim.rx_len, deadline);
+		if (rret <= 0)
+			return (int)rret;
+		mbim.rx_len += rret;
+	}
+}
+
+static int
+mbim_basic_connect(const struct mbim_msg *msg)
+{
+	return !memcmp(msg->uuid, mbim_uuid_basic_connect, MBIM_UUID_LEN);
+}
+
+/* Message sans rapport avec l'échange en cours */
+static void
+mbim_unsolicited(const struct mbim_msg *msg)
+{
+	uint32_t val;
+
+	if (msg->type != MBIM_INDICATE_STATUS_MSG) {
+		DBG("stale MBIM message 0x%08x dropped", msg->type);
+		return;
+	}
+	if (mbim_basic_connect(msg) && msg->cid == MBIM_CID_CONNECT
+			&& !mbim_get_u32(msg, 4, &val)) {
+		LOG("activation state: %u", val);
+		return;
+	}
+	if (mbim_basic_connect(msg) && msg->cid == MBIM_CID_SIGNAL_STATE
+			&& !mbim_get_u32(msg, 0, &val)) {
+		DBG("signal state: rssi %u", val);
+		return;
+	}
+	DBG("MBIM indication %u ignored", msg->cid);
+}
+
+static void
+mbim_send(int comd, struct mbim_msg *msg)
+{
+	uint8_t buf[MBIM_MSG_MAX];
+	ssize_t len;
+
+	if (!++mbim.tid)
+		mbim.tid++;
+	msg->tid = mbim.tid;
+	len = mbim_encode(msg, buf, sizeof(buf));
+	if (len < 0)
+		ERROR(EMSGSIZE, "MBIM message too long");
+	umts_counters.at++;
+	writebuf(comd, (const char *)buf, len);
+}
+
+/* Ouverture de la fonction MBIM */
+static void
+mbim_open(int comd)
+{
+	struct mbim_msg msg = {
+		.type = MBIM_OPEN_MSG,
+		.status = MBIM_MSG_MAX,
+	};
+	msec_t deadline = deadline_in(MBIM_TIMEOUT);
+	uint32_t tid;
+
+	LOG("Opening MBIM function");
+	mbim_send(comd, &msg);
+	tid = msg.tid;
+	for (;;) {
+		if (mbim_recv(comd, &msg, deadline) <= 0)
+			ERROR(EPROTO, "no answer to MBIM open");
+		if (msg.type != MBIM_OPEN_DONE || msg.tid != tid) {
+			mbim_unsolicited(&msg);
+			continue;
+		}
+		if (msg.status != MBIM_STATUS_SUCCESS)
+			ERROR(EPROTO, "MBIM open failed: status %u", msg.status);
+		return;
+	}
+}
+
+/* Envoi d'une commande Basic Connect et attente de la réponse, dans
+ * resp. Retourne 0 en cas de succès, -1 sinon, status contenant alors
+ * le statut MBIM (MBIM_STATUS_SUCCESS sans réponse). */
+static int
+mbim_command(int comd, uint32_t cid, uint32_t cmd_type,
+		const struct mbim_info *info, struct mbim_msg *resp,
+		uint32_t *status, unsigned int timeout)
+{
+	struct mbim_msg msg;
+	msec_t deadline = deadline_in(timeout);
+	int opened = 0;
+
+	if (!mbim.tid)
+		mbim.tid = (uint32_t)getpid() << 16;
+retry:
+	memset(&msg, 0, sizeof(msg));
+	msg.type = MBIM_COMMAND_MSG;
+	msg.uuid = mbim_uuid_basic_connect;
+	msg.cid = cid;
+	msg.cmd_type = cmd_type;
+	if (info) {
+		msg.info = info->buf;
+		msg.info_len = (uint32_t)info->len;
+	}
+	DBGV(2, "-> MBIM %s %u", (cmd_type == MBIM_SET) ? "set" : "query", cid);
+	mbim_send(comd, &msg);
+
+	for (;;) {
+		if (mbim_recv(comd, resp, deadline) <= 0) {
+			WARN("no answer to MBIM command %u", cid);
+			*status = MBIM_STATUS_SUCCESS;
+			return -1;
+		}
+		if (resp->type == MBIM_FUNCTION_ERROR_MSG
+				&& resp->tid == msg.tid) {
+			if (resp->status == MBIM_ERROR_NOT_OPENED && !opened) {
+				mbim_open(comd);
+				opened = 1;
+				goto retry;
+			}
+			ERROR(EPROTO, "MBIM command %u: error %u",
+							cid, resp->status);
+		}
+		if (resp->type != MBIM_COMMAND_DONE || resp->tid != msg.tid
+				|| resp->cid != cid
+				|| !mbim_basic_connect(resp)) {
+			mbim_unsolicited(resp);
+			continue;
+		}
+		*status = resp->status;
+		DBGV(2, "<- MBIM %u: %u", cid, *status);
+		return (*status == MBIM_STATUS_SUCCESS) ? 0 : -1;
+	}
+}
+
+/* Attente d'une indication Basic Connect. Retourne 1 si elle est reçue,
+ * 0 à l'échéance, -1 sur erreur. */
+static int
+mbim_wait_indication(int comd, uint32_t cid, struct mbim_msg *msg,
+							msec_t deadline)
+{
+	int ret;
+
+	for (;;) {
+		ret = mbim_recv(comd, msg, deadline);
+		if (ret <= 0)
+			return ret;
+		if (msg->type == MBIM_INDICATE_STATUS_MSG
+				&& mbim_basic_connect(msg) && msg->cid == cid)
+			return 1;
+		mbim_unsolicited(msg);
+	}
+}
+
+/*********************************************************/
+/** Connexion **/
+/*********************************************************/
+
+static void
+mbim_configure_net_down(char *interface)
+{
+	/* pas de script de down : la déconfiguration est complète */
+	phase_begin("net_down");
+	LOG("Bringing down network on %s", interface);
+
+	if (net_down(interface, NULL))
+		ERROR(EFAULT, "Failed to bring down network");
+}
+
+static void
+mbim_configure_net_up(char *interface, struct cdata *p_conn_data)
+{
+	char *argv[] = {
+		MBIM_SCRIPT_UP,
+		interface,
+		p_conn_data->ip_address,
+		p_conn_data->mask,
+		p_conn_data->gateway,
+		p_conn_data->dns1,
+		p_conn_data->dns2,
+		NULL };
+
+	phase_begin("net_up");
+	LOG("Bringing up network: %s:%s/%s, GW: %s, DNS: %s / %s",
+		interface,
+		p_conn_data->ip_address,
+		p_conn_data->mask,
+		p_conn_data->gateway,
+		p_conn_data->dns1,
+		p_conn_data->dns2);
+
+	if (net_up(interface, p_conn_data, NET_GATEWAY | NET_FIX_HWADDR, argv))
+		ERROR(EFAULT, "Failed to configure network");
+}
+
+/* État d'activation du contexte, -1 si illisible */
+static int
+mbim_activation_state(int comd)
+{
+	struct mbim_info info;
+	struct mbim_msg resp;
+	uint32_t status, state;
+
+	mbim_info_init(&info, MBIM_CONNECT_LEN);
+	mbim_info_u32(&info, 0, MBIM_SESSION_ID);
+	if (mbim_command(comd, MBIM_CID_CONNECT, MBIM_QUERY, &info, &resp,
+						&status, MBIM_TIMEOUT)) {
+		if (status == MBIM_STATUS_CONTEXT_NOT_ACTIVATED)
+			return 0;
+		return -1;
+	}
+	if (mbim_get_u32(&resp, 4, &state))
+		return -1;
+	return (int)state;
+}
+
+/* Adresse IPv4 dont l'offset est à off */
+static int
+mbim_ipv4(const struct mbim_msg *msg, size_t off, uint32_t *addr)
+{
+	const uint8_t *p;
+	uint32_t offset;
+
+	if (mbim_get_u32(msg, off, &offset))
+		return -1;
+	p = mbim_get_data(msg, offset, 4);
+	if (!p)
+		return -1;
+	memcpy(addr, p, 4);	/* ordre réseau */
+	return 0;
+}
+
+/* Paramètres IP du contexte activé (MBIM_CID_IP_CONFIGURATION) */
+static int
+mbim_get_settings(int comd, struct cdata *p_conn_data)
+{
+	struct mbim_info info;
+	struct mbim_msg resp;
+	struct at_ipconf ipconf;
+	const uint8_t *p;
+	uint32_t status, avail, count, offset, prefix;
+
+	mbim_info_init(&info, MBIM_IP_CONFIG_LEN);
+	mbim_info_u32(&info, 0, MBIM_SESSION_ID);
+	if (mbim_command(comd, MBIM_CID_IP_CONFIGURATION, MBIM_QUERY, &info,
+					&resp, &status, MBIM_TIMEOUT)) {
+		LOG("No connection parameters: status %u", status);
+		return -1;
+	}
+
+	/* IPv4ConfigurationAvailable : 1 adresse, 2 passerelle, 4 DNS */
+	if (mbim_get_u32(&resp, 4, &avail) || !(avail & 1)
+			|| mbim_get_u32(&resp, 12, &count) || !count
+			|| mbim_get_u32(&resp, 16, &offset))
+		return -1;
+	/* élément : longueur du préfixe, puis adresse */
+	p = mbim_get_data(&resp, offset, 8);
+	if (!p)
+		return -1;
+
+	memset(&ipconf, 0, sizeof(ipconf));
+	prefix = mbim_get_le32(p);
+	memcpy(&ipconf.addr, p + 4, 4);
+	if (prefix && prefix <= 32) {
+		ipconf.mask = htonl(~0U << (32 - prefix));
+		ipconf.has_mask = 1;
+	}
+	if (avail & 2)
+		mbim_ipv4(&resp, 28, &ipconf.gw);
+	if ((avail & 4) && !mbim_get_u32(&resp, 36, &count)
+			&& !mbim_get_u32(&resp, 40, &offset)) {
+		if (count >= 1 && (p = mbim_get_data(&resp, offset, 4)))
+			memcpy(&ipconf.dns1, p, 4);
+		if (count >= 2 && (p = mbim_get_data(&resp, offset + 4, 4)))
+			memcpy(&ipconf.dns2, p, 4);
+	}
+	set_ipconf(p_conn_data, &ipconf);
+	return 0;
+}
+
+static void
+mbim_add_string(struct mbim_info *info, size_t off, const char *str)
+{
+	if (mbim_info_string(info, off, str))
+		ERROR(EMSGSIZE, "MBIM message too long");
+}
+
+/* Activation du contexte, bloquante jusqu'à ce que le modem l'ait
+ * activé ou refusé */
+static void
+mbim_connect(int comd, struct cdata *p_conn_data)
+{
+	struct mbim_info info;
+	struct mbim_msg resp;
+	msec_t deadline = deadline_in(MBIM_CONNECT_TIMEOUT);
+	uint32_t status, state;
+
+	phase_begin("call");
+	LOG("Activating context with APN %s", p_conn_data->apn);
+
+	mbim_info_init(&info, MBIM_CONNECT_SET_LEN);
+	mbim_info_u32(&info, 0, MBIM_SESSION_ID);
+	mbim_info_u32(&info, 4, MBIM_ACT_ACTIVATE);
+	mbim_add_string(&info, 8, p_conn_data->apn);
+	if (p_conn_data->identity[0]) {
+		mbim_add_string(&info, 16, p_conn_data->identity);
+		mbim_add_string(&info, 24, p_conn_data->password);
+		mbim_info_u32(&info, 36, MBIM_AUTH_PAP);
+	} else {
+		mbim_info_u32(&info, 36, MBIM_AUTH_NONE);
+	}
+	mbim_info_u32(&info, 40, MBIM_IP_TYPE_IPV4);
+	mbim_info_uuid(&info, 44, mbim_uuid_context_internet);
+
+	if (mbim_command(comd, MBIM_CID_CONNECT, MBIM_SET, &info, &resp,
+					&status, MBIM_CONNECT_TIMEOUT)) {
+		if (!mbim_get_u32(&resp, 32, &state) && state)
+			ERROR(ECALLFAILED, "Call failed: status %u, "
+					"network error %u", status, state);
+		ERROR(ECALLFAILED, "Call failed: status %u", status);
+	}
+	if (mbim_get_u32(&resp, 4, &state))
+		ERROR(EPROTO, "No activation state in connect answer");
+
+	while (state == MBIM_ACT_ACTIVATING) {
+		if (mbim_wait_indication(comd, MBIM_CID_CONNECT, &resp,
+							deadline) <= 0)
+			ERROR(ECALLFAILED, "Context activation timeout");
+		if (mbim_get_u32(&resp, 4, &state))
+			ERROR(EPROTO, "No activation state in connect "
+							"indication");
+	}
+	if (state != MBIM_ACT_ACTIVATED)
+		ERROR(ECALLFAILED, "Call failed: activation state %u", state);
+}
+
+/* Interprétation de l'état d'enregistrement : retourne 0 si
+ * enregistré, -1 si refusé, 1 s'il faut attendre */
+static int
+mbim_reg_status(const struct mbim_msg *msg)
+{
+	uint32_t state;
+
+	if (mbim_get_u32(msg, 4, &state))
+		ERROR(EPROTO, "No registration state");
+
+	switch (state) {
+		case MBIM_REG_HOME:
+			LOG("Registered with network, native");
+			return 0;
+		case MBIM_REG_ROAMING:
+		case MBIM_REG_PARTNER:
+			LOG("Registered with network, roaming");
+			return 0;
+		case MBIM_REG_DENIED:
+			WARN("Registration denied");
+			return -1;
+		case MBIM_REG_SEARCHING:
+			DBG("Searching network");
+			return 1;
+		default:
+			return 1;
+	}
+}
+
+/* Technologie radio d'après la classe de données courante */
+static const char *
+mbim_data_class(uint32_t class)
+{
+	if (class & 0x20)
+		return "LTE";
+	if (class & 0x18)
+		return "HSPA";
+	if (class & 0x04)
+		return "UMTS";
+	if (class & 0x02)
+		return "EDGE";
+	if (class & 0x01)
+		return "GPRS";
+	return "unknown";
+}
+
+/**********************/
+/* External functions */
+/**********************/
+
+static int
+mbim_check_pin(int comd, struct cdata *p_conn_data)
+{
+	struct mbim_info info;
+	struct mbim_msg resp;
+	uint32_t status, ready, type, state;
+
+	if (mbim_command(comd, MBIM_CID_SUBSCRIBER_READY_STATUS, MBIM_QUERY,
+					NULL, &resp, &status, MBIM_TIMEOUT)
+			|| mbim_get_u32(&resp, 0, &ready)) {
+		WARN("No subscriber ready status");
+		return -1;
+	}
+	if (ready == MBIM_READY_INITIALIZED) {
+		LOG("PIN already set up");
+		return 0;
+	}
+	if (ready != MBIM_READY_DEVICE_LOCKED) {
+		WARN("unexpected subscriber ready state %u", ready);
+		return -1;
+	}
+
+	if (mbim_command(comd, MBIM_CID_PIN, MBIM_QUERY, NULL, &resp,
+						&status, MBIM_TIMEOUT)
+			|| mbim_get_u32(&resp, 0, &type)
+			|| mbim_get_u32(&resp, 4, &state)) {
+		WARN("No PIN status");
+		return -1;
+	}
+	if (state != MBIM_PIN_STATE_LOCKED) {
+		LOG("PIN already set up");
+		return 0;
+	}
+	if (type != MBIM_PIN_TYPE_PIN1)
+		ERROR(ESIMPIN, "SIM locked, PIN type %u", type);
+
+	LOG("Setting up PIN code");
+	mbim_info_init(&info, MBIM_PIN_SET_LEN);
+	mbim_info_u32(&info, 0, MBIM_PIN_TYPE_PIN1);
+	mbim_info_u32(&info, 4, MBIM_PIN_OP_ENTER);
+	mbim_add_string(&info, 8, p_conn_data->pin);
+	/* pas de nouvel essai sur un code erroné */
+	if (mbim_command(comd, MBIM_CID_PIN, MBIM_SET, &info, &resp,
+						&status, MBIM_TIMEOUT))
+		ERROR(ESIMPIN, "PIN verification failed: status %u", status);
+	return 0;
+}
+
+/* Reprise rapide : le contexte du bail précédent est-il toujours actif ? */
+static int
+mbim_warm_start(int comd, struct cdata *p_conn_data,
+			const struct cdata *lease, char *interface)
+{
+	if (mbim_activation_state(comd) != MBIM_ACT_ACTIVATED)
+		return -1;
+	if (mbim_get_settings(comd, p_conn_data))
+		return -1;
+	if (!lease_match(lease, p_conn_data))
+		return -1;
+
+	mbim_configure_net_up(interface, p_conn_data);
+	return 0;
+}
+
+/* Vérifie si la liaison est établie, l'établit au besoin */
+static void
+mbim_check_conn_up(int comd, struct cdata *p_conn_data, char *interface)
+{
+	if (mbim_activation_state(comd) == MBIM_ACT_ACTIVATED)
+		LOG("Context already activated");
+	else
+		mbim_connect(comd, p_conn_data);
+
+	phase_begin("conn_params");
+	if (mbim_get_settings(comd, p_conn_data))
+		ERROR(EADDRNOTAVAIL, "Unreadable connection parameters");
+	mbim_configure_net_up(interface, p_conn_data);
+}
+
+/* Attente de l'enregistrement : radio allumée, état courant, puis
+ * indications Register State, et enfin attachement paquet */
+static int
+mbim_wait_reg_status(int comd)
+{
+	struct mbim_info info;
+	struct mbim_msg msg;
+	msec_t deadline;
+	uint32_t status;
+	int ret;
+
+	deadline = deadline_in(REG_TIMEOUT);
+	mbim_info_init(&info, 4);
+	mbim_info_u32(&info, 0, 1);	/* MBIMRadioOn */
+	if (mbim_command(comd, MBIM_CID_RADIO_STATE, MBIM_SET, &info, &msg,
+						&status, MBIM_TIMEOUT))
+		WARN("Radio state error %u", status);
+
+	if (mbim_command(comd, MBIM_CID_REGISTER_STATE, MBIM_QUERY, NULL,
+					&msg, &status, MBIM_TIMEOUT))
+		ERROR(EPROTO, "Register state error %u", status);
+
+	while ((ret = mbim_reg_status(&msg)) > 0) {
+		ret = mbim_wait_indication(comd, MBIM_CID_REGISTER_STATE,
+							&msg, deadline);
+		if (ret <= 0) {
+			if (!ret)
+				WARN("Registration timeout");
+			return -1;
+		}
+	}
+	if (ret)
+		return ret;
+
+	mbim_info_init(&info, MBIM_PACKET_SET_LEN);
+	mbim_info_u32(&info, 0, 0);	/* MBIMPacketServiceActionAttach */
+	if (mbim_command(comd, MBIM_CID_PACKET_SERVICE, MBIM_SET, &info, &msg,
+						&status, MBIM_TIMEOUT))
+		WARN("Packet service attach error %u", status);
+	return 0;
+}
+
+static void
+mbim_set_conn_down(int comd, char *interface)
+{
+	struct mbim_info info;
+	struct mbim_msg resp;
+	uint32_t status;
+
+	mbim_info_init(&info, MBIM_CONNECT_SET_LEN);
+	mbim_info_u32(&info, 0, MBIM_SESSION_ID);
+	mbim_info_u32(&info, 4, MBIM_ACT_DEACTIVATE);
+	mbim_info_u32(&info, 40, MBIM_IP_TYPE_IPV4);
+	mbim_info_uuid(&info, 44, mbim_uuid_context_internet);
+	if (mbim_command(comd, MBIM_CID_CONNECT, MBIM_SET, &info, &resp,
+					&status, MBIM_TIMEOUT)) {
+		if (status == MBIM_STATUS_CONTEXT_NOT_ACTIVATED)
+			LOG("No context to deactivate");
+		else
+			WARN("Context deactivation error %u", status);
+	}
+	mbim_configure_net_down(interface);
+}
+
+static int
+mbim_monitor_connection(int comd, const char *filename,
+			const char *interface,
+			const char *ipsec)
+{
+	struct mbim_msg resp;
+	const char *typestr;
+	struct quality_sample sample;
+	struct at_csq csq;
+	fixed_buf oper;
+	uint32_t status, class, highest, rssi, error_rate;
+	int level = 0;
+
+	if (mbim_command(comd, MBIM_CID_REGISTER_STATE, MBIM_QUERY, NULL,
+					&resp, &status, MBIM_TIMEOUT))
+		ERROR(EPROTO, "Register state error %u", status);
+	if (mbim_get_string(&resp, 28, oper, MAX_LEN) || !oper[0])
+		ERROR(EFAULT, "operator, no provider name in register state");
+	/* AvailableDataClasses ; CurrentCellularClass (16) ne distingue
+	 * que GSM et CDMA */
+	if (mbim_get_u32(&resp, 12, &class))
+		class = 0;
+	DBGV(2, "operator: %s", oper);
+
+	/* Technologie : HighestAvailableDataClass du service de paquets,
+	 * à défaut la plus élevée des classes disponibles */
+	if (!mbim_command(comd, MBIM_CID_PACKET_SERVICE, MBIM_QUERY, NULL,
+					&resp, &status, MBIM_TIMEOUT)
+			&& !mbim_get_u32(&resp, 8, &highest) && highest)
+		class = highest;
+	typestr = mbim_data_class(class);
+
+	/* Rssi et ErrorRate suivent le codage de AT+CSQ :
+	 * 31 => 5, 25-30 => 4, 15-24 => 3, 10-14 => 2, 0-9 => 1,
+	 * 99 => 0 ; si ErrorRate > 0, -1 sur le signal. */
+	if (mbim_command(comd, MBIM_CID_SIGNAL_STATE, MBIM_QUERY, NULL,
+					&resp, &status, MBIM_TIMEOUT)
+			|| mbim_get_u32(&resp, 0, &rssi)
+			|| mbim_get_u32(&resp, 4, &error_rate))
+		ERROR(EPROTO, "Signal state error %u", status);
+
+	if (rssi == 99)
+		level = 0;
+	else {
+		if (rssi > 31)
+			WARN("out of bounds strength %u", rssi);
+		if (rssi >= 31)
+			level = 5;
+		else if (rssi >= 25)
+			level = 4;
+		else if (rssi >= 15)
+			level = 3;
+		else if (rssi >= 10)
+			level = 2;
+		else
+			level = 1;
+		if (error_rate != 99 && error_rate > 0)
+			level--;
+	}
+	DBGV(2, "level: %d", level);
+
+	quality_init(&sample, level, oper, typestr);
+	csq.rssi = (rssi > 99) ? 99 : (int)rssi;
+	csq.ber = (error_rate > 99) ? 99 : (int)error_rate;
+	quality_set_csq(&sample, &csq);
+	quality_record(interface, &sample);
+
+	return monitor_publish(filename, ipsec, level, "%s (%s)",
+					oper, typestr);
+}
+
+umts_device_t mbim_device =
+{
+	.name = "MBIM",
+	.device = "/dev/cdc-wdm0",
+	.interface = "wwan0",
+	.raw = 1,
+	.check_pin = mbim_check_pin,
+	.check_conn_up = mbim_check_conn_up,
+	.wait_reg_status = mbim_wait_reg_status,
+	.set_conn_down = mbim_set_conn_down,
+	.monitor_connection = mbim_monitor_connection,
+	.warm_start = mbim_warm_start,
+};
@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef UMTS_MBIM_H
+#define UMTS_MBIM_H
+
+#include "umts.h"
+#include "umts_mbim_msg.h"
+
+#define MBIM_SCRIPT_UP		HOOKS_DIR"/umts_huawei_net_up.sh" /* same as Huawei */
+
+/* Délai maximal de réponse à une commande MBIM (ms) */
+#define MBIM_TIMEOUT		10000U
+/* Délai maximal d'activation du contexte (ms) */
+#define MBIM_CONNECT_TIMEOUT	60000U
+
+extern umts_device_t mbim_device;
+#endif /* UMTS_MBIM_H */
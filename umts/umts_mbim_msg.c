@@ -0,0 +1,264 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_mbim_msg - messages de contrôle MBIM
+ */
+
+#include <string.h>
+
+#include "umts_mbim_msg.h"
+
+#define MBIM_HDR_LEN	12	/* type, longueur, transaction */
+#define MBIM_FRAG_LEN	8	/* nombre de fragments, numéro */
+
+/* a289cc33-bcbb-8b4f-b6b0-133ec2aae6df */
+const uint8_t mbim_uuid_basic_connect[MBIM_UUID_LEN] = {
+	0xa2, 0x89, 0xcc, 0x33, 0xbc, 0xbb, 0x8b, 0x4f,
+	0xb6, 0xb0, 0x13, 0x3e, 0xc2, 0xaa, 0xe6, 0xdf,
+};
+
+/* 7e5e2a7e-4e6f-7272-736b-656e7e5e2a7e */
+const uint8_t mbim_uuid_context_internet[MBIM_UUID_LEN] = {
+	0x7e, 0x5e, 0x2a, 0x7e, 0x4e, 0x6f, 0x72, 0x72,
+	0x73, 0x6b, 0x65, 0x6e, 0x7e, 0x5e, 0x2a, 0x7e,
+};
+
+/*********************************************************/
+/** Tampon d'information **/
+/*********************************************************/
+
+void
+mbim_info_init(struct mbim_info *info, size_t fixed)
+{
+	memset(info->buf, 0, fixed);
+	info->len = fixed;
+}
+
+void
+mbim_info_u32(struct mbim_info *info, size_t off, uint32_t val)
+{
+	mbim_put_le32(info->buf + off, val);
+}
+
+void
+mbim_info_uuid(struct mbim_info *info, size_t off, const uint8_t *uuid)
+{
+	memcpy(info->buf + off, uuid, MBIM_UUID_LEN);
+}
+
+/* Ajout de données à la suite du tampon, alignées sur 4 octets ;
+ * offset reçoit leur position */
+int
+mbim_info_append(struct mbim_info *info, const void *data, size_t len,
+							uint32_t *offset)
+{
+	size_t pad = (4 - len % 4) % 4;
+
+	if (len + pad > sizeof(info->buf) - info->len)
+		return -1;
+	*offset = (uint32_t)info->len;
+	memcpy(info->buf + info->len, data, len);
+	memset(info->buf + info->len + len, 0, pad);
+	info->len += len + pad;
+	return 0;
+}
+
+/* Chaîne ASCII en UTF-16LE, référencée par le couple (offset, taille)
+ * situé à off dans la partie fixe. Une chaîne vide n'est pas ajoutée. */
+int
+mbim_info_string(struct mbim_info *info, size_t off, const char *str)
+{
+	uint8_t wide[2 * 256];
+	size_t i, len = strlen(str);
+	uint32_t offset = 0;
+
+	if (len > sizeof(wide) / 2)
+		return -1;
+	for (i = 0; i < len; i++) {
+		wide[2 * i] = (uint8_t)str[i];
+		wide[2 * i + 1] = 0;
+	}
+	if (len && mbim_info_append(info, wide, 2 * len, &offset))
+		return -1;
+	mbim_info_u32(info, off, offset);
+	mbim_info_u32(info, off + 4, (uint32_t)(2 * len));
+	return 0;
+}
+
+/*********************************************************/
+/** Messages **/
+/*********************************************************/
+
+/* Taille de l'en-tête propre à chaque type, tampon d'information exclu */
+static size_t
+mbim_hdr_len(uint32_t type)
+{
+	switch (type) {
+	case MBIM_CLOSE_MSG:
+		return MBIM_HDR_LEN;
+	case MBIM_OPEN_MSG:
+	case MBIM_OPEN_DONE:
+	case MBIM_CLOSE_DONE:
+	case MBIM_FUNCTION_ERROR_MSG:
+		return MBIM_HDR_LEN + 4;
+	case MBIM_COMMAND_MSG:
+	case MBIM_COMMAND_DONE:
+		return MBIM_HDR_LEN + MBIM_FRAG_LEN + MBIM_UUID_LEN + 12;
+	case MBIM_INDICATE_STATUS_MSG:
+		return MBIM_HDR_LEN + MBIM_FRAG_LEN + MBIM_UUID_LEN + 8;
+	default:
+		return 0;
+	}
+}
+
+static int
+mbim_has_info(uint32_t type)
+{
+	return (type == MBIM_COMMAND_MSG || type == MBIM_COMMAND_DONE
+			|| type == MBIM_INDICATE_STATUS_MSG);
+}
+
+/* Message complet, non fragmenté. Retourne sa longueur, -1 si out est
+ * trop petit ou le type inconnu. */
+ssize_t
+mbim_encode(const struct mbim_msg *msg, uint8_t *out, size_t size)
+{
+	size_t hdr = mbim_hdr_len(msg->type);
+	size_t len = hdr + ((mbim_has_info(msg->type)) ? msg->info_len : 0);
+	uint8_t *p = out + MBIM_HDR_LEN;
+
+	if (!hdr || len > size)
+		return -1;
+
+	mbim_put_le32(out, msg->type);
+	mbim_put_le32(out + 4, (uint32_t)len);
+	mbim_put_le32(out + 8, msg->tid);
+	if (!mbim_has_info(msg->type)) {
+		if (hdr > MBIM_HDR_LEN)
+			mbim_put_le32(p, msg->status);
+		return (ssize_t)len;
+	}
+
+	mbim_put_le32(p, 1);		/* un seul fragment */
+	mbim_put_le32(p + 4, 0);
+	p += MBIM_FRAG_LEN;
+	memcpy(p, msg->uuid, MBIM_UUID_LEN);
+	p += MBIM_UUID_LEN;
+	mbim_put_le32(p, msg->cid);
+	p += 4;
+	if (msg->type == MBIM_COMMAND_MSG) {
+		mbim_put_le32(p, msg->cmd_type);
+		p += 4;
+	} else if (msg->type == MBIM_COMMAND_DONE) {
+		mbim_put_le32(p, msg->status);
+		p += 4;
+	}
+	mbim_put_le32(p, msg->info_len);
+	p += 4;
+	if (msg->info_len)
+		memcpy(p, msg->info, msg->info_len);
+	return (ssize_t)len;
+}
+
+/* Longueur du message en tête de data : 0 s'il est incomplet,
+ * -1 si data ne commence pas par un message valide */
+ssize_t
+mbim_msg_len(const uint8_t *data, size_t len)
+{
+	uint32_t type, mlen;
+
+	if (len < MBIM_HDR_LEN)
+		return 0;
+	type = mbim_get_le32(data);
+	mlen = mbim_get_le32(data + 4);
+	if (!mbim_hdr_len(type) || mlen < mbim_hdr_len(type)
+						|| mlen > MBIM_MSG_MAX)
+		return -1;
+	return (mlen <= len) ? (ssize_t)mlen : 0;
+}
+
+/* Analyse d'un message complet. Le tampon d'information n'est pas
+ * recopié. Les messages fragmentés ne sont pas pris en charge. */
+int
+mbim_decode(const uint8_t *data, size_t len, struct mbim_msg *msg)
+{
+	const uint8_t *p = data + MBIM_HDR_LEN;
+	size_t hdr;
+
+	if (mbim_msg_len(data, len) != (ssize_t)len)
+		return -1;
+
+	memset(msg, 0, sizeof(*msg));
+	msg->type = mbim_get_le32(data);
+	msg->tid = mbim_get_le32(data + 8);
+	hdr = mbim_hdr_len(msg->type);
+	if (!mbim_has_info(msg->type)) {
+		if (hdr > MBIM_HDR_LEN)
+			msg->status = mbim_get_le32(p);
+		return 0;
+	}
+
+	if (mbim_get_le32(p) != 1 || mbim_get_le32(p + 4) != 0)
+		return -1;
+	p += MBIM_FRAG_LEN;
+	msg->uuid = p;
+	p += MBIM_UUID_LEN;
+	msg->cid = mbim_get_le32(p);
+	p += 4;
+	if (msg->type == MBIM_COMMAND_MSG) {
+		msg->cmd_type = mbim_get_le32(p);
+		p += 4;
+	} else if (msg->type == MBIM_COMMAND_DONE) {
+		msg->status = mbim_get_le32(p);
+		p += 4;
+	}
+	msg->info_len = mbim_get_le32(p);
+	if (msg->info_len > len - hdr)
+		return -1;
+	msg->info = data + hdr;
+	return 0;
+}
+
+/*********************************************************/
+/** Lecture du tampon d'information **/
+/*********************************************************/
+
+int
+mbim_get_u32(const struct mbim_msg *msg, size_t off, uint32_t *val)
+{
+	if (off > msg->info_len || msg->info_len - off < 4)
+		return -1;
+	*val = mbim_get_le32(msg->info + off);
+	return 0;
+}
+
+/* Données de len octets à offset, NULL si elles dépassent le tampon */
+const uint8_t *
+mbim_get_data(const struct mbim_msg *msg, uint32_t offset, size_t len)
+{
+	if (offset > msg->info_len || msg->info_len - offset < len)
+		return NULL;
+	return msg->info + offset;
+}
+
+/* Chaîne référencée par le couple (offset, taille) situé à off,
+ * convertie en ASCII ('?' hors ASCII) et tronquée à size - 1 */
+int
+mbim_get_string(const struct mbim_msg *msg, size_t off, char *buf,
+							size_t size)
+{
+	const uint8_t *p;
+	uint32_t offset, len, i;
+
+	if (!size || mbim_get_u32(msg, off, &offset)
+			|| mbim_get_u32(msg, off + 4, &len))
+		return -1;
+	p = mbim_get_data(msg, offset, len);
+	if (!p)
+		return -1;
+	for (i = 0; i < len / 2 && i < size - 1; i++)
+		buf[i] = (p[2 * i + 1] || p[2 * i] > 0x7e || p[2 * i] < 0x20)
+				? '?' : (char)p[2 * i];
+	buf[i] = '\0';
+	return 0;
+}
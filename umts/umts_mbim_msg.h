@@ -0,0 +1,136 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef UMTS_MBIM_MSG_H
+#define UMTS_MBIM_MSG_H
+
+/*
+ *	Codage et décodage des messages de contrôle MBIM (/dev/cdc-wdmN).
+ *	Aucune dépendance autre que la libc : partagé par le pilote mbim,
+ *	le simulateur et la cible de fuzzing.
+ *
+ *	En-tête : type, longueur totale, identifiant de transaction, puis
+ *	selon le type l'en-tête de fragment (nombre, numéro), l'UUID du
+ *	service, le CID, le type de commande ou le statut, et le tampon
+ *	d'information. Les champs de taille variable du tampon sont décrits
+ *	par un couple (offset, taille) relatif à son début, les chaînes sont
+ *	en UTF-16LE. Tous les entiers sont petit-boutistes.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Taille maximale d'un message (MaxControlTransfer demandé) */
+#define MBIM_MSG_MAX			4096
+#define MBIM_INFO_MAX			(MBIM_MSG_MAX - 48)
+
+/* Types de message */
+#define MBIM_OPEN_MSG			0x00000001
+#define MBIM_CLOSE_MSG			0x00000002
+#define MBIM_COMMAND_MSG		0x00000003
+#define MBIM_OPEN_DONE			0x80000001
+#define MBIM_CLOSE_DONE			0x80000002
+#define MBIM_COMMAND_DONE		0x80000003
+#define MBIM_FUNCTION_ERROR_MSG		0x80000004
+#define MBIM_INDICATE_STATUS_MSG	0x80000007
+
+/* Types de commande */
+#define MBIM_QUERY			0
+#define MBIM_SET			1
+
+/* Erreurs de protocole (MBIM_FUNCTION_ERROR_MSG) */
+#define MBIM_ERROR_NOT_OPENED		5
+
+/* Statuts des commandes */
+#define MBIM_STATUS_SUCCESS		0
+#define MBIM_STATUS_FAILURE		2
+#define MBIM_STATUS_NO_DEVICE_SUPPORT	9
+#define MBIM_STATUS_CONTEXT_NOT_ACTIVATED 16
+
+/* CID du service Basic Connect */
+#define MBIM_CID_SUBSCRIBER_READY_STATUS 2
+#define MBIM_CID_RADIO_STATE		3
+#define MBIM_CID_PIN			4
+#define MBIM_CID_REGISTER_STATE		9
+#define MBIM_CID_PACKET_SERVICE		10
+#define MBIM_CID_SIGNAL_STATE		11
+#define MBIM_CID_CONNECT		12
+#define MBIM_CID_IP_CONFIGURATION	15
+
+#define MBIM_UUID_LEN			16
+
+extern const uint8_t mbim_uuid_basic_connect[MBIM_UUID_LEN];
+extern const uint8_t mbim_uuid_context_internet[MBIM_UUID_LEN];
+
+/* Message émis ou reçu ; uuid et info pointent dans le message reçu */
+struct mbim_msg {
+	uint32_t type;
+	uint32_t tid;
+	/* statut des *_DONE, erreur de MBIM_FUNCTION_ERROR_MSG,
+	 * MaxControlTransfer de MBIM_OPEN_MSG */
+	uint32_t status;
+	const uint8_t *uuid;
+	uint32_t cid;
+	uint32_t cmd_type;		/* MBIM_COMMAND_MSG */
+	const uint8_t *info;
+	uint32_t info_len;
+};
+
+/* Tampon d'information à émettre : partie fixe, puis données */
+struct mbim_info {
+	uint8_t buf[MBIM_INFO_MAX];
+	size_t len;
+};
+
+void
+mbim_info_init(struct mbim_info *info, size_t fixed);
+
+void
+mbim_info_u32(struct mbim_info *info, size_t off, uint32_t val);
+
+void
+mbim_info_uuid(struct mbim_info *info, size_t off, const uint8_t *uuid);
+
+int
+mbim_info_append(struct mbim_info *info, const void *data, size_t len,
+							uint32_t *offset);
+
+int
+mbim_info_string(struct mbim_info *info, size_t off, const char *str);
+
+ssize_t
+mbim_encode(const struct mbim_msg *msg, uint8_t *out, size_t size);
+
+ssize_t
+mbim_msg_len(const uint8_t *data, size_t len);
+
+int
+mbim_decode(const uint8_t *data, size_t len, struct mbim_msg *msg);
+
+int
+mbim_get_u32(const struct mbim_msg *msg, size_t off, uint32_t *val);
+
+const uint8_t *
+mbim_get_data(const struct mbim_msg *msg, uint32_t offset, size_t len);
+
+int
+mbim_get_string(const struct mbim_msg *msg, size_t off, char *buf,
+							size_t size);
+
+static inline uint32_t
+mbim_get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+		| ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+mbim_put_le32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = val >> 24;
+}
+
+#endif /* UMTS_MBIM_MSG_H */
@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_netlink - configuration de l'interface par rtnetlink
+ *
+ *	Après l'appel, le lien, l'adresse et la route par défaut sont
+ *	configurés par un seul envoi de messages NETLINK_ROUTE, chacun
+ *	acquitté, au lieu d'un processus ip par opération. Les fichiers
+ *	d'état <interface>_umts et route_umts sont ensuite écrits par
+ *	renommage. Le script du pilote n'est plus qu'une étape facultative,
+ *	exécutée après coup s'il est présent (serveurs DNS).
+ */
+
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "umts.h"
+
+/* Nombre maximal de messages par envoi */
+#define NL_MAX_MSG	8
+/* Adresses supprimées au plus par net_down (ip addr flush) */
+#define NL_FLUSH_MAX	4
+/* Attente des acquittements (ms) */
+#define NL_TIMEOUT	1000
+
+/* Adresse imposée aux modems dont le firmware émet des trames avec
+ * une adresse MAC erronée */
+static const uint8_t net_fixed_hwaddr[6] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05 };
+
+/* Messages à envoyer en une fois, avec pour chacun l'erreur tolérée */
+struct nl_batch {
+	uint8_t buf[2048] __attribute__((aligned(NLMSG_ALIGNTO)));
+	size_t len;
+	size_t last;			/* début du dernier message */
+	unsigned int count;
+	uint32_t seq;
+	const char *what[NL_MAX_MSG];
+	int ignore[NL_MAX_MSG];
+};
+
+static void *
+nl_msg(struct nl_batch *b, uint16_t type, uint16_t flags, size_t hdrlen,
+				const char *what, int ignore)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)(b->buf + b->len);
+	size_t len = NLMSG_SPACE(hdrlen);
+
+	if (b->count == NL_MAX_MSG || b->len + len > sizeof(b->buf))
+		ERROR(EMSGSIZE, "netlink batch too long");
+	memset(nlh, 0, len);
+	nlh->nlmsg_len = NLMSG_LENGTH(hdrlen);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK | flags;
+	nlh->nlmsg_seq = b->seq + b->count;
+	b->what[b->count] = what;
+	b->ignore[b->count] = ignore;
+	b->count++;
+	b->last = b->len;
+	b->len += len;
+	return NLMSG_DATA(nlh);
+}
+
+/* Attribut ajouté au dernier message */
+static void
+nl_attr(struct nl_batch *b, uint16_t type, const void *data, size_t len)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)(b->buf + b->last);
+	struct rtattr *rta;
+
+	if (b->len + RTA_SPACE(len) > sizeof(b->buf))
+		ERROR(EMSGSIZE, "netlink batch too long");
+	rta = (struct rtattr *)(b->buf + b->len);
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	memset((uint8_t *)RTA_DATA(rta) + len, 0, RTA_SPACE(len) - RTA_LENGTH(len));
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + RTA_SPACE(len);
+	b->len += RTA_SPACE(len);
+}
+
+static void
+nl_init(struct nl_batch *b)
+{
+	b->len = 0;
+	b->last = 0;
+	b->count = 0;
+	b->seq = (uint32_t)time(NULL);
+}
+
+/* Envoi des messages et lecture de leurs acquittements. Le noyau les
+ * traite dans l'ordre, un échec n'interrompant pas les suivants.
+ * Retourne 0 si tous ont réussi ou échoué avec l'erreur tolérée. */
+static int
+nl_commit(struct nl_batch *b)
+{
+	struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+	struct timeval tv = { NL_TIMEOUT / 1000, (NL_TIMEOUT % 1000) * 1000 };
+	uint8_t buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	unsigned int acked = 0, idx;
+	ssize_t len;
+	int sock, ret = 0;
+
+	sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (sock < 0) {
+		WARN_ERRNO("netlink socket");
+		return -1;
+	}
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		WARN_ERRNO("netlink SO_RCVTIMEO");
+
+	if (sendto(sock, b->buf, b->len, 0, (struct sockaddr *)&kernel,
+				sizeof(kernel)) != (ssize_t)b->len) {
+		WARN_ERRNO("netlink send");
+		close(sock);
+		return -1;
+	}
+
+	while (acked < b->count) {
+		len = recv(sock, buf, sizeof(buf), 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			WARN_ERRNO("netlink receive");
+			ret = -1;
+			break;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, (size_t)len);
+					nlh = NLMSG_NEXT(nlh, len)) {
+			idx = nlh->nlmsg_seq - b->seq;
+			if (nlh->nlmsg_type != NLMSG_ERROR || idx >= b->count)
+				continue;
+			acked++;
+			err = NLMSG_DATA(nlh);
+			if (!err->error)
+				continue;
+			if (-err->error == b->ignore[idx]) {
+				DBG("%s: %s (ignored)", b->what[idx],
+						strerror(-err->error));
+				continue;
+			}
+			WARN("%s failed: %s", b->what[idx],
+						strerror(-err->error));
+			ret = -1;
+		}
+	}
+	close(sock);
+	return ret;
+}
+
+/*********************************************************/
+/** Messages **/
+/*********************************************************/
+
+static void
+nl_link(struct nl_batch *b, int ifindex, int up, const uint8_t *hwaddr)
+{
+	struct ifinfomsg *ifi;
+
+	ifi = nl_msg(b, RTM_NEWLINK, 0, sizeof(*ifi),
+				(up) ? "link set up" : "link set down", 0);
+	ifi->ifi_family = AF_UNSPEC;
+	ifi->ifi_index = ifindex;
+	ifi->ifi_change = IFF_UP;
+	ifi->ifi_flags = (up) ? IFF_UP : 0;
+	/* l'adresse est changée avant l'activation */
+	if (hwaddr)
+		nl_attr(b, IFLA_ADDRESS, hwaddr, 6);
+}
+
+static void
+nl_addr(struct nl_batch *b, int ifindex, const char *interface,
+		struct in_addr addr, unsigned int prefix, int broadcast)
+{
+	struct ifaddrmsg *ifa;
+	char label[IFNAMSIZ];
+
+	ifa = nl_msg(b, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+					sizeof(*ifa), "addr add", 0);
+	ifa->ifa_family = AF_INET;
+	ifa->ifa_prefixlen = prefix;
+	ifa->ifa_scope = RT_SCOPE_UNIVERSE;
+	ifa->ifa_index = ifindex;
+	nl_attr(b, IFA_LOCAL, &addr, sizeof(addr));
+	nl_attr(b, IFA_ADDRESS, &addr, sizeof(addr));
+	if (broadcast)
+		nl_attr(b, IFA_BROADCAST, &addr, sizeof(addr));
+	if ((size_t)snprintf(label, sizeof(label), "%s:core", interface)
+							< sizeof(label))
+		nl_attr(b, IFA_LABEL, label, strlen(label) + 1);
+}
+
+/* Route par défaut de la table principale par l'interface : ajout, qui
+ * comme ip route add échoue si une autre route par défaut existe, celle
+ * d'une interface filaire par exemple, ou suppression */
+static void
+nl_default_route(struct nl_batch *b, int ifindex, int add,
+					const struct in_addr *gw)
+{
+	struct rtmsg *rtm;
+	uint32_t oif = (uint32_t)ifindex;
+
+	if (add)
+		rtm = nl_msg(b, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_EXCL,
+					sizeof(*rtm), "route add default", 0);
+	else
+		rtm = nl_msg(b, RTM_DELROUTE, 0, sizeof(*rtm),
+					"route del default", ESRCH);
+	rtm->rtm_family = AF_INET;
+	rtm->rtm_table = RT_TABLE_MAIN;
+	rtm->rtm_protocol = RTPROT_BOOT;
+	rtm->rtm_type = RTN_UNICAST;
+	/* suppression : toute portée */
+	if (!add)
+		rtm->rtm_scope = RT_SCOPE_NOWHERE;
+	else
+		rtm->rtm_scope = (gw) ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+	nl_attr(b, RTA_OIF, &oif, sizeof(oif));
+	if (gw)
+		nl_attr(b, RTA_GATEWAY, gw, sizeof(*gw));
+}
+
+/* Sans IFA_LOCAL, le noyau supprime la première adresse de
+ * l'interface (et ses secondaires) : répété, c'est ip addr flush */
+static void
+nl_flush(struct nl_batch *b, int ifindex)
+{
+	struct ifaddrmsg *ifa;
+	unsigned int i;
+
+	for (i = 0; i < NL_FLUSH_MAX; i++) {
+		ifa = nl_msg(b, RTM_DELADDR, 0, sizeof(*ifa), "addr flush",
+							EADDRNOTAVAIL);
+		ifa->ifa_family = AF_INET;
+		ifa->ifa_index = ifindex;
+	}
+}
+
+/*********************************************************/
+/** Fichiers d'état **/
+/*********************************************************/
+
+static void
+net_state_path(char *path, size_t len, const char *name, const char *suffix)
+{
+	snprintf(path, len, "%s/%s%s", umts_run_dir(), name, suffix);
+}
+
+static int
+net_state_write(const char *name, const char *value)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	FILE *fp;
+
+	net_state_path(path, sizeof(path), name, "");
+	net_state_path(tmp, sizeof(tmp), name, ".tmp");
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		WARN_ERRNO("failed to open %s", tmp);
+		return -1;
+	}
+	fprintf(fp, "%s\n", value);
+	if (fclose(fp) || rename(tmp, path)) {
+		WARN_ERRNO("failed to write %s", path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+net_state_clear(const char *interface)
+{
+	char path[PATH_MAX];
+	fixed_buf name;
+
+	buf_format_string(name, "%s_umts", interface);
+	net_state_path(path, sizeof(path), name, "");
+	if (unlink(path) && errno != ENOENT)
+		WARN_ERRNO("failed to remove %s", path);
+	net_state_path(path, sizeof(path), "route_umts", "");
+	if (unlink(path) && errno != ENOENT)
+		WARN_ERRNO("failed to remove %s", path);
+}
+
+/*********************************************************/
+/** Interface **/
+/*********************************************************/
+
+/* Le simulateur ne touche au noyau que sur demande (UMTS_SIM_NETLINK,
+ * dans un espace de noms réseau dédié) */
+static int
+net_kernel(void)
+{
+#ifdef UMTS_SIM
+	return getenv("UMTS_SIM_NETLINK") != NULL;
+#else
+	return 1;
+#endif
+}
+
+static int
+net_ifindex(const char *interface)
+{
+	unsigned int ifindex = if_nametoindex(interface);
+
+	if (!ifindex)
+		WARN_ERRNO("unknown interface %s", interface);
+	return (int)ifindex;
+}
+
+/* Longueur du préfixe d'un masque contigu, -1 sinon */
+static int
+net_prefix(const char *mask)
+{
+	struct in_addr m;
+	uint32_t val;
+	int prefix = 0;
+
+	if (inet_pton(AF_INET, mask, &m) != 1)
+		return -1;
+	val = ntohl(m.s_addr);
+	while (val & 0x80000000U) {
+		prefix++;
+		val <<= 1;
+	}
+	return (val) ? -1 : prefix;
+}
+
+static int
+net_run_hook(char **hook)
+{
+	if (!hook || access(hook[0], X_OK))
+		return 0;
+	DBG("running %s", hook[0]);
+	return fork_exec(hook);
+}
+
+static int
+net_flush_kernel(const char *interface)
+{
+	struct nl_batch b;
+	int ifindex;
+
+	if (!net_kernel())
+		return 0;
+	ifindex = net_ifindex(interface);
+	if (!ifindex)
+		return -1;
+
+	nl_init(&b);
+	nl_default_route(&b, ifindex, 0, NULL);
+	nl_link(&b, ifindex, 0, NULL);
+	nl_flush(&b, ifindex);
+	return nl_commit(&b);
+}
+
+/* Lien actif, adresse, route par défaut et fichiers d'état, puis le
+ * script hook s'il est présent. En cas d'échec, l'interface est
+ * déconfigurée et -1 retourné. */
+int
+net_up(const char *interface, const struct cdata *p_conn_data,
+				unsigned int flags, char **hook)
+{
+	struct nl_batch b;
+	struct in_addr addr, gw;
+	fixed_buf name;
+	int ifindex, prefix = 32;
+
+	if (inet_pton(AF_INET, p_conn_data->ip_address, &addr) != 1) {
+		WARN("invalid address %s", p_conn_data->ip_address);
+		return -1;
+	}
+	if ((flags & NET_GATEWAY)
+		&& inet_pton(AF_INET, p_conn_data->gateway, &gw) != 1) {
+		WARN("invalid gateway %s", p_conn_data->gateway);
+		return -1;
+	}
+	if (p_conn_data->mask[0]
+			&& (prefix = net_prefix(p_conn_data->mask)) < 0) {
+		WARN("invalid netmask %s", p_conn_data->mask);
+		return -1;
+	}
+
+	if (net_kernel()) {
+		ifindex = net_ifindex(interface);
+		if (!ifindex)
+			return -1;
+
+		nl_init(&b);
+		if (flags & NET_FIX_HWADDR) {
+			nl_link(&b, ifindex, 0, NULL);
+			nl_link(&b, ifindex, 1, net_fixed_hwaddr);
+		} else {
+			nl_link(&b, ifindex, 1, NULL);
+		}
+		/* sans masque, adresse seule, diffusion comprise */
+		nl_addr(&b, ifindex, interface, addr, prefix,
+						!p_conn_data->mask[0]);
+		/* route d'une configuration précédente de l'interface */
+		nl_default_route(&b, ifindex, 0, NULL);
+		nl_default_route(&b, ifindex, 1,
+					(flags & NET_GATEWAY) ? &gw : NULL);
+		if (nl_commit(&b))
+			goto err;
+	}
+
+	buf_format_string(name, "%s_umts", interface);
+	if (net_state_write(name, p_conn_data->ip_address)
+		|| net_state_write("route_umts", p_conn_data->gateway))
+		goto err;
+
+	if (net_run_hook(hook)) {
+		WARN("%s failed", hook[0]);
+		goto err;
+	}
+	return 0;
+
+err:
+	net_state_clear(interface);
+	net_flush_kernel(interface);
+	return -1;
+}
+
+/* Fichiers d'état, route par défaut, lien et adresses, puis le
+ * script hook s'il est présent */
+int
+net_down(const char *interface, char **hook)
+{
+	int ret;
+
+	net_state_clear(interface);
+	ret = net_flush_kernel(interface);
+	if (net_run_hook(hook)) {
+		WARN("%s failed", hook[0]);
+		ret = -1;
+	}
+	return ret;
+}
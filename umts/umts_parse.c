@@ -0,0 +1,309 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_parse - analyse des réponses AT en structures typées
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "umts_parse.h"
+
+/*********************************************************/
+/** Découpage **/
+/*********************************************************/
+
+static char *
+skip_blanks(char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	return s;
+}
+
+/* Découpe "<prefix>:<v0>,<v1>,..." sur place. Les valeurs entre
+ * guillemets peuvent contenir des virgules. Au-delà de AT_MAX_TOKENS
+ * valeurs, la fin de la ligne est ignorée. */
+int
+at_tokenize(char *line, const char *prefix, struct at_tokens *tok)
+{
+	size_t len = strlen(prefix);
+	char *s, *start, *end;
+
+	tok->n = 0;
+	if (strncmp(line, prefix, len) || line[len] != ':')
+		return -1;
+	s = skip_blanks(line + len + 1);
+	if (!*s)
+		return 0;
+
+	while (tok->n < AT_MAX_TOKENS) {
+		s = skip_blanks(s);
+		start = s;
+		if (*s == '"') {
+			tok->v[tok->n++] = ++start;
+			s = strchr(start, '"');
+			if (!s)
+				return -1;
+			*s++ = '\0';
+			s = skip_blanks(s);
+			if (*s && *s != ',')
+				return -1;
+		} else {
+			tok->v[tok->n++] = start;
+			s += strcspn(s, ",");
+			/* espaces de fin de valeur */
+			for (end = s; end > start && (end[-1] == ' '
+				|| end[-1] == '\t' || end[-1] == '\r'); end--)
+				;
+			if (end != s)
+				*end = '\0';
+		}
+		if (!*s)
+			break;
+		*s++ = '\0';
+	}
+	return 0;
+}
+
+/* Entier décimal, sans caractère superflu */
+static int
+tok_int(const char *s, int *val)
+{
+	char *end;
+	long v;
+
+	if (!*s)
+		return -1;
+	errno = 0;
+	v = strtol(s, &end, 10);
+	if (errno || *end || v < INT_MIN || v > INT_MAX)
+		return -1;
+	*val = (int)v;
+	return 0;
+}
+
+/* Mot de 32 bits en hexadécimal, sans préfixe ni signe */
+static int
+tok_hex32(const char *s, uint32_t *val)
+{
+	unsigned long v;
+	char *end;
+
+	if (!*s || *s == '-' || *s == '+')
+		return -1;
+	errno = 0;
+	v = strtoul(s, &end, 16);
+	if (errno || *end || v > UINT32_MAX)
+		return -1;
+	*val = (uint32_t)v;
+	return 0;
+}
+
+static int
+tok_ipv4(const char *s, uint32_t *addr)
+{
+	struct in_addr in;
+
+	if (inet_pton(AF_INET, s, &in) != 1)
+		return -1;
+	*addr = in.s_addr;
+	return 0;
+}
+
+/*********************************************************/
+/** Réponses typées **/
+/*********************************************************/
+
+int
+at_parse_creg(char *line, int query, struct at_creg *creg)
+{
+	struct at_tokens tok;
+	unsigned int i = 0;
+
+	if (at_tokenize(line, "+CREG", &tok))
+		return -1;
+	creg->n = -1;
+	if (query) {
+		if (tok.n < 2 || tok_int(tok.v[i++], &creg->n))
+			return -1;
+	} else if (tok.n < 1) {
+		return -1;
+	}
+	return tok_int(tok.v[i], &creg->stat);
+}
+
+int
+at_parse_csq(char *line, struct at_csq *csq)
+{
+	struct at_tokens tok;
+
+	if (at_tokenize(line, "+CSQ", &tok) || tok.n < 2)
+		return -1;
+	if (tok_int(tok.v[0], &csq->rssi) || tok_int(tok.v[1], &csq->ber))
+		return -1;
+	return 0;
+}
+
+int
+at_parse_cesq(char *line, struct at_cesq *cesq)
+{
+	struct at_tokens tok;
+
+	if (at_tokenize(line, "+CESQ", &tok) || tok.n < 6)
+		return -1;
+	if (tok_int(tok.v[0], &cesq->rxlev) || tok_int(tok.v[1], &cesq->ber)
+			|| tok_int(tok.v[2], &cesq->rscp)
+			|| tok_int(tok.v[3], &cesq->ecno)
+			|| tok_int(tok.v[4], &cesq->rsrq)
+			|| tok_int(tok.v[5], &cesq->rsrp))
+		return -1;
+	return 0;
+}
+
+int
+at_parse_cops(char *line, struct at_cops *cops)
+{
+	struct at_tokens tok;
+
+	if (at_tokenize(line, "+COPS", &tok) || tok.n < 1)
+		return -1;
+	if (tok_int(tok.v[0], &cops->mode))
+		return -1;
+	cops->format = cops->act = -1;
+	cops->oper = NULL;
+	if (tok.n >= 3) {
+		if (tok_int(tok.v[1], &cops->format))
+			return -1;
+		cops->oper = tok.v[2];
+	}
+	if (tok.n >= 4 && tok_int(tok.v[3], &cops->act))
+		return -1;
+	return 0;
+}
+
+int
+at_parse_cind(char *line, int *signal)
+{
+	struct at_tokens tok;
+
+	if (at_tokenize(line, "+CIND", &tok) || tok.n < 2)
+		return -1;
+	return tok_int(tok.v[1], signal);
+}
+
+int
+at_parse_owandata(char *line, struct at_ipconf *ipconf)
+{
+	struct at_tokens tok;
+	int cid;
+
+	if (at_tokenize(line, "_OWANDATA", &tok) || tok.n < 5)
+		return -1;
+	memset(ipconf, 0, sizeof(*ipconf));
+	if (tok_int(tok.v[0], &cid)
+			|| tok_ipv4(tok.v[1], &ipconf->addr)
+			|| tok_ipv4(tok.v[2], &ipconf->gw)
+			|| tok_ipv4(tok.v[3], &ipconf->dns1)
+			|| tok_ipv4(tok.v[4], &ipconf->dns2))
+		return -1;
+	return 0;
+}
+
+int
+at_parse_dhcp(char *line, struct at_ipconf *ipconf)
+{
+	struct at_tokens tok;
+	uint32_t dhcp;
+
+	if (at_tokenize(line, "^DHCP", &tok) || tok.n < 8)
+		return -1;
+	memset(ipconf, 0, sizeof(*ipconf));
+	/* Le modem donne les adresses telles qu'en mémoire,
+	 * c'est-à-dire déjà dans l'ordre réseau sur x86 */
+	if (tok_hex32(tok.v[0], &ipconf->addr)
+			|| tok_hex32(tok.v[1], &ipconf->mask)
+			|| tok_hex32(tok.v[2], &ipconf->gw)
+			|| tok_hex32(tok.v[3], &dhcp)
+			|| tok_hex32(tok.v[4], &ipconf->dns1)
+			|| tok_hex32(tok.v[5], &ipconf->dns2))
+		return -1;
+	ipconf->has_mask = 1;
+	return 0;
+}
+
+static void
+cell_init(struct at_cell *cell)
+{
+	cell->gsm = cell->umts = -1;
+	cell->sysmode = cell->submode = NULL;
+}
+
+int
+at_parse_owcti(char *line, struct at_cell *cell)
+{
+	struct at_tokens tok;
+
+	cell_init(cell);
+	if (at_tokenize(line, "_OWCTI", &tok) || tok.n < 1)
+		return -1;
+	return tok_int(tok.v[0], &cell->umts);
+}
+
+int
+at_parse_octi(char *line, struct at_cell *cell)
+{
+	struct at_tokens tok;
+	int mode;
+
+	cell_init(cell);
+	if (at_tokenize(line, "_OCTI", &tok) || tok.n < 2)
+		return -1;
+	if (tok_int(tok.v[0], &mode))
+		return -1;
+	return tok_int(tok.v[1], &cell->gsm);
+}
+
+int
+at_parse_erinfo(char *line, struct at_cell *cell)
+{
+	struct at_tokens tok;
+	int mode;
+
+	cell_init(cell);
+	if (at_tokenize(line, "*ERINFO", &tok) || tok.n < 3)
+		return -1;
+	if (tok_int(tok.v[0], &mode) || tok_int(tok.v[1], &cell->gsm)
+			|| tok_int(tok.v[2], &cell->umts))
+		return -1;
+	return 0;
+}
+
+int
+at_parse_sysinfoex(char *line, struct at_cell *cell)
+{
+	struct at_tokens tok;
+	int sysmode, submode;
+
+	cell_init(cell);
+	if (at_tokenize(line, "^SYSINFOEX", &tok) || tok.n < 9)
+		return -1;
+	if (tok_int(tok.v[5], &sysmode) || tok_int(tok.v[7], &submode))
+		return -1;
+	cell->sysmode = tok.v[6];
+	cell->submode = tok.v[8];
+	return 0;
+}
+
+int
+at_parse_enap(char *line, int *status)
+{
+	struct at_tokens tok;
+
+	if (at_tokenize(line, "*ENAP", &tok) || tok.n < 1)
+		return -1;
+	return tok_int(tok.v[0], status);
+}
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef UMTS_PARSE_H
+#define UMTS_PARSE_H
+
+/*
+ * Analyse des réponses AT.
+ *
+ * Chaque réponse est découpée une seule fois, sur place : les champs
+ * sont terminés par '\0' dans la ligne elle-même, guillemets et espaces
+ * retirés, et les structures retournées pointent dans cette ligne.
+ * Aucune fonction de ce module ne termine le programme ni n'écrit dans
+ * les journaux : les erreurs sont signalées par un retour -1, à charge
+ * pour l'appelant de décider. Ce module ne dépend que de la libc, pour
+ * pouvoir être compilé seul (fuzzing, banc de mesure).
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AT_MAX_TOKENS 12
+
+/* Ligne découpée : "<prefix>: v0,v1,..." */
+struct at_tokens {
+	unsigned int n;
+	char *v[AT_MAX_TOKENS];
+};
+
+int
+at_tokenize(char *line, const char *prefix, struct at_tokens *tok);
+
+/* +CREG: [<n>,]<stat>[,<lac>,<ci>[,<AcT>]] */
+struct at_creg {
+	int n;		/* -1 pour une notification */
+	int stat;
+};
+
+/* query : réponse à AT+CREG? (avec <n>), sinon notification */
+int
+at_parse_creg(char *line, int query, struct at_creg *creg);
+
+/* +CSQ: <rssi>,<ber> */
+struct at_csq {
+	int rssi;
+	int ber;
+};
+
+int
+at_parse_csq(char *line, struct at_csq *csq);
+
+/* +CESQ: <rxlev>,<ber>,<rscp>,<ecno>,<rsrq>,<rsrp>
+ * (255, 99 pour rxlev et ber : inconnu) */
+struct at_cesq {
+	int rxlev;
+	int ber;
+	int rscp;
+	int ecno;
+	int rsrq;
+	int rsrp;
+};
+
+int
+at_parse_cesq(char *line, struct at_cesq *cesq);
+
+/* +COPS: <mode>[,<format>,<oper>[,<AcT>]] */
+struct at_cops {
+	int mode;
+	int format;	/* -1 si absent */
+	const char *oper;	/* NULL si absent */
+	int act;	/* -1 si absent */
+};
+
+int
+at_parse_cops(char *line, struct at_cops *cops);
+
+/* +CIND: <battchg>,<signal>,... : niveau du signal */
+int
+at_parse_cind(char *line, int *signal);
+
+/* Configuration IPv4 (adresses dans l'ordre réseau) */
+struct at_ipconf {
+	uint32_t addr, mask, gw, dns1, dns2;
+	int has_mask;
+};
+
+/* _OWANDATA: <cid>, <ip>, <gw>, <dns1>, <dns2>, ... */
+int
+at_parse_owandata(char *line, struct at_ipconf *ipconf);
+
+/* ^DHCP:<ip>,<mask>,<gw>,<dhcp>,<dns1>,<dns2>,<rx>,<tx> (hexadécimal) */
+int
+at_parse_dhcp(char *line, struct at_ipconf *ipconf);
+
+/* Type de cellule, selon les pilotes */
+struct at_cell {
+	int gsm;		/* type 2G, -1 si inconnu */
+	int umts;		/* type 3G, -1 si inconnu */
+	const char *sysmode;	/* ^SYSINFOEX : noms de mode et sous-mode */
+	const char *submode;
+};
+
+/* _OWCTI: <type> */
+int
+at_parse_owcti(char *line, struct at_cell *cell);
+
+/* _OCTI: <mode>,<type> */
+int
+at_parse_octi(char *line, struct at_cell *cell);
+
+/* *ERINFO: <mode>,<gsm>,<umts> */
+int
+at_parse_erinfo(char *line, struct at_cell *cell);
+
+/* ^SYSINFOEX:<srv>,<domain>,<roam>,<sim>,<lock>,<sysmode>,"<nom>",<submode>,"<nom>" */
+int
+at_parse_sysinfoex(char *line, struct at_cell *cell);
+
+/* *ENAP:<status>[,...] */
+int
+at_parse_enap(char *line, int *status);
+
+#endif /* UMTS_PARSE_H */
@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_parse_bench - mesure du coût de umts_parse
+ *
+ *	Analyse n fois chacune des réponses enregistrées ci-dessous et
+ *	affiche le temps moyen par réponse. Avec -w <dir>, écrit ces
+ *	réponses dans <dir>, un fichier par réponse, pour servir de corpus
+ *	initial à umts_parse_fuzz.
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#include "umts.h"
+
+struct bench_reply {
+	const char *name;
+	const char *line;
+	int (*parse)(char *line);
+};
+
+static int
+bench_creg(char *line)
+{
+	struct at_creg creg;
+
+	return at_parse_creg(line, 1, &creg);
+}
+
+static int
+bench_creg_urc(char *line)
+{
+	struct at_creg creg;
+
+	return at_parse_creg(line, 0, &creg);
+}
+
+static int
+bench_csq(char *line)
+{
+	struct at_csq csq;
+
+	return at_parse_csq(line, &csq);
+}
+
+static int
+bench_cesq(char *line)
+{
+	struct at_cesq cesq;
+
+	return at_parse_cesq(line, &cesq);
+}
+
+static int
+bench_cops(char *line)
+{
+	struct at_cops cops;
+
+	return at_parse_cops(line, &cops);
+}
+
+static int
+bench_cind(char *line)
+{
+	int level;
+
+	return at_parse_cind(line, &level);
+}
+
+static int
+bench_owandata(char *line)
+{
+	struct at_ipconf ipconf;
+
+	return at_parse_owandata(line, &ipconf);
+}
+
+static int
+bench_dhcp(char *line)
+{
+	struct at_ipconf ipconf;
+
+	return at_parse_dhcp(line, &ipconf);
+}
+
+static int
+bench_owcti(char *line)
+{
+	struct at_cell cell;
+
+	return at_parse_owcti(line, &cell);
+}
+
+static int
+bench_octi(char *line)
+{
+	struct at_cell cell;
+
+	return at_parse_octi(line, &cell);
+}
+
+static int
+bench_erinfo(char *line)
+{
+	struct at_cell cell;
+
+	return at_parse_erinfo(line, &cell);
+}
+
+static int
+bench_sysinfoex(char *line)
+{
+	struct at_cell cell;
+
+	return at_parse_sysinfoex(line, &cell);
+}
+
+static int
+bench_enap(char *line)
+{
+	int status;
+
+	return at_parse_enap(line, &status);
+}
+
+/* Réponses relevées sur les modems pris en charge */
+static const struct bench_reply bench_replies[] = {
+	{ "creg", "+CREG: 1,1", bench_creg },
+	{ "creg_urc", "+CREG: 5", bench_creg_urc },
+	{ "csq", "+CSQ: 23,99", bench_csq },
+	{ "cesq", "+CESQ: 99,99,255,255,20,45", bench_cesq },
+	{ "cops", "+COPS: 0,0,\"Orange F\",2", bench_cops },
+	{ "cind", "+CIND: 5,4,0,0,1,0,0,0,0,0,0,0", bench_cind },
+	{ "owandata", "_OWANDATA: 1, 10.65.12.201, 0.0.0.0, "
+		"192.168.10.110, 192.168.10.111, 0.0.0.0, 0.0.0.0, 144000",
+		bench_owandata },
+	{ "dhcp", "^DHCP:c90c410a,f8ffffff,ca0c410a,ca0c410a,"
+		"6e0aa8c0,6f0aa8c0,236800000,236800000", bench_dhcp },
+	{ "owcti", "_OWCTI: 4", bench_owcti },
+	{ "octi", "_OCTI: 0,3", bench_octi },
+	{ "erinfo", "*ERINFO: 0,2,2", bench_erinfo },
+	{ "sysinfoex", "^SYSINFOEX:2,3,0,1,,3,\"WCDMA\",46,\"DC-HSPA+\"",
+		bench_sysinfoex },
+	{ "enap", "*ENAP:1,\"\"", bench_enap },
+};
+#define BENCH_NREPLIES (sizeof(bench_replies) / sizeof(bench_replies[0]))
+
+static void
+bench_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-w corpus_dir]\n", prog);
+	exit(EINVAL);
+}
+
+static void
+bench_write_corpus(const char *dir)
+{
+	fixed_buf path;
+	unsigned int i;
+	FILE *fp;
+
+	if (mkdir(dir, S_IRWXU) && errno != EEXIST)
+		ERROR_ERRNO("failed to create %s", dir);
+	for (i = 0; i < BENCH_NREPLIES; i++) {
+		buf_format_two_strings(path, "%s/%s", dir,
+						bench_replies[i].name);
+		fp = fopen(path, "w");
+		if (!fp || fputs(bench_replies[i].line, fp) < 0 || fclose(fp))
+			ERROR_ERRNO("failed to write %s", path);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const struct bench_reply *br;
+	unsigned long n = 1000000, j;
+	struct timespec start, end;
+	fixed_buf line;
+	unsigned int i;
+	size_t len;
+	double ns;
+	int opt;
+
+	openlog("umts_parse_bench", LOG_PERROR, LOG_DAEMON);
+	while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			if (!n)
+				bench_usage(argv[0]);
+			break;
+		case 'w':
+			bench_write_corpus(optarg);
+			return EXIT_SUCCESS;
+		default:
+			bench_usage(argv[0]);
+		}
+	}
+
+	printf("%-10s %10s %10s\n", "reply", "n", "ns/parse");
+	for (i = 0; i < BENCH_NREPLIES; i++) {
+		br = &bench_replies[i];
+		len = strlen(br->line) + 1;
+		buf_cpy(line, br->line);
+		if (br->parse(line))
+			ERROR(EPROTO, "failed to parse %s", br->line);
+
+		/* l'analyse modifie la ligne : sa recopie est comprise
+		 * dans la mesure */
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (j = 0; j < n; j++) {
+			memcpy(line, br->line, len);
+			br->parse(line);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		ns = ((end.tv_sec - start.tv_sec) * 1e9
+			+ (end.tv_nsec - start.tv_nsec)) / n;
+		printf("%-10s %10lu %10.1f\n", br->name, n, ns);
+	}
+
+	closelog();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_parse_fuzz - cible de fuzzing de umts_parse, umts_qmux et
+ *	umts_mbim_msg
+ *
+ *	Compilé avec -DUMTS_LIBFUZZER, fournit LLVMFuzzerTestOneInput pour
+ *	libFuzzer (make fuzz). Sinon, lit une entrée sur stdin, ou dans
+ *	chacun des fichiers passés en argument, pour AFL ou pour rejouer
+ *	un corpus (make fuzz_stdin).
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "umts_parse.h"
+#include "umts_qmux.h"
+#include "umts_mbim_msg.h"
+
+/* Taille des lignes lues sur le port série (MAX_LEN) */
+#define FUZZ_LINE_LEN 200
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* Chaque analyseur reçoit sa propre copie : la ligne est modifiée */
+#define FUZZ_ONE(call) do { \
+	memcpy(line, data, size); \
+	line[size] = '\0'; \
+	(void)call; \
+} while (0)
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	char line[FUZZ_LINE_LEN];
+	struct at_tokens tok;
+	struct at_creg creg;
+	struct at_csq csq;
+	struct at_cesq cesq;
+	struct at_cops cops;
+	struct at_ipconf ipconf;
+	struct at_cell cell;
+	struct qmi_msg msg;
+	struct mbim_msg mmsg;
+	char str[64];
+	uint32_t u32;
+	size_t off;
+	uint16_t error, len;
+	unsigned int type;
+	int val;
+
+	if (size >= sizeof(line))
+		size = sizeof(line) - 1;
+
+	FUZZ_ONE(at_tokenize(line, "+COPS", &tok));
+	FUZZ_ONE(at_parse_creg(line, 1, &creg));
+	FUZZ_ONE(at_parse_creg(line, 0, &creg));
+	FUZZ_ONE(at_parse_csq(line, &csq));
+	FUZZ_ONE(at_parse_cesq(line, &cesq));
+	FUZZ_ONE(at_parse_cops(line, &cops));
+	FUZZ_ONE(at_parse_cind(line, &val));
+	FUZZ_ONE(at_parse_owandata(line, &ipconf));
+	FUZZ_ONE(at_parse_dhcp(line, &ipconf));
+	FUZZ_ONE(at_parse_owcti(line, &cell));
+	FUZZ_ONE(at_parse_octi(line, &cell));
+	FUZZ_ONE(at_parse_erinfo(line, &cell));
+	FUZZ_ONE(at_parse_enap(line, &val));
+
+	/* Les champs retournés doivent rester dans la ligne */
+	memcpy(line, data, size);
+	line[size] = '\0';
+	if (!at_parse_sysinfoex(line, &cell)) {
+		if (cell.sysmode < line || cell.sysmode > line + size
+				|| cell.submode < line
+				|| cell.submode > line + size)
+			abort();
+	}
+
+	/* Trame QMUX : les TLV retournés doivent rester dans la trame */
+	if (!qmi_decode(data, size, &msg)) {
+		qmi_result(&msg, &error);
+		for (type = 0; type < 256; type++) {
+			const uint8_t *v = qmi_tlv(&msg, type, &len);
+			if (v && (v < data || v + len > data + size))
+				abort();
+		}
+	}
+
+	/* Message MBIM : le tampon d'information doit rester dans le
+	 * message, les chaînes référencées aussi */
+	if (!mbim_decode(data, size, &mmsg)) {
+		if (mmsg.info && (mmsg.info < data
+				|| mmsg.info + mmsg.info_len > data + size))
+			abort();
+		for (off = 0; off < 64; off += 4) {
+			(void)mbim_get_u32(&mmsg, off, &u32);
+			(void)mbim_get_string(&mmsg, off, str, sizeof(str));
+		}
+	}
+	return 0;
+}
+
+#ifndef UMTS_LIBFUZZER
+static void
+fuzz_file(FILE *fp)
+{
+	uint8_t data[FUZZ_LINE_LEN];
+	size_t size;
+
+	size = fread(data, 1, sizeof(data), fp);
+	LLVMFuzzerTestOneInput(data, size);
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE *fp;
+	int i;
+
+	if (argc < 2) {
+		fuzz_file(stdin);
+		return EXIT_SUCCESS;
+	}
+	for (i = 1; i < argc; i++) {
+		fp = fopen(argv[i], "r");
+		if (!fp) {
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+		fuzz_file(fp);
+		fclose(fp);
+	}
+	return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,822 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#include "umts_qmi.h"
+
+/* umts_config module for qmi_wwan modems, native QMI on /dev/cdc-wdmN
+ *
+ * Un client QMI est alloué par service utilisé (CTL Get Client ID) et
+ * libéré en fin d'exécution, sauf le client WDS ayant établi l'appel :
+ * sa libération couperait l'appel. Il est conservé avec le handle de
+ * l'appel dans UMTS_RUN_DIR/umts_qmi.<périphérique>, pour être repris
+ * par check, le up suivant ou down. */
+
+/**********************/
+/* Internal functions */
+/**********************/
+
+static const char *const qmi_services[QMI_SERVICE_MAX + 1] = {
+	"CTL", "WDS", "DMS", "NAS",
+};
+
+static const char *
+qmi_service_name(uint8_t service)
+{
+	return (service <= QMI_SERVICE_MAX) ? qmi_services[service] : "?";
+}
+
+/* TLV des messages utilisés */
+#define QMI_TLV_CTL_CLIENT	0x01	/* service, client */
+#define QMI_TLV_WDS_PDH		0x01	/* handle de l'appel */
+#define QMI_TLV_WDS_END_REASON	0x10
+#define QMI_TLV_WDS_APN		0x14
+#define QMI_TLV_WDS_AUTH	0x16
+#define QMI_TLV_WDS_USER	0x17
+#define QMI_TLV_WDS_PASSWORD	0x18
+#define QMI_TLV_WDS_STATUS	0x01	/* état de l'appel */
+#define QMI_TLV_WDS_MASK	0x10	/* paramètres demandés */
+#define QMI_TLV_WDS_DNS1	0x15
+#define QMI_TLV_WDS_DNS2	0x16
+#define QMI_TLV_WDS_ADDR	0x1e
+#define QMI_TLV_WDS_GW		0x20
+#define QMI_TLV_WDS_NETMASK	0x21
+#define QMI_TLV_DMS_PIN_ID	0x01
+#define QMI_TLV_DMS_PIN1	0x11
+#define QMI_TLV_NAS_SERVING	0x01	/* état, attachements, réseaux */
+#define QMI_TLV_NAS_ROAMING	0x10
+#define QMI_TLV_NAS_PLMN	0x12
+#define QMI_TLV_NAS_GSM		0x12	/* Get Signal Info */
+#define QMI_TLV_NAS_WCDMA	0x13
+#define QMI_TLV_NAS_LTE		0x14
+
+/* WDS Get Current Settings : DNS, adresse, passerelle et masque */
+#define QMI_SETTINGS_MASK	0x0310
+/* WDS : authentification PAP ou CHAP */
+#define QMI_AUTH_PAP_CHAP	0x03
+/* WDS Packet Service Status */
+#define QMI_PKT_CONNECTED	0x02
+
+#define QMI_RX_LEN (2 * QMI_FRAME_MAX)
+
+static struct {
+	int comd;
+	uint8_t ctl_tid;
+	uint16_t tid;
+	unsigned int clients;		/* services dont le client est alloué */
+	uint8_t cid[QMI_SERVICE_MAX + 1];
+	int keep_wds;			/* client WDS porteur de l'appel */
+	uint8_t rx[QMI_RX_LEN];		/* octets reçus non traités */
+	size_t rx_len;
+	uint8_t frame[QMI_FRAME_MAX];	/* dernière trame extraite */
+} qmi = { .comd = -1 };
+
+/* Client WDS et appel conservés d'une exécution à l'autre */
+struct qmi_session {
+	unsigned int cid;
+	uint32_t pdh;
+};
+
+/* Extrait la prochaine trame reçue avant l'échéance. msg pointe dans
+ * qmi.frame, jusqu'à l'appel suivant. Retourne 1 si une trame est
+ * extraite, 0 à l'échéance, -1 sur erreur. */
+static int
+qmi_recv(int comd, struct qmi_msg *msg, msec_t deadline)
+{
+	const uint8_t *next;
+	ssize_t flen, rret;
+	size_t drop;
+
+	for (;;) {
+		flen = qmi_frame_len(qmi.rx, qmi.rx_len);
+		if (flen < 0) {
+			/* resynchronisation sur le début de trame suivant */
+			next = memchr(qmi.rx + 1, QMUX_IF, qmi.rx_len - 1);
+			drop = (next) ? (size_t)(next - qmi.rx) : qmi.rx_len;
+			WARN("dropping %zu bytes of garbage", drop);
+			memmove(qmi.rx, qmi.rx + drop, qmi.rx_len - drop);
+			qmi.rx_len -= drop;
+			continue;
+		}
+		if (flen > 0) {
+			memcpy(qmi.frame, qmi.rx, flen);
+			qmi.rx_len -= flen;
+			memmove(qmi.rx, qmi.rx + flen, qmi.rx_len);
+			if (qmi_decode(qmi.frame, flen, msg)) {
+				WARN("malformed QMI message dropped");
+				continue;
+			}
+			return 1;
+		}
+
+		rret = serial_read(comd, qmi.rx + qmi.rx_len,
+					sizeof(qmi.rx) - qmi.rx_len, deadline);
+		if (rret <= 0)
+			return (int)rret;
+		qmi.rx_len += rret;
+	}
+}
+
+/* Message d'un service sans rapport avec l'échange en cours */
+static void
+qmi_unsolicited(const struct qmi_msg *msg)
+{
+	uint8_t status;
+
+	if (msg->type != QMI_INDICATION) {
+		DBG("stale QMI %s response 0x%04x dropped",
+			qmi_service_name(msg->service), msg->id);
+		return;
+	}
+	if (msg->service == QMI_WDS && msg->id == QMI_WDS_PKT_SRVC_STATUS
+			&& !qmi_tlv_u8(msg, QMI_TLV_WDS_STATUS, &status)) {
+		LOG("packet service status: %u", status);
+		return;
+	}
+	DBG("QMI %s indication 0x%04x ignored",
+			qmi_service_name(msg->service), msg->id);
+}
+
+/* Envoi d'une requête par le client du service et attente de la
+ * réponse, dans resp. Retourne 0 en cas de succès, -1 sinon, error
+ * contenant alors le code d'erreur QMI (QMI_ERR_NONE sans réponse). */
+static int
+qmi_request(int comd, const struct qmi_packet *pkt, struct qmi_msg *resp,
+				uint16_t *error, unsigned int timeout)
+{
+	uint8_t frame[QMI_FRAME_MAX];
+	uint8_t cid = (pkt->service == QMI_CTL) ? 0 : qmi.cid[pkt->service];
+	msec_t deadline = deadline_in(timeout);
+	uint16_t tid;
+	ssize_t len;
+	int ret;
+
+	if (pkt->service == QMI_CTL) {
+		if (!++qmi.ctl_tid)
+			qmi.ctl_tid++;
+		tid = qmi.ctl_tid;
+	} else {
+		if (!++qmi.tid)
+			qmi.tid++;
+		tid = qmi.tid;
+	}
+	len = qmi_encode(pkt, cid, QMI_REQUEST, tid, frame, sizeof(frame));
+	if (len < 0)
+		ERROR(EMSGSIZE, "QMI message too long");
+
+	DBGV(2, "-> QMI %s 0x%04x", qmi_service_name(pkt->service), pkt->id);
+	umts_counters.at++;
+	writebuf(comd, (const char *)frame, len);
+
+	for (;;) {
+		ret = qmi_recv(comd, resp, deadline);
+		if (ret <= 0) {
+			WARN("no answer to QMI %s request 0x%04x",
+				qmi_service_name(pkt->service), pkt->id);
+			*error = QMI_ERR_NONE;
+			return -1;
+		}
+		if (resp->type != QMI_RESPONSE
+				|| resp->service != pkt->service
+				|| resp->cid != cid || resp->tid != tid
+				|| resp->id != pkt->id) {
+			qmi_unsolicited(resp);
+			continue;
+		}
+		ret = qmi_result(resp, error);
+		DBGV(2, "<- QMI %s 0x%04x: 0x%04x",
+			qmi_service_name(pkt->service), pkt->id, *error);
+		return ret;
+	}
+}
+
+/* Attente d'une indication du service, adressée à notre client ou à
+ * tous. Retourne 1 si elle est reçue, 0 à l'échéance, -1 sur erreur. */
+static int
+qmi_wait_indication(int comd, uint8_t service, uint16_t id,
+				struct qmi_msg *msg, msec_t deadline)
+{
+	int ret;
+
+	for (;;) {
+		ret = qmi_recv(comd, msg, deadline);
+		if (ret <= 0)
+			return ret;
+		if (msg->type == QMI_INDICATION && msg->service == service
+				&& msg->id == id
+				&& (msg->cid == qmi.cid[service]
+					|| msg->cid == QMI_CID_BROADCAST))
+			return 1;
+		qmi_unsolicited(msg);
+	}
+}
+
+static void
+qmi_release(int comd, uint8_t service)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	uint8_t val[2] = { service, qmi.cid[service] };
+	uint16_t error;
+
+	qmi.clients &= ~(1U << service);
+	qmi_packet_init(&pkt, QMI_CTL, QMI_CTL_RELEASE_CLIENT_ID);
+	qmi_packet_tlv(&pkt, QMI_TLV_CTL_CLIENT, val, sizeof(val));
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_PROBE_TIMEOUT))
+		WARN("failed to release QMI %s client %u: error 0x%04x",
+			qmi_service_name(service), val[1], error);
+}
+
+/* Libération des clients à la fermeture du port */
+static void
+qmi_release_all(int comd)
+{
+	uint8_t service;
+
+	for (service = QMI_WDS; service <= QMI_SERVICE_MAX; service++) {
+		if (!(qmi.clients & (1U << service)))
+			continue;
+		if (service == QMI_WDS && qmi.keep_wds)
+			continue;
+		qmi_release(comd, service);
+	}
+	qmi.comd = -1;
+}
+
+/* ou en fin d'exécution sur erreur, le port étant alors encore ouvert */
+static void
+qmi_release_exit(void)
+{
+	if (qmi.comd >= 0)
+		qmi_release_all(qmi.comd);
+}
+
+static void
+qmi_release_at_exit(int comd)
+{
+	static int registered;
+
+	if (qmi.comd >= 0)
+		return;
+	qmi.comd = comd;
+	serial_at_close(comd, qmi_release_all);
+	if (!registered && atexit(qmi_release_exit))
+		WARN("failed to register QMI client release");
+	registered = 1;
+}
+
+/* Allocation du client d'un service, s'il ne l'est pas encore */
+static void
+qmi_client(int comd, uint8_t service)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	const uint8_t *val;
+	uint16_t error, len;
+
+	if (qmi.clients & (1U << service))
+		return;
+	qmi_release_at_exit(comd);
+
+	qmi_packet_init(&pkt, QMI_CTL, QMI_CTL_GET_CLIENT_ID);
+	qmi_packet_u8(&pkt, QMI_TLV_CTL_CLIENT, service);
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_TIMEOUT))
+		ERROR(EPROTO, "failed to allocate QMI %s client: error 0x%04x",
+					qmi_service_name(service), error);
+	val = qmi_tlv(&resp, QMI_TLV_CTL_CLIENT, &len);
+	if (!val || len < 2 || val[0] != service)
+		ERROR(EPROTO, "unexpected QMI %s client allocation",
+					qmi_service_name(service));
+	qmi.cid[service] = val[1];
+	qmi.clients |= 1U << service;
+	DBG("QMI %s client %u", qmi_service_name(service), val[1]);
+}
+
+/*********************************************************/
+/** Session WDS **/
+/*********************************************************/
+
+static void
+qmi_session_path(char *path, size_t len, const char *suffix)
+{
+	fixed_buf key;
+
+	buf_cpy(key, qmi_device.device);
+	run_key_sanitize(key);
+	snprintf(path, len, "%s/umts_qmi.%s%s", umts_run_dir(), key, suffix);
+}
+
+static void
+qmi_session_save(const struct qmi_session *sess)
+{
+	char path[PATH_MAX], tmp[PATH_MAX];
+	FILE *fp;
+
+	qmi_session_path(path, sizeof(path), "");
+	qmi_session_path(tmp, sizeof(tmp), ".tmp");
+
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		WARN_ERRNO("failed to open %s", tmp);
+		return;
+	}
+	fprintf(fp, "wds_cid=%u\npdh=%u\n", sess->cid, sess->pdh);
+	if (fclose(fp) || rename(tmp, path))
+		WARN_ERRNO("failed to write %s", path);
+}
+
+static int
+qmi_session_load(struct qmi_session *sess)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+	int ret;
+
+	qmi_session_path(path, sizeof(path), "");
+	fp = fopen(path, "r");
+	if (!fp)
+		return -1;
+	ret = fscanf(fp, "wds_cid=%u pdh=%u", &sess->cid, &sess->pdh);
+	fclose(fp);
+	if (ret != 2 || !sess->cid || sess->cid >= QMI_CID_BROADCAST) {
+		WARN("invalid QMI session file %s", path);
+		return -1;
+	}
+	return 0;
+}
+
+static void
+qmi_session_clear(void)
+{
+	char path[PATH_MAX];
+
+	qmi_session_path(path, sizeof(path), "");
+	if (unlink(path) && errno != ENOENT)
+		WARN_ERRNO("failed to remove %s", path);
+}
+
+/* Reprise du client WDS d'une session, conservé par défaut */
+static void
+qmi_session_attach(int comd, const struct qmi_session *sess)
+{
+	qmi_release_at_exit(comd);
+	qmi.cid[QMI_WDS] = (uint8_t)sess->cid;
+	qmi.clients |= 1U << QMI_WDS;
+	qmi.keep_wds = 1;
+}
+
+/* Reprise du client WDS de la session enregistrée.
+ * Retourne 1 si son appel est établi, 0 sinon. */
+static int
+qmi_session_connected(int comd, struct qmi_session *sess)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	uint16_t error;
+	uint8_t status;
+
+	if (qmi_session_load(sess))
+		return 0;
+	qmi_session_attach(comd, sess);
+
+	qmi_packet_init(&pkt, QMI_WDS, QMI_WDS_PKT_SRVC_STATUS);
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_PROBE_TIMEOUT)) {
+		/* client disparu (modem réinitialisé) : rien à libérer */
+		LOG("QMI WDS client %u is gone", sess->cid);
+		qmi.clients &= ~(1U << QMI_WDS);
+		qmi.keep_wds = 0;
+		qmi_session_clear();
+		return 0;
+	}
+	if (qmi_tlv_u8(&resp, QMI_TLV_WDS_STATUS, &status)
+					|| status != QMI_PKT_CONNECTED) {
+		/* client réutilisable, appel à rétablir */
+		qmi.keep_wds = 0;
+		qmi_session_clear();
+		return 0;
+	}
+	return 1;
+}
+
+/*********************************************************/
+/** Connexion **/
+/*********************************************************/
+
+static void
+qmi_configure_net_down(char *interface)
+{
+	/* pas de script de down : la déconfiguration est complète */
+	phase_begin("net_down");
+	LOG("Bringing down network on %s", interface);
+
+	if (net_down(interface, NULL))
+		ERROR(EFAULT, "Failed to bring down network");
+}
+
+static void
+qmi_configure_net_up(char *interface, struct cdata *p_conn_data)
+{
+	char *argv[] = {
+		QMI_SCRIPT_UP,
+		interface,
+		p_conn_data->ip_address,
+		p_conn_data->mask,
+		p_conn_data->gateway,
+		p_conn_data->dns1,
+		p_conn_data->dns2,
+		NULL };
+
+	phase_begin("net_up");
+	LOG("Bringing up network: %s:%s/%s, GW: %s, DNS: %s / %s",
+		interface,
+		p_conn_data->ip_address,
+		p_conn_data->mask,
+		p_conn_data->gateway,
+		p_conn_data->dns1,
+		p_conn_data->dns2);
+
+	if (net_up(interface, p_conn_data, NET_GATEWAY | NET_FIX_HWADDR, argv))
+		ERROR(EFAULT, "Failed to configure network");
+}
+
+/* Paramètres IP de l'appel établi (WDS Get Current Settings) */
+static int
+qmi_get_settings(int comd, struct cdata *p_conn_data, unsigned int timeout)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	struct at_ipconf ipconf;
+	uint32_t val;
+	uint16_t error;
+
+	qmi_packet_init(&pkt, QMI_WDS, QMI_WDS_GET_CURRENT_SETTINGS);
+	qmi_packet_u32(&pkt, QMI_TLV_WDS_MASK, QMI_SETTINGS_MASK);
+	if (qmi_request(comd, &pkt, &resp, &error, timeout)) {
+		LOG("No connection parameters: error 0x%04x", error);
+		return -1;
+	}
+
+	/* adresses en entiers 32 bits, ordre de l'hôte du modem */
+	memset(&ipconf, 0, sizeof(ipconf));
+	if (qmi_tlv_u32(&resp, QMI_TLV_WDS_ADDR, &val))
+		return -1;
+	ipconf.addr = htonl(val);
+	if (!qmi_tlv_u32(&resp, QMI_TLV_WDS_GW, &val))
+		ipconf.gw = htonl(val);
+	if (!qmi_tlv_u32(&resp, QMI_TLV_WDS_NETMASK, &val)) {
+		ipconf.mask = htonl(val);
+		ipconf.has_mask = 1;
+	}
+	if (!qmi_tlv_u32(&resp, QMI_TLV_WDS_DNS1, &val))
+		ipconf.dns1 = htonl(val);
+	if (!qmi_tlv_u32(&resp, QMI_TLV_WDS_DNS2, &val))
+		ipconf.dns2 = htonl(val);
+	set_ipconf(p_conn_data, &ipconf);
+	return 0;
+}
+
+static void
+qmi_add_string(struct qmi_packet *pkt, uint8_t type, const char *str)
+{
+	if (qmi_packet_tlv(pkt, type, str, (uint16_t)strlen(str)))
+		ERROR(EMSGSIZE, "QMI message too long");
+}
+
+/* Établissement de l'appel (WDS Start Network), bloquant jusqu'à ce
+ * que le modem l'ait établi ou refusé */
+static void
+qmi_start_network(int comd, struct cdata *p_conn_data)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	struct qmi_session sess;
+	uint16_t error, reason;
+
+	phase_begin("call");
+	LOG("Starting network with APN %s", p_conn_data->apn);
+	qmi_client(comd, QMI_WDS);
+
+	qmi_packet_init(&pkt, QMI_WDS, QMI_WDS_START_NETWORK);
+	if (p_conn_data->apn[0])
+		qmi_add_string(&pkt, QMI_TLV_WDS_APN, p_conn_data->apn);
+	if (p_conn_data->identity[0]) {
+		qmi_packet_u8(&pkt, QMI_TLV_WDS_AUTH, QMI_AUTH_PAP_CHAP);
+		qmi_add_string(&pkt, QMI_TLV_WDS_USER, p_conn_data->identity);
+		qmi_add_string(&pkt, QMI_TLV_WDS_PASSWORD,
+						p_conn_data->password);
+	}
+
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_CALL_TIMEOUT)) {
+		if (error != QMI_ERR_NONE
+			&& !qmi_tlv_u16(&resp, QMI_TLV_WDS_END_REASON, &reason))
+			ERROR(ECALLFAILED, "Call failed: error 0x%04x, "
+					"end reason %u", error, reason);
+		ERROR(ECALLFAILED, "Call failed: error 0x%04x", error);
+	}
+	if (qmi_tlv_u32(&resp, QMI_TLV_WDS_PDH, &sess.pdh))
+		ERROR(EPROTO, "No packet data handle in Start Network answer");
+
+	/* l'appel appartient au client WDS : il est conservé */
+	sess.cid = qmi.cid[QMI_WDS];
+	qmi.keep_wds = 1;
+	qmi_session_save(&sess);
+}
+
+/* Interprétation de l'état d'enregistrement NAS : retourne 0 si
+ * enregistré, -1 si refusé, 1 s'il faut attendre */
+static int
+qmi_reg_status(const struct qmi_msg *msg)
+{
+	uint8_t state, roaming;
+
+	if (qmi_tlv_u8(msg, QMI_TLV_NAS_SERVING, &state))
+		ERROR(EPROTO, "No registration state in serving system");
+
+	switch (state) {
+		case 1:
+			if (!qmi_tlv_u8(msg, QMI_TLV_NAS_ROAMING, &roaming)
+								&& !roaming)
+				LOG("Registered with network, roaming");
+			else
+				LOG("Registered with network, native");
+			return 0;
+		case 3:
+			WARN("Registration denied");
+			return -1;
+		case 0:
+			DBG("Not registered with network yet");
+			return 1;
+		case 2: /* en recherche */
+		case 4: /* inconnu */
+			return 1;
+		default:
+			ERROR(EPROTO, "Unexpected registration state %u", state);
+	}
+}
+
+/* Nom de l'opérateur et technologie radio courante */
+static void
+qmi_serving_system(const struct qmi_msg *msg, fixed_buf oper,
+						const char **typestr)
+{
+	const uint8_t *val;
+	uint16_t len;
+	unsigned int i;
+
+	oper[0] = '\0';
+	val = qmi_tlv(msg, QMI_TLV_NAS_PLMN, &len);
+	if (val && len >= 5 && val[4] <= len - 5 && val[4] < MAX_LEN) {
+		memcpy(oper, val + 5, val[4]);
+		oper[val[4]] = '\0';
+		if (!oper[0])
+			snprintf(oper, MAX_LEN, "%u-%u", qmi_get_le16(val),
+							qmi_get_le16(val + 2));
+	}
+
+	*typestr = "unknown";
+	val = qmi_tlv(msg, QMI_TLV_NAS_SERVING, &len);
+	if (!val || len < 5)
+		return;
+	for (i = 0; i < val[4] && 5 + i < len; i++) {
+		switch (val[5 + i]) {
+			case 4:
+				*typestr = "GSM";
+				break;
+			case 5:
+				*typestr = "UMTS";
+				break;
+			case 8:
+				*typestr = "LTE";
+				break;
+			case 9:
+				*typestr = "TD-SCDMA";
+				break;
+		}
+	}
+}
+
+/**********************/
+/* External functions */
+/**********************/
+
+static int
+qmi_check_pin(int comd, struct cdata *p_conn_data)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	const uint8_t *val;
+	uint8_t pin[2 + SIZE_PIN];
+	uint16_t error, len;
+	size_t pinlen;
+
+	qmi_client(comd, QMI_DMS);
+	qmi_packet_init(&pkt, QMI_DMS, QMI_DMS_UIM_GET_PIN_STATUS);
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_TIMEOUT))
+		return -1;
+	val = qmi_tlv(&resp, QMI_TLV_DMS_PIN1, &len);
+	if (!val || len < 1) {
+		WARN("No PIN1 status");
+		return -1;
+	}
+
+	/* 1 : activé, non vérifié ; 2 : vérifié ; 3 : désactivé ;
+	 * 4, 5 : bloqué ; 6 : débloqué ; 7 : modifié */
+	switch (val[0]) {
+		case 2:
+		case 3:
+		case 6:
+		case 7:
+			LOG("PIN already set up");
+			return 0;
+		case 4:
+		case 5:
+			ERROR(ESIMPIN, "SIM PIN blocked");
+		case 1:
+			break;
+		default:
+			WARN("unexpected PIN1 status %u", val[0]);
+			return -1;
+	}
+
+	LOG("Setting up PIN code");
+	pinlen = strlen(p_conn_data->pin);
+	pin[0] = 1;	/* PIN1 */
+	pin[1] = (uint8_t)pinlen;
+	memcpy(pin + 2, p_conn_data->pin, pinlen);
+	qmi_packet_init(&pkt, QMI_DMS, QMI_DMS_UIM_VERIFY_PIN);
+	qmi_packet_tlv(&pkt, QMI_TLV_DMS_PIN_ID, pin, (uint16_t)(2 + pinlen));
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_TIMEOUT)) {
+		/* pas de nouvel essai sur un code erroné */
+		if (error == QMI_ERR_INCORRECT_PIN)
+			ERROR(ESIMPIN, "Incorrect SIM PIN");
+		WARN("PIN verification failed: error 0x%04x", error);
+		return -1;
+	}
+	return 0;
+}
+
+/* Reprise rapide : l'appel du bail précédent est-il toujours établi ? */
+static int
+qmi_warm_start(int comd, struct cdata *p_conn_data,
+			const struct cdata *lease, char *interface)
+{
+	struct qmi_session sess;
+
+	if (!qmi_session_connected(comd, &sess))
+		return -1;
+	if (qmi_get_settings(comd, p_conn_data, QMI_TIMEOUT))
+		return -1;
+	if (!lease_match(lease, p_conn_data))
+		return -1;
+
+	qmi_configure_net_up(interface, p_conn_data);
+	return 0;
+}
+
+/* Vérifie si la liaison est établie, l'établit au besoin */
+static void
+qmi_check_conn_up(int comd, struct cdata *p_conn_data, char *interface)
+{
+	struct qmi_session sess;
+
+	if (qmi_session_connected(comd, &sess))
+		LOG("Call already established, handle %u", sess.pdh);
+	else
+		qmi_start_network(comd, p_conn_data);
+
+	phase_begin("conn_params");
+	if (qmi_get_settings(comd, p_conn_data, QMI_TIMEOUT))
+		ERROR(EADDRNOTAVAIL, "Unreadable connection parameters");
+	qmi_configure_net_up(interface, p_conn_data);
+}
+
+/* Attente de l'enregistrement : état courant, puis indications
+ * Serving System du service NAS */
+static int
+qmi_wait_reg_status(int comd)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg msg;
+	msec_t deadline;
+	uint16_t error;
+	int ret;
+
+	deadline = deadline_in(REG_TIMEOUT);
+	qmi_client(comd, QMI_NAS);
+	qmi_packet_init(&pkt, QMI_NAS, QMI_NAS_GET_SERVING_SYSTEM);
+	if (qmi_request(comd, &pkt, &msg, &error, QMI_TIMEOUT))
+		ERROR(EPROTO, "Serving system error 0x%04x", error);
+
+	while ((ret = qmi_reg_status(&msg)) > 0) {
+		ret = qmi_wait_indication(comd, QMI_NAS,
+				QMI_NAS_GET_SERVING_SYSTEM, &msg, deadline);
+		if (ret <= 0) {
+			if (!ret)
+				WARN("Registration timeout");
+			return -1;
+		}
+	}
+	return ret;
+}
+
+static void
+qmi_set_conn_down(int comd, char *interface)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	struct qmi_session sess;
+	uint16_t error;
+
+	if (qmi_session_load(&sess)) {
+		LOG("No call to stop");
+	} else {
+		qmi_session_attach(comd, &sess);
+		qmi.keep_wds = 0;	/* libéré en fin d'exécution */
+		qmi_session_clear();
+
+		qmi_packet_init(&pkt, QMI_WDS, QMI_WDS_STOP_NETWORK);
+		qmi_packet_u32(&pkt, QMI_TLV_WDS_PDH, sess.pdh);
+		if (qmi_request(comd, &pkt, &resp, &error, QMI_TIMEOUT)
+					&& error != QMI_ERR_NO_EFFECT)
+			WARN("Stop network error 0x%04x", error);
+	}
+	qmi_configure_net_down(interface);
+}
+
+static int
+qmi_monitor_connection(int comd, const char *filename,
+			const char *interface,
+			const char *ipsec)
+{
+	struct qmi_packet pkt;
+	struct qmi_msg resp;
+	const uint8_t *val;
+	const char *typestr;
+	struct quality_sample sample;
+	fixed_buf oper;
+	uint16_t error, len;
+	int8_t rssi = 0;
+	int level = 0;
+
+	qmi_client(comd, QMI_NAS);
+	qmi_packet_init(&pkt, QMI_NAS, QMI_NAS_GET_SERVING_SYSTEM);
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_TIMEOUT))
+		ERROR(EPROTO, "Serving system error 0x%04x", error);
+	qmi_serving_system(&resp, oper, &typestr);
+	if (!oper[0])
+		ERROR(EFAULT, "operator, no PLMN in serving system");
+	DBGV(2, "operator: %s", oper);
+
+	/* Niveau d'après le RSSI (dBm) de la technologie courante, avec
+	 * les seuils de AT+CSQ (rssi = -113 + 2 * csq) :
+	 * >= -51 => 5, -63 => 4, -83 => 3, -93 => 2, sinon 1 */
+	qmi_packet_init(&pkt, QMI_NAS, QMI_NAS_GET_SIGNAL_INFO);
+	if (qmi_request(comd, &pkt, &resp, &error, QMI_TIMEOUT))
+		ERROR(EPROTO, "Signal info error 0x%04x", error);
+	quality_init(&sample, 0, oper, typestr);
+	if ((val = qmi_tlv(&resp, QMI_TLV_NAS_LTE, &len)) && len >= 1) {
+		rssi = (int8_t)val[0];
+		/* rssi, rsrq (dB), rsrp (dBm), snr */
+		if (len >= 4) {
+			sample.rsrq = (int16_t)(10 * (int8_t)val[1]);
+			sample.rsrp = (int16_t)qmi_get_le16(val + 2);
+		}
+	} else if ((val = qmi_tlv(&resp, QMI_TLV_NAS_WCDMA, &len)) && len >= 1)
+		rssi = (int8_t)val[0];
+	else if ((val = qmi_tlv(&resp, QMI_TLV_NAS_GSM, &len)) && len >= 1)
+		rssi = (int8_t)val[0];
+
+	if (!rssi)
+		level = 0;
+	else if (rssi >= -51)
+		level = 5;
+	else if (rssi >= -63)
+		level = 4;
+	else if (rssi >= -83)
+		level = 3;
+	else if (rssi >= -93)
+		level = 2;
+	else
+		level = 1;
+	DBGV(2, "level: %d (%d dBm)", level, rssi);
+
+	sample.level = (uint8_t)level;
+	if (rssi)
+		sample.rssi = rssi;
+	quality_record(interface, &sample);
+
+	return monitor_publish(filename, ipsec, level, "%s (%s)",
+					oper, typestr);
+}
+
+umts_device_t qmi_device =
+{
+	.name = "QMI",
+	.device = "/dev/cdc-wdm0",
+	.interface = "wwan0",
+	.raw = 1,
+	.check_pin = qmi_check_pin,
+	.check_conn_up = qmi_check_conn_up,
+	.wait_reg_status = qmi_wait_reg_status,
+	.set_conn_down = qmi_set_conn_down,
+	.monitor_connection = qmi_monitor_connection,
+	.warm_start = qmi_warm_start,
+};
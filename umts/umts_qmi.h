@@ -0,0 +1,20 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef UMTS_QMI_H
+#define UMTS_QMI_H
+
+#include "umts.h"
+#include "umts_qmux.h"
+
+#define QMI_SCRIPT_UP		HOOKS_DIR"/umts_huawei_net_up.sh" /* same as Huawei */
+
+/* Délai maximal de réponse à une requête QMI (ms) */
+#define QMI_TIMEOUT		10000U
+/* Délai maximal d'établissement de l'appel (WDS Start Network, ms) */
+#define QMI_CALL_TIMEOUT	60000U
+/* Délai de réponse attendu sur un client WDS conservé d'une exécution
+ * précédente, qui peut ne plus exister après réinitialisation du modem (ms) */
+#define QMI_PROBE_TIMEOUT	1000U
+
+extern umts_device_t qmi_device;
+#endif /* UMTS_QMI_H */
@@ -0,0 +1,247 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_qmux - trames QMUX et TLV QMI
+ */
+
+#include <string.h>
+
+#include "umts_qmux.h"
+
+/*********************************************************/
+/** Émission **/
+/*********************************************************/
+
+void
+qmi_packet_init(struct qmi_packet *pkt, uint8_t service, uint16_t id)
+{
+	pkt->service = service;
+	pkt->id = id;
+	pkt->tlv_len = 0;
+}
+
+int
+qmi_packet_tlv(struct qmi_packet *pkt, uint8_t type, const void *val,
+							uint16_t len)
+{
+	uint8_t *p;
+
+	if ((size_t)pkt->tlv_len + 3 + len > sizeof(pkt->tlv))
+		return -1;
+	p = pkt->tlv + pkt->tlv_len;
+	p[0] = type;
+	qmi_put_le16(p + 1, len);
+	if (len)
+		memcpy(p + 3, val, len);
+	pkt->tlv_len += 3 + len;
+	return 0;
+}
+
+int
+qmi_packet_u8(struct qmi_packet *pkt, uint8_t type, uint8_t val)
+{
+	return qmi_packet_tlv(pkt, type, &val, 1);
+}
+
+int
+qmi_packet_u32(struct qmi_packet *pkt, uint8_t type, uint32_t val)
+{
+	uint8_t le[4];
+
+	qmi_put_le32(le, val);
+	return qmi_packet_tlv(pkt, type, le, sizeof(le));
+}
+
+/* TLV de résultat d'une réponse : 0 ou 1 (échec), puis le code d'erreur */
+int
+qmi_packet_result(struct qmi_packet *pkt, uint16_t error)
+{
+	uint8_t res[4];
+
+	qmi_put_le16(res, (error == QMI_ERR_NONE) ? 0 : 1);
+	qmi_put_le16(res + 2, error);
+	return qmi_packet_tlv(pkt, QMI_TLV_RESULT, res, sizeof(res));
+}
+
+/* Trame complète du message pkt pour le client cid.
+ * Retourne sa longueur, -1 si frame est trop petit. */
+ssize_t
+qmi_encode(const struct qmi_packet *pkt, uint8_t cid, uint8_t type,
+			uint16_t tid, uint8_t *frame, size_t size)
+{
+	size_t sdu_hdr = (pkt->service == QMI_CTL) ? 2 : 3;
+	size_t len = QMUX_HDR_LEN + sdu_hdr + 4 + pkt->tlv_len;
+	uint8_t *p = frame;
+
+	if (len > size || len - 1 > UINT16_MAX)
+		return -1;
+
+	*p++ = QMUX_IF;
+	qmi_put_le16(p, (uint16_t)(len - 1));
+	p += 2;
+	*p++ = (type == QMI_REQUEST) ? 0 : QMUX_FROM_SERVICE;
+	*p++ = pkt->service;
+	*p++ = cid;
+
+	if (pkt->service == QMI_CTL) {
+		/* CTL : réponse 0x01, indication 0x02 */
+		*p++ = type >> 1;
+		*p++ = tid & 0xff;
+	} else {
+		*p++ = type;
+		qmi_put_le16(p, tid);
+		p += 2;
+	}
+	qmi_put_le16(p, pkt->id);
+	qmi_put_le16(p + 2, pkt->tlv_len);
+	p += 4;
+	memcpy(p, pkt->tlv, pkt->tlv_len);
+
+	return (ssize_t)len;
+}
+
+/*********************************************************/
+/** Réception **/
+/*********************************************************/
+
+/* Longueur de la trame en tête de data : 0 si elle est incomplète,
+ * -1 si data ne commence pas par une trame valide */
+ssize_t
+qmi_frame_len(const uint8_t *data, size_t len)
+{
+	size_t flen;
+
+	if (!len)
+		return 0;
+	if (data[0] != QMUX_IF)
+		return -1;
+	if (len < 3)
+		return 0;
+	flen = (size_t)qmi_get_le16(data + 1) + 1;
+	if (flen < QMUX_HDR_LEN + 2 + 4 || flen > QMI_FRAME_MAX)
+		return -1;
+	return (flen <= len) ? (ssize_t)flen : 0;
+}
+
+/* Analyse d'une trame complète. Les TLV ne sont pas recopiés. */
+int
+qmi_decode(const uint8_t *frame, size_t len, struct qmi_msg *msg)
+{
+	const uint8_t *p = frame + QMUX_HDR_LEN;
+	const uint8_t *end = frame + len;
+	uint16_t off;
+
+	if (qmi_frame_len(frame, len) != (ssize_t)len)
+		return -1;
+
+	msg->service = frame[4];
+	msg->cid = frame[5];
+	if (msg->service == QMI_CTL) {
+		if (end - p < 2)
+			return -1;
+		msg->type = (uint8_t)(p[0] << 1);
+		msg->tid = p[1];
+		p += 2;
+	} else {
+		if (end - p < 3)
+			return -1;
+		msg->type = p[0];
+		msg->tid = qmi_get_le16(p + 1);
+		p += 3;
+	}
+	if (end - p < 4)
+		return -1;
+	msg->id = qmi_get_le16(p);
+	msg->tlv_len = qmi_get_le16(p + 2);
+	p += 4;
+	if (msg->tlv_len > end - p)
+		return -1;
+	msg->tlv = p;
+
+	/* Chaque TLV doit tenir dans le message */
+	for (off = 0; off < msg->tlv_len; ) {
+		if (msg->tlv_len - off < 3)
+			return -1;
+		if (qmi_get_le16(p + off + 1) > msg->tlv_len - off - 3)
+			return -1;
+		off += 3 + qmi_get_le16(p + off + 1);
+	}
+	return 0;
+}
+
+/* Valeur du TLV type, NULL s'il est absent */
+const uint8_t *
+qmi_tlv(const struct qmi_msg *msg, uint8_t type, uint16_t *len)
+{
+	const uint8_t *p = msg->tlv;
+	const uint8_t *end = msg->tlv + msg->tlv_len;
+	uint16_t vlen;
+
+	while (end - p >= 3) {
+		vlen = qmi_get_le16(p + 1);
+		if (vlen > end - p - 3)
+			break;
+		if (p[0] == type) {
+			*len = vlen;
+			return p + 3;
+		}
+		p += 3 + vlen;
+	}
+	return NULL;
+}
+
+int
+qmi_tlv_u8(const struct qmi_msg *msg, uint8_t type, uint8_t *val)
+{
+	const uint8_t *p;
+	uint16_t len;
+
+	p = qmi_tlv(msg, type, &len);
+	if (!p || len < 1)
+		return -1;
+	*val = p[0];
+	return 0;
+}
+
+int
+qmi_tlv_u16(const struct qmi_msg *msg, uint8_t type, uint16_t *val)
+{
+	const uint8_t *p;
+	uint16_t len;
+
+	p = qmi_tlv(msg, type, &len);
+	if (!p || len < 2)
+		return -1;
+	*val = qmi_get_le16(p);
+	return 0;
+}
+
+int
+qmi_tlv_u32(const struct qmi_msg *msg, uint8_t type, uint32_t *val)
+{
+	const uint8_t *p;
+	uint16_t len;
+
+	p = qmi_tlv(msg, type, &len);
+	if (!p || len < 4)
+		return -1;
+	*val = qmi_get_le32(p);
+	return 0;
+}
+
+/* Résultat d'une réponse : 0 en cas de succès, -1 sinon, avec le code
+ * d'erreur dans error (QMI_ERR_INVALID_QMI_CMD si le TLV est absent) */
+int
+qmi_result(const struct qmi_msg *msg, uint16_t *error)
+{
+	const uint8_t *p;
+	uint16_t len;
+
+	p = qmi_tlv(msg, QMI_TLV_RESULT, &len);
+	if (!p || len < 4) {
+		*error = QMI_ERR_INVALID_QMI_CMD;
+		return -1;
+	}
+	*error = qmi_get_le16(p + 2);
+	return (qmi_get_le16(p)) ? -1 : 0;
+}
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+#ifndef UMTS_QMUX_H
+#define UMTS_QMUX_H
+
+/*
+ *	Codage et décodage des messages QMI sur QMUX (/dev/cdc-wdmN).
+ *	Aucune dépendance autre que la libc : partagé par le pilote qmi,
+ *	le simulateur et la cible de fuzzing.
+ *
+ *	Trame : 0x01, longueur (16 bits, hors premier octet), drapeaux,
+ *	service, client, puis le SDU : drapeaux, identifiant de transaction
+ *	(8 bits pour CTL, 16 bits sinon), identifiant du message, longueur
+ *	des TLV et TLV (type 8 bits, longueur 16 bits, valeur).
+ *	Tous les entiers sont petit-boutistes.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define QMUX_IF			0x01
+#define QMUX_HDR_LEN		6	/* 0x01, longueur, drapeaux, service, client */
+#define QMUX_FROM_SERVICE	0x80
+
+/* Taille maximale d'une trame traitée */
+#define QMI_FRAME_MAX		2048
+#define QMI_TLV_MAX		1024
+
+/* Services */
+#define QMI_CTL			0x00
+#define QMI_WDS			0x01
+#define QMI_DMS			0x02
+#define QMI_NAS			0x03
+#define QMI_SERVICE_MAX		QMI_NAS
+
+/* Client destinataire de toutes les indications d'un service */
+#define QMI_CID_BROADCAST	0xff
+
+/* Type de message (drapeaux du SDU, codage des services hors CTL) */
+#define QMI_REQUEST		0x00
+#define QMI_RESPONSE		0x02
+#define QMI_INDICATION		0x04
+
+/* CTL */
+#define QMI_CTL_GET_CLIENT_ID		0x0022
+#define QMI_CTL_RELEASE_CLIENT_ID	0x0023
+
+/* WDS */
+#define QMI_WDS_START_NETWORK		0x0020
+#define QMI_WDS_STOP_NETWORK		0x0021
+#define QMI_WDS_PKT_SRVC_STATUS		0x0022
+#define QMI_WDS_GET_CURRENT_SETTINGS	0x002d
+
+/* DMS */
+#define QMI_DMS_UIM_VERIFY_PIN		0x0028
+#define QMI_DMS_UIM_GET_PIN_STATUS	0x002b
+
+/* NAS */
+#define QMI_NAS_EVENT_REPORT		0x0002
+#define QMI_NAS_GET_SERVING_SYSTEM	0x0024
+#define QMI_NAS_GET_SIGNAL_INFO		0x004f
+
+/* TLV communs */
+#define QMI_TLV_RESULT			0x02
+
+/* Codes d'erreur utiles */
+#define QMI_ERR_NONE			0x0000
+#define QMI_ERR_CALL_FAILED		0x000e
+#define QMI_ERR_OUT_OF_CALL		0x000f
+#define QMI_ERR_INCORRECT_PIN		0x000c
+#define QMI_ERR_NO_EFFECT		0x001a
+#define QMI_ERR_INVALID_QMI_CMD		0x0047
+
+/* Message à émettre */
+struct qmi_packet {
+	uint8_t service;
+	uint16_t id;
+	uint16_t tlv_len;
+	uint8_t tlv[QMI_TLV_MAX];
+};
+
+/* Message reçu ; tlv pointe dans la trame */
+struct qmi_msg {
+	uint8_t service;
+	uint8_t cid;
+	uint8_t type;		/* QMI_REQUEST, QMI_RESPONSE, QMI_INDICATION */
+	uint16_t tid;
+	uint16_t id;
+	uint16_t tlv_len;
+	const uint8_t *tlv;
+};
+
+void
+qmi_packet_init(struct qmi_packet *pkt, uint8_t service, uint16_t id);
+
+int
+qmi_packet_tlv(struct qmi_packet *pkt, uint8_t type, const void *val,
+							uint16_t len);
+
+int
+qmi_packet_u8(struct qmi_packet *pkt, uint8_t type, uint8_t val);
+
+int
+qmi_packet_u32(struct qmi_packet *pkt, uint8_t type, uint32_t val);
+
+int
+qmi_packet_result(struct qmi_packet *pkt, uint16_t error);
+
+ssize_t
+qmi_encode(const struct qmi_packet *pkt, uint8_t cid, uint8_t type,
+			uint16_t tid, uint8_t *frame, size_t size);
+
+ssize_t
+qmi_frame_len(const uint8_t *data, size_t len);
+
+int
+qmi_decode(const uint8_t *frame, size_t len, struct qmi_msg *msg);
+
+const uint8_t *
+qmi_tlv(const struct qmi_msg *msg, uint8_t type, uint16_t *len);
+
+int
+qmi_tlv_u8(const struct qmi_msg *msg, uint8_t type, uint8_t *val);
+
+int
+qmi_tlv_u16(const struct qmi_msg *msg, uint8_t type, uint16_t *val);
+
+int
+qmi_tlv_u32(const struct qmi_msg *msg, uint8_t type, uint32_t *val);
+
+int
+qmi_result(const struct qmi_msg *msg, uint16_t *error);
+
+static inline uint16_t
+qmi_get_le16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+qmi_get_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+		| ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void
+qmi_put_le16(uint8_t *p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = val >> 8;
+}
+
+static inline void
+qmi_put_le32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = val >> 24;
+}
+
+#endif /* UMTS_QMUX_H */
@@ -0,0 +1,447 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_quality - historique de la qualité du lien
+ *
+ *	Chaque check ajoute un échantillon brut (RSSI, BER, RSRP, RSRQ,
+ *	technologie, opérateur) à un anneau de taille fixe, projeté en
+ *	mémoire depuis UMTS_RUN_DIR/umts_quality.<interface> : aucune
+ *	allocation, et l'historique survit aux exécutions de umts_config.
+ *	Les commandes stats et export en produisent respectivement un
+ *	résumé (extrema, moyenne, centiles, histogrammes) et la liste
+ *	complète au format CSV. L'historique n'est qu'une aide au
+ *	diagnostic : une erreur sur le fichier ne fait pas échouer le check.
+ */
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "umts.h"
+
+#define QUALITY_MAGIC		0x51554d55	/* "UMUQ" */
+#define QUALITY_VERSION		1
+/* 24 h à raison d'un check toutes les 30 s */
+#define QUALITY_CAPACITY	2880
+
+struct quality_ring {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t sample_size;
+	uint32_t head;		/* prochain emplacement écrit */
+	uint32_t count;
+	struct quality_sample samples[QUALITY_CAPACITY];
+};
+
+/* Grandeurs résumées : valeurs entières bornées, propres à chaque
+ * grandeur ; les centiles sont lus sur un histogramme de pas 1 couvrant
+ * [low, high]. Une valeur hors de l'intervalle (99 : BER inconnu) est
+ * ignorée. */
+#define QUALITY_SPAN	201	/* plus large intervalle */
+
+static const struct quality_metric {
+	const char *name;
+	const char *unit;
+	size_t off;
+	int scale;		/* diviseur d'affichage */
+	int bucket;		/* largeur d'une classe de l'histogramme */
+	int low, high;
+} quality_metrics[] = {
+	{ "rssi", "dBm", offsetof(struct quality_sample, rssi), 1, 6,
+								-200, 0 },
+	{ "ber", "", offsetof(struct quality_sample, ber), 1, 1, 0, 7 },
+	{ "rsrp", "dBm", offsetof(struct quality_sample, rsrp), 1, 6,
+								-200, 0 },
+	{ "rsrq", "dB", offsetof(struct quality_sample, rsrq), 10, 10,
+								-200, 0 },
+};
+#define QUALITY_NMETRICS (sizeof(quality_metrics) / sizeof(quality_metrics[0]))
+
+struct quality_stat {
+	unsigned int n;
+	long sum;
+	int min, max;
+	unsigned int counts[QUALITY_SPAN];
+};
+
+/* Répartition par technologie et par opérateur */
+#define QUALITY_MAX_NAMES 8
+
+struct quality_names {
+	unsigned int n;
+	const char *name[QUALITY_MAX_NAMES];
+	unsigned int count[QUALITY_MAX_NAMES + 1];	/* + autres */
+};
+
+static void
+quality_path(char *path, size_t len, const char *interface)
+{
+	fixed_buf key;
+
+	buf_cpy(key, interface);
+	run_key_sanitize(key);
+	snprintf(path, len, "%s/umts_quality.%s", umts_run_dir(), key);
+}
+
+static void
+quality_strcpy(char *dst, size_t size, const char *src)
+{
+	snprintf(dst, size, "%s", (src) ? src : "");
+}
+
+void
+quality_init(struct quality_sample *s, int level, const char *oper,
+							const char *tech)
+{
+	memset(s, 0, sizeof(*s));
+	s->time = (int64_t)time(NULL);
+	s->rssi = s->ber = s->rsrp = s->rsrq = QUALITY_NONE;
+	s->level = (level < 0) ? 0 : (uint8_t)level;
+	quality_strcpy(s->oper, sizeof(s->oper), oper);
+	quality_strcpy(s->tech, sizeof(s->tech), tech);
+}
+
+/* +CSQ : rssi 0-31 => -113 à -51 dBm, 99 inconnu ; ber 0-7, 99 inconnu */
+void
+quality_set_csq(struct quality_sample *s, const struct at_csq *csq)
+{
+	if (csq->rssi >= 0 && csq->rssi <= 31)
+		s->rssi = (int16_t)(-113 + 2 * csq->rssi);
+	if (csq->ber >= 0 && csq->ber <= 7)
+		s->ber = (int16_t)csq->ber;
+}
+
+/* +CESQ (3GPP TS 36.133) : rsrp 0-97 => -141 à -44 dBm,
+ * rsrq 0-34 => -20 à -3 dB, 255 inconnu */
+void
+quality_set_cesq(struct quality_sample *s, const struct at_cesq *cesq)
+{
+	if (cesq->rsrp >= 0 && cesq->rsrp <= 97)
+		s->rsrp = (int16_t)(-141 + cesq->rsrp);
+	if (cesq->rsrq >= 0 && cesq->rsrq <= 34)
+		s->rsrq = (int16_t)(-200 + 5 * cesq->rsrq);
+}
+
+/* Projection de l'anneau ; fd reste verrouillé jusqu'à sa fermeture.
+ * En écriture, un fichier absent ou d'un autre format est réinitialisé. */
+static struct quality_ring *
+quality_map(const char *path, int writable, int *fd)
+{
+	struct quality_ring *ring;
+	struct stat buf;
+
+	*fd = open(path, (writable) ? O_RDWR|O_CREAT|O_NOFOLLOW|O_CLOEXEC
+				: O_RDONLY|O_NOFOLLOW|O_CLOEXEC, S_IRUSR|S_IWUSR);
+	if (*fd < 0)
+		return NULL;
+	if (flock(*fd, (writable) ? LOCK_EX : LOCK_SH) || fstat(*fd, &buf))
+		goto err;
+
+	if (buf.st_size != sizeof(*ring)) {
+		if (!writable) {
+			errno = EINVAL;
+			goto err;
+		}
+		if (ftruncate(*fd, 0) || ftruncate(*fd, sizeof(*ring)))
+			goto err;
+	}
+	ring = mmap(NULL, sizeof(*ring), PROT_READ | (writable ? PROT_WRITE : 0),
+						MAP_SHARED, *fd, 0);
+	if (ring == MAP_FAILED)
+		goto err;
+
+	if (ring->magic != QUALITY_MAGIC || ring->version != QUALITY_VERSION
+			|| ring->capacity != QUALITY_CAPACITY
+			|| ring->sample_size != sizeof(struct quality_sample)
+			|| ring->head >= QUALITY_CAPACITY
+			|| ring->count > QUALITY_CAPACITY) {
+		if (!writable) {
+			munmap(ring, sizeof(*ring));
+			errno = EINVAL;
+			goto err;
+		}
+		DBG("resetting %s", path);
+		memset(ring, 0, offsetof(struct quality_ring, samples));
+		ring->magic = QUALITY_MAGIC;
+		ring->version = QUALITY_VERSION;
+		ring->capacity = QUALITY_CAPACITY;
+		ring->sample_size = sizeof(struct quality_sample);
+	}
+	return ring;
+
+err:
+	(void)close(*fd);
+	return NULL;
+}
+
+void
+quality_record(const char *interface, const struct quality_sample *s)
+{
+	char path[PATH_MAX];
+	struct quality_ring *ring;
+	int fd;
+
+	quality_path(path, sizeof(path), interface);
+	ring = quality_map(path, 1, &fd);
+	if (!ring) {
+		WARN_ERRNO("failed to map %s", path);
+		return;
+	}
+	ring->samples[ring->head] = *s;
+	ring->head = (ring->head + 1) % QUALITY_CAPACITY;
+	if (ring->count < QUALITY_CAPACITY)
+		ring->count++;
+	munmap(ring, sizeof(*ring));
+	(void)close(fd);
+}
+
+/* i-ème échantillon, du plus ancien au plus récent */
+static const struct quality_sample *
+quality_nth(const struct quality_ring *ring, unsigned int i)
+{
+	return &ring->samples[(ring->head + QUALITY_CAPACITY - ring->count + i)
+							% QUALITY_CAPACITY];
+}
+
+static int
+quality_value(const struct quality_sample *s, const struct quality_metric *m)
+{
+	int16_t v;
+
+	memcpy(&v, (const char *)s + m->off, sizeof(v));
+	return v;
+}
+
+static void
+quality_stat_add(struct quality_stat *st, const struct quality_metric *m,
+									int v)
+{
+	if (v < m->low || v > m->high)
+		return;
+	if (!st->n || v < st->min)
+		st->min = v;
+	if (!st->n || v > st->max)
+		st->max = v;
+	st->n++;
+	st->sum += v;
+	st->counts[v - m->low]++;
+}
+
+/* Centile p (0-100), au rang le plus proche */
+static int
+quality_percentile(const struct quality_stat *st,
+			const struct quality_metric *m, unsigned int p)
+{
+	unsigned int rank = (p * st->n + 99) / 100, seen = 0;
+	int v;
+
+	if (!rank)
+		rank = 1;
+	for (v = st->min; v < st->max; v++) {
+		seen += st->counts[v - m->low];
+		if (seen >= rank)
+			break;
+	}
+	return v;
+}
+
+static void
+quality_names_add(struct quality_names *names, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < names->n; i++) {
+		if (!strcmp(names->name[i], name))
+			break;
+	}
+	if (i == names->n && names->n < QUALITY_MAX_NAMES)
+		names->name[names->n++] = name;
+	names->count[i]++;
+}
+
+static void
+quality_print_names(FILE *fp, const char *what,
+				const struct quality_names *names)
+{
+	unsigned int i;
+
+	for (i = 0; i < names->n; i++)
+		fprintf(fp, "%s %s: %u\n", what, names->name[i],
+							names->count[i]);
+	if (names->count[QUALITY_MAX_NAMES])
+		fprintf(fp, "%s (other): %u\n", what,
+					names->count[QUALITY_MAX_NAMES]);
+}
+
+static void
+quality_print_time(FILE *fp, const char *what, int64_t t)
+{
+	time_t tt = (time_t)t;
+	struct tm tm;
+	char buf[32];
+
+	if (!gmtime_r(&tt, &tm)
+			|| !strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm))
+		quality_strcpy(buf, sizeof(buf), "?");
+	fprintf(fp, "%s: %s\n", what, buf);
+}
+
+static void
+quality_print_metric(FILE *fp, const struct quality_metric *m,
+					const struct quality_stat *st)
+{
+	const double scale = m->scale;
+	int v, i, end, lo;
+	unsigned int n;
+
+	if (!st->n) {
+		fprintf(fp, "%s: n 0\n", m->name);
+		return;
+	}
+	fprintf(fp, "%s: n %u min %g avg %.1f p10 %g p50 %g p90 %g "
+		"max %g%s%s\n", m->name, st->n, st->min / scale,
+		(double)st->sum / st->n / scale,
+		quality_percentile(st, m, 10) / scale,
+		quality_percentile(st, m, 50) / scale,
+		quality_percentile(st, m, 90) / scale,
+		st->max / scale, (m->unit[0]) ? " " : "", m->unit);
+
+	/* Histogramme par classes de m->bucket, alignées sur 0 */
+	lo = st->min - ((st->min % m->bucket) + m->bucket) % m->bucket;
+	for (v = lo; v <= st->max; v = end) {
+		end = v + m->bucket;
+		n = 0;
+		for (i = v; i < end && i <= st->max; i++) {
+			if (i >= st->min)
+				n += st->counts[i - m->low];
+		}
+		fprintf(fp, "%s [%g, %g[: %u\n", m->name, v / scale,
+							end / scale, n);
+	}
+}
+
+static void
+quality_summary(FILE *fp, const char *interface,
+					const struct quality_ring *ring)
+{
+	static struct quality_stat stats[QUALITY_NMETRICS];
+	struct quality_names techs, opers;
+	unsigned int levels[6] = { 0 }, i, m;
+	const struct quality_sample *s;
+	int v;
+
+	memset(stats, 0, sizeof(stats));
+	memset(&techs, 0, sizeof(techs));
+	memset(&opers, 0, sizeof(opers));
+	for (i = 0; i < ring->count; i++) {
+		s = quality_nth(ring, i);
+		for (m = 0; m < QUALITY_NMETRICS; m++) {
+			v = quality_value(s, &quality_metrics[m]);
+			if (v != QUALITY_NONE)
+				quality_stat_add(&stats[m],
+						&quality_metrics[m], v);
+		}
+		levels[(s->level > 5) ? 5 : s->level]++;
+		quality_names_add(&techs, s->tech);
+		quality_names_add(&opers, s->oper);
+	}
+
+	fprintf(fp, "interface: %s\n", interface);
+	fprintf(fp, "samples: %u\n", ring->count);
+	if (!ring->count)
+		return;
+	quality_print_time(fp, "first", quality_nth(ring, 0)->time);
+	quality_print_time(fp, "last", quality_nth(ring, ring->count - 1)->time);
+	for (m = 0; m < QUALITY_NMETRICS; m++)
+		quality_print_metric(fp, &quality_metrics[m], &stats[m]);
+	for (i = 0; i < 6; i++)
+		fprintf(fp, "level %u: %u\n", i, levels[i]);
+	quality_print_names(fp, "tech", &techs);
+	quality_print_names(fp, "operator", &opers);
+}
+
+static void
+quality_print_field(FILE *fp, int v, int scale)
+{
+	if (v == QUALITY_NONE)
+		fputc(',', fp);
+	else if (scale == 1)
+		fprintf(fp, ",%d", v);
+	else
+		fprintf(fp, ",%g", (double)v / scale);
+}
+
+/* Champ texte CSV, guillemets doublés (RFC 4180) */
+static void
+quality_print_string(FILE *fp, const char *str)
+{
+	fputs(",\"", fp);
+	for (; *str; str++) {
+		if (*str == '"')
+			fputc('"', fp);
+		fputc(*str, fp);
+	}
+	fputc('"', fp);
+}
+
+static void
+quality_export(FILE *fp, const struct quality_ring *ring)
+{
+	const struct quality_sample *s;
+	unsigned int i, m;
+
+	fprintf(fp, "time,level");
+	for (m = 0; m < QUALITY_NMETRICS; m++)
+		fprintf(fp, ",%s", quality_metrics[m].name);
+	fprintf(fp, ",tech,operator\n");
+	for (i = 0; i < ring->count; i++) {
+		s = quality_nth(ring, i);
+		fprintf(fp, "%lld,%u", (long long)s->time, s->level);
+		for (m = 0; m < QUALITY_NMETRICS; m++)
+			quality_print_field(fp, quality_value(s,
+				&quality_metrics[m]), quality_metrics[m].scale);
+		quality_print_string(fp, s->tech);
+		quality_print_string(fp, s->oper);
+		fputc('\n', fp);
+	}
+}
+
+/* Résumé (raw : liste CSV) de l'historique de interface, écrit dans
+ * filename ("-" : sortie standard). Sans historique, le résumé est vide. */
+int
+quality_report(const char *interface, const char *filename, int raw)
+{
+	static const struct quality_ring empty;
+	const struct quality_ring *ring = &empty;
+	struct quality_ring *map;
+	char path[PATH_MAX];
+	int fd, to_stdout = !strcmp(filename, "-");
+	FILE *fp;
+
+	quality_path(path, sizeof(path), interface);
+	map = quality_map(path, 0, &fd);
+	if (map)
+		ring = map;
+	else if (errno != ENOENT)
+		WARN_ERRNO("failed to map %s", path);
+
+	if (to_stdout) {
+		fp = stdout;
+	} else {
+		fp = open_file(filename, WriteMode);
+		if (!fp || ftruncate(fileno(fp), 0))
+			ERROR_ERRNO("can't open report file %s", filename);
+	}
+	if (raw)
+		quality_export(fp, ring);
+	else
+		quality_summary(fp, interface, ring);
+
+	if (map) {
+		munmap(map, sizeof(*map));
+		(void)close(fd);
+	}
+	if (to_stdout)
+		return (fflush(stdout)) ? EIO : 0;
+	return close_file(filename, fp);
+}
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_quality_test - vérification du résumé de l'historique
+ *
+ *	Enregistre quelques échantillons connus dans un répertoire
+ *	temporaire (UMTS_SIM_RUN_DIR), puis contrôle les lignes produites
+ *	par quality_report : extrema, classes de l'histogramme, codes
+ *	inconnus (99) écartés, et guillemets doublés de l'export CSV.
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#include "umts.h"
+
+#define TEST_IF "wwan0"
+#define TEST_OPER "Op \"A\""
+
+static const struct test_csq {
+	int rssi, ber;
+} test_csq[] = {
+	{ 20, 3 },	/* -73 dBm */
+	{ 10, 5 },	/* -93 dBm */
+	{ 15, 99 },	/* -83 dBm, BER inconnu */
+	{ 99, 99 },
+};
+#define TEST_NCSQ (sizeof(test_csq) / sizeof(test_csq[0]))
+
+static const char *const test_expect[] = {
+	"samples: 4\n",
+	"rssi: n 3 min -93 avg -83.0 p10 -93 p50 -83 p90 -73 max -73 dBm\n",
+	"ber: n 2 min 3 avg 4.0 p10 3 p50 3 p90 5 max 5\n",
+	"ber [3, 4[: 1\n",
+	"ber [4, 5[: 0\n",
+	"ber [5, 6[: 1\n",
+	"rsrp: n 0\n",
+};
+#define TEST_NEXPECT (sizeof(test_expect) / sizeof(test_expect[0]))
+
+static const char *const test_expect_raw[] = {
+	"time,level,rssi,ber,rsrp,rsrq,tech,operator\n",
+	",-73,3,,,\"UMTS\",\"Op \"\"A\"\"\"\n",
+};
+#define TEST_NEXPECT_RAW \
+	(sizeof(test_expect_raw) / sizeof(test_expect_raw[0]))
+
+/* Contrôle d'un rapport, retourne le nombre de lignes manquantes */
+static unsigned int
+test_report(const char *dir, int raw, const char *const *expect,
+							unsigned int n)
+{
+	char path[PATH_MAX], report[4096];
+	unsigned int i, failed = 0;
+	size_t len;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/report", dir);
+	if (quality_report(TEST_IF, path, raw))
+		ERROR(EIO, "quality_report failed");
+	fp = fopen(path, "r");
+	if (!fp)
+		ERROR_ERRNO("can't open %s", path);
+	len = fread(report, 1, sizeof(report) - 1, fp);
+	report[len] = '\0';
+	(void)fclose(fp);
+	(void)unlink(path);
+
+	for (i = 0; i < n; i++) {
+		if (!strstr(report, expect[i])) {
+			printf("FAIL: missing \"%.*s\"\n",
+				(int)strlen(expect[i]) - 1, expect[i]);
+			failed++;
+		}
+	}
+	if (failed)
+		printf("--- report\n%s", report);
+	return failed;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/umts_quality_test.XXXXXX", path[PATH_MAX];
+	struct quality_sample s;
+	struct at_csq csq;
+	unsigned int i, failed;
+
+	openlog("umts_quality_test", LOG_PERROR, LOG_DAEMON);
+	if (!mkdtemp(dir))
+		ERROR_ERRNO("mkdtemp");
+	setenv("UMTS_SIM_RUN_DIR", dir, 1);
+
+	for (i = 0; i < TEST_NCSQ; i++) {
+		quality_init(&s, 3, TEST_OPER, "UMTS");
+		csq.rssi = test_csq[i].rssi;
+		csq.ber = test_csq[i].ber;
+		quality_set_csq(&s, &csq);
+		quality_record(TEST_IF, &s);
+	}
+
+	failed = test_report(dir, 0, test_expect, TEST_NEXPECT);
+	failed += test_report(dir, 1, test_expect_raw, TEST_NEXPECT_RAW);
+
+	snprintf(path, sizeof(path), "%s/umts_quality.%s", dir, TEST_IF);
+	(void)unlink(path);
+	(void)rmdir(dir);
+
+	printf("%s: %u/%u checks passed\n", (failed) ? "FAIL" : "ok",
+			(unsigned int)(TEST_NEXPECT + TEST_NEXPECT_RAW) - failed,
+			(unsigned int)(TEST_NEXPECT + TEST_NEXPECT_RAW));
+	closelog();
+	return (failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
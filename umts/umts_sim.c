@@ -0,0 +1,1126 @@
+// SPDX-License-Identifier: LGPL-2.1-or-later
+// Copyright © 2008-2018 ANSSI. All Rights Reserved.
+/*
+ *	umts_sim - simulateur de modem 3G sur pseudo-terminal
+ *
+ *	Crée un pseudo-terminal, affiche le nom de son esclave sur la sortie
+ *	standard, puis répond aux commandes AT des modules hso, acm et huawei
+ *	de umts_config, avec des délais configurables par octet et par
+ *	réponse, écho optionnel et injection d'URC. En mode qmi, répond
+ *	aux messages QMUX du module qmi comme un /dev/cdc-wdmN, en mode
+ *	mbim aux messages MBIM du module mbim.
+ *
+ *	Outil de développement uniquement, non installé.
+ */
+
+#include "umts.h"
+#include "umts_qmux.h"
+#include "umts_mbim_msg.h"
+
+#define SIM_MAX_EVENTS 16
+#define SIM_NEVER ((msec_t)-1)
+
+typedef enum {
+	SIM_HSO = 0,
+	SIM_ACM,
+	SIM_HUAWEI,
+	SIM_QMI,
+	SIM_MBIM,
+} sim_type_t;
+
+/* Sortie différée (URC, ou message QMUX ou MBIM de len octets) */
+struct sim_event {
+	msec_t when;
+	fixed_buf line;
+	size_t len;
+	int call_state;		/* état de l'appel à appliquer, -1 sinon */
+};
+
+static struct {
+	sim_type_t type;
+	int master;
+	int echo;
+	unsigned int byte_delay;	/* usec par octet émis */
+	unsigned int reply_delay;	/* ms avant chaque réponse */
+	unsigned int reg_delay;		/* ms avant enregistrement */
+	unsigned int call_delay;	/* ms avant établissement de l'appel */
+	unsigned int urc_period;	/* ms entre deux URC parasites, 0 sinon */
+	int qcpdpp;			/* AT$QCPDPP supporté */
+	int concat;			/* concaténation de commandes supportée */
+	int pin_ready;
+	int creg_n;
+	int radio_on;
+	msec_t reg_at;
+	int reg_reported;		/* changement d'état déjà notifié */
+	int call_state;			/* 0 déconnecté, 1 connecté, 2 en cours */
+	msec_t next_urc;
+	struct sim_event events[SIM_MAX_EVENTS];
+	unsigned int nevents;
+	uint8_t qmi_cid;		/* dernier client QMI alloué */
+	uint8_t qmi_wds_cid;		/* client WDS porteur de l'appel */
+	uint32_t qmi_pdh;
+	int mbim_opened;		/* MBIM_OPEN_MSG reçu */
+} sim;
+
+static const char *const sim_types[] = { "hso", "acm", "huawei", "qmi",
+								"mbim" };
+
+static void
+sim_usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t hso|acm|huawei|qmi|mbim] "
+			"[-b byte_delay_us] "
+			"[-r reply_delay_ms] [-g reg_delay_ms] "
+			"[-c call_delay_ms] [-u urc_period_ms] [-E] [-P] [-Q] "
+			"[-S]\n"
+			"  -E: no echo, -P: SIM PIN already entered, "
+			"-Q: accept AT$QCPDPP,\n"
+			"  -S: reject concatenated commands\n", prog);
+	exit(EINVAL);
+}
+
+/*********************************************************/
+/** Émission **/
+/*********************************************************/
+
+static void
+sim_write(const char *buf, size_t len)
+{
+	size_t off = 0;
+	ssize_t wret;
+
+	while (off < len) {
+		wret = write(sim.master, buf + off,
+				(sim.byte_delay) ? 1 : len - off);
+		if (wret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			ERROR_ERRNO("write on pty master");
+		}
+		off += wret;
+		if (sim.byte_delay)
+			usleep(sim.byte_delay);
+	}
+}
+
+static void
+sim_line(const char *line)
+{
+	sim_write("\r\n", 2);
+	sim_write(line, strlen(line));
+	sim_write("\r\n", 2);
+}
+
+static void
+sim_schedule(unsigned int delay, const char *line, int call_state)
+{
+	struct sim_event *ev;
+
+	if (sim.nevents == SIM_MAX_EVENTS) {
+		WARN("event queue full, dropping %s", line);
+		return;
+	}
+	ev = &sim.events[sim.nevents++];
+	ev->when = deadline_in(delay);
+	buf_cpy(ev->line, line);
+	ev->len = 0;
+	ev->call_state = call_state;
+}
+
+static void
+sim_schedule_raw(unsigned int delay, const uint8_t *data, size_t len,
+							int call_state)
+{
+	struct sim_event *ev;
+
+	if (sim.nevents == SIM_MAX_EVENTS || len > sizeof(ev->line)) {
+		WARN("event queue full, dropping %zu bytes", len);
+		return;
+	}
+	ev = &sim.events[sim.nevents++];
+	ev->when = deadline_in(delay);
+	memcpy(ev->line, data, len);
+	ev->len = len;
+	ev->call_state = call_state;
+}
+
+/*********************************************************/
+/** État simulé **/
+/*********************************************************/
+
+static int
+sim_registered(void)
+{
+	return (sim.radio_on && clock_ms() >= sim.reg_at);
+}
+
+static void
+sim_radio(int on)
+{
+	sim.radio_on = on;
+	if (!on) {
+		sim.reg_at = SIM_NEVER;
+		sim.reg_reported = 0;
+		sim.call_state = 0;
+	} else if (sim.reg_at == SIM_NEVER) {
+		sim.reg_at = deadline_in(sim.reg_delay);
+	}
+}
+
+/* Lance l'établissement (on = 1) ou la coupure de l'appel, avec les
+ * notifications propres à chaque modèle */
+static void
+sim_call(int on)
+{
+	if (on) {
+		sim.call_state = 2;
+		if (sim.type == SIM_HSO) {
+			sim_schedule(sim.call_delay / 2, "_OWANCALL: 1, 2", -1);
+			sim_schedule(sim.call_delay, "_OWANCALL: 1, 1", 1);
+		} else {
+			sim_schedule(sim.call_delay, "", 1);
+		}
+	} else {
+		sim.call_state = 0;
+		if (sim.type == SIM_HSO)
+			sim_schedule(sim.call_delay / 4, "_OWANCALL: 1, 0", -1);
+	}
+}
+
+/*********************************************************/
+/** Interprétation des commandes **/
+/*********************************************************/
+
+/* Réponse à une commande élémentaire (sans le préfixe AT) :
+ * écrit les lignes intermédiaires, retourne le code final */
+static const char *
+sim_command(const char *cmd)
+{
+	fixed_buf line;
+	int n;
+
+	/* Commandes communes */
+	if (!*cmd || !strcmp(cmd, "E") || !strcmp(cmd, "E0")
+				|| !strcmp(cmd, "E1")) {
+		if (*cmd)
+			sim.echo = (cmd[1] == '1');
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CPIN?")) {
+		sim_line((sim.pin_ready) ? "+CPIN: READY" : "+CPIN: SIM PIN");
+		return "OK";
+	}
+	if (strmatch(cmd, "+CPIN=")) {
+		sim.pin_ready = 1;
+		return "OK";
+	}
+	if (sscanf(cmd, "+CREG=%d", &n) == 1) {
+		sim.creg_n = n;
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CREG?")) {
+		buf_format(line, "+CREG: %d,", sim.creg_n);
+		strcat(line, (sim_registered()) ? "1" : "2");
+		sim_line(line);
+		return "OK";
+	}
+	if (sscanf(cmd, "+CFUN=%d", &n) == 1) {
+		sim_radio(n == 1);
+		return "OK";
+	}
+	if (!strcmp(cmd, "+COPS=0")) {
+		sim_radio(1);
+		return "OK";
+	}
+	if (!strcmp(cmd, "+COPS?")) {
+		if (!sim_registered())
+			sim_line("+COPS: 0");
+		else
+			sim_line("+COPS: 0,0,\"SIM Operator\",2");
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CSQ")) {
+		sim_line("+CSQ: 20,0");
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CESQ")) {
+		sim_line("+CESQ: 99,99,255,255,20,45");
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CIND?")) {
+		sim_line("+CIND: 5,4,0,0,1,0,0,0,0,0,0,0");
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CGMM")) {
+		sim_line(sim_types[sim.type]);
+		return "OK";
+	}
+	if (!strcmp(cmd, "+CGSN")) {
+		sim_line("350000000000001");
+		return "OK";
+	}
+	if (strmatch(cmd, "+CGDCONT="))
+		return "OK";
+
+	switch (sim.type) {
+	case SIM_HSO:
+		if (!strcmp(cmd, "_OBLS")) {
+			sim_line("_OBLS: 1,1,1");
+			return "OK";
+		}
+		if (strmatch(cmd, "_OPSYS="))
+			return "OK";
+		if (strmatch(cmd, "$QCPDPP="))
+			return (sim.qcpdpp) ? "OK" : "ERROR";
+		if (strmatch(cmd, "_OPDPP="))
+			return "OK";
+		if (!strcmp(cmd, "_OWANCALL=1,1,1")) {
+			sim_call(1);
+			return "OK";
+		}
+		if (!strcmp(cmd, "_OWANCALL=1,0")) {
+			sim_call(0);
+			return "OK";
+		}
+		if (!strcmp(cmd, "_OWANDATA=1")) {
+			if (sim.call_state != 1)
+				return "ERROR";
+			sim_line("_OWANDATA: 1, 10.64.0.2, 10.64.0.1, "
+				"10.64.0.53, 10.64.0.54, 0.0.0.0, 0.0.0.0, "
+				"144000");
+			return "OK";
+		}
+		if (!strcmp(cmd, "_OWCTI?")) {
+			sim_line("_OWCTI: 2");
+			return "OK";
+		}
+		if (!strcmp(cmd, "_OCTI?")) {
+			sim_line("_OCTI: 1,3");
+			return "OK";
+		}
+		break;
+	case SIM_ACM:
+		if (strmatch(cmd, "*EIAAUW="))
+			return "OK";
+		if (!strcmp(cmd, "*EIAAUR=1,1")) {
+			sim_line("*EIAAUR: 1,1,\"user\",\"\",1,0");
+			return "OK";
+		}
+		if (!strcmp(cmd, "*ENAP=1,1")) {
+			sim_call(1);
+			return "OK";
+		}
+		if (!strcmp(cmd, "*ENAP=0")) {
+			sim_call(0);
+			return "OK";
+		}
+		if (!strcmp(cmd, "*ENAP?")) {
+			buf_format(line, "*ENAP:%d,\"\"", sim.call_state);
+			sim_line(line);
+			return "OK";
+		}
+		if (!strcmp(cmd, "*ERINFO?")) {
+			sim_line("*ERINFO: 0,0,2");
+			return "OK";
+		}
+		break;
+	case SIM_HUAWEI:
+		if (strmatch(cmd, "^NDISDUP=1,1")) {
+			sim_call(1);
+			return "OK";
+		}
+		if (!strcmp(cmd, "^NDISDUP=1,0")) {
+			sim_call(0);
+			return "OK";
+		}
+		if (!strcmp(cmd, "^DHCP?")) {
+			if (sim.call_state != 1)
+				return "+CME ERROR: 3";
+			sim_line("^DHCP:0200400a,00ffffff,0100400a,0100400a,"
+				"3500400a,3600400a,144000000,144000000");
+			return "OK";
+		}
+		if (!strcmp(cmd, "^SYSINFOEX")) {
+			sim_line("^SYSINFOEX:2,3,0,1,,3,\"WCDMA\",41,"
+							"\"WCDMA\"");
+			return "OK";
+		}
+		break;
+	case SIM_QMI:
+	case SIM_MBIM:
+		break;
+	}
+
+	return "ERROR";
+}
+
+static void
+sim_handle(const char *input)
+{
+	const char *res;
+	fixed_buf cmd;
+	char *ptr, *end, *next;
+	int quoted;
+
+	if (sim.echo) {
+		sim_write(input, strlen(input));
+		sim_write("\r", 1);
+	}
+	if (strncasecmp(input, "AT", 2)) {
+		sim_line("ERROR");
+		return;
+	}
+
+	if (sim.reply_delay)
+		usleep(sim.reply_delay * 1000U);
+
+	/* Concaténation V.25ter : AT+COPS?;+CSQ, exécution jusqu'à la
+	 * première erreur, un seul code final */
+	buf_cpy(cmd, input + 2);
+	ptr = cmd;
+	do {
+		for (end = ptr, quoted = 0; *end; end++) {
+			if (*end == '"')
+				quoted = !quoted;
+			else if (*end == ';' && !quoted)
+				break;
+		}
+		if (*end && !sim.concat) {
+			res = "ERROR";
+			break;
+		}
+		next = (*end) ? end + 1 : NULL;
+		*end = '\0';
+		res = sim_command(ptr);
+		ptr = next;
+	} while (ptr && !strcmp(res, "OK"));
+	sim_line(res);
+}
+
+/*********************************************************/
+/** Mode QMI **/
+/*********************************************************/
+
+/* Émission d'un message QMI, après delay ms s'il est non nul */
+static void
+sim_qmi_send(const struct qmi_packet *pkt, uint8_t cid, uint8_t type,
+		uint16_t tid, unsigned int delay, int call_state)
+{
+	uint8_t frame[QMI_FRAME_MAX];
+	ssize_t len;
+
+	len = qmi_encode(pkt, cid, type, tid, frame, sizeof(frame));
+	if (len < 0)
+		ERROR(EMSGSIZE, "QMI message too long");
+	if (delay)
+		sim_schedule_raw(delay, frame, len, call_state);
+	else
+		sim_write((const char *)frame, len);
+}
+
+/* TLV de NAS Serving System : état, PLMN */
+static void
+sim_qmi_serving_system(struct qmi_packet *pkt)
+{
+	static const char oper[] = "SIM Operator";
+	uint8_t serving[6], plmn[5 + sizeof(oper) - 1];
+	int reg = sim_registered();
+
+	serving[0] = (reg) ? 1 : 2;	/* enregistré / en recherche */
+	serving[1] = serving[2] = (reg) ? 1 : 2;	/* CS, PS attachés */
+	serving[3] = 1;			/* 3GPP */
+	serving[4] = 1;
+	serving[5] = 5;			/* UMTS */
+	qmi_packet_tlv(pkt, 0x01, serving, sizeof(serving));
+	if (!reg)
+		return;
+
+	qmi_packet_u8(pkt, 0x10, 1);	/* pas d'itinérance */
+	qmi_put_le16(plmn, 208);
+	qmi_put_le16(plmn + 2, 1);
+	plmn[4] = sizeof(oper) - 1;
+	memcpy(plmn + 5, oper, sizeof(oper) - 1);
+	qmi_packet_tlv(pkt, 0x12, plmn, sizeof(plmn));
+}
+
+/* Indication Serving System à tous les clients NAS */
+static void
+sim_qmi_registered(void)
+{
+	struct qmi_packet pkt;
+
+	qmi_packet_init(&pkt, QMI_NAS, QMI_NAS_GET_SERVING_SYSTEM);
+	sim_qmi_serving_system(&pkt);
+	sim_qmi_send(&pkt, QMI_CID_BROADCAST, QMI_INDICATION, 0, 0, -1);
+}
+
+/* Indication NAS Event Report parasite : force du signal */
+static void
+sim_qmi_signal(void)
+{
+	struct qmi_packet pkt;
+	uint8_t strength[2] = { (uint8_t)-71, 5 };
+
+	qmi_packet_init(&pkt, QMI_NAS, QMI_NAS_EVENT_REPORT);
+	qmi_packet_tlv(&pkt, 0x10, strength, sizeof(strength));
+	sim_qmi_send(&pkt, QMI_CID_BROADCAST, QMI_INDICATION, 0, 0, -1);
+}
+
+/* Indication WDS Packet Service Status au client porteur de l'appel */
+static void
+sim_qmi_pkt_status(unsigned int delay, int connected)
+{
+	struct qmi_packet pkt;
+	uint8_t status[2] = { (connected) ? 2 : 1, 0 };
+
+	qmi_packet_init(&pkt, QMI_WDS, QMI_WDS_PKT_SRVC_STATUS);
+	qmi_packet_tlv(&pkt, 0x01, status, sizeof(status));
+	sim_qmi_send(&pkt, sim.qmi_wds_cid, QMI_INDICATION, 0, delay, -1);
+}
+
+/* Réponse à une requête : TLV propres au message dans body, code
+ * d'erreur dans error. Retourne le délai de la réponse (ms), l'appel
+ * étant établi à son émission s'il est non nul. */
+static unsigned int
+sim_qmi_request(const struct qmi_msg *req, struct qmi_packet *body,
+							uint16_t *error)
+{
+	const uint8_t *val;
+	uint8_t tmp[6];
+	uint16_t len;
+
+	switch (req->service) {
+	case QMI_CTL:
+		val = qmi_tlv(req, 0x01, &len);
+		if (!val || !len)
+			break;
+		if (req->id == QMI_CTL_GET_CLIENT_ID) {
+			tmp[0] = val[0];
+			tmp[1] = ++sim.qmi_cid;
+			qmi_packet_tlv(body, 0x01, tmp, 2);
+			return 0;
+		}
+		if (req->id == QMI_CTL_RELEASE_CLIENT_ID && len >= 2) {
+			qmi_packet_tlv(body, 0x01, val, 2);
+			return 0;
+		}
+		break;
+	case QMI_DMS:
+		if (req->id == QMI_DMS_UIM_GET_PIN_STATUS) {
+			tmp[0] = (sim.pin_ready) ? 2 : 1;
+			tmp[1] = 3;
+			tmp[2] = 10;
+			qmi_packet_tlv(body, 0x11, tmp, 3);
+			return 0;
+		}
+		if (req->id == QMI_DMS_UIM_VERIFY_PIN) {
+			sim.pin_ready = 1;
+			return 0;
+		}
+		break;
+	case QMI_NAS:
+		if (req->id == QMI_NAS_GET_SERVING_SYSTEM) {
+			sim_qmi_serving_system(body);
+			return 0;
+		}
+		if (req->id == QMI_NAS_GET_SIGNAL_INFO) {
+			tmp[0] = (uint8_t)-71;	/* RSSI, dBm */
+			qmi_put_le16(tmp + 1, (uint16_t)-12);	/* Ec/Io */
+			qmi_packet_tlv(body, 0x13, tmp, 3);
+			return 0;
+		}
+		if (req->id == QMI_NAS_EVENT_REPORT)
+			return 0;
+		break;
+	case QMI_WDS:
+		switch (req->id) {
+		case QMI_WDS_START_NETWORK:
+			if (!sim_registered()) {
+				*error = QMI_ERR_CALL_FAILED;
+				qmi_put_le16(tmp, 1);	/* non spécifié */
+				qmi_packet_tlv(body, 0x10, tmp, 2);
+				return 0;
+			}
+			if (sim.call_state) {
+				*error = QMI_ERR_NO_EFFECT;
+				return 0;
+			}
+			sim.call_state = 2;
+			sim.qmi_wds_cid = req->cid;
+			qmi_packet_u32(body, 0x01, ++sim.qmi_pdh);
+			sim_qmi_pkt_status(sim.call_delay, 1);
+			return (sim.call_delay) ? sim.call_delay : 1;
+		case QMI_WDS_STOP_NETWORK:
+			if (sim.call_state != 1) {
+				*error = QMI_ERR_NO_EFFECT;
+				return 0;
+			}
+			sim.call_state = 0;
+			sim_qmi_pkt_status(sim.call_delay / 4 + 1, 0);
+			return 0;
+		case QMI_WDS_PKT_SRVC_STATUS:
+			tmp[0] = (sim.call_state == 1) ? 2 : 1;
+			tmp[1] = 0;
+			qmi_packet_tlv(body, 0x01, tmp, 2);
+			return 0;
+		case QMI_WDS_GET_CURRENT_SETTINGS:
+			if (sim.call_state != 1) {
+				*error = QMI_ERR_OUT_OF_CALL;
+				return 0;
+			}
+			/* mêmes paramètres que _OWANDATA */
+			qmi_packet_u32(body, 0x15, 0x0a400035);
+			qmi_packet_u32(body, 0x16, 0x0a400036);
+			qmi_packet_u32(body, 0x1e, 0x0a400002);
+			qmi_packet_u32(body, 0x20, 0x0a400001);
+			qmi_packet_u32(body, 0x21, 0xffffff00);
+			return 0;
+		}
+		break;
+	}
+
+	*error = QMI_ERR_INVALID_QMI_CMD;
+	return 0;
+}
+
+static void
+sim_qmi_handle(const uint8_t *frame, size_t len)
+{
+	struct qmi_msg req;
+	struct qmi_packet body, resp;
+	uint16_t error = QMI_ERR_NONE;
+	unsigned int delay;
+
+	if (qmi_decode(frame, len, &req) || req.type != QMI_REQUEST) {
+		WARN("invalid QMI request dropped");
+		return;
+	}
+	if (sim.reply_delay)
+		usleep(sim.reply_delay * 1000U);
+
+	qmi_packet_init(&body, req.service, req.id);
+	delay = sim_qmi_request(&req, &body, &error);
+
+	qmi_packet_init(&resp, req.service, req.id);
+	qmi_packet_result(&resp, error);
+	memcpy(resp.tlv + resp.tlv_len, body.tlv, body.tlv_len);
+	resp.tlv_len += body.tlv_len;
+	sim_qmi_send(&resp, req.cid, QMI_RESPONSE, req.tid, delay,
+						(delay) ? 1 : -1);
+}
+
+/* Assemblage des trames reçues */
+static void
+sim_qmi_input(uint8_t c)
+{
+	static uint8_t frame[QMI_FRAME_MAX];
+	static size_t len;
+	ssize_t flen;
+
+	frame[len++] = c;
+	flen = qmi_frame_len(frame, len);
+	if (flen < 0) {
+		WARN("invalid QMUX frame dropped");
+		len = 0;
+	} else if (flen > 0) {
+		sim_qmi_handle(frame, len);
+		len = 0;
+	}
+}
+
+/*********************************************************/
+/** Mode MBIM **/
+/*********************************************************/
+
+/* Émission d'un message MBIM, après delay ms s'il est non nul */
+static void
+sim_mbim_send(const struct mbim_msg *msg, unsigned int delay,
+							int call_state)
+{
+	uint8_t buf[MBIM_MSG_MAX];
+	ssize_t len;
+
+	len = mbim_encode(msg, buf, sizeof(buf));
+	if (len < 0)
+		ERROR(EMSGSIZE, "MBIM message too long");
+	if (delay)
+		sim_schedule_raw(delay, buf, len, call_state);
+	else
+		sim_write((const char *)buf, len);
+}
+
+/* Indication Basic Connect, si la fonction est ouverte */
+static void
+sim_mbim_indicate(uint32_t cid, const struct mbim_info *info,
+				unsigned int delay, int call_state)
+{
+	struct mbim_msg msg = {
+		.type = MBIM_INDICATE_STATUS_MSG,
+		.uuid = mbim_uuid_basic_connect,
+		.cid = cid,
+		.info = info->buf,
+		.info_len = (uint32_t)info->len,
+	};
+
+	if (sim.mbim_opened)
+		sim_mbim_send(&msg, delay, call_state);
+}
+
+/* Register State : état, classes de données, opérateur */
+static void
+sim_mbim_register_state(struct mbim_info *info)
+{
+	int reg = sim_registered();
+
+	mbim_info_init(info, 48);
+	mbim_info_u32(info, 4, (reg) ? 3 : 2);	/* home / en recherche */
+	mbim_info_u32(info, 8, 1);		/* sélection automatique */
+	mbim_info_u32(info, 12, 0x1f);		/* GPRS à HSUPA */
+	if (!reg)
+		return;
+	mbim_info_u32(info, 16, 1);		/* GSM */
+	mbim_info_string(info, 20, "20801");
+	mbim_info_string(info, 28, "SIM Operator");
+}
+
+static void
+sim_mbim_registered(void)
+{
+	struct mbim_info info;
+
+	sim_mbim_register_state(&info);
+	sim_mbim_indicate(MBIM_CID_REGISTER_STATE, &info, 0, -1);
+}
+
+/* Signal State : Rssi et ErrorRate au codage de AT+CSQ */
+static void
+sim_mbim_signal_state(struct mbim_info *info)
+{
+	mbim_info_init(info, 20);
+	mbim_info_u32(info, 0, 20);
+	mbim_info_u32(info, 4, 0);
+}
+
+/* Indication Signal State parasite */
+static void
+sim_mbim_signal(void)
+{
+	struct mbim_info info;
+
+	sim_mbim_signal_state(&info);
+	sim_mbim_indicate(MBIM_CID_SIGNAL_STATE, &info, 0, -1);
+}
+
+/* Connect : état d'activation du contexte internet */
+static void
+sim_mbim_connect_state(struct mbim_info *info, uint32_t state)
+{
+	mbim_info_init(info, 36);
+	mbim_info_u32(info, 4, state);
+	mbim_info_u32(info, 12, 1);		/* IPv4 */
+	mbim_info_uuid(info, 16, mbim_uuid_context_internet);
+}
+
+/* IP Configuration : mêmes paramètres que _OWANDATA */
+static void
+sim_mbim_ip_configuration(struct mbim_info *info)
+{
+	static const uint8_t addr[8] = { 24, 0, 0, 0, 10, 64, 0, 2 };
+	static const uint8_t gw[4] = { 10, 64, 0, 1 };
+	static const uint8_t dns[8] = { 10, 64, 0, 53, 10, 64, 0, 54 };
+	uint32_t offset;
+
+	mbim_info_init(info, 60);
+	mbim_info_u32(info, 4, 7);		/* adresse, passerelle, DNS */
+	mbim_info_u32(info, 12, 1);
+	mbim_info_append(info, addr, sizeof(addr), &offset);
+	mbim_info_u32(info, 16, offset);
+	mbim_info_append(info, gw, sizeof(gw), &offset);
+	mbim_info_u32(info, 28, offset);
+	mbim_info_u32(info, 36, 2);
+	mbim_info_append(info, dns, sizeof(dns), &offset);
+	mbim_info_u32(info, 40, offset);
+}
+
+/* Connect set : l'activation est annoncée par une indication après
+ * call_delay */
+static uint32_t
+sim_mbim_connect(const struct mbim_msg *req, struct mbim_info *info)
+{
+	struct mbim_info ind;
+	uint32_t cmd;
+
+	if (mbim_get_u32(req, 4, &cmd))
+		return MBIM_STATUS_FAILURE;
+	if (cmd) {
+		if (!sim_registered())
+			return MBIM_STATUS_FAILURE;
+		if (sim.call_state != 1) {
+			sim.call_state = 2;
+			sim_mbim_connect_state(&ind, 1);
+			sim_mbim_indicate(MBIM_CID_CONNECT, &ind,
+						sim.call_delay, 1);
+		}
+		sim_mbim_connect_state(info, (sim.call_state == 1) ? 1 : 2);
+		return MBIM_STATUS_SUCCESS;
+	}
+	if (!sim.call_state)
+		return MBIM_STATUS_CONTEXT_NOT_ACTIVATED;
+	sim.call_state = 0;
+	sim_mbim_connect_state(info, 3);	/* désactivé */
+	return MBIM_STATUS_SUCCESS;
+}
+
+/* Réponse à une commande : tampon d'information dans info, statut
+ * retourné */
+static uint32_t
+sim_mbim_command(const struct mbim_msg *req, struct mbim_info *info)
+{
+	uint32_t val;
+
+	mbim_info_init(info, 0);
+	if (memcmp(req->uuid, mbim_uuid_basic_connect, MBIM_UUID_LEN))
+		return MBIM_STATUS_NO_DEVICE_SUPPORT;
+
+	switch (req->cid) {
+	case MBIM_CID_SUBSCRIBER_READY_STATUS:
+		mbim_info_init(info, 28);
+		/* initialisé / verrouillé */
+		mbim_info_u32(info, 0, (sim.pin_ready) ? 1 : 6);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_PIN:
+		/* tout code est accepté */
+		if (req->cmd_type == MBIM_SET)
+			sim.pin_ready = 1;
+		mbim_info_init(info, 12);
+		mbim_info_u32(info, 0, 2);	/* PIN1 */
+		mbim_info_u32(info, 4, (sim.pin_ready) ? 0 : 1);
+		mbim_info_u32(info, 8, 3);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_RADIO_STATE:
+		if (req->cmd_type == MBIM_SET && !mbim_get_u32(req, 0, &val))
+			sim_radio(val != 0);
+		mbim_info_init(info, 8);
+		mbim_info_u32(info, 0, (uint32_t)sim.radio_on);
+		mbim_info_u32(info, 4, 1);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_REGISTER_STATE:
+		sim_mbim_register_state(info);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_PACKET_SERVICE:
+		mbim_info_init(info, 28);
+		/* attaché / détaché */
+		mbim_info_u32(info, 4, (sim_registered()) ? 2 : 4);
+		/* HighestAvailableDataClass : UMTS */
+		mbim_info_u32(info, 8, (sim_registered()) ? 0x04 : 0);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_SIGNAL_STATE:
+		sim_mbim_signal_state(info);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_CONNECT:
+		if (req->cmd_type == MBIM_SET)
+			return sim_mbim_connect(req, info);
+		sim_mbim_connect_state(info, (sim.call_state == 1) ? 1
+					: (sim.call_state == 2) ? 2 : 3);
+		return MBIM_STATUS_SUCCESS;
+	case MBIM_CID_IP_CONFIGURATION:
+		if (sim.call_state != 1)
+			return MBIM_STATUS_CONTEXT_NOT_ACTIVATED;
+		sim_mbim_ip_configuration(info);
+		return MBIM_STATUS_SUCCESS;
+	}
+	return MBIM_STATUS_NO_DEVICE_SUPPORT;
+}
+
+static void
+sim_mbim_handle(const uint8_t *data, size_t len)
+{
+	struct mbim_msg req, resp;
+	struct mbim_info info;
+
+	if (mbim_decode(data, len, &req)) {
+		WARN("invalid MBIM message dropped");
+		return;
+	}
+	if (sim.reply_delay)
+		usleep(sim.reply_delay * 1000U);
+
+	memset(&resp, 0, sizeof(resp));
+	resp.tid = req.tid;
+	switch (req.type) {
+	case MBIM_OPEN_MSG:
+		sim.mbim_opened = 1;
+		resp.type = MBIM_OPEN_DONE;
+		break;
+	case MBIM_CLOSE_MSG:
+		/* la fermeture désactive le contexte */
+		sim.mbim_opened = 0;
+		sim.call_state = 0;
+		resp.type = MBIM_CLOSE_DONE;
+		break;
+	case MBIM_COMMAND_MSG:
+		if (!sim.mbim_opened) {
+			resp.type = MBIM_FUNCTION_ERROR_MSG;
+			resp.status = MBIM_ERROR_NOT_OPENED;
+			break;
+		}
+		resp.type = MBIM_COMMAND_DONE;
+		resp.uuid = req.uuid;
+		resp.cid = req.cid;
+		resp.status = sim_mbim_command(&req, &info);
+		resp.info = info.buf;
+		resp.info_len = (uint32_t)info.len;
+		break;
+	default:
+		WARN("unexpected MBIM message 0x%08x dropped", req.type);
+		return;
+	}
+	sim_mbim_send(&resp, 0, -1);
+}
+
+/* Assemblage des messages reçus */
+static void
+sim_mbim_input(uint8_t c)
+{
+	static uint8_t msg[MBIM_MSG_MAX];
+	static size_t len;
+	ssize_t mlen;
+
+	msg[len++] = c;
+	mlen = mbim_msg_len(msg, len);
+	if (mlen < 0) {
+		WARN("invalid MBIM message dropped");
+		len = 0;
+	} else if (mlen > 0) {
+		sim_mbim_handle(msg, len);
+		len = 0;
+	}
+}
+
+/*********************************************************/
+/** Boucle principale **/
+/*********************************************************/
+
+static void
+sim_run_events(void)
+{
+	unsigned int i = 0;
+	msec_t now = clock_ms();
+
+	/* +CREG: <stat> n'est émis que sur changement d'état */
+	if (!sim.reg_reported && sim_registered()) {
+		sim.reg_reported = 1;
+		if (sim.type == SIM_QMI)
+			sim_qmi_registered();
+		else if (sim.type == SIM_MBIM)
+			sim_mbim_registered();
+		else if (sim.creg_n)
+			sim_line("+CREG: 1");
+	}
+
+	while (i < sim.nevents) {
+		struct sim_event *ev = &sim.events[i];
+		if (ev->when > now) {
+			i++;
+			continue;
+		}
+		if (ev->call_state >= 0)
+			sim.call_state = ev->call_state;
+		if (ev->len)
+			sim_write(ev->line, ev->len);
+		else if (ev->line[0])
+			sim_line(ev->line);
+		sim.nevents--;
+		memmove(ev, ev + 1, (sim.nevents - i) * sizeof(*ev));
+	}
+
+	if (sim.urc_period && now >= sim.next_urc) {
+		if (sim.type == SIM_QMI)
+			sim_qmi_signal();
+		else if (sim.type == SIM_MBIM)
+			sim_mbim_signal();
+		else
+			sim_line("^RSSI: 20");
+		sim.next_urc = now + sim.urc_period;
+	}
+}
+
+static int
+sim_next_timeout(void)
+{
+	msec_t next = SIM_NEVER;
+	unsigned int i;
+
+	for (i = 0; i < sim.nevents; i++) {
+		if (sim.events[i].when < next)
+			next = sim.events[i].when;
+	}
+	if (sim.urc_period && sim.next_urc < next)
+		next = sim.next_urc;
+	if (!sim.reg_reported && sim.reg_at < next)
+		next = sim.reg_at;
+	if (next == SIM_NEVER)
+		return -1;
+	return ms_left(next);
+}
+
+static void
+sim_loop(void)
+{
+	char in[MAX_LEN];
+	size_t inlen = 0;
+	struct pollfd pfd;
+	char c;
+	ssize_t rret;
+	int num;
+
+	for (;;) {
+		pfd.fd = sim.master;
+		pfd.events = POLLIN;
+		num = poll(&pfd, 1, sim_next_timeout());
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			ERROR_ERRNO("poll");
+		}
+		sim_run_events();
+		if (!num)
+			continue;
+
+		rret = read(sim.master, &c, 1);
+		if (rret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			ERROR_ERRNO("read on pty master");
+		}
+		if (!rret)
+			return;
+
+		if (sim.type == SIM_QMI) {
+			sim_qmi_input((uint8_t)c);
+			continue;
+		}
+		if (sim.type == SIM_MBIM) {
+			sim_mbim_input((uint8_t)c);
+			continue;
+		}
+		if (c == '\n')
+			continue;
+		if (c != '\r') {
+			if (inlen < sizeof(in) - 1)
+				in[inlen++] = c;
+			continue;
+		}
+		in[inlen] = '\0';
+		inlen = 0;
+		sim_handle(in);
+	}
+}
+
+static unsigned int
+sim_uint(const char *arg, const char *prog)
+{
+	char *eptr;
+	unsigned long val;
+
+	errno = 0;
+	val = strtoul(arg, &eptr, 10);
+	if (errno || *eptr || val > UINT_MAX)
+		sim_usage(prog);
+	return (unsigned int)val;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct termios tios;
+	const char *slave;
+	int opt, slavefd;
+	unsigned int i;
+
+	sim.type = SIM_HSO;
+	sim.echo = 1;
+	sim.reg_delay = 200;
+	sim.call_delay = 300;
+	sim.concat = 1;
+
+	while ((opt = getopt(argc, argv, "t:b:r:g:c:u:EPQS")) != -1) {
+		switch (opt) {
+		case 't':
+			for (i = 0; i < sizeof(sim_types)/sizeof(char *); i++) {
+				if (!strcmp(optarg, sim_types[i]))
+					break;
+			}
+			if (i == sizeof(sim_types)/sizeof(char *))
+				sim_usage(argv[0]);
+			sim.type = i;
+			break;
+		case 'b':
+			sim.byte_delay = sim_uint(optarg, argv[0]);
+			break;
+		case 'r':
+			sim.reply_delay = sim_uint(optarg, argv[0]);
+			break;
+		case 'g':
+			sim.reg_delay = sim_uint(optarg, argv[0]);
+			break;
+		case 'c':
+			sim.call_delay = sim_uint(optarg, argv[0]);
+			break;
+		case 'u':
+			sim.urc_period = sim_uint(optarg, argv[0]);
+			break;
+		case 'E':
+			sim.echo = 0;
+			break;
+		case 'P':
+			sim.pin_ready = 1;
+			break;
+		case 'Q':
+			sim.qcpdpp = 1;
+			break;
+		case 'S':
+			sim.concat = 0;
+			break;
+		default:
+			sim_usage(argv[0]);
+		}
+	}
+
+	openlog("umts_sim", LOG_PERROR|LOG_PID, LOG_DAEMON);
+
+	sim.master = posix_openpt(O_RDWR|O_NOCTTY);
+	if (sim.master < 0)
+		ERROR_ERRNO("posix_openpt");
+	if (grantpt(sim.master) || unlockpt(sim.master))
+		ERROR_ERRNO("grantpt/unlockpt");
+	slave = ptsname(sim.master);
+	if (!slave)
+		ERROR_ERRNO("ptsname");
+
+	if (tcgetattr(sim.master, &tios))
+		ERROR_ERRNO("tcgetattr");
+	cfmakeraw(&tios);
+	if (tcsetattr(sim.master, TCSANOW, &tios))
+		ERROR_ERRNO("tcsetattr");
+
+	/* On garde l'esclave ouvert pour survivre aux fermetures
+	 * successives par umts_config */
+	slavefd = open(slave, O_RDWR|O_NOCTTY);
+	if (slavefd < 0)
+		ERROR_ERRNO("open %s", slave);
+
+	sim.radio_on = 1;
+	sim.reg_at = deadline_in(sim.reg_delay);
+	if (sim.urc_period)
+		sim.next_urc = deadline_in(sim.urc_period);
+
+	printf("%s\n", slave);
+	fflush(stdout);
+
+	sim_loop();
+
+	close(slavefd);
+	closelog();
+	return EXIT_SUCCESS;
+}